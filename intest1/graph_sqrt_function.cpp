@@ -2,19 +2,15 @@
 #include <cmath> // for std::sqrt
 #include <vector>
 #include <iostream>
+#include <algorithm>
 #include <def_math.h>
+#include <meval_interval.h>
 
 // Function to map a value from one range to another
 float mapValue(float value, float inputMin, float inputMax, float outputMin, float outputMax) {
     return outputMin + ((value - inputMin) / (inputMax - inputMin)) * (outputMax - outputMin);
 }
 
-// Function to compute f(x) = sqrt(x^2 + 4)
-double fn(double x, const std::shared_ptr<meval::var_map>& vars,const meval::math_expr& expr) {
-    (*vars)["x"] = x;
-    return expr.eval();
-}
-
 int main() {
     /* Math eval
      */
@@ -45,20 +41,31 @@ int main() {
     // Set the graph origin to the middle of the screen
     Vector2 origin = { screenWidth / 2.0f, screenHeight / 2.0f };
 
-    // Set the step size for x values
-    const float step = 0.1f;
-    yMin = fn(xMin,vars,mexp);
-    yMax = yMin;
-    std::vector<Vector2> points;
+    // Sample adaptively: cells are refined only until f's interval bound over
+    // them is about a pixel tall, and yMin/yMax come from the same pass
+    std::vector<std::vector<Vector2>> polylines;
     try {
-        // Calculate the points for the graph
-        for (float x = xMin; x <= xMax; x += step) {
-
-            float y = fn(x,vars,mexp);
-            yMin = std::min(yMin, y);
-            yMax = std::max(yMax, y);
-            //std::cout << x << " " << y << std::endl;
-            points.push_back({ x, y });
+        const auto& compiled = mexp.get_compiled();
+        std::vector<double> slots;
+        for (const auto& name : compiled->slot_names())
+            slots.push_back(vars->at(name));
+        const meval::interval_expr bounds(compiled);
+        meval::sample_options options;
+        options.tolerance = (yMax - yMin) / screenHeight;
+        const auto x_slot = std::find(compiled->slot_names().begin(), compiled->slot_names().end(), "x") -
+                            compiled->slot_names().begin();
+        const auto sampled = meval::adaptive_sample(bounds, slots, static_cast<uint32_t>(x_slot), xMin, xMax,
+                                                    options);
+        std::cout << sampled.point_evals << " point and " << sampled.interval_evals << " interval evaluations"
+                  << std::endl;
+        if (!sampled.range.is_empty()) {
+            yMin = sampled.range.lo;
+            yMax = sampled.range.hi;
+        }
+        for (const auto& line : sampled.polylines) {
+            auto& points = polylines.emplace_back();
+            for (const auto& p : line)
+                points.push_back({static_cast<float>(p.x), static_cast<float>(p.y)});
         }
     }catch (const meval::meval_error& merr) {
         std::cout << merr.what() << std::endl;
@@ -69,11 +76,12 @@ int main() {
 
     //const auto yRatio = (yMax-yMin)/(maxY-minY);
 
-    std::vector<Vector2> scaled_points{points};
-    std::for_each(scaled_points.begin(), scaled_points.end(), [&](auto& p) {
-        p.x = mapValue(p.x, xMin, xMax, 0, screenWidth);
-        p.y = mapValue(p.y, yMin, yMax, screenHeight, 0);// Y is inverted (top is 0)
-    });
+    for (auto& scaled_points : polylines) {
+        std::for_each(scaled_points.begin(), scaled_points.end(), [&](auto& p) {
+            p.x = mapValue(p.x, xMin, xMax, 0, screenWidth);
+            p.y = mapValue(p.y, yMin, yMax, screenHeight, 0);// Y is inverted (top is 0)
+        });
+    }
     while (!WindowShouldClose()) {
         // Start drawing
         BeginDrawing();
@@ -84,8 +92,10 @@ int main() {
         DrawLine(origin.x, 0, origin.x, screenHeight, GRAY); // Y-axis
 
         // Draw the graph
-        for (size_t i = 0; i < scaled_points.size() - 1; ++i) {
-            DrawLineV(scaled_points[i], scaled_points[i + 1], BLUE);
+        for (const auto& scaled_points : polylines) {
+            for (size_t i = 1; i < scaled_points.size(); ++i) {
+                DrawLineV(scaled_points[i - 1], scaled_points[i], BLUE);
+            }
         }
 
         // Add labels
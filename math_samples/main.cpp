@@ -1,5 +1,6 @@
 #include <iostream>
 #include "def_math.h"
+#include "meval_static.h"
 
 // TIP To <b>Run</b> code, press <shortcut actionId="Run"/> or
 // click the <icon src="AllIcons.Actions.Execute"/> icon in the gutter.
@@ -16,6 +17,9 @@ int main() {
         std::cout << mexp.eval() << std::endl;
         (*vars)["x"] = 1.0;
         std::cout << mexp.eval() << std::endl;
+        // the same formula parsed at compile time; $x becomes the parameter
+        constexpr meval::static_expr<"($x^2+4)^(1/2)"> sexp;
+        std::cout << sexp(0.0) << ' ' << sexp(1.0) << std::endl;
     }catch (const meval::meval_error& merr) {
         std::cout << merr.what() << std::endl;
     }
@@ -0,0 +1,795 @@
+// meval_bench.cpp
+// Benchmark suite for the parse, compile and eval paths.
+//
+//   corpus   postfix interpreter, compiled bytecode (also with opt_level::full
+//            and fast_math), columnar batch (with and without error masks)
+//            and the native jit_expr on a set of representative formulas
+//   parse    tokenize + to_postfix + compile throughput across expression
+//            lengths and symbol-table sizes
+//   latency  scalar math_expr::eval latency percentiles
+//   scaling  eval_range rows/s for 1..N pool threads
+//   store    var_store evaluation by 1..N reader threads while one writer
+//            publishes updates, checking that no reader sees a torn update
+//   vecmath  array kernels of every built-in function per SIMD level against
+//            a libm loop, with the largest difference from libm seen
+//   library  cold start and eval from a memory-mapped compiled_library
+//            against parsing the same formulas
+//   static   static_expr against hand-written code and compiled bytecode
+//   bulk     bulk_compiler formulas/min for 1..N pool threads against one
+//            math_expr per formula
+//
+// Usage: meval_bench [--json FILE|-] [--min-time MS] [--only SECTION]...
+// Tables go to stdout unless the JSON is written there ("--json -").
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "def_math.h"
+#include "meval_bulk.h"
+#include "meval_jit.h"
+#include "meval_lexer.h"
+#include "meval_library.h"
+#include "meval_parallel.h"
+#include "meval_static.h"
+#include "meval_store.h"
+#include "meval_vecmath.h"
+
+namespace {
+    typedef std::chrono::steady_clock bench_clock;
+
+    double min_time_ns = 200e6;
+    FILE* table = stdout;
+
+    const std::vector<std::string> corpus = {
+        "($x^2+4)^(1/2)",
+        "$x*$y+$pi",
+        "@sin($x)*@cos($y)",
+        "(($x+1)*($y-2)/($x+3))%7+$e^$x",
+        "@sqrt($x*$x+$y*$y)+@log(@abs($x)+1)-@exp($y/10)",
+        "$x^3-2*$x^2+3*$x-4",
+        "1/(1+@exp(0-$x))",
+        "@exp(0-($x-$y)^2/2)/@sqrt(2*$pi)",
+        "@atan($y/(@abs($x)+1))*180/$pi",
+        "@tanh($x)*(1-@tanh($x)^2)+@floor($y)%3",
+        "$x<0?0:$x>1?1:$x*$x*(3-2*$x)",
+    };
+
+    // Runs f(n) with a growing n until one run takes at least min_time_ns;
+    // returns ns per item of the last run.
+    template<typename F>
+    double ns_per_item(F&& f, uint64_t n = 1) {
+        for (;;) {
+            const auto start = bench_clock::now();
+            f(n);
+            const double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+            if (ns >= min_time_ns || n >= (uint64_t{1} << 40))
+                return ns / static_cast<double>(n);
+            n = ns <= 0 ? n * 16 : std::max(n * 2, static_cast<uint64_t>(static_cast<double>(n) * min_time_ns / ns * 1.1));
+        }
+    }
+
+    double percentile(const std::vector<double>& sorted, const double p) {
+        if (sorted.empty())
+            return 0;
+        const auto i = static_cast<std::size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+
+    // Minimal streaming JSON writer; keys and values are written in call order.
+    class json_writer {
+    public:
+        explicit json_writer(std::ostream& os) : m_os(os) {}
+
+        json_writer& begin_object(const char* key = nullptr) {return open(key, '{');}
+        json_writer& end_object() {return close('}');}
+        json_writer& begin_array(const char* key = nullptr) {return open(key, '[');}
+        json_writer& end_array() {return close(']');}
+
+        json_writer& value(const char* key, const std::string& v) {
+            prefix(key);
+            quote(v);
+            return *this;
+        }
+        json_writer& value(const char* key, const char* v) {return value(key, std::string(v));}
+        json_writer& value(const char* key, const double v) {
+            prefix(key);
+            if (v != v || v - v != 0) {
+                m_os << "null";
+            } else {
+                char buf[32];
+                std::snprintf(buf, sizeof buf, "%.6g", v);
+                m_os << buf;
+            }
+            return *this;
+        }
+        json_writer& value(const char* key, const uint64_t v) {
+            prefix(key);
+            m_os << v;
+            return *this;
+        }
+        json_writer& value(const char* key, const bool v) {
+            prefix(key);
+            m_os << (v ? "true" : "false");
+            return *this;
+        }
+    private:
+        std::ostream& m_os;
+        std::vector<bool> m_first{true};
+
+        void prefix(const char* key) {
+            if (!m_first.back())
+                m_os << ',';
+            m_first.back() = false;
+            m_os << '\n' << std::string(2 * (m_first.size() - 1), ' ');
+            if (key) {
+                quote(key);
+                m_os << ": ";
+            }
+        }
+        json_writer& open(const char* key, const char c) {
+            if (m_first.size() > 1 || !m_first.back())
+                prefix(key);
+            m_os << c;
+            m_first.push_back(true);
+            return *this;
+        }
+        json_writer& close(const char c) {
+            const bool empty = m_first.back();
+            m_first.pop_back();
+            if (!empty)
+                m_os << '\n' << std::string(2 * (m_first.size() - 1), ' ');
+            m_os << c;
+            if (m_first.size() == 1)
+                m_os << '\n';
+            return *this;
+        }
+        void quote(const std::string& s) {
+            m_os << '"';
+            for (const char c : s) {
+                if (c == '"' || c == '\\') {
+                    m_os << '\\' << c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof buf, "\\u%04x", c);
+                    m_os << buf;
+                } else {
+                    m_os << c;
+                }
+            }
+            m_os << '"';
+        }
+    };
+
+    struct symbols {
+        std::shared_ptr<meval::var_map> vars = std::make_shared<meval::var_map>();
+        std::shared_ptr<meval::func_map> funcs = std::make_shared<meval::func_map>();
+        std::shared_ptr<meval::operator_map> ops = std::make_shared<meval::operator_map>();
+        std::vector<std::string> names;  // the maps hold views into these
+
+        // the default tables plus extra_vars filler variables
+        explicit symbols(const std::size_t extra_vars = 0) {
+            meval::init_def_vars(vars);
+            meval::init_def_funcs(funcs);
+            meval::init_def_ops(ops);
+            (*vars)["x"] = 0.5;
+            (*vars)["y"] = 1.5;
+            names.reserve(extra_vars);
+            for (std::size_t i = 0; i < extra_vars; i++)
+                (*vars)[names.emplace_back("v" + std::to_string(i))] = static_cast<double>(i);
+        }
+    };
+
+    void bench_corpus(json_writer& js) {
+        const symbols sym;
+        std::vector<double> xs(4096), ys(xs.size(), 1.5), out(xs.size());
+        std::vector<uint32_t> errors(xs.size());
+        for (std::size_t i = 0; i < xs.size(); i++)
+            xs[i] = static_cast<double>(i & 1023) * 0.01;
+
+        std::fprintf(table, "\n[corpus] ns per row\n%-52s %12s %12s %12s %12s %12s %12s %12s %8s\n", "formula",
+                     "postfix", "compiled", "fast", "batch", "masked", "jit", "jit batch", "speedup");
+        meval::compile_options fast_options;
+        fast_options.level = meval::opt_level::full;
+        fast_options.fast_math = true;
+        js.begin_array("corpus");
+        for (const auto& f : corpus) {
+            const meval::math_expr mexp(f, sym.vars, sym.funcs, sym.ops);
+            double& x = (*sym.vars)["x"];
+            volatile double sink = 0;
+            const auto before = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++) {
+                    x = static_cast<double>(i & 1023) * 0.01;
+                    sink = mexp.eval_postfix();
+                }
+            });
+            const auto after = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++) {
+                    x = static_cast<double>(i & 1023) * 0.01;
+                    sink = mexp.eval();
+                }
+            });
+            const meval::math_expr fused(f, sym.vars, sym.funcs, sym.ops, fast_options);
+            const auto fast = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++) {
+                    x = static_cast<double>(i & 1023) * 0.01;
+                    sink = fused.eval();
+                }
+            });
+            const meval::column_map columns{{"x", xs}, {"y", ys}};
+            const auto batch = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++)
+                    mexp.eval_batch(columns, out);
+            }) / static_cast<double>(xs.size());
+            const auto masked = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++)
+                    mexp.eval_batch(columns, out, errors);
+            }) / static_cast<double>(xs.size());
+            const meval::jit_expr jit(mexp.get_compiled());
+            const auto& names = mexp.get_compiled()->slot_names();
+            std::vector<double> slots(names.size());
+            const auto x_slot = std::find(names.begin(), names.end(), "x") - names.begin();
+            for (std::size_t i = 0; i < names.size(); i++)
+                slots[i] = (*sym.vars)[names[i]];
+            const auto native = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++) {
+                    if (x_slot < static_cast<std::ptrdiff_t>(slots.size()))
+                        slots[x_slot] = static_cast<double>(i & 1023) * 0.01;
+                    sink = jit.eval(slots.data());
+                }
+            });
+            const auto bound = mexp.bind_columns(columns);
+            const auto native_batch = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++)
+                    jit.eval_batch(bound, out);
+            }) / static_cast<double>(xs.size());
+            sink = out[0];
+            (void)sink;
+            std::fprintf(table, "%-52s %12.2f %12.2f %12.2f %12.2f %12.2f %12.2f %12.2f %7.1fx\n", f.c_str(), before,
+                         after, fast, batch, masked, native, native_batch, before / after);
+            js.begin_object()
+                .value("formula", f)
+                .value("instructions", static_cast<uint64_t>(mexp.get_compiled()->code().size()))
+                .value("postfix_ns", before)
+                .value("compiled_ns", after)
+                .value("fast_math_ns", fast)
+                .value("batch_ns_per_row", batch)
+                .value("masked_batch_ns_per_row", masked)
+                .value("jit_ns", native)
+                .value("jit_batch_ns_per_row", native_batch)
+                .value("jit_native", jit.is_native())
+                .end_object();
+        }
+        js.end_array();
+    }
+
+    // sum of terms cycling through a few shapes so that every token kind shows up
+    std::string make_expression(const std::size_t terms) {
+        static const char* const shapes[] = {"$x*2.5", "@sin($y)", "($x-$y)^2", "@sqrt(@abs($x)+1)/3", "$pi%7"};
+        std::string s;
+        for (std::size_t i = 0; i < terms; i++) {
+            if (i)
+                s += '+';
+            s += shapes[i % std::size(shapes)];
+        }
+        return s;
+    }
+
+    void bench_parse(json_writer& js) {
+        std::fprintf(table, "\n[parse] expression construction (tokenize, to_postfix, compile)\n"
+                     "%8s %8s %10s %14s %12s %12s %14s\n", "terms", "vars", "bytes", "ns/expr", "MB/s", "ns/instr",
+                     "shared ns/expr");
+        js.begin_array("parse");
+        for (const std::size_t extra : {std::size_t{0}, std::size_t{256}, std::size_t{16384}}) {
+            const symbols sym(extra);
+            meval::compile_options plain;
+            plain.level = meval::opt_level::none;
+            meval::compile_options shared = plain;
+            shared.symbols = std::make_shared<meval::symbol_tables>(*sym.vars, *sym.funcs, *sym.ops);
+            for (const std::size_t terms : {std::size_t{1}, std::size_t{8}, std::size_t{64}, std::size_t{512},
+                                            std::size_t{4096}}) {
+                const std::string expr = make_expression(terms);
+                const auto tokens = meval::math_expr(expr, sym.vars, sym.funcs, sym.ops, plain)
+                        .get_compiled()->code().size();
+                const auto fresh = ns_per_item([&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; i++)
+                        (void)meval::math_expr(expr, sym.vars, sym.funcs, sym.ops, plain);
+                });
+                const auto reused = ns_per_item([&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; i++)
+                        (void)meval::math_expr(expr, sym.vars, sym.funcs, sym.ops, shared);
+                });
+                const double mbps = static_cast<double>(expr.size()) / fresh * 1e3;
+                std::fprintf(table, "%8zu %8zu %10zu %14.0f %12.1f %12.1f %14.0f\n", terms, sym.vars->size(),
+                             expr.size(), fresh, mbps, fresh / static_cast<double>(tokens), reused);
+                js.begin_object()
+                    .value("terms", static_cast<uint64_t>(terms))
+                    .value("vars", static_cast<uint64_t>(sym.vars->size()))
+                    .value("bytes", static_cast<uint64_t>(expr.size()))
+                    .value("instructions", static_cast<uint64_t>(tokens))
+                    .value("ns_per_expr", fresh)
+                    .value("mb_per_s", mbps)
+                    .value("ns_per_instruction", fresh / static_cast<double>(tokens))
+                    .value("shared_symbols_ns_per_expr", reused)
+                    .end_object();
+            }
+        }
+        js.end_array();
+    }
+
+    void bench_latency(json_writer& js) {
+        // single calls are below the clock resolution, so each sample times a short run
+        constexpr int calls = 16;
+        const auto samples = static_cast<std::size_t>(std::clamp(min_time_ns / 2e3, 1e3, 1e5));
+        const symbols sym;
+        std::fprintf(table, "\n[latency] math_expr::eval ns per call over %zu samples of %d calls\n"
+                     "%-52s %9s %9s %9s %9s %9s %9s\n", samples, calls, "formula", "mean", "p50", "p90", "p99",
+                     "p99.9", "max");
+        js.begin_array("latency");
+        for (const auto& f : corpus) {
+            const meval::math_expr mexp(f, sym.vars, sym.funcs, sym.ops);
+            double& x = (*sym.vars)["x"];
+            volatile double sink = 0;
+            std::vector<double> ns(samples);
+            for (int warm = 0; warm < 1000; warm++)
+                sink = mexp.eval();
+            double total = 0;
+            for (std::size_t s = 0; s < samples; s++) {
+                const auto start = bench_clock::now();
+                for (int i = 0; i < calls; i++) {
+                    x = static_cast<double>((s + i) & 1023) * 0.01;
+                    sink = mexp.eval();
+                }
+                ns[s] = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / calls;
+                total += ns[s];
+            }
+            (void)sink;
+            std::sort(ns.begin(), ns.end());
+            const double mean = total / static_cast<double>(samples);
+            std::fprintf(table, "%-52s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", f.c_str(), mean, percentile(ns, 50),
+                         percentile(ns, 90), percentile(ns, 99), percentile(ns, 99.9), ns.back());
+            js.begin_object()
+                .value("formula", f)
+                .value("samples", static_cast<uint64_t>(samples))
+                .value("calls_per_sample", static_cast<uint64_t>(calls))
+                .value("mean_ns", mean)
+                .value("p50_ns", percentile(ns, 50))
+                .value("p90_ns", percentile(ns, 90))
+                .value("p99_ns", percentile(ns, 99))
+                .value("p999_ns", percentile(ns, 99.9))
+                .value("max_ns", ns.back())
+                .end_object();
+        }
+        js.end_array();
+    }
+
+    void bench_scaling(json_writer& js) {
+        const symbols sym;
+        const std::string f = "@sqrt($x*$x+$y*$y)+@log(@abs($x)+1)-@exp($y/10)";
+        const meval::math_expr mexp(f, sym.vars, sym.funcs, sym.ops);
+        std::vector<double> xs(std::size_t{1} << 22), ys(xs.size()), out(xs.size());
+        for (std::size_t i = 0; i < xs.size(); i++) {
+            xs[i] = static_cast<double>(i & 1023) * 0.01;
+            ys[i] = static_cast<double>(i % 977) * 0.1;
+        }
+        const auto bound = mexp.bind_columns({{"x", xs}, {"y", ys}});
+
+        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned> counts;
+        for (unsigned t = 1; t < hw; t *= 2)
+            counts.push_back(t);
+        counts.push_back(hw);
+
+        std::fprintf(table, "\n[scaling] eval_range over %zu rows: %s\n%8s %14s %10s %11s\n", xs.size(), f.c_str(),
+                     "threads", "rows/s", "speedup", "efficiency");
+        js.begin_object("scaling").value("formula", f).value("rows", static_cast<uint64_t>(xs.size()));
+        js.begin_array("runs");
+        double base = 0;
+        for (const unsigned t : counts) {
+            meval::thread_pool pool(t);
+            const double ns = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++)
+                    meval::eval_range(*mexp.get_compiled(), bound, out, pool);
+            }) / static_cast<double>(xs.size());
+            const double rows_per_s = 1e9 / ns;
+            if (t == 1)
+                base = rows_per_s;
+            std::fprintf(table, "%8u %14.3e %9.2fx %10.0f%%\n", t, rows_per_s, rows_per_s / base,
+                         100 * rows_per_s / base / t);
+            js.begin_object()
+                .value("threads", static_cast<uint64_t>(t))
+                .value("rows_per_s", rows_per_s)
+                .value("speedup", rows_per_s / base)
+                .end_object();
+        }
+        js.end_array().end_object();
+    }
+
+    void bench_store(json_writer& js) {
+        const symbols sym;
+        // the writer keeps x + y == 0, so any other result is a torn read
+        const std::string f = "($x+$y)*$z";
+        (*sym.vars)["z"] = 1;
+        const meval::math_expr mexp(f, sym.vars, sym.funcs, sym.ops);
+        meval::var_store store({{"x", 0.0}, {"y", 0.0}, {"z", 1.0}});
+        const auto& expr = *mexp.get_compiled();
+        const auto slots = store.slots_for(expr);
+        const auto x = static_cast<uint32_t>(store.slot_of("x"));
+        const auto y = static_cast<uint32_t>(store.slot_of("y"));
+
+        const unsigned hw = std::max(2u, std::thread::hardware_concurrency());
+        std::vector<unsigned> counts;
+        for (unsigned t = 1; t < hw - 1; t *= 2)
+            counts.push_back(t);
+        counts.push_back(hw - 1);
+
+        std::fprintf(table, "\n[store] %s under one writer\n%8s %14s %16s %8s\n", f.c_str(), "readers",
+                     "ns per eval", "updates/s", "torn");
+        js.begin_object("store").value("formula", f);
+        js.begin_array("runs");
+        for (const unsigned t : counts) {
+            std::atomic<bool> stop{false};
+            std::atomic<uint64_t> torn{0};
+            uint64_t updates = 0;
+            const auto start = bench_clock::now();
+            std::thread writer([&] {
+                while (!stop.load(std::memory_order_relaxed)) {
+                    const auto v = static_cast<double>(++updates);
+                    store.update({{x, v}, {y, -v}});
+                }
+            });
+            std::vector<double> ns(t);
+            std::vector<std::thread> readers;
+            for (unsigned r = 0; r < t; r++) {
+                readers.emplace_back([&, r] {
+                    ns[r] = ns_per_item([&](const uint64_t n) {
+                        uint64_t bad = 0;
+                        for (uint64_t i = 0; i < n; i++)
+                            bad += store.eval(expr, slots) != 0;
+                        torn += bad;
+                    });
+                });
+            }
+            for (auto& th : readers)
+                th.join();
+            stop = true;
+            writer.join();
+            const double elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+            const double mean = std::accumulate(ns.begin(), ns.end(), 0.0) / t;
+            std::fprintf(table, "%8u %14.2f %16.3e %8llu\n", t, mean, static_cast<double>(updates) / elapsed,
+                         static_cast<unsigned long long>(torn.load()));
+            js.begin_object()
+                .value("readers", static_cast<uint64_t>(t))
+                .value("eval_ns", mean)
+                .value("updates_per_s", static_cast<double>(updates) / elapsed)
+                .value("torn", torn.load())
+                .end_object();
+        }
+        js.end_array().end_object();
+    }
+
+    void bench_vecmath(json_writer& js) {
+        constexpr std::size_t n = 4096;
+        std::vector<meval::simd_level> levels;
+        for (const auto l : {meval::simd_level::scalar, meval::simd_level::sse2, meval::simd_level::avx2,
+                             meval::simd_level::avx512}) {
+            if (meval::simd_supported(l))
+                levels.push_back(l);
+        }
+        std::fprintf(table, "\n[vecmath] ns per value, best level %s\n%8s",
+                     std::string(meval::simd_level_name(meval::best_simd_level())).c_str(), "func");
+        for (const auto l : levels)
+            std::fprintf(table, " %10s", std::string(meval::simd_level_name(l)).c_str());
+        std::fprintf(table, " %10s %10s\n", "speedup", "max ulp");
+        js.begin_object("vecmath").value("best", std::string(meval::simd_level_name(meval::best_simd_level())));
+        js.begin_array("funcs");
+        const auto kernels = meval::array_kernels(meval::simd_level::scalar);
+        for (std::size_t f = 0; f < kernels.size(); f++) {
+            const std::string_view name = kernels[f].name;
+            // arguments spread over the function's domain
+            double lo = -10, hi = 10;
+            if (name == "asin" || name == "acos" || name == "atanh")
+                lo = -1, hi = 1;
+            else if (name == "acosh")
+                lo = 1, hi = 100;
+            else if (name == "log" || name == "log10" || name == "sqrt")
+                lo = 0, hi = 100;
+            std::vector<double> in(n), out(n), ref(n);
+            for (std::size_t i = 0; i < n; i++)
+                in[i] = lo + (hi - lo) * (static_cast<double>(i) + 0.5) / n;
+            kernels[f].fn(in.data(), ref.data(), n);
+            std::fprintf(table, "%8s", std::string(name).c_str());
+            js.begin_object().value("func", std::string(name));
+            double libm_ns = 0, best_ns = 0, max_ulp = 0;
+            for (const auto l : levels) {
+                const auto fn = meval::array_kernels(l)[f].fn;
+                const double ns = ns_per_item([&](const uint64_t reps) {
+                    for (uint64_t r = 0; r < reps; r++)
+                        fn(in.data(), out.data(), n);
+                }) / n;
+                for (std::size_t i = 0; i < n; i++) {
+                    if (out[i] != ref[i])
+                        max_ulp = std::max(max_ulp, std::fabs(out[i] - ref[i]) /
+                                                        (std::nextafter(std::fabs(ref[i]), HUGE_VAL) - std::fabs(ref[i])));
+                }
+                if (l == meval::simd_level::scalar)
+                    libm_ns = ns;
+                best_ns = ns;
+                std::fprintf(table, " %10.3f", ns);
+                js.value(std::string(meval::simd_level_name(l)).append("_ns").c_str(), ns);
+            }
+            std::fprintf(table, " %10.2f %10.2f\n", libm_ns / best_ns, max_ulp);
+            js.value("speedup", libm_ns / best_ns).value("max_ulp", max_ulp).end_object();
+        }
+        js.end_array().end_object();
+    }
+
+    void bench_library(json_writer& js) {
+        const symbols sym;
+        constexpr std::size_t formulas = std::size_t{1} << 16;
+        std::vector<std::string> sources, names;
+        for (std::size_t i = 0; i < formulas; i++) {
+            sources.push_back(corpus[i % corpus.size()] + "+" + std::to_string(i));
+            names.push_back("f" + std::to_string(i));
+        }
+        const auto timed_ms = [](auto&& f) {
+            const auto start = bench_clock::now();
+            f();
+            return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+        };
+        std::vector<std::unique_ptr<meval::math_expr>> parsed;
+        const double parse_ms = timed_ms([&] {
+            for (const auto& src : sources)
+                parsed.push_back(std::make_unique<meval::math_expr>(src, sym.vars, sym.funcs, sym.ops));
+        });
+        meval::library_writer writer;
+        for (std::size_t i = 0; i < formulas; i++)
+            writer.add(names[i], *parsed[i]->get_compiled());
+        const auto path = (std::filesystem::temp_directory_path() / "meval_bench.mevallib").string();
+        writer.write(path);
+        const auto bytes = std::filesystem::file_size(path);
+        const double open_ms = timed_ms([&] { (void)meval::compiled_library(path, *sym.funcs, *sym.ops); });
+        const double trusted_ms = timed_ms([&] { (void)meval::compiled_library(path, *sym.funcs, *sym.ops, false); });
+        // eval keeps what it unpacks, as a long-lived server would
+        const meval::compiled_library lib(path, *sym.funcs, *sym.ops, true, true);
+        std::filesystem::remove(path);
+
+        // both sides evaluate every formula once per pass, with the same slot values
+        std::vector<std::vector<double>> slots(formulas);
+        for (uint32_t i = 0; i < formulas; i++) {
+            for (const auto name : lib.slot_names(i))
+                slots[i].push_back(sym.vars->at(name));
+        }
+        volatile double sink = 0;
+        const auto compiled = ns_per_item([&](const uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                sink = parsed[i % formulas]->eval();
+        });
+        const auto mapped = ns_per_item([&](const uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                sink = lib.eval(static_cast<uint32_t>(i % formulas), slots[i % formulas].data());
+        });
+        (void)sink;
+        std::fprintf(table, "\n[library] %zu formulas\n%14s %14s %14s %14s %14s %14s\n", formulas, "parse ms",
+                     "open ms", "trusted ms", "bytes/expr", "eval ns", "mapped ns");
+        std::fprintf(table, "%14.1f %14.2f %14.2f %14.1f %14.2f %14.2f\n", parse_ms, open_ms, trusted_ms,
+                     static_cast<double>(bytes) / formulas, compiled, mapped);
+        js.begin_object("library")
+            .value("formulas", static_cast<uint64_t>(formulas))
+            .value("parse_ms", parse_ms)
+            .value("open_ms", open_ms)
+            .value("open_unverified_ms", trusted_ms)
+            .value("bytes", static_cast<uint64_t>(bytes))
+            .value("eval_ns", compiled)
+            .value("mapped_eval_ns", mapped)
+            .end_object();
+    }
+
+    // One [static] row: hand-written code, static_expr<S> and compiled bytecode
+    // for the same formula, with x varying as in the corpus section.
+    template<meval::fixed_string S, typename F>
+    void bench_static_row(json_writer& js, const symbols& sym, F&& hand) {
+        typedef meval::static_expr<S> expr;
+        const meval::math_expr mexp(std::string(S.view()), sym.vars, sym.funcs, sym.ops);
+        double& x = (*sym.vars)["x"];
+        const double y = sym.vars->at("y");
+        std::array<double, expr::arity> slots{};
+        for (std::size_t i = 0; i < expr::arity; i++)
+            slots[i] = sym.vars->at(expr::variables[i]);
+        constexpr auto x_slot = expr::slot("x");
+        volatile double sink = 0;
+        const auto written = ns_per_item([&](const uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                sink = hand(static_cast<double>(i & 1023) * 0.01, y);
+        });
+        const auto fixed = ns_per_item([&](const uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                if constexpr (x_slot < expr::arity)
+                    slots[x_slot] = static_cast<double>(i & 1023) * 0.01;
+                sink = expr{}.eval(slots);
+            }
+        });
+        const auto compiled = ns_per_item([&](const uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                x = static_cast<double>(i & 1023) * 0.01;
+                sink = mexp.eval();
+            }
+        });
+        (void)sink;
+        std::fprintf(table, "%-52s %12.2f %12.2f %12.2f\n", S.data, written, fixed, compiled);
+        js.begin_object()
+            .value("formula", std::string(S.view()))
+            .value("hand_ns", written)
+            .value("static_ns", fixed)
+            .value("compiled_ns", compiled)
+            .end_object();
+    }
+
+    void bench_static(json_writer& js) {
+        const symbols sym;
+        std::fprintf(table, "\n[static] ns per eval\n%-52s %12s %12s %12s\n", "formula", "hand", "static_expr",
+                     "compiled");
+        js.begin_array("static");
+        // operators apply left to right, as the hand-written versions spell out
+        bench_static_row<"($x^2+4)^(1/2)">(js, sym, [](const double x, double) {
+            return std::pow(std::pow(x, 2) + 4, 1.0 / 2);
+        });
+        bench_static_row<"(($x+1)*($y-2)/($x+3))%7+$e^$x">(js, sym, [](const double x, const double y) {
+            return std::pow(std::fmod((x + 1) * (y - 2) / (x + 3), 7) + std::numbers::e, x);
+        });
+        bench_static_row<"@sqrt($x*$x+$y*$y)+@log(@abs($x)+1)-@exp($y/10)">(js, sym, [](const double x, const double y) {
+            return std::sqrt((x * x + y) * y) + std::log(std::fabs(x) + 1) - std::exp(y / 10);
+        });
+        bench_static_row<"@tanh($x)*(1-@tanh($x)^2)+@floor($y)%3">(js, sym, [](const double x, const double y) {
+            return std::fmod(std::tanh(x) * std::pow(1 - std::tanh(x), 2) + std::floor(y), 3);
+        });
+        js.end_array();
+    }
+
+    void bench_bulk(json_writer& js) {
+        const symbols sym;
+        constexpr std::size_t formulas = std::size_t{1} << 16;
+        std::vector<std::string> sources;
+        for (std::size_t i = 0; i < formulas; i++)
+            sources.push_back(corpus[i % corpus.size()] + "+" + std::to_string(i));
+        meval::compile_options shared;
+        shared.symbols = std::make_shared<meval::symbol_tables>(*sym.vars, *sym.funcs, *sym.ops);
+        const double per_expr = ns_per_item([&](const uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                (void)meval::math_expr(sources[i % formulas], sym.vars, sym.funcs, sym.ops, shared);
+        });
+        const meval::bulk_compiler compiler(sym.vars, sym.funcs, sym.ops);
+
+        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned> counts;
+        for (unsigned t = 1; t < hw; t *= 2)
+            counts.push_back(t);
+        counts.push_back(hw);
+
+        std::fprintf(table, "\n[bulk] %zu formulas; math_expr with shared symbols: %.3e formulas/min\n"
+                     "%8s %16s %10s %12s\n", formulas, 60e9 / per_expr, "threads", "formulas/min", "speedup",
+                     "vs math_expr");
+        js.begin_object("bulk")
+            .value("formulas", static_cast<uint64_t>(formulas))
+            .value("math_expr_per_min", 60e9 / per_expr);
+        js.begin_array("runs");
+        double base = 0;
+        for (const unsigned t : counts) {
+            meval::thread_pool pool(t);
+            const double ns = ns_per_item([&](const uint64_t n) {
+                for (uint64_t i = 0; i < n; i++)
+                    (void)compiler.compile(std::span<const std::string>(sources), pool);
+            }) / static_cast<double>(formulas);
+            const double per_min = 60e9 / ns;
+            if (t == 1)
+                base = per_min;
+            std::fprintf(table, "%8u %16.3e %9.2fx %11.2fx\n", t, per_min, per_min / base, per_expr / ns);
+            js.begin_object()
+                .value("threads", static_cast<uint64_t>(t))
+                .value("formulas_per_min", per_min)
+                .value("speedup", per_min / base)
+                .end_object();
+        }
+        js.end_array().end_object();
+    }
+
+    const char* compiler() {
+#if defined(__clang__)
+        return "clang " __clang_version__;
+#elif defined(__GNUC__)
+        return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+        return "msvc";
+#else
+        return "unknown";
+#endif
+    }
+
+}
+
+int main(int argc, char** argv) {
+    const char* json_path = nullptr;
+    std::vector<std::string> only;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            min_time_ns = std::stod(argv[++i]) * 1e6;
+        } else if (!std::strcmp(argv[i], "--only") && i + 1 < argc) {
+            only.emplace_back(argv[++i]);
+        } else {
+            std::fprintf(stderr, "usage: %s [--json FILE|-] [--min-time MS] [--only corpus|parse|latency|scaling|store|vecmath|library|static]...\n",
+                         argv[0]);
+            return 2;
+        }
+    }
+    const bool json_stdout = json_path && !std::strcmp(json_path, "-");
+    if (json_stdout)
+        table = stderr;
+    const auto selected = [&only](const char* name) {
+        return only.empty() || std::find(only.begin(), only.end(), name) != only.end();
+    };
+
+    std::ostringstream buf;
+    json_writer js(buf);
+    js.begin_object();
+    js.begin_object("meta")
+        .value("compiler", compiler())
+#ifdef NDEBUG
+        .value("optimized", true)
+#else
+        .value("optimized", false)
+#endif
+        .value("hardware_threads", static_cast<uint64_t>(std::thread::hardware_concurrency()))
+        .value("jit_available", meval::jit_expr::available())
+        .value("jit_batch_available", meval::jit_expr::batch_available())
+        .value("min_time_ms", min_time_ns / 1e6)
+        .end_object();
+    try {
+        if (selected("corpus"))
+            bench_corpus(js);
+        if (selected("parse"))
+            bench_parse(js);
+        if (selected("latency"))
+            bench_latency(js);
+        if (selected("scaling"))
+            bench_scaling(js);
+        if (selected("store"))
+            bench_store(js);
+        if (selected("vecmath"))
+            bench_vecmath(js);
+        if (selected("library"))
+            bench_library(js);
+        if (selected("static"))
+            bench_static(js);
+        if (selected("bulk"))
+            bench_bulk(js);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "benchmark failed: %s\n", e.what());
+        return 1;
+    }
+    js.end_object();
+
+    if (json_stdout) {
+        std::cout << buf.str();
+    } else if (json_path) {
+        std::ofstream file(json_path);
+        file << buf.str();
+        if (!file) {
+            std::fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -4,67 +4,102 @@
 
 #include "def_math.h"
 #include <cmath>
+#include <numbers>
 namespace meval {
-    double add(const double a, const double b, const double epsilon) {
-        return a + b;
+    namespace {
+        template<typename T>
+        void def_vars(basic_var_map<T>& vmap) {
+            vmap["pi"] = std::numbers::pi_v<T>;
+            vmap["e"] = std::numbers::e_v<T>;
+            vmap["x"] = 0.0;
+            vmap["y"] = 0.0;
+        }
+
+        // the libm overload for T, so double maps hold the plain C functions
+        template<typename T>
+        void def_funcs(basic_func_map<T>& fmap) {
+            typedef T (*fp)(T);
+            fmap["sin"] = static_cast<fp>(std::sin);
+            fmap["cos"] = static_cast<fp>(std::cos);
+            fmap["tan"] = static_cast<fp>(std::tan);
+            fmap["asin"] = static_cast<fp>(std::asin);
+            fmap["acos"] = static_cast<fp>(std::acos);
+            fmap["atan"] = static_cast<fp>(std::atan);
+            fmap["sinh"] = static_cast<fp>(std::sinh);
+            fmap["cosh"] = static_cast<fp>(std::cosh);
+            fmap["tanh"] = static_cast<fp>(std::tanh);
+            fmap["asinh"] = static_cast<fp>(std::asinh);
+            fmap["acosh"] = static_cast<fp>(std::acosh);
+            fmap["atanh"] = static_cast<fp>(std::atanh);
+            fmap["sqrt"] = static_cast<fp>(std::sqrt);
+            fmap["log"] = static_cast<fp>(std::log);
+            fmap["log10"] = static_cast<fp>(std::log10);
+            fmap["exp"] = static_cast<fp>(std::exp);
+            fmap["abs"] = static_cast<fp>(std::fabs);
+            fmap["ceil"] = static_cast<fp>(std::ceil);
+            fmap["floor"] = static_cast<fp>(std::floor);
+            fmap["round"] = static_cast<fp>(std::round);
+        }
+
+        template<typename T>
+        void def_ops(basic_operator_map<T>& omap) {
+            typedef std::pair<basic_func_binary<T>,uint32_t> entry;
+            uint32_t i = 1;
+            omap["+"] = entry{add<T>,i};
+            omap["-"] = entry{sub<T>,i};
+            omap["*"] = entry{mul<T>,i};
+            omap["/"] = entry{div<T>,i};
+            omap["%"] = entry{mod<T>,i};
+            omap["^"] = entry{pow<T>,i};
+            // comparisons bind more loosely than arithmetic
+            i = 0;
+            omap["<"] = entry{lt<T>,i};
+            omap["<="] = entry{le<T>,i};
+            omap[">"] = entry{gt<T>,i};
+            omap[">="] = entry{ge<T>,i};
+            omap["=="] = entry{eq<T>,i};
+            omap["!="] = entry{ne<T>,i};
+        }
     }
-    double sub(const double a, const double b, const double epsilon) {
-        return a - b;
+
+    void init_def_vars(const std::shared_ptr<var_map>& vmap) {
+        def_vars(*vmap);
     }
-    double mul(const double a, const double b, const double epsilon) {
-        return a * b;
+
+    void init_def_vars(const std::shared_ptr<basic_var_map<float>>& vmap) {
+        def_vars(*vmap);
     }
-    double div(const double a, const double b, const double epsilon) {
-        if (fabs(b) < epsilon) {
-            throw std::runtime_error("Division by zero");
-        }
-        return a / b;
+
+    void init_def_vars(const std::shared_ptr<basic_var_map<long double>>& vmap) {
+        def_vars(*vmap);
     }
-    double mod(const double a, const double b, const double epsilon) {
-        return fmod(a, b);
+
+    void init_def_consts(const std::shared_ptr<const_set>& cset) {
+        cset->insert("pi");
+        cset->insert("e");
     }
 
-    double pow(const double a, const double b, const double epsilon) {
-        return std::pow(a, b);
+    void init_def_funcs(const std::shared_ptr<func_map>& fmap) {
+        def_funcs(*fmap);
     }
 
-    void init_def_vars(const std::shared_ptr<var_map>& vmap) {
-        (*vmap)["pi"] = 3.14159265358979323846;
-        (*vmap)["e"] = 2.71828182845904523536;
-        (*vmap)["x"] = 0.0;
-        (*vmap)["y"] = 0.0;
+    void init_def_funcs(const std::shared_ptr<basic_func_map<float>>& fmap) {
+        def_funcs(*fmap);
     }
 
-    void init_def_funcs(const std::shared_ptr<func_map>& fmap) {
-        (*fmap)["sin"] = sin;
-        (*fmap)["cos"] = cos;
-        (*fmap)["tan"] = tan;
-        (*fmap)["asin"] = asin;
-        (*fmap)["acos"] = acos;
-        (*fmap)["atan"] = atan;
-        (*fmap)["sinh"] = sinh;
-        (*fmap)["cosh"] = cosh;
-        (*fmap)["tanh"] = tanh;
-        (*fmap)["asinh"] = asinh;
-        (*fmap)["acosh"] = acosh;
-        (*fmap)["atanh"] = atanh;
-        (*fmap)["sqrt"] = sqrt;
-        (*fmap)["log"] = log;
-        (*fmap)["log10"] = log10;
-        (*fmap)["exp"] = exp;
-        (*fmap)["abs"] = fabs;
-        (*fmap)["ceil"] = ceil;
-        (*fmap)["floor"] = floor;
-        (*fmap)["round"] = round;
+    void init_def_funcs(const std::shared_ptr<basic_func_map<long double>>& fmap) {
+        def_funcs(*fmap);
     }
 
     void init_def_ops(const std::shared_ptr<operator_map>& omap) {
-        uint32_t i = 1;
-        (*omap)["+"] = std::pair<func_binary,uint32_t>{add,i};
-        (*omap)["-"] = std::pair<func_binary,uint32_t>{sub,i};
-        (*omap)["*"] = std::pair<func_binary,uint32_t>{mul,i};
-        (*omap)["/"] = std::pair<func_binary,uint32_t>{div,i};
-        (*omap)["%"] = std::pair<func_binary,uint32_t>{mod,i};
-        (*omap)["^"] = std::pair<func_binary,uint32_t>{pow,i};
+        def_ops(*omap);
+    }
+
+    void init_def_ops(const std::shared_ptr<basic_operator_map<float>>& omap) {
+        def_ops(*omap);
+    }
+
+    void init_def_ops(const std::shared_ptr<basic_operator_map<long double>>& omap) {
+        def_ops(*omap);
     }
 } // mpl
\ No newline at end of file
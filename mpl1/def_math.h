@@ -6,18 +6,153 @@
 #define DEF_MATH_H
 
 #include "meval.h"
+#include <bit>
+#include <cmath>
+#include <stdexcept>
 
 namespace meval {
 
-    double add(double a, double b, double epsilon = 1e-20);
-    double sub(double a, double b, double epsilon = 1e-20);
-    double mul(double a, double b, double epsilon = 1e-20);
-    double div(double a, double b, double epsilon = 1e-20);
-    double mod(double a, double b, double epsilon = 1e-20);
-    double pow(double a, double b, double epsilon = 1e-20);
+    // defined inline so the compiler in meval.cpp can recognise them by address
+    template<typename T>
+    inline T add(const T a, const T b, const T epsilon = T(1e-20)) {
+        return a + b;
+    }
+    template<typename T>
+    inline T sub(const T a, const T b, const T epsilon = T(1e-20)) {
+        return a - b;
+    }
+    template<typename T>
+    inline T mul(const T a, const T b, const T epsilon = T(1e-20)) {
+        return a * b;
+    }
+    template<typename T>
+    inline T div(const T a, const T b, const T epsilon = T(1e-20)) {
+        using std::fabs;
+        if (fabs(b) < epsilon) {
+            throw std::runtime_error("Division by zero");
+        }
+        return a / b;
+    }
+    template<typename T>
+    inline T mod(const T a, const T b, const T epsilon = T(1e-20)) {
+        using std::fmod;
+        return fmod(a, b);
+    }
+    template<typename T>
+    inline T pow(const T a, const T b, const T epsilon = T(1e-20)) {
+        using std::pow;
+        return pow(a, b);
+    }
+
+    // the double forms callers had before the templates, so that mixed
+    // arguments such as pow(x, 2) still convert; the opcode of either form is
+    // recognised by address
+    inline double add(const double a, const double b, const double epsilon = 1e-20) {
+        return add<double>(a, b, epsilon);
+    }
+    inline double sub(const double a, const double b, const double epsilon = 1e-20) {
+        return sub<double>(a, b, epsilon);
+    }
+    inline double mul(const double a, const double b, const double epsilon = 1e-20) {
+        return mul<double>(a, b, epsilon);
+    }
+    inline double div(const double a, const double b, const double epsilon = 1e-20) {
+        return div<double>(a, b, epsilon);
+    }
+    inline double mod(const double a, const double b, const double epsilon = 1e-20) {
+        return mod<double>(a, b, epsilon);
+    }
+    inline double pow(const double a, const double b, const double epsilon = 1e-20) {
+        return pow<double>(a, b, epsilon);
+    }
+
+    // 1 where the comparison holds, else 0; NaN compares false except under ne
+    template<typename T>
+    inline T lt(const T a, const T b, const T = T(1e-20)) {
+        return a < b ? T(1) : T(0);
+    }
+    template<typename T>
+    inline T le(const T a, const T b, const T = T(1e-20)) {
+        return a <= b ? T(1) : T(0);
+    }
+    template<typename T>
+    inline T gt(const T a, const T b, const T = T(1e-20)) {
+        return a > b ? T(1) : T(0);
+    }
+    template<typename T>
+    inline T ge(const T a, const T b, const T = T(1e-20)) {
+        return a >= b ? T(1) : T(0);
+    }
+    template<typename T>
+    inline T eq(const T a, const T b, const T = T(1e-20)) {
+        return a == b ? T(1) : T(0);
+    }
+    template<typename T>
+    inline T ne(const T a, const T b, const T = T(1e-20)) {
+        return a != b ? T(1) : T(0);
+    }
+    // c ? a : b over values already computed, so a blend rather than a branch;
+    // any c other than 0, NaN included, picks a
+    template<typename T>
+    inline T select(const T c, const T a, const T b) {
+        return c != T(0) ? a : b;
+    }
+
+    // results of the fused opcodes, shared by every evaluator so that they agree
+    template<typename T>
+    inline T square(const T a) {
+        return a * a;
+    }
+    template<typename T>
+    inline T recip(const T a, const T epsilon = T(1e-20)) {
+        return div(T(1), a, epsilon);
+    }
+    // square-and-multiply from the leading bit of n, which must be at least 1
+    template<typename T>
+    inline T powi(const T a, const uint32_t n) {
+        T r = a;
+        for (int bit = std::bit_width(n) - 2; bit >= 0; bit--) {
+            r = r * r;
+            if (n >> bit & 1)
+                r = r * a;
+        }
+        return r;
+    }
+    // the optimizer fuses these for the built-in floating types only; other
+    // scalar types get the unfused forms so that the evaluators still compile
+    template<typename T>
+    inline T fused_sqrt(const T a) {
+        if constexpr (std::is_floating_point_v<T>) {
+            return std::sqrt(a);
+        } else {
+            using std::pow;
+            return pow(a, T(0.5));
+        }
+    }
+    template<typename T>
+    inline T fused_hypot(const T a, const T b) {
+        if constexpr (std::is_floating_point_v<T>)
+            return std::hypot(a, b);
+        else
+            return fused_sqrt(a * a + b * b);
+    }
+    template<typename T>
+    inline T fused_fma(const T a, const T b, const T c) {
+        if constexpr (std::is_floating_point_v<T>)
+            return std::fma(a, b, c);
+        else
+            return a * b + c;
+    }
     void init_def_vars(const std::shared_ptr<var_map>& vmap);
+    void init_def_vars(const std::shared_ptr<basic_var_map<float>>& vmap);
+    void init_def_vars(const std::shared_ptr<basic_var_map<long double>>& vmap);
+    void init_def_consts(const std::shared_ptr<const_set>& cset);
     void init_def_funcs(const std::shared_ptr<func_map>& fmap);
+    void init_def_funcs(const std::shared_ptr<basic_func_map<float>>& fmap);
+    void init_def_funcs(const std::shared_ptr<basic_func_map<long double>>& fmap);
     void init_def_ops(const std::shared_ptr<operator_map>& omap);
+    void init_def_ops(const std::shared_ptr<basic_operator_map<float>>& omap);
+    void init_def_ops(const std::shared_ptr<basic_operator_map<long double>>& omap);
 
 } // mpl
 
@@ -2,14 +2,17 @@
 #define MEVAL_H
 
 #include <string_view>
+#include <array>
 #include <string>
 #include <map>
+#include <set>
+#include <span>
 #include <memory>
-#include <stack>
 #include <vector>
 #include <exception>
 #include <cstdint>
 #include <functional>
+#include <type_traits>
 
 namespace meval {
 
@@ -21,6 +24,7 @@ namespace meval {
             unknown_function,
             unknown_variable,
             invalid_expression,
+            invalid_argument,
         };
         explicit meval_error(const std::string &msg,error_type et, uint32_t pos=0);
         [[nodiscard]] const char* what() const noexcept override;
@@ -32,13 +36,274 @@ namespace meval {
         uint32_t m_pos;
     };
 
-    typedef std::function<double(double)> func_unary;
-    typedef std::function<double(double,double,double)> func_binary;
-    typedef std::map<std::string_view,func_unary> func_map;
-    typedef std::map<std::string_view,std::pair<func_binary,uint32_t>> operator_map;
-    typedef std::map<std::string_view,double> var_map;
+    // The engine is generic over the scalar type T. float, double and long
+    // double are instantiated in the library; other types (intervals, dual
+    // numbers, ...) need meval_impl.h and must provide arithmetic, comparison,
+    // construction from double and fabs/fmod/pow found by ADL.
+    template<typename T> using basic_func_unary = std::function<T(T)>;
+    template<typename T> using basic_func_binary = std::function<T(T,T,T)>;
+    template<typename T> using basic_func_map = std::map<std::string_view,basic_func_unary<T>>;
+    template<typename T> using basic_operator_map = std::map<std::string_view,std::pair<basic_func_binary<T>,uint32_t>>;
+    template<typename T> using basic_var_map = std::map<std::string_view,T>;
+    template<typename T> using basic_column_map = std::map<std::string_view,std::span<const T>>;
 
-    class math_expr {
+    typedef basic_func_unary<double> func_unary;
+    typedef basic_func_binary<double> func_binary;
+    typedef basic_func_map<double> func_map;
+    typedef basic_operator_map<double> operator_map;
+    typedef basic_var_map<double> var_map;
+    typedef basic_column_map<double> column_map;
+    // variables whose value is fixed once an expression is compiled
+    typedef std::set<std::string_view> const_set;
+
+    enum class opt_level {
+        none,   // evaluate the postfix program as parsed
+        basic,  // fold constant subexpressions, including immutable variables
+        full,   // basic plus identities such as x*1, x+0, x^1 and x^0, and fused opcodes
+    };
+
+    struct symbol_tables;
+    template<typename T> class basic_math_expr;
+    template<typename T> struct basic_expr_rewriter;
+    class math_program;
+    class compiled_library;
+    class bulk_compiler;
+    namespace detail {
+        struct stats_counter;
+        class instruction_timer;
+    }
+
+    // Bits of the error mask filled in by the non-throwing evaluation paths.
+    enum eval_error : uint32_t {
+        eval_ok = 0,
+        eval_div_by_zero = 1u << 0,  // divisor within epsilon of zero
+        eval_invalid = 1u << 1,      // NaN from operands that were not NaN: 0/0, sqrt(-1), fmod(x, 0)
+        eval_overflow = 1u << 2,     // infinity from finite operands: exp(1000), log(0)
+    };
+
+    // What a non-throwing evaluation does about a domain error of one operation.
+    enum class domain_mode : uint8_t {
+        propagate,  // keep the IEEE result (x/0 = inf, 0/0 = NaN) and report nothing
+        flag,       // keep the IEEE result and set the error's bit in the mask
+    };
+
+    // Domain error handling by the name an operator or function is
+    // registered under, resolved once when an expression is compiled.
+    struct error_policy {
+        std::map<std::string, domain_mode, std::less<>> modes;
+        domain_mode fallback = domain_mode::flag;
+
+        [[nodiscard]] domain_mode mode_of(std::string_view name) const {
+            const auto it = modes.find(name);
+            return it == modes.end() ? fallback : it->second;
+        }
+    };
+
+    struct compile_options {
+        opt_level level = opt_level::basic;
+        std::shared_ptr<const_set> consts = nullptr;
+        double epsilon = 1e-20;
+        // prebuilt lookup tables for the symbol maps, searched directly when null
+        std::shared_ptr<const symbol_tables> symbols = nullptr;
+        // domain errors of every operation are flagged when null
+        std::shared_ptr<const error_policy> errors = nullptr;
+        // At opt_level::full, also apply rewrites that round differently from
+        // the formula as written: x^n as multiplications, x^0.5 as sqrt, a*b+c
+        // as fma, sqrt(a*a+b*b) as hypot, exp(a)*exp(b) as exp(a+b) and
+        // polynomials in Horner form.
+        bool fast_math = false;
+        // Batch evaluation of double expressions runs built-in functions
+        // through the array kernels of meval_vecmath.h, which may differ from
+        // libm within their documented ulp bounds. When false, batch rows equal
+        // eval() bit for bit.
+        bool vector_math = true;
+    };
+
+    enum class opcode : uint8_t {
+        push_const,
+        push_var,
+        add,
+        sub,
+        mul,
+        div,
+        mod,
+        pow,
+        call_func,      // plain T(*)(T)
+        call_func_obj,  // func_unary that is not a plain function pointer
+        call_op,        // plain T(*)(T,T,T)
+        call_op_obj,    // func_binary that is not a plain function pointer
+        // fused opcodes, only produced by the optimizer
+        square,         // a*a
+        recip,          // 1/a, checked like div
+        sqrt,
+        powi,           // a^arg by repeated multiplication, arg >= 2
+        hypot,
+        fma,            // a*b+c in one rounding
+        // comparisons give 1 where they hold and 0 elsewhere
+        lt,
+        le,
+        gt,
+        ge,
+        eq,
+        ne,
+        select,         // c ? a : b, a blend of two operands that are both evaluated
+    };
+
+    struct instruction {
+        opcode op;
+        uint32_t arg;
+    };
+
+    // number of stack operands consumed by op
+    constexpr uint32_t operand_count(const opcode op) noexcept {
+        switch (op) {
+            case opcode::push_const:
+            case opcode::push_var:
+                return 0;
+            case opcode::call_func:
+            case opcode::call_func_obj:
+            case opcode::square:
+            case opcode::recip:
+            case opcode::sqrt:
+            case opcode::powi:
+                return 1;
+            case opcode::fma:
+            case opcode::select:
+                return 3;
+            default:
+                return 2;
+        }
+    }
+
+    // Postfix program with variables bound to slot indices and every operator
+    // and function resolved to an opcode or a direct callable. A conditional
+    // c ? a : b evaluates both a and b and then picks one; only the errors of
+    // the condition and of the operand picked are reported or thrown, so
+    // $x==0?0:1/$x is safe at x=0.
+    template<typename T>
+    class basic_compiled_expr {
+    public:
+        typedef T value_type;
+        typedef T (*func_ptr)(T);
+        typedef T (*op_ptr)(T,T,T);
+        typedef void (*array_ptr)(const T*, T*, std::size_t);
+
+        [[nodiscard]] T eval(const T* slots) const;
+        [[nodiscard]] T eval(const T* const* slot_refs) const;
+        // columns are indexed by slot; a column of size 1 is broadcast to every row
+        void eval_batch(std::span<const std::span<const T>> columns, std::span<T> out) const;
+
+        // Non-throwing evaluation. Domain errors yield the IEEE result, and
+        // those of operations compiled with domain_mode::flag are or'ed into
+        // errors as eval_error bits. A callable that throws yields NaN, a
+        // domain error like any other. The stack shape was validated when the
+        // expression was compiled, so nothing else can fail.
+        [[nodiscard]] T eval(const T* slots, uint32_t& errors) const noexcept;
+        [[nodiscard]] T eval(const T* const* slot_refs, uint32_t& errors) const noexcept;
+        // As above per row: errors is empty or holds one mask per output row.
+        // Only mismatched column or mask sizes throw, before any row is evaluated.
+        void eval_batch(std::span<const std::span<const T>> columns, std::span<T> out,
+                        std::span<uint32_t> errors) const;
+
+        static constexpr std::size_t batch_block = 256;
+
+        [[nodiscard]] const std::vector<instruction>& code() const noexcept{return m_code;}
+        [[nodiscard]] const std::vector<T>& constants() const noexcept{return m_consts;}
+        [[nodiscard]] const std::vector<std::string>& slot_names() const noexcept{return m_slots;}
+        [[nodiscard]] const std::vector<func_ptr>& func_ptrs() const noexcept{return m_func_ptrs;}
+        // per func_ptrs entry, its array kernel for batches, or null
+        [[nodiscard]] const std::vector<array_ptr>& array_ptrs() const noexcept{return m_array_ptrs;}
+        [[nodiscard]] const std::vector<basic_func_unary<T>>& func_objs() const noexcept{return m_func_objs;}
+        [[nodiscard]] const std::vector<op_ptr>& op_ptrs() const noexcept{return m_op_ptrs;}
+        [[nodiscard]] const std::vector<basic_func_binary<T>>& op_objs() const noexcept{return m_op_objs;}
+        [[nodiscard]] uint32_t max_stack() const noexcept{return m_max_stack;}
+        [[nodiscard]] T get_epsilon() const noexcept{return m_epsilon;}
+        // per instruction, whether the non-throwing paths report its domain errors
+        [[nodiscard]] const std::vector<uint8_t>& flagged() const noexcept{return m_flagged;}
+        // whether the code has a select, which drops the errors of the operand it does not pick
+        [[nodiscard]] bool has_select() const noexcept{return m_has_select;}
+        // whether batches call the array kernels of the built-in functions
+        [[nodiscard]] bool vector_math() const noexcept{return m_vector_math;}
+        // name a call instruction's function or operator was registered under, empty for other opcodes
+        [[nodiscard]] std::string_view callable_name(const instruction& in) const noexcept;
+    private:
+        friend class basic_math_expr<T>;
+        friend struct basic_expr_rewriter<T>;
+        friend class compiled_library;
+        friend class bulk_compiler;
+
+        std::vector<instruction> m_code;
+        std::vector<T> m_consts;
+        std::vector<std::string> m_slots;
+        std::vector<func_ptr> m_func_ptrs;
+        std::vector<array_ptr> m_array_ptrs;
+        std::vector<basic_func_unary<T>> m_func_objs;
+        std::vector<op_ptr> m_op_ptrs;
+        std::vector<basic_func_binary<T>> m_op_objs;
+        // registered names, parallel to the four tables above
+        std::vector<std::string> m_func_ptr_names;
+        std::vector<std::string> m_func_obj_names;
+        std::vector<std::string> m_op_ptr_names;
+        std::vector<std::string> m_op_obj_names;
+        // per instruction, whether the non-throwing paths report its domain errors
+        std::vector<uint8_t> m_flagged;
+        // per instruction, the callable's counter in MEVAL_STATS builds
+        std::vector<detail::stats_counter*> m_counters;
+        uint32_t m_max_stack=0;
+        T m_epsilon=T(1e-20);
+        bool m_vector_math=true;
+        bool m_has_select=false;
+        // and an instruction the throwing evaluators may raise at: a division
+        // or a callable not known to be pure
+        bool m_select_may_raise=false;
+
+        // bits of the run masks past the eval_error ones, for the throwing
+        // evaluators: a division by zero, reported or not, and a callable that threw
+        static constexpr uint32_t raised_div = 1u << 30;
+        static constexpr uint32_t raised_exception = 1u << 31;
+        static constexpr uint32_t reported = eval_div_by_zero | eval_invalid | eval_overflow;
+
+        // checks arguments and stack shape and resolves m_flagged and, with
+        // vector_math, m_array_ptrs; builtin holds the modes of the add..pow opcodes
+        void finalize(const error_policy* policy, const std::array<domain_mode, 6>& builtin, bool vector_math);
+        [[nodiscard]] static domain_mode fused_mode(opcode op, const std::array<domain_mode, 6>& builtin) noexcept;
+        [[nodiscard]] detail::instruction_timer time_instruction(std::size_t k, uint64_t rows) const noexcept;
+        // Masked ors the errors reaching the result into errors and, with
+        // Selective and thrown given, stores there what a callable behind it
+        // threw; Selective tracks errors per stack entry, which only a select
+        // needs
+        template<bool Masked, bool Selective, typename Load>
+        T run(Load load, uint32_t& errors, std::exception_ptr* thrown) const noexcept(Masked);
+        // throws the errors reaching the result
+        template<typename Load>
+        T run_raising(Load load) const;
+        template<bool Masked>
+        void run_batch(std::span<const std::span<const T>> columns, std::span<T> out,
+                       std::span<uint32_t> errors) const;
+    };
+
+    // Per-thread variable values for one shared compiled_expr. The compiled
+    // expression is never modified, so any number of bindings may evaluate it
+    // concurrently.
+    template<typename T>
+    class basic_var_binding {
+    public:
+        explicit basic_var_binding(std::shared_ptr<const basic_compiled_expr<T>> expr);
+        basic_var_binding(std::shared_ptr<const basic_compiled_expr<T>> expr, const basic_var_map<T>& initial);
+
+        void set(std::string_view name, T value);
+        void set(uint32_t slot, T value) noexcept{m_slots[slot] = value;}
+        [[nodiscard]] T get(std::string_view name) const;
+        [[nodiscard]] int32_t slot_of(std::string_view name) const noexcept;
+        [[nodiscard]] T eval() const{return m_expr->eval(m_slots.data());}
+        [[nodiscard]] const std::shared_ptr<const basic_compiled_expr<T>>& get_expr() const noexcept{return m_expr;}
+    private:
+        std::shared_ptr<const basic_compiled_expr<T>> m_expr;
+        std::vector<T> m_slots;
+    };
+
+    template<typename T>
+    class basic_math_expr {
     public:
         enum class token_type {
             number,
@@ -47,27 +312,56 @@ namespace meval {
             operator_binary,
             open_bracket,
             close_bracket,
+            conditional,    // '?'
+            alternative,    // ':', and in the postfix the select of a conditional
             eof
         };
 
 
-        static const char sym_var_start;// = "$";
-        static const char sym_func_start;// = "@";
+        static constexpr char sym_var_start = '$';
+        static constexpr char sym_func_start = '@';
 
-        static const std::vector<char> m_reserved_symbols;
-        static const std::pair<char,char> bracket;// = {"(",")"};
+        inline static const std::vector<char> m_reserved_symbols = {
+            sym_var_start, sym_func_start, //sym_iota_start,
+            '.',
+            '(', ')',
+            '?', ':'
+        };
+        static constexpr std::pair<char,char> bracket = {'(', ')'};
+        // c ? a : b binds more loosely than any operator and groups to the right
+        static constexpr std::pair<char,char> ternary = {'?', ':'};
 
-        explicit math_expr(const std::string& expr,
-            const std::shared_ptr<var_map>& vars,
-            const std::shared_ptr<func_map>& funcs,
-            const std::shared_ptr<operator_map>& ops,
+        explicit basic_math_expr(const std::string& expr,
+            const std::shared_ptr<basic_var_map<T>>& vars,
+            const std::shared_ptr<basic_func_map<T>>& funcs,
+            const std::shared_ptr<basic_operator_map<T>>& ops,
             double epsilon=1e-20);
+        basic_math_expr(const std::string& expr,
+            const std::shared_ptr<basic_var_map<T>>& vars,
+            const std::shared_ptr<basic_func_map<T>>& funcs,
+            const std::shared_ptr<basic_operator_map<T>>& ops,
+            const compile_options& options);
 
-        [[nodiscard]] double eval() const;
+        [[nodiscard]] T eval() const;
+        // reference interpreter over m_postfix, kept for benchmarking
+        [[nodiscard]] T eval_postfix() const;
+        // variables missing from columns are broadcast from their current var_map value
+        void eval_batch(const basic_column_map<T>& columns, std::span<T> out) const;
+        // non-throwing counterparts of eval and eval_batch, see compiled_expr
+        [[nodiscard]] T eval(uint32_t& errors) const noexcept;
+        void eval_batch(const basic_column_map<T>& columns, std::span<T> out, std::span<uint32_t> errors) const;
+        [[nodiscard]] const std::shared_ptr<const basic_compiled_expr<T>>& get_compiled() const noexcept{
+            return m_compiled;
+        }
+        // input columns in slot order for compiled_expr::eval_batch and eval_range
+        [[nodiscard]] std::vector<std::span<const T>> bind_columns(const basic_column_map<T>& columns) const;
         [[nodiscard]] token_type get_token_type(std::string_view token) const;
-        [[nodiscard]] double get_epsilon() const noexcept{return m_epsilon;}
+        [[nodiscard]] T get_epsilon() const noexcept{return m_epsilon;}
         [[nodiscard]] std::string get_expr() const noexcept{return m_expr;}
+        [[nodiscard]] const compile_options& get_options() const noexcept{return m_options;}
     private:
+        friend class math_program;
+
         enum class token_element_type {
             digit,
             letter,
@@ -85,27 +379,44 @@ namespace meval {
 
         struct token {
             token_type type;
-            double number;
+            T number;
             std::string_view name;
         };
+        struct resolver;
 
         std::string m_expr;
-        std::shared_ptr<var_map> m_vars;
-        std::shared_ptr<func_map> m_funcs;
-        std::shared_ptr<operator_map> m_ops;
+        std::shared_ptr<basic_var_map<T>> m_vars;
+        std::shared_ptr<basic_func_map<T>> m_funcs;
+        std::shared_ptr<basic_operator_map<T>> m_ops;
 
-        double m_epsilon;
-        std::stack<token> m_opr_stack;
+        T m_epsilon;
+        compile_options m_options;
+        // kept after compile for eval_postfix and the output names of math_program
         std::vector<token> m_postfix;
+        std::shared_ptr<const basic_compiled_expr<T>> m_compiled;
+        std::vector<const T*> m_slot_refs;
         uint32_t m_current_token_str_pos=0;
 
-        static void stack_move(std::stack<token>& stackA, std::stack<token>& stackB);
         void reset_token_str_pos();
-        token get_full_token(token_type);
-        token parse_next_token_from_str();
-        std::vector<token> tokenize();
-        void to_postfix();
+        std::vector<token> tokenize(const symbol_tables* symbols);
+        void to_postfix(const symbol_tables* symbols);
+        void compile();
 
     };
+
+    typedef basic_compiled_expr<double> compiled_expr;
+    typedef basic_var_binding<double> var_binding;
+    typedef basic_math_expr<double> math_expr;
+
+    // instantiated in meval.cpp
+    extern template class basic_compiled_expr<float>;
+    extern template class basic_compiled_expr<double>;
+    extern template class basic_compiled_expr<long double>;
+    extern template class basic_var_binding<float>;
+    extern template class basic_var_binding<double>;
+    extern template class basic_var_binding<long double>;
+    extern template class basic_math_expr<float>;
+    extern template class basic_math_expr<double>;
+    extern template class basic_math_expr<long double>;
 }
 #endif //MEVAL_H
\ No newline at end of file
@@ -0,0 +1,279 @@
+//
+// Compilation of many formulas against one set of symbol maps.
+//
+
+#include "meval_bulk.h"
+#include "meval_impl.h"
+
+namespace meval {
+
+    namespace {
+        enum class token_type : uint8_t {
+            number,
+            variable,
+            function,
+            operator_binary,
+            open_bracket,
+            close_bracket,
+            conditional,
+            alternative,
+        };
+
+        struct token {
+            token_type type;
+            uint32_t id;    // trie id of variables, functions and operators
+            double number;
+        };
+
+        constexpr auto bracket = math_expr::bracket;
+    }
+
+    struct bulk_compiler::func_entry {
+        compiled_expr::func_ptr ptr;
+        const func_unary* obj;  // in m_funcs, null if the name is not in the map
+    };
+
+    struct bulk_compiler::op_entry {
+        opcode op;
+        compiled_expr::op_ptr ptr;
+        const func_binary* obj;  // in m_ops, null if the name is not in the map
+        uint32_t precedence;
+        bool flags_builtin;      // a builtin opcode reached through a name the error policy flags
+    };
+
+    // Per-thread working memory, cleared but not released between formulas.
+    struct bulk_compiler::scratch {
+        std::string text;
+        std::vector<token> tokens;
+        std::vector<token> stack;
+        std::vector<token> postfix;
+        // per symbol (variables, then functions, then operators), its index
+        // in the tables of the formula that last stamped it
+        std::vector<uint32_t> local;
+        std::vector<uint64_t> stamp;
+        uint64_t formula=0;
+        std::vector<uint32_t> slot_vars;  // trie id of the variable in each slot
+    };
+
+    bulk_compiler::bulk_compiler(std::shared_ptr<var_map> vars, std::shared_ptr<func_map> funcs,
+                                 std::shared_ptr<operator_map> ops, const compile_options& options)
+        : m_vars(std::move(vars)),
+          m_funcs(std::move(funcs)),
+          m_ops(std::move(ops)),
+          m_options(options),
+          m_symbols(options.symbols) {
+        if (!m_symbols) {
+            detail::phase_timer timer(stats_phase::symbols);
+            m_symbols = std::make_shared<const symbol_tables>(*m_vars, *m_funcs, *m_ops);
+        }
+        const auto& tables = *m_symbols;
+        m_var_values.resize(tables.vars.size());
+        m_var_const.resize(tables.vars.size());
+        for (uint32_t id = 0; id < tables.vars.size(); id++) {
+            const auto name = tables.vars.name(id);
+            if (const auto it = m_vars->find(name); it != m_vars->end())
+                m_var_values[id] = &it->second;
+            m_var_const[id] = m_options.consts && m_options.consts->contains(name);
+        }
+        m_func_entries.resize(tables.funcs.size());
+        for (uint32_t id = 0; id < tables.funcs.size(); id++) {
+            if (const auto it = m_funcs->find(tables.funcs.name(id)); it != m_funcs->end())
+                m_func_entries[id] = {detail::target_ptr(it->second), &it->second};
+        }
+        m_op_entries.resize(tables.ops.size());
+        for (uint32_t id = 0; id < tables.ops.size(); id++) {
+            const auto name = tables.ops.name(id);
+            const auto it = m_ops->find(name);
+            if (it == m_ops->end()) {
+                m_op_entries[id] = {opcode::call_op_obj, nullptr, nullptr, 0, false};
+                continue;
+            }
+            op_entry& e = m_op_entries[id];
+            e = {opcode::call_op_obj, detail::target_ptr(it->second.first), &it->second.first, it->second.second,
+                 false};
+            e.op = detail::binary_opcode<double>(e.ptr);
+            e.flags_builtin = m_options.errors && e.op <= opcode::pow &&
+                              m_options.errors->mode_of(name) == domain_mode::flag;
+        }
+    }
+
+    bulk_compiler::~bulk_compiler() = default;
+
+    bulk_result bulk_compiler::compile(const std::string_view formula) const {
+        static thread_local scratch s;
+        // the text math_expr compiles: spaces dropped, in brackets, so that
+        // error positions agree
+        s.text.clear();
+        s.text.reserve(formula.size() + 2);
+        s.text += bracket.first;
+        for (const char c : formula) {
+            if (c != ' ')
+                s.text += c;
+        }
+        s.text += bracket.second;
+        try {
+            tokenize(s);
+            to_postfix(s);
+            return {emit(s), std::nullopt};
+        } catch (const meval_error& e) {
+            return {nullptr, e};
+        } catch (const std::exception& e) {
+            return {nullptr, meval_error(e.what(), meval_error::error_type::invalid_expression)};
+        }
+    }
+
+    std::vector<bulk_result> bulk_compiler::compile(const std::span<const std::string_view> formulas,
+                                                    thread_pool& pool, const std::size_t grain) const {
+        return compile_all(formulas, pool, grain);
+    }
+
+    std::vector<bulk_result> bulk_compiler::compile(const std::span<const std::string> formulas,
+                                                    thread_pool& pool, const std::size_t grain) const {
+        return compile_all(formulas, pool, grain);
+    }
+
+    template<typename String>
+    std::vector<bulk_result> bulk_compiler::compile_all(const std::span<const String> formulas, thread_pool& pool,
+                                                        const std::size_t grain) const {
+        std::vector<bulk_result> results(formulas.size());
+        pool.parallel_for(0, formulas.size(), std::max<std::size_t>(grain, 1),
+                          [&](const std::size_t first, const std::size_t last) {
+            for (std::size_t i = first; i < last; i++)
+                results[i] = compile(std::string_view(formulas[i]));
+        });
+        return results;
+    }
+
+    // as math_expr::tokenize, with names as ids
+    void bulk_compiler::tokenize(scratch& s) const {
+        detail::phase_timer timer(stats_phase::tokenize);
+        struct lexicon {
+            const symbol_tables& tables;
+
+            static std::size_t read(const token_type type, const symbol_trie& trie, const std::string_view text,
+                                    token& tok) {
+                const int32_t id = trie.longest_match_id(text);
+                if (id < 0)
+                    return 0;
+                tok = {type, static_cast<uint32_t>(id), 0};
+                return trie.name(id).size();
+            }
+            std::size_t variable(const std::string_view text, token& tok) const {
+                return read(token_type::variable, tables.vars, text, tok);
+            }
+            std::size_t function(const std::string_view text, token& tok) const {
+                return read(token_type::function, tables.funcs, text, tok);
+            }
+            std::size_t operator_binary(const std::string_view text, token& tok) const {
+                return read(token_type::operator_binary, tables.ops, text, tok);
+            }
+        } lex{*m_symbols};
+        s.tokens.clear();
+        uint32_t pos = 0;
+        detail::tokenize(std::string_view(s.text), s.tokens, pos, lex);
+    }
+
+    // as math_expr::to_postfix
+    void bulk_compiler::to_postfix(scratch& s) const {
+        detail::phase_timer timer(stats_phase::to_postfix);
+        const auto precedence = [&](const token& tok) {
+            const op_entry& e = m_op_entries[tok.id];
+            if (!e.obj)
+                throw meval_error("Unknown operator: " + std::string(m_symbols->ops.name(tok.id)),
+                                  meval_error::error_type::unknown_operator, static_cast<uint32_t>(s.text.size()));
+            return e.precedence;
+        };
+        detail::to_postfix(s.tokens, s.stack, s.postfix, precedence);
+    }
+
+    // as math_expr::compile
+    std::shared_ptr<const compiled_expr> bulk_compiler::emit(scratch& s) const {
+        detail::phase_timer timer(stats_phase::compile);
+        const auto& tables = *m_symbols;
+        const std::size_t func_base = tables.vars.size();
+        const std::size_t op_base = func_base + tables.funcs.size();
+        if (s.local.size() < op_base + tables.ops.size()) {
+            s.local.resize(op_base + tables.ops.size());
+            s.stamp.resize(op_base + tables.ops.size());
+        }
+        const uint64_t formula = ++s.formula;
+        // index of symbol in a table of the formula, appending value and name on first use
+        const auto intern = [&](const std::size_t symbol, auto& table, std::vector<std::string>& names,
+                                const std::string_view name, const auto& value) {
+            if (s.stamp[symbol] != formula) {
+                s.stamp[symbol] = formula;
+                s.local[symbol] = static_cast<uint32_t>(table.size());
+                table.push_back(value);
+                names.emplace_back(name);
+            }
+            return s.local[symbol];
+        };
+
+        struct resolver {
+            const bulk_compiler& bc;
+            compiled_expr& ce;
+            scratch& s;
+            const decltype(intern)& intern_symbol;
+            std::size_t func_base;
+            std::size_t op_base;
+
+            [[nodiscard]] std::string_view name(const token& tkn) const {
+                const auto& tables = *bc.m_symbols;
+                return tkn.type == token_type::function ? tables.funcs.name(tkn.id) : tables.ops.name(tkn.id);
+            }
+            uint32_t variable(const token& tkn) const {
+                const auto name = bc.m_symbols->vars.name(tkn.id);
+                if (!bc.m_var_values[tkn.id])
+                    throw meval_error("Unknown variable: " + std::string(name),
+                                      meval_error::error_type::unknown_variable);
+                return intern_symbol(tkn.id, s.slot_vars, ce.m_slots, name, tkn.id);
+            }
+            instruction function(const token& tkn) const {
+                const func_entry& fn = bc.m_func_entries[tkn.id];
+                const auto fname = name(tkn);
+                if (!fn.obj)
+                    throw meval_error("Unknown function: " + std::string(fname),
+                                      meval_error::error_type::unknown_function);
+                const std::size_t symbol = func_base + tkn.id;
+                if (fn.ptr)
+                    return {opcode::call_func,
+                            intern_symbol(symbol, ce.m_func_ptrs, ce.m_func_ptr_names, fname, fn.ptr)};
+                return {opcode::call_func_obj,
+                        intern_symbol(symbol, ce.m_func_objs, ce.m_func_obj_names, fname, *fn.obj)};
+            }
+            std::pair<instruction, bool> operator_binary(const token& tkn) const {
+                const op_entry& op = bc.m_op_entries[tkn.id];
+                const auto oname = name(tkn);
+                if (!op.obj)
+                    throw meval_error("Unknown operator: " + std::string(oname),
+                                      meval_error::error_type::unknown_operator);
+                instruction in{op.op, 0};
+                const std::size_t symbol = op_base + tkn.id;
+                if (in.op == opcode::call_op)
+                    in.arg = intern_symbol(symbol, ce.m_op_ptrs, ce.m_op_ptr_names, oname, op.ptr);
+                else if (in.op == opcode::call_op_obj)
+                    in.arg = intern_symbol(symbol, ce.m_op_objs, ce.m_op_obj_names, oname, *op.obj);
+                return {in, op.flags_builtin};
+            }
+        };
+
+        compiled_expr ce;
+        ce.m_epsilon = m_options.epsilon;
+        s.slot_vars.clear();
+        std::array<domain_mode, 6> builtin_modes;
+        builtin_modes.fill(m_options.errors ? domain_mode::propagate : domain_mode::flag);
+        resolver resolve{*this, ce, s, intern, func_base, op_base};
+        ce.m_max_stack = detail::emit(s.postfix, ce.m_code, ce.m_consts, builtin_modes, resolve);
+        if (m_options.level != opt_level::none) {
+            std::vector<std::optional<double>> immutable(ce.m_slots.size());
+            for (std::size_t i = 0; i < immutable.size(); i++) {
+                if (m_var_const[s.slot_vars[i]])
+                    immutable[i] = *m_var_values[s.slot_vars[i]];
+            }
+            expr_rewriter::optimize(ce, m_options.level, immutable, m_options.fast_math);
+        }
+        ce.finalize(m_options.errors.get(), builtin_modes, m_options.vector_math);
+        return std::make_shared<const compiled_expr>(std::move(ce));
+    }
+
+} // meval
@@ -0,0 +1,79 @@
+//
+// Compilation of many formulas against one set of symbol maps.
+//
+
+#ifndef MEVAL_BULK_H
+#define MEVAL_BULK_H
+
+#include "meval.h"
+#include "meval_parallel.h"
+#include <optional>
+
+namespace meval {
+
+    // One formula of a bulk compile: its expression, or the error math_expr
+    // would have thrown for it.
+    struct bulk_result {
+        std::shared_ptr<const compiled_expr> expr;
+        std::optional<meval_error> error;
+
+        [[nodiscard]] bool ok() const noexcept{return expr != nullptr;}
+    };
+
+    // Compiles formulas to the compiled_expr a math_expr over the same maps
+    // and options would hold, without building the math_expr. The names of
+    // the maps are interned once, on construction, as dense ids, and all that
+    // hangs off a name (callable, opcode, precedence, error mode, the value
+    // folded for compile_options::consts) is resolved for each id then. A
+    // formula costs one pass over its text and the bytecode passes; its
+    // tokens, operator stack and postfix live in scratch buffers of the
+    // calling thread that are reset, not freed, between formulas, so a warm
+    // thread allocates only what the result keeps. The maps must not change
+    // while the compiler lives.
+    class bulk_compiler {
+    public:
+        bulk_compiler(std::shared_ptr<var_map> vars, std::shared_ptr<func_map> funcs,
+                      std::shared_ptr<operator_map> ops, const compile_options& options = {});
+        ~bulk_compiler();
+        bulk_compiler(const bulk_compiler&) = delete;
+        bulk_compiler& operator=(const bulk_compiler&) = delete;
+
+        // errors are returned, including exceptions of the callables run
+        // while folding constants, as invalid_expression
+        [[nodiscard]] bulk_result compile(std::string_view formula) const;
+        // results in formula order; a formula that fails does not stop the others
+        [[nodiscard]] std::vector<bulk_result> compile(std::span<const std::string_view> formulas,
+                                                       thread_pool& pool = thread_pool::shared(),
+                                                       std::size_t grain = 64) const;
+        [[nodiscard]] std::vector<bulk_result> compile(std::span<const std::string> formulas,
+                                                       thread_pool& pool = thread_pool::shared(),
+                                                       std::size_t grain = 64) const;
+
+        [[nodiscard]] const compile_options& get_options() const noexcept{return m_options;}
+    private:
+        struct func_entry;
+        struct op_entry;
+        struct scratch;
+
+        std::shared_ptr<var_map> m_vars;
+        std::shared_ptr<func_map> m_funcs;
+        std::shared_ptr<operator_map> m_ops;
+        compile_options m_options;
+        std::shared_ptr<const symbol_tables> m_symbols;
+        // by trie id of the name
+        std::vector<const double*> m_var_values;
+        std::vector<bool> m_var_const;
+        std::vector<func_entry> m_func_entries;
+        std::vector<op_entry> m_op_entries;
+
+        void tokenize(scratch& s) const;
+        void to_postfix(scratch& s) const;
+        [[nodiscard]] std::shared_ptr<const compiled_expr> emit(scratch& s) const;
+        template<typename String>
+        std::vector<bulk_result> compile_all(std::span<const String> formulas, thread_pool& pool,
+                                             std::size_t grain) const;
+    };
+
+} // meval
+
+#endif //MEVAL_BULK_H
@@ -0,0 +1,137 @@
+//
+// Process-wide cache of compiled expressions.
+//
+
+#include "meval_cache.h"
+#include "meval_stats.h"
+#include <algorithm>
+#include <mutex>
+
+namespace meval {
+
+    std::size_t expr_cache::key_hash::operator()(const key& k) const noexcept {
+        std::size_t h = std::hash<std::string>{}(k.text);
+        const auto mix = [&h](const std::size_t v) { h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+        mix(std::hash<const void*>{}(k.vars));
+        mix(std::hash<const void*>{}(k.funcs));
+        mix(std::hash<const void*>{}(k.ops));
+        mix(std::hash<const void*>{}(k.consts));
+        mix(std::hash<const void*>{}(k.symbols));
+        mix(std::hash<const void*>{}(k.errors));
+        mix(static_cast<std::size_t>(k.level));
+        mix(static_cast<std::size_t>(k.fast_math));
+        mix(static_cast<std::size_t>(k.vector_math));
+        mix(std::hash<double>{}(k.epsilon));
+        mix(std::hash<uint64_t>{}(k.version));
+        return h;
+    }
+
+    bool expr_cache::entry::owned_by(const owner_refs& refs) const noexcept {
+        for (std::size_t i = 0; i < owners.size(); i++) {
+            if (owners[i].owner_before(refs[i]) || refs[i].owner_before(owners[i]))
+                return false;
+        }
+        return true;
+    }
+
+    expr_cache::expr_cache(const std::size_t capacity, const unsigned shards)
+        : m_capacity(std::max<std::size_t>(capacity, 1)) {
+        const unsigned n = std::clamp<unsigned>(shards, 1, static_cast<unsigned>(m_capacity));
+        m_shard_capacity = (m_capacity + n - 1) / n;
+        m_shards.reserve(n);
+        for (unsigned i = 0; i < n; i++)
+            m_shards.push_back(std::make_unique<shard>());
+        if constexpr (stats_enabled)
+            detail::register_cache(this);
+    }
+
+    expr_cache::~expr_cache() {
+        if constexpr (stats_enabled)
+            detail::unregister_cache(this);
+    }
+
+    expr_cache& expr_cache::shared() {
+        static expr_cache cache;
+        return cache;
+    }
+
+    std::shared_ptr<const compiled_expr> expr_cache::get(const std::string_view expr,
+                                                         const std::shared_ptr<var_map>& vars,
+                                                         const std::shared_ptr<func_map>& funcs,
+                                                         const std::shared_ptr<operator_map>& ops,
+                                                         const compile_options& options,
+                                                         const uint64_t version) {
+        key k{{}, vars.get(), funcs.get(), ops.get(), options.consts.get(), options.symbols.get(),
+              options.errors.get(), options.level, options.fast_math,
+              options.vector_math, options.epsilon, version};
+        k.text.reserve(expr.size());
+        for (const char c : expr) {
+            if (c != ' ')
+                k.text += c;
+        }
+        const owner_refs owners{vars, funcs, ops, options.consts, options.symbols, options.errors};
+        const std::size_t h = key_hash{}(k);
+        shard& sh = *m_shards[h % m_shards.size()];
+        {
+            std::shared_lock lk(sh.mutex);
+            if (const auto it = sh.map.find(k); it != sh.map.end() && it->second.owned_by(owners)) {
+                it->second.referenced.store(true, std::memory_order_relaxed);
+                sh.hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second.expr;
+            }
+        }
+        sh.misses.fetch_add(1, std::memory_order_relaxed);
+        // compile without holding the lock; a racing miss on the same key keeps the first result
+        auto compiled = math_expr(std::string(expr), vars, funcs, ops, options).get_compiled();
+
+        std::unique_lock lk(sh.mutex);
+        const auto [it, inserted] = sh.map.try_emplace(std::move(k));
+        if (!inserted && it->second.owned_by(owners))
+            return it->second.expr;
+        // a new entry, or one left by maps since freed, which keeps its place in the queue
+        it->second.expr = std::move(compiled);
+        std::ranges::copy(owners, it->second.owners.begin());
+        it->second.referenced.store(true, std::memory_order_relaxed);
+        if (inserted)
+            sh.queue.push_back(&it->first);
+        if (sh.map.size() > m_shard_capacity)
+            evict(sh);
+        return it->second.expr;
+    }
+
+    void expr_cache::evict(shard& sh) {
+        // new entries start referenced, so they survive at least one sweep
+        while (!sh.queue.empty()) {
+            const auto victim = sh.map.find(*sh.queue.front());
+            if (victim->second.referenced.exchange(false, std::memory_order_relaxed)) {
+                sh.queue.splice(sh.queue.end(), sh.queue, sh.queue.begin());
+                continue;
+            }
+            sh.queue.pop_front();
+            sh.map.erase(victim);
+            sh.evictions.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    void expr_cache::clear() {
+        for (const auto& sh : m_shards) {
+            std::unique_lock lk(sh->mutex);
+            sh->map.clear();
+            sh->queue.clear();
+        }
+    }
+
+    expr_cache::stats expr_cache::get_stats() const {
+        stats s{};
+        for (const auto& sh : m_shards) {
+            s.hits += sh->hits.load(std::memory_order_relaxed);
+            s.misses += sh->misses.load(std::memory_order_relaxed);
+            s.evictions += sh->evictions.load(std::memory_order_relaxed);
+            std::shared_lock lk(sh->mutex);
+            s.entries += sh->map.size();
+        }
+        return s;
+    }
+
+} // meval
@@ -0,0 +1,99 @@
+//
+// Process-wide cache of compiled expressions.
+//
+
+#ifndef MEVAL_CACHE_H
+#define MEVAL_CACHE_H
+
+#include "meval.h"
+#include <array>
+#include <atomic>
+#include <list>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace meval {
+
+    // Maps expression text to shared compiled_expr objects. Entries are keyed
+    // on the text with spaces removed, the identity of the symbol maps, the
+    // compile options and a caller supplied version that must be bumped
+    // whenever the contents of the maps change. An entry holds weak references
+    // to the maps and tables it was compiled against, so a map allocated where
+    // a freed one lived does not match it. Lookups take a shared lock on
+    // one of several shards; eviction is second-chance (CLOCK), which
+    // approximates LRU without writing on every hit.
+    class expr_cache {
+    public:
+        struct stats {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            uint64_t entries;
+        };
+
+        explicit expr_cache(std::size_t capacity = 4096, unsigned shards = 16);
+        ~expr_cache();
+        expr_cache(const expr_cache&) = delete;
+        expr_cache& operator=(const expr_cache&) = delete;
+
+        // compiles expr on a miss; compile errors are thrown and not cached
+        [[nodiscard]] std::shared_ptr<const compiled_expr> get(std::string_view expr,
+            const std::shared_ptr<var_map>& vars,
+            const std::shared_ptr<func_map>& funcs,
+            const std::shared_ptr<operator_map>& ops,
+            const compile_options& options = {},
+            uint64_t version = 0);
+
+        void clear();
+        [[nodiscard]] stats get_stats() const;
+        [[nodiscard]] std::size_t capacity() const noexcept{return m_capacity;}
+
+        static expr_cache& shared();
+    private:
+        struct key {
+            std::string text;
+            const void* vars;
+            const void* funcs;
+            const void* ops;
+            const void* consts;
+            const void* symbols;
+            const void* errors;
+            opt_level level;
+            bool fast_math;
+            bool vector_math;
+            double epsilon;
+            uint64_t version;
+
+            bool operator==(const key&) const = default;
+        };
+        struct key_hash {
+            std::size_t operator()(const key& k) const noexcept;
+        };
+        // vars, funcs, ops, consts, symbols and errors, in the order of key
+        typedef std::array<std::shared_ptr<const void>, 6> owner_refs;
+        struct entry {
+            std::shared_ptr<const compiled_expr> expr;
+            std::array<std::weak_ptr<const void>, 6> owners;
+            mutable std::atomic<bool> referenced{false};
+
+            [[nodiscard]] bool owned_by(const owner_refs& refs) const noexcept;
+        };
+        struct shard {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<key, entry, key_hash> map;
+            std::list<const key*> queue;  // insertion order for the clock hand
+            std::atomic<uint64_t> hits{0};
+            std::atomic<uint64_t> misses{0};
+            std::atomic<uint64_t> evictions{0};
+        };
+
+        std::size_t m_capacity;
+        std::size_t m_shard_capacity;
+        std::vector<std::unique_ptr<shard>> m_shards;
+
+        void evict(shard& sh);
+    };
+
+} // meval
+
+#endif //MEVAL_CACHE_H
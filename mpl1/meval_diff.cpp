@@ -0,0 +1,294 @@
+//
+// Forward- and reverse-mode automatic differentiation of compiled_expr.
+//
+
+#include "meval_diff.h"
+#include "def_math.h"
+#include "meval_opt.h"
+#include <cmath>
+#include <numbers>
+
+namespace meval {
+    namespace {
+        typedef compiled_expr::func_ptr fp;
+
+        double d_sin(const double x) { return std::cos(x); }
+        double d_cos(const double x) { return -std::sin(x); }
+        double d_tan(const double x) { const double t = std::tan(x); return 1 + t * t; }
+        double d_asin(const double x) { return 1 / std::sqrt(1 - x * x); }
+        double d_acos(const double x) { return -1 / std::sqrt(1 - x * x); }
+        double d_atan(const double x) { return 1 / (1 + x * x); }
+        double d_sinh(const double x) { return std::cosh(x); }
+        double d_cosh(const double x) { return std::sinh(x); }
+        double d_tanh(const double x) { const double t = std::tanh(x); return 1 - t * t; }
+        double d_asinh(const double x) { return 1 / std::sqrt(x * x + 1); }
+        double d_acosh(const double x) { return 1 / std::sqrt(x * x - 1); }
+        double d_atanh(const double x) { return 1 / (1 - x * x); }
+        double d_sqrt(const double x) { return 0.5 / std::sqrt(x); }
+        double d_log(const double x) { return 1 / x; }
+        double d_log10(const double x) { return 1 / (x * std::numbers::ln10); }
+        double d_exp(const double x) { return std::exp(x); }
+        double d_fabs(const double x) { return x > 0 ? 1 : x < 0 ? -1 : 0; }
+        // piecewise constant
+        double d_step(const double) { return 0; }
+
+        fp builtin_derivative(const fp f) {
+            static const std::pair<fp, fp> table[] = {
+                {static_cast<fp>(std::sin), d_sin}, {static_cast<fp>(std::cos), d_cos},
+                {static_cast<fp>(std::tan), d_tan}, {static_cast<fp>(std::asin), d_asin},
+                {static_cast<fp>(std::acos), d_acos}, {static_cast<fp>(std::atan), d_atan},
+                {static_cast<fp>(std::sinh), d_sinh}, {static_cast<fp>(std::cosh), d_cosh},
+                {static_cast<fp>(std::tanh), d_tanh}, {static_cast<fp>(std::asinh), d_asinh},
+                {static_cast<fp>(std::acosh), d_acosh}, {static_cast<fp>(std::atanh), d_atanh},
+                {static_cast<fp>(std::sqrt), d_sqrt}, {static_cast<fp>(std::log), d_log},
+                {static_cast<fp>(std::log10), d_log10}, {static_cast<fp>(std::exp), d_exp},
+                {static_cast<fp>(std::fabs), d_fabs}, {static_cast<fp>(std::ceil), d_step},
+                {static_cast<fp>(std::floor), d_step}, {static_cast<fp>(std::round), d_step},
+            };
+            for (const auto& [fn, d] : table) {
+                if (fn == f)
+                    return d;
+            }
+            return nullptr;
+        }
+
+        struct local_partials {
+            double value;
+            double d_lhs;
+            double d_rhs;
+            double d_addend = 0;
+        };
+
+        // value of one call or operator instruction and its partials with respect to its operands
+        local_partials apply(const compiled_expr& expr, const instruction& in, const detail::diff_rule& rule,
+                             const double a, const double b, const double c = 0) {
+            const double eps = expr.get_epsilon();
+            switch (in.op) {
+                case opcode::add:
+                    return {a + b, 1, 1};
+                case opcode::sub:
+                    return {a - b, 1, -1};
+                case opcode::mul:
+                    return {a * b, b, a};
+                case opcode::div: {
+                    const double v = div(a, b, eps);
+                    return {v, 1 / b, -v / b};
+                }
+                case opcode::mod:
+                    return {std::fmod(a, b), 1, -std::trunc(a / b)};
+                case opcode::pow: {
+                    const double v = std::pow(a, b);
+                    const double da = b == 0 ? 0 : b * std::pow(a, b - 1);
+                    const double db = a > 0 ? v * std::log(a) : a == 0 ? 0 : std::nan("");
+                    return {v, da, db};
+                }
+                case opcode::call_func: {
+                    const double v = expr.func_ptrs()[in.arg](a);
+                    return {v, rule.func_ptr ? rule.func_ptr(a) : (*rule.func_obj)(a), 0};
+                }
+                case opcode::call_func_obj: {
+                    const double v = expr.func_objs()[in.arg](a);
+                    return {v, rule.func_ptr ? rule.func_ptr(a) : (*rule.func_obj)(a), 0};
+                }
+                case opcode::call_op: {
+                    const auto [da, db] = (*rule.op)(a, b, eps);
+                    return {expr.op_ptrs()[in.arg](a, b, eps), da, db};
+                }
+                case opcode::call_op_obj: {
+                    const auto [da, db] = (*rule.op)(a, b, eps);
+                    return {expr.op_objs()[in.arg](a, b, eps), da, db};
+                }
+                case opcode::square:
+                    return {a * a, 2 * a, 0};
+                case opcode::recip: {
+                    const double v = recip(a, eps);
+                    return {v, -v * v, 0};
+                }
+                case opcode::sqrt: {
+                    const double v = std::sqrt(a);
+                    return {v, 0.5 / v, 0};
+                }
+                case opcode::powi:
+                    return {powi(a, in.arg), in.arg == 2 ? 2 * a : in.arg * powi(a, in.arg - 1), 0};
+                case opcode::hypot: {
+                    const double v = std::hypot(a, b);
+                    return {v, v == 0 ? 0 : a / v, v == 0 ? 0 : b / v};
+                }
+                case opcode::fma:
+                    return {std::fma(a, b, c), b, a, 1};
+                // piecewise constant, so flat on either side of the switch
+                case opcode::lt:
+                    return {lt(a, b), 0, 0};
+                case opcode::le:
+                    return {le(a, b), 0, 0};
+                case opcode::gt:
+                    return {gt(a, b), 0, 0};
+                case opcode::ge:
+                    return {ge(a, b), 0, 0};
+                case opcode::eq:
+                    return {eq(a, b), 0, 0};
+                case opcode::ne:
+                    return {ne(a, b), 0, 0};
+                case opcode::select:
+                    return {select(a, b, c), 0, a != 0 ? 1.0 : 0.0, a != 0 ? 0.0 : 1.0};
+                default:
+                    return {0, 0, 0};
+            }
+        }
+    }
+
+    std::vector<detail::diff_rule> detail::resolve_rules(const compiled_expr& expr, const derivative_rules* rules) {
+        std::vector<diff_rule> resolved(expr.code().size());
+        for (std::size_t i = 0; i < resolved.size(); i++) {
+            const auto& in = expr.code()[i];
+            const auto name = expr.callable_name(in);
+            switch (in.op) {
+                case opcode::call_func:
+                case opcode::call_func_obj: {
+                    if (rules) {
+                        if (const auto it = rules->funcs.find(name); it != rules->funcs.end()) {
+                            resolved[i].func_obj = &it->second;
+                            break;
+                        }
+                    }
+                    if (in.op == opcode::call_func)
+                        resolved[i].func_ptr = builtin_derivative(expr.func_ptrs()[in.arg]);
+                    if (!resolved[i].func_ptr)
+                        throw meval_error("No derivative rule for function: " + std::string(name),
+                            meval_error::error_type::invalid_argument);
+                    break;
+                }
+                case opcode::call_op:
+                case opcode::call_op_obj: {
+                    if (rules) {
+                        if (const auto it = rules->ops.find(name); it != rules->ops.end())
+                            resolved[i].op = &it->second;
+                    }
+                    if (!resolved[i].op)
+                        throw meval_error("No derivative rule for operator: " + std::string(name),
+                            meval_error::error_type::invalid_argument);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        return resolved;
+    }
+
+    // Implementation of forward_diff
+    forward_diff::forward_diff(std::shared_ptr<const compiled_expr> expr, std::shared_ptr<const derivative_rules> rules)
+        : m_expr(std::move(expr)),
+          m_rules(std::move(rules)),
+          m_rule(detail::resolve_rules(*m_expr, m_rules.get())) {
+    }
+
+    template<typename Seed>
+    dual forward_diff::run(const double* slots, Seed seed) const {
+        constexpr uint32_t local_stack = 32;
+        dual local[local_stack]{};
+        std::vector<dual> heap;
+        dual* st = local;
+        if (m_expr->max_stack() > local_stack) {
+            heap.resize(m_expr->max_stack());
+            st = heap.data();
+        }
+        const auto& code = m_expr->code();
+        uint32_t top = 0;
+        for (std::size_t i = 0; i < code.size(); i++) {
+            const auto& in = code[i];
+            switch (in.op) {
+                case opcode::push_const:
+                    st[top++] = {m_expr->constants()[in.arg], 0};
+                    continue;
+                case opcode::push_var:
+                    st[top++] = {slots[in.arg], seed(in.arg)};
+                    continue;
+                default:
+                    break;
+            }
+            const auto n = operand_count(in.op);
+            const dual c = n == 3 ? st[--top] : dual{0, 0};
+            const dual b = n >= 2 ? st[--top] : dual{0, 0};
+            const dual a = st[top - 1];
+            const auto p = apply(*m_expr, in, m_rule[i], a.value, b.value, c.value);
+            // a zero tangent contributes nothing, even where the partial is
+            // infinite, and a zero partial nothing, as for the branch a
+            // conditional does not take, even where the tangent is NaN
+            double d = 0;
+            if (a.deriv != 0 && p.d_lhs != 0)
+                d += p.d_lhs * a.deriv;
+            if (b.deriv != 0 && p.d_rhs != 0)
+                d += p.d_rhs * b.deriv;
+            if (c.deriv != 0 && p.d_addend != 0)
+                d += p.d_addend * c.deriv;
+            st[top - 1] = {p.value, d};
+        }
+        return st[0];
+    }
+
+    dual forward_diff::eval(const double* slots, const double* direction) const {
+        return run(slots, [direction](const uint32_t slot) { return direction[slot]; });
+    }
+
+    dual forward_diff::eval(const double* slots, const uint32_t slot) const {
+        return run(slots, [slot](const uint32_t s) { return s == slot ? 1.0 : 0.0; });
+    }
+
+    // Implementation of reverse_diff
+    reverse_diff::reverse_diff(std::shared_ptr<const compiled_expr> expr, std::shared_ptr<const derivative_rules> rules)
+        : m_expr(std::move(expr)),
+          m_rules(std::move(rules)),
+          m_rule(detail::resolve_rules(*m_expr, m_rules.get())) {
+        // to_tree keeps one node per instruction, in program order
+        for (const auto& nd : expr_rewriter::to_tree(*m_expr))
+            m_tape.push_back({nd.lhs, nd.rhs, nd.addend, 0, 0, 0, 0, 0});
+    }
+
+    double reverse_diff::gradient(const double* slots, double* grad) {
+        const auto& code = m_expr->code();
+        for (std::size_t i = 0; i < code.size(); i++) {
+            const auto& in = code[i];
+            auto& t = m_tape[i];
+            t.adjoint = 0;
+            switch (in.op) {
+                case opcode::push_const:
+                    t.value = m_expr->constants()[in.arg];
+                    break;
+                case opcode::push_var:
+                    t.value = slots[in.arg];
+                    break;
+                default: {
+                    const double a = m_tape[t.lhs].value;
+                    const double b = t.rhs >= 0 ? m_tape[t.rhs].value : 0;
+                    const double c = t.addend >= 0 ? m_tape[t.addend].value : 0;
+                    const auto p = apply(*m_expr, in, m_rule[i], a, b, c);
+                    t.value = p.value;
+                    t.d_lhs = p.d_lhs;
+                    t.d_rhs = p.d_rhs;
+                    t.d_addend = p.d_addend;
+                    break;
+                }
+            }
+        }
+        std::fill_n(grad, m_expr->slot_names().size(), 0.0);
+        m_tape.back().adjoint = 1;
+        for (auto i = static_cast<int64_t>(code.size()) - 1; i >= 0; i--) {
+            const auto& t = m_tape[i];
+            if (t.adjoint == 0)
+                continue;
+            if (code[i].op == opcode::push_var) {
+                grad[code[i].arg] += t.adjoint;
+                continue;
+            }
+            if (t.lhs >= 0)
+                m_tape[t.lhs].adjoint += t.adjoint * t.d_lhs;
+            if (t.rhs >= 0)
+                m_tape[t.rhs].adjoint += t.adjoint * t.d_rhs;
+            if (t.addend >= 0)
+                m_tape[t.addend].adjoint += t.adjoint * t.d_addend;
+        }
+        return m_tape.back().value;
+    }
+
+} // meval
@@ -0,0 +1,92 @@
+//
+// Forward- and reverse-mode automatic differentiation of compiled_expr.
+//
+
+#ifndef MEVAL_DIFF_H
+#define MEVAL_DIFF_H
+
+#include "meval.h"
+
+namespace meval {
+
+    // partial derivatives of a binary operator with respect to both operands
+    typedef std::function<std::pair<double,double>(double,double,double)> partials_binary;
+
+    // Derivatives of functions and operators by the name they are registered
+    // under. Entries override the built-in rules, which cover the opcodes and
+    // the libm functions installed by init_def_funcs.
+    struct derivative_rules {
+        std::map<std::string, func_unary, std::less<>> funcs;
+        std::map<std::string, partials_binary, std::less<>> ops;
+    };
+
+    struct dual {
+        double value;
+        double deriv;
+    };
+
+    namespace detail {
+        // derivative rule resolved for one instruction of a compiled_expr
+        struct diff_rule {
+            compiled_expr::func_ptr func_ptr=nullptr;
+            const func_unary* func_obj=nullptr;
+            const partials_binary* op=nullptr;
+        };
+
+        std::vector<diff_rule> resolve_rules(const compiled_expr& expr, const derivative_rules* rules);
+    }
+
+    // Forward mode: propagates a dual number through the program, giving the
+    // value and one directional derivative per pass. Thread safe.
+    class forward_diff {
+    public:
+        explicit forward_diff(std::shared_ptr<const compiled_expr> expr,
+                              std::shared_ptr<const derivative_rules> rules = nullptr);
+
+        // direction holds one entry per slot
+        [[nodiscard]] dual eval(const double* slots, const double* direction) const;
+        // derivative with respect to a single slot
+        [[nodiscard]] dual eval(const double* slots, uint32_t slot) const;
+        [[nodiscard]] const std::shared_ptr<const compiled_expr>& get_expr() const noexcept{return m_expr;}
+    private:
+        std::shared_ptr<const compiled_expr> m_expr;
+        std::shared_ptr<const derivative_rules> m_rules;
+        std::vector<detail::diff_rule> m_rule;
+
+        template<typename Seed>
+        dual run(const double* slots, Seed seed) const;
+    };
+
+    // Reverse mode: one forward sweep records every node's value and local
+    // partials on a tape, one backward sweep accumulates the adjoints, giving
+    // the value and the full gradient. The tape is allocated once by the
+    // constructor, so gradient() does not allocate; use one instance per thread.
+    class reverse_diff {
+    public:
+        explicit reverse_diff(std::shared_ptr<const compiled_expr> expr,
+                              std::shared_ptr<const derivative_rules> rules = nullptr);
+
+        // grad receives d(value)/d(slot) for every slot; returns the value
+        double gradient(const double* slots, double* grad);
+        [[nodiscard]] const std::shared_ptr<const compiled_expr>& get_expr() const noexcept{return m_expr;}
+    private:
+        struct tape_entry {
+            int32_t lhs;
+            int32_t rhs;
+            int32_t addend;
+            double value;
+            double d_lhs;
+            double d_rhs;
+            double d_addend;
+            double adjoint;
+        };
+
+        std::shared_ptr<const compiled_expr> m_expr;
+        std::shared_ptr<const derivative_rules> m_rules;
+        std::vector<detail::diff_rule> m_rule;
+        std::vector<tape_entry> m_tape;
+    };
+
+} // meval
+
+#endif //MEVAL_DIFF_H
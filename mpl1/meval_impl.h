@@ -0,0 +1,1098 @@
+//
+// Template definitions of the expression engine. meval.cpp instantiates them
+// for float, double and long double; include this header to use the engine
+// with any other scalar type.
+//
+
+#ifndef MEVAL_IMPL_H
+#define MEVAL_IMPL_H
+
+#include "meval.h"
+#include "def_math.h"
+#include "meval_lexer.h"
+#include "meval_opt_impl.h"
+#include "meval_parse.h"
+#include "meval_stats.h"
+#include "meval_vecmath.h"
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <stack>
+#include <type_traits>
+
+namespace meval {
+    namespace detail {
+        // plain function pointer held by f, whether or not it was declared noexcept
+        template<typename R, typename... A>
+        R (*target_ptr(const std::function<R(A...)>& f))(A...) {
+            if (const auto p = f.template target<R(*)(A...)>())
+                return *p;
+            if (const auto p = f.template target<R(*)(A...) noexcept>())
+                return *p;
+            return nullptr;
+        }
+
+        // f(a...), or NaN where it throws, for the non-throwing evaluators
+        template<typename T, typename F, typename... A>
+        T nothrow_call(const F& f, const A... a) noexcept {
+            try {
+                return f(a...);
+            } catch (...) {
+                return std::numeric_limits<T>::quiet_NaN();
+            }
+        }
+    }
+
+    // Implementation of math_expr
+    template<typename T>
+    basic_math_expr<T>::basic_math_expr(const std::string& expr,
+                                        const std::shared_ptr<basic_var_map<T>>& vars,
+                                        const std::shared_ptr<basic_func_map<T>>& funcs,
+                                        const std::shared_ptr<basic_operator_map<T>>& ops,
+                                        const double epsilon)
+        : basic_math_expr(expr, vars, funcs, ops, compile_options{.level = opt_level::basic, .epsilon = epsilon}) {
+    }
+
+    template<typename T>
+    basic_math_expr<T>::basic_math_expr(const std::string& expr,
+                                        const std::shared_ptr<basic_var_map<T>>& vars,
+                                        const std::shared_ptr<basic_func_map<T>>& funcs,
+                                        const std::shared_ptr<basic_operator_map<T>>& ops,
+                                        const compile_options& options)
+        : m_expr(expr),
+          m_vars(vars),
+          m_funcs(funcs),
+          m_ops(ops),
+          m_epsilon(T(options.epsilon)),
+          m_options(options) {
+        //validate variable names
+        //validate function names
+        //validate operator names
+        m_expr = "("+m_expr+")";
+        std::string st{};
+        for (const auto& c : m_expr) {
+            if (c != ' ')
+                st+=c;
+        }
+        m_expr = st;
+        to_postfix(m_options.symbols.get());
+        compile();
+    }
+
+    template<typename T>
+    void basic_math_expr<T>::to_postfix(const symbol_tables* symbols) {
+        const auto tokens = tokenize(symbols);
+        detail::phase_timer timer(stats_phase::to_postfix);
+        const auto precedence = [this](const token& tok) {
+            const auto op = m_ops->find(tok.name);
+            if (op == m_ops->end())
+                throw meval_error("Unknown operator: " + std::string(tok.name),
+                    meval_error::error_type::unknown_operator, m_current_token_str_pos);
+            return op->second.second;
+        };
+        std::vector<token> stack;
+        detail::to_postfix(tokens, stack, m_postfix, precedence);
+    }
+
+    template<typename T>
+    T basic_math_expr<T>::eval() const {
+        return m_compiled->eval(m_slot_refs.data());
+    }
+
+    template<typename T>
+    T basic_math_expr<T>::eval(uint32_t& errors) const noexcept {
+        return m_compiled->eval(m_slot_refs.data(), errors);
+    }
+
+    template<typename T>
+    T basic_math_expr<T>::eval_postfix() const {
+        std::stack<T> ex;
+        T op1{},op2{};
+        for (const auto& tkn: m_postfix) {
+            switch (tkn.type) {
+                case token_type::number:
+                    ex.push(tkn.number);
+                break;
+                case token_type::variable:
+                    ex.push(m_vars->at(tkn.name));
+                break;
+                case token_type::function:
+                    op1 = ex.top();
+                    ex.pop();
+                    ex.push(m_funcs->at(tkn.name)(op1));
+                break;
+                case token_type::operator_binary:
+                    op2 = ex.top();
+                    ex.pop();
+                    op1 = ex.top();
+                    ex.pop();
+                    ex.push(m_ops->at(tkn.name).first(op1,op2,m_epsilon));
+                break;
+                case token_type::alternative: {
+                    const T otherwise = ex.top();
+                    ex.pop();
+                    op2 = ex.top();
+                    ex.pop();
+                    op1 = ex.top();
+                    ex.pop();
+                    ex.push(select(op1, op2, otherwise));
+                }
+                break;
+                default:
+                    throw meval_error("Unexpected token type in postfix expression",
+                        meval_error::error_type::invalid_expression);
+            }
+        }
+        if (ex.empty())
+            throw meval_error("Unexpected token type in postfix expression",
+                        meval_error::error_type::invalid_expression);
+        return ex.top();
+    }
+
+
+    template<typename T>
+    std::vector<std::span<const T>> basic_math_expr<T>::bind_columns(const basic_column_map<T>& columns) const {
+        const auto& names = m_compiled->slot_names();
+        std::vector<std::span<const T>> cols;
+        cols.reserve(names.size());
+        for (std::size_t i = 0; i < names.size(); i++) {
+            const auto col = columns.find(names[i]);
+            cols.push_back(col != columns.end() ? col->second : std::span<const T>(m_slot_refs[i], 1));
+        }
+        return cols;
+    }
+
+    template<typename T>
+    void basic_math_expr<T>::eval_batch(const basic_column_map<T>& columns, const std::span<T> out) const {
+        m_compiled->eval_batch(bind_columns(columns), out);
+    }
+
+    template<typename T>
+    void basic_math_expr<T>::eval_batch(const basic_column_map<T>& columns, const std::span<T> out,
+                                        const std::span<uint32_t> errors) const {
+        m_compiled->eval_batch(bind_columns(columns), out, errors);
+    }
+
+    // interns the symbols of the postfix into the tables of ce, see detail::emit
+    template<typename T>
+    struct basic_math_expr<T>::resolver {
+        basic_math_expr& expr;
+        basic_compiled_expr<T>& ce;
+        std::map<std::string_view, uint32_t> slots, funcs, ops;
+
+        static uint32_t intern(std::map<std::string_view, uint32_t>& ids, std::string_view name, auto& table,
+                               std::vector<std::string>& names, const auto& value) {
+            const auto [it, inserted] = ids.try_emplace(name, static_cast<uint32_t>(table.size()));
+            if (inserted) {
+                table.push_back(value);
+                names.emplace_back(name);
+            }
+            return it->second;
+        }
+        [[nodiscard]] std::string_view name(const token& tkn) const {return tkn.name;}
+        uint32_t variable(const token& tkn) {
+            const auto var = expr.m_vars->find(tkn.name);
+            if (var == expr.m_vars->end())
+                throw meval_error("Unknown variable: " + std::string(tkn.name),
+                    meval_error::error_type::unknown_variable);
+            const auto [it, inserted] = slots.try_emplace(tkn.name, static_cast<uint32_t>(ce.m_slots.size()));
+            if (inserted) {
+                ce.m_slots.emplace_back(tkn.name);
+                expr.m_slot_refs.push_back(&var->second);
+            }
+            return it->second;
+        }
+        instruction function(const token& tkn) {
+            const auto fn = expr.m_funcs->find(tkn.name);
+            if (fn == expr.m_funcs->end())
+                throw meval_error("Unknown function: " + std::string(tkn.name),
+                    meval_error::error_type::unknown_function);
+            if (const auto ptr = detail::target_ptr(fn->second))
+                return {opcode::call_func, intern(funcs, tkn.name, ce.m_func_ptrs, ce.m_func_ptr_names, ptr)};
+            return {opcode::call_func_obj, intern(funcs, tkn.name, ce.m_func_objs, ce.m_func_obj_names, fn->second)};
+        }
+        std::pair<instruction, bool> operator_binary(const token& tkn) {
+            const auto op = expr.m_ops->find(tkn.name);
+            if (op == expr.m_ops->end())
+                throw meval_error("Unknown operator: " + std::string(tkn.name),
+                    meval_error::error_type::unknown_operator);
+            const auto ptr = detail::target_ptr(op->second.first);
+            instruction in{detail::binary_opcode<T>(ptr), 0};
+            // comparisons have no domain errors to report
+            const auto& errors = expr.m_options.errors;
+            const bool flags = errors && in.op <= opcode::pow && errors->mode_of(tkn.name) == domain_mode::flag;
+            if (in.op == opcode::call_op)
+                in.arg = intern(ops, tkn.name, ce.m_op_ptrs, ce.m_op_ptr_names, ptr);
+            else if (in.op == opcode::call_op_obj)
+                in.arg = intern(ops, tkn.name, ce.m_op_objs, ce.m_op_obj_names, op->second.first);
+            return {in, flags};
+        }
+    };
+
+    template<typename T>
+    void basic_math_expr<T>::compile() {
+        detail::phase_timer timer(stats_phase::compile);
+        basic_compiled_expr<T> ce;
+        ce.m_epsilon = m_epsilon;
+        m_slot_refs.clear();
+        resolver resolve{*this, ce, {}, {}, {}};
+        // a builtin opcode reports its errors if any name it was reached through does
+        std::array<domain_mode, 6> builtin_modes;
+        builtin_modes.fill(m_options.errors ? domain_mode::propagate : domain_mode::flag);
+        ce.m_max_stack = detail::emit(m_postfix, ce.m_code, ce.m_consts, builtin_modes, resolve);
+        if (m_options.level != opt_level::none) {
+            std::vector<std::optional<T>> immutable(ce.m_slots.size());
+            if (m_options.consts) {
+                for (std::size_t i = 0; i < immutable.size(); i++) {
+                    if (m_options.consts->contains(ce.m_slots[i]))
+                        immutable[i] = *m_slot_refs[i];
+                }
+            }
+            const auto remap = basic_expr_rewriter<T>::optimize(ce, m_options.level, immutable,
+                                                                    m_options.fast_math);
+            std::vector<const T*> refs(ce.m_slots.size());
+            for (std::size_t i = 0; i < remap.size(); i++) {
+                if (remap[i] >= 0)
+                    refs[remap[i]] = m_slot_refs[i];
+            }
+            m_slot_refs = std::move(refs);
+        }
+        ce.finalize(m_options.errors.get(), builtin_modes, m_options.vector_math);
+        m_compiled = std::make_shared<const basic_compiled_expr<T>>(std::move(ce));
+    }
+
+    // Implementation of var_binding
+    template<typename T>
+    basic_var_binding<T>::basic_var_binding(std::shared_ptr<const basic_compiled_expr<T>> expr)
+        : m_expr(std::move(expr)),
+          m_slots(m_expr->slot_names().size(), T(0)) {
+    }
+
+    template<typename T>
+    basic_var_binding<T>::basic_var_binding(std::shared_ptr<const basic_compiled_expr<T>> expr,
+                                            const basic_var_map<T>& initial)
+        : basic_var_binding(std::move(expr)) {
+        const auto& names = m_expr->slot_names();
+        for (std::size_t i = 0; i < names.size(); i++) {
+            if (const auto v = initial.find(names[i]); v != initial.end())
+                m_slots[i] = v->second;
+        }
+    }
+
+    template<typename T>
+    int32_t basic_var_binding<T>::slot_of(const std::string_view name) const noexcept {
+        const auto& names = m_expr->slot_names();
+        const auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? -1 : static_cast<int32_t>(it - names.begin());
+    }
+
+    template<typename T>
+    void basic_var_binding<T>::set(const std::string_view name, const T value) {
+        const auto slot = slot_of(name);
+        if (slot < 0)
+            throw meval_error("Variable not used by expression: " + std::string(name),
+                meval_error::error_type::unknown_variable);
+        m_slots[slot] = value;
+    }
+
+    template<typename T>
+    T basic_var_binding<T>::get(const std::string_view name) const {
+        const auto slot = slot_of(name);
+        if (slot < 0)
+            throw meval_error("Variable not used by expression: " + std::string(name),
+                meval_error::error_type::unknown_variable);
+        return m_slots[slot];
+    }
+
+    // Implementation of compiled_expr
+    template<typename T>
+    domain_mode basic_compiled_expr<T>::fused_mode(const opcode op, const std::array<domain_mode, 6>& builtin) noexcept {
+        // a fused opcode reports errors if any operator it was made from does
+        enum : uint32_t { a = 1, s = 2, m = 4, d = 8, p = 32 };
+        uint32_t from = 0;
+        switch (op) {
+            case opcode::square: from = m | p; break;
+            case opcode::recip: from = d | p; break;
+            case opcode::sqrt: from = p; break;
+            case opcode::powi: from = m | p; break;
+            case opcode::hypot: from = a | m | p; break;
+            case opcode::fma: from = a | s | m; break;
+            default: break;
+        }
+        for (std::size_t i = 0; i < builtin.size(); i++) {
+            if ((from >> i & 1) && builtin[i] == domain_mode::flag)
+                return domain_mode::flag;
+        }
+        return domain_mode::propagate;
+    }
+
+    template<typename T>
+    void basic_compiled_expr<T>::finalize(const error_policy* const policy,
+                                          const std::array<domain_mode, 6>& builtin, const bool vector_math) {
+        const auto table_size = [this](const opcode op) -> std::size_t {
+            switch (op) {
+                case opcode::push_const: return m_consts.size();
+                case opcode::push_var: return m_slots.size();
+                case opcode::call_func: return m_func_ptrs.size();
+                case opcode::call_func_obj: return m_func_objs.size();
+                case opcode::call_op: return m_op_ptrs.size();
+                case opcode::call_op_obj: return m_op_objs.size();
+                case opcode::powi: return 65;
+                default: return 1;
+            }
+        };
+        m_flagged.assign(m_code.size(), 0);
+        m_has_select = false;
+        bool may_raise = false;
+        if constexpr (stats_enabled)
+            m_counters.assign(m_code.size(), nullptr);
+        uint32_t depth = 0;
+        uint32_t max_depth = 0;
+        for (std::size_t k = 0; k < m_code.size(); k++) {
+            const auto& in = m_code[k];
+            const auto n = operand_count(in.op);
+            if (in.op > opcode::select || in.arg >= table_size(in.op) || depth < n)
+                throw meval_error("Invalid: malformed compiled program",
+                    meval_error::error_type::invalid_expression);
+            depth = depth + 1 - n;
+            max_depth = std::max(max_depth, depth);
+            m_has_select |= in.op == opcode::select;
+            if (n == 0)
+                continue;
+            may_raise |= in.op == opcode::div || in.op == opcode::recip || !basic_expr_rewriter<T>::is_pure(*this, in);
+            domain_mode mode = domain_mode::flag;
+            if (in.op >= opcode::add && in.op <= opcode::pow)
+                mode = builtin[static_cast<std::size_t>(in.op) - static_cast<std::size_t>(opcode::add)];
+            else if (in.op >= opcode::call_func && in.op <= opcode::call_op_obj && policy)
+                mode = policy->mode_of(callable_name(in));
+            else if (in.op > opcode::call_op_obj)
+                mode = fused_mode(in.op, builtin);
+            m_flagged[k] = mode == domain_mode::flag;
+            if constexpr (stats_enabled) {
+                if (in.op >= opcode::call_func && in.op <= opcode::call_op_obj)
+                    m_counters[k] = detail::callable_counter(callable_name(in));
+            }
+        }
+        if (depth != 1 || max_depth > m_max_stack)
+            throw meval_error("Invalid: malformed compiled program",
+                meval_error::error_type::invalid_expression);
+        m_select_may_raise = m_has_select && may_raise;
+        // the kernels exist for the double overloads of the built-ins only
+        m_vector_math = vector_math;
+        m_array_ptrs.assign(m_func_ptrs.size(), nullptr);
+        if constexpr (std::is_same_v<T, double>) {
+            if (vector_math) {
+                for (std::size_t i = 0; i < m_func_ptrs.size(); i++)
+                    m_array_ptrs[i] = find_array_kernel(m_func_ptrs[i]);
+            }
+        }
+    }
+
+    template<typename T>
+    template<bool Masked, bool Selective, typename Load>
+    T basic_compiled_expr<T>::run(Load load, uint32_t& errors, std::exception_ptr* const thrown) const
+        noexcept(Masked) {
+        static_assert(Masked || !Selective);
+        constexpr uint32_t local_stack = 32;
+        T local[local_stack]{};
+        // With Selective, the errors behind each stack entry, so that a select
+        // passes on those of the operand it picks only; otherwise every error
+        // reaches the result and one mask gathers them.
+        uint32_t local_mask[Selective ? local_stack : 1];
+        local_mask[0] = eval_ok;
+        std::vector<T> heap;
+        std::conditional_t<Selective, std::vector<uint32_t>, std::nullptr_t> heap_mask{};
+        // per stack entry marked raised_exception, what was thrown
+        std::conditional_t<Selective, std::vector<std::exception_ptr>, std::nullptr_t> why{};
+        T* st = local;
+        uint32_t* mask = local_mask;
+        if (m_max_stack > local_stack) {
+            heap.resize(m_max_stack);
+            st = heap.data();
+            if constexpr (Selective) {
+                heap_mask.resize(m_max_stack);
+                mask = heap_mask.data();
+            }
+        }
+        const auto mask_of = [mask](const uint32_t pos) -> uint32_t& { return mask[Selective ? pos : 0]; };
+        [[maybe_unused]] const detail::latency_timer latency(false);
+        // the stack shape was validated by finalize, so no checks here
+        uint32_t top = 0;
+        // the entry at dst takes on the errors of the one at src
+        const auto merge = [&](const uint32_t dst, const uint32_t src) {
+            if constexpr (Selective) {
+                if (mask[src] & ~mask[dst] & raised_exception)
+                    why[dst] = why[src];
+                mask[dst] |= mask[src];
+            }
+        };
+        // store the result r of instruction k over the operands on top of the stack
+        const auto unary = [&](const std::size_t k, const T r) {
+            if constexpr (Masked) {
+                if (m_flagged[k])
+                    mask_of(top - 1) |= detail::domain_errors(r, st[top - 1], st[top - 1]);
+            }
+            st[top - 1] = r;
+        };
+        const auto binary = [&](const std::size_t k, const T r) {
+            merge(top - 1, top);
+            if constexpr (Masked) {
+                if (m_flagged[k])
+                    mask_of(top - 1) |= detail::domain_errors(r, st[top - 1], st[top]);
+            }
+            st[top - 1] = r;
+        };
+        // under Masked a callable that throws yields NaN, reported as a domain
+        // error, and what it threw is kept for thrown
+        const auto call = [&](const auto& f, const auto... a) -> T {
+            if constexpr (Masked) {
+                try {
+                    return f(a...);
+                } catch (...) {
+                    if constexpr (Selective) {
+                        if (thrown && !(mask[top - 1] & raised_exception)) {
+                            why.resize(m_max_stack);
+                            why[top - 1] = std::current_exception();
+                            mask[top - 1] |= raised_exception;
+                        }
+                    }
+                    return std::numeric_limits<T>::quiet_NaN();
+                }
+            } else {
+                return f(a...);
+            }
+        };
+        for (std::size_t k = 0; k < m_code.size(); k++) {
+            const auto& in = m_code[k];
+            [[maybe_unused]] const auto timer = time_instruction(k, 1);
+            switch (in.op) {
+                case opcode::push_const:
+                    if constexpr (Selective)
+                        mask[top] = eval_ok;
+                    st[top++] = m_consts[in.arg];
+                    break;
+                case opcode::push_var:
+                    if constexpr (Selective)
+                        mask[top] = eval_ok;
+                    st[top++] = load(in.arg);
+                    break;
+                case opcode::add:
+                    --top;
+                    binary(k, st[top - 1] + st[top]);
+                    break;
+                case opcode::sub:
+                    --top;
+                    binary(k, st[top - 1] - st[top]);
+                    break;
+                case opcode::mul:
+                    --top;
+                    binary(k, st[top - 1] * st[top]);
+                    break;
+                case opcode::div:
+                    --top;
+                    if constexpr (Masked) {
+                        using std::fabs;
+                        if (fabs(st[top]) < m_epsilon) {
+                            merge(top - 1, top);
+                            mask_of(top - 1) |= raised_div | (m_flagged[k] ? eval_div_by_zero : eval_ok);
+                            st[top - 1] = st[top - 1] / st[top];
+                        } else {
+                            binary(k, st[top - 1] / st[top]);
+                        }
+                    } else {
+                        st[top - 1] = div(st[top - 1], st[top], m_epsilon);
+                    }
+                    break;
+                case opcode::mod:
+                    --top;
+                    binary(k, mod(st[top - 1], st[top], m_epsilon));
+                    break;
+                case opcode::pow:
+                    --top;
+                    binary(k, pow(st[top - 1], st[top], m_epsilon));
+                    break;
+                case opcode::call_func:
+                    unary(k, call(m_func_ptrs[in.arg], st[top - 1]));
+                    break;
+                case opcode::call_func_obj:
+                    unary(k, call(m_func_objs[in.arg], st[top - 1]));
+                    break;
+                case opcode::call_op:
+                    --top;
+                    binary(k, call(m_op_ptrs[in.arg], st[top - 1], st[top], m_epsilon));
+                    break;
+                case opcode::call_op_obj:
+                    --top;
+                    binary(k, call(m_op_objs[in.arg], st[top - 1], st[top], m_epsilon));
+                    break;
+                case opcode::square:
+                    unary(k, square(st[top - 1]));
+                    break;
+                case opcode::recip:
+                    if constexpr (Masked) {
+                        using std::fabs;
+                        if (fabs(st[top - 1]) < m_epsilon) {
+                            mask_of(top - 1) |= raised_div | (m_flagged[k] ? eval_div_by_zero : eval_ok);
+                            st[top - 1] = T(1) / st[top - 1];
+                        } else {
+                            unary(k, T(1) / st[top - 1]);
+                        }
+                    } else {
+                        st[top - 1] = recip(st[top - 1], m_epsilon);
+                    }
+                    break;
+                case opcode::sqrt:
+                    unary(k, fused_sqrt(st[top - 1]));
+                    break;
+                case opcode::powi:
+                    unary(k, powi(st[top - 1], in.arg));
+                    break;
+                case opcode::hypot:
+                    --top;
+                    binary(k, fused_hypot(st[top - 1], st[top]));
+                    break;
+                case opcode::fma: {
+                    top -= 2;
+                    const T r = fused_fma(st[top - 1], st[top], st[top + 1]);
+                    merge(top - 1, top);
+                    merge(top - 1, top + 1);
+                    if constexpr (Masked) {
+                        if (m_flagged[k])
+                            mask_of(top - 1) |= detail::domain_errors(r, st[top - 1], st[top]) &
+                                             detail::domain_errors(r, st[top + 1], st[top + 1]);
+                    }
+                    st[top - 1] = r;
+                    break;
+                }
+                case opcode::lt:
+                    --top;
+                    merge(top - 1, top);
+                    st[top - 1] = lt(st[top - 1], st[top]);
+                    break;
+                case opcode::le:
+                    --top;
+                    merge(top - 1, top);
+                    st[top - 1] = le(st[top - 1], st[top]);
+                    break;
+                case opcode::gt:
+                    --top;
+                    merge(top - 1, top);
+                    st[top - 1] = gt(st[top - 1], st[top]);
+                    break;
+                case opcode::ge:
+                    --top;
+                    merge(top - 1, top);
+                    st[top - 1] = ge(st[top - 1], st[top]);
+                    break;
+                case opcode::eq:
+                    --top;
+                    merge(top - 1, top);
+                    st[top - 1] = eq(st[top - 1], st[top]);
+                    break;
+                case opcode::ne:
+                    --top;
+                    merge(top - 1, top);
+                    st[top - 1] = ne(st[top - 1], st[top]);
+                    break;
+                case opcode::select:
+                    // the condition's errors and those of the operand picked
+                    top -= 2;
+                    merge(top - 1, st[top - 1] != T(0) ? top : top + 1);
+                    st[top - 1] = select(st[top - 1], st[top], st[top + 1]);
+                    break;
+            }
+        }
+        if constexpr (Masked) {
+            errors |= mask[0];
+            if constexpr (Selective) {
+                if (thrown && (mask[0] & raised_exception))
+                    *thrown = why[0];
+            }
+        }
+        return st[0];
+    }
+
+    template<typename T>
+    template<typename Load>
+    T basic_compiled_expr<T>::run_raising(Load load) const {
+        uint32_t errors = eval_ok;
+        // without a select every error reaches the result, so the first one is thrown where it happens
+        if (!m_select_may_raise)
+            return run<false, false>(load, errors, nullptr);
+        std::exception_ptr thrown;
+        const T r = run<true, true>(load, errors, &thrown);
+        if (thrown)
+            std::rethrow_exception(thrown);
+        if (errors & raised_div)
+            throw std::runtime_error("Division by zero");
+        return r;
+    }
+
+    template<typename T>
+    detail::instruction_timer basic_compiled_expr<T>::time_instruction(const std::size_t k,
+                                                                       const uint64_t rows) const noexcept {
+        if constexpr (stats_enabled)
+            return detail::instruction_timer(m_code[k].op, m_counters[k], rows);
+        else
+            return detail::instruction_timer(m_code[k].op, nullptr, rows);
+    }
+
+    template<typename T>
+    std::string_view basic_compiled_expr<T>::callable_name(const instruction& in) const noexcept {
+        switch (in.op) {
+            case opcode::call_func:
+                return m_func_ptr_names[in.arg];
+            case opcode::call_func_obj:
+                return m_func_obj_names[in.arg];
+            case opcode::call_op:
+                return m_op_ptr_names[in.arg];
+            case opcode::call_op_obj:
+                return m_op_obj_names[in.arg];
+            default:
+                return {};
+        }
+    }
+
+    template<typename T>
+    T basic_compiled_expr<T>::eval(const T* slots) const {
+        return run_raising([slots](const uint32_t i) { return slots[i]; });
+    }
+
+    template<typename T>
+    T basic_compiled_expr<T>::eval(const T* const* slot_refs) const {
+        return run_raising([slot_refs](const uint32_t i) { return *slot_refs[i]; });
+    }
+
+    template<typename T>
+    T basic_compiled_expr<T>::eval(const T* slots, uint32_t& errors) const noexcept {
+        uint32_t found = eval_ok;
+        const auto load = [slots](const uint32_t i) { return slots[i]; };
+        const T r = m_has_select ? run<true, true>(load, found, nullptr) : run<true, false>(load, found, nullptr);
+        errors |= found & reported;
+        return r;
+    }
+
+    template<typename T>
+    T basic_compiled_expr<T>::eval(const T* const* slot_refs, uint32_t& errors) const noexcept {
+        uint32_t found = eval_ok;
+        const auto load = [slot_refs](const uint32_t i) { return *slot_refs[i]; };
+        const T r = m_has_select ? run<true, true>(load, found, nullptr) : run<true, false>(load, found, nullptr);
+        errors |= found & reported;
+        return r;
+    }
+
+    template<typename T>
+    void basic_compiled_expr<T>::eval_batch(const std::span<const std::span<const T>> columns,
+                                            const std::span<T> out) const {
+        run_batch<false>(columns, out, {});
+    }
+
+    template<typename T>
+    void basic_compiled_expr<T>::eval_batch(const std::span<const std::span<const T>> columns,
+                                            const std::span<T> out, const std::span<uint32_t> errors) const {
+        run_batch<true>(columns, out, errors);
+    }
+
+    template<typename T>
+    template<bool Masked>
+    void basic_compiled_expr<T>::run_batch(const std::span<const std::span<const T>> columns,
+                                           const std::span<T> out, const std::span<uint32_t> errors) const {
+        if (columns.size() != m_slots.size())
+            throw meval_error("Expected " + std::to_string(m_slots.size()) + " columns, got " +
+                              std::to_string(columns.size()),
+                              meval_error::error_type::invalid_argument);
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].size() != 1 && columns[i].size() < out.size())
+                throw meval_error("Column for $" + m_slots[i] + " is shorter than the output",
+                                  meval_error::error_type::invalid_argument);
+        }
+        if (!errors.empty() && errors.size() != out.size())
+            throw meval_error("Expected " + std::to_string(out.size()) + " error masks, got " +
+                              std::to_string(errors.size()),
+                              meval_error::error_type::invalid_argument);
+        [[maybe_unused]] const detail::latency_timer latency(true);
+        // one scratch block per stack position; stack entries point either into
+        // scratch or straight into an input column
+        using std::fabs;
+        std::vector<T> scratch(static_cast<std::size_t>(m_max_stack) * batch_block);
+        std::vector<const T*> st(m_max_stack);
+        const auto reg = [&scratch](const uint32_t pos) { return scratch.data() + pos * batch_block; };
+        // Per stack position and row, the errors behind the entry, as the masks
+        // of run. They are kept for rows that report errors and, when a select
+        // may drop some, for the throwing path, which raises the errors that
+        // reach the result only.
+        const bool track = Masked ? !errors.empty() : m_select_may_raise;
+        // without a select every error reaches the result, and one mask per row gathers them
+        const bool selective = track && m_has_select;
+        std::vector<uint32_t> masks(track ? (selective ? m_max_stack : 1) * batch_block : 0);
+        std::vector<std::exception_ptr> why;  // by masks entry marked raised_exception
+        const auto msk = [&masks, selective](const uint32_t pos) {
+            return masks.data() + (selective ? pos : 0) * batch_block;
+        };
+        for (std::size_t row = 0; row < out.size(); row += batch_block) {
+            const std::size_t n = std::min(batch_block, out.size() - row);
+            uint32_t top = 0;
+            if (track && !selective)
+                std::fill_n(masks.data(), n, eval_ok);
+            // the entry at dst takes on the errors of the one at src
+            const auto merge = [&](const uint32_t dst, const uint32_t src) {
+                if (!selective)
+                    return;
+                uint32_t* const d = msk(dst);
+                const uint32_t* const s = msk(src);
+                if (!why.empty()) {
+                    for (std::size_t i = 0; i < n; i++) {
+                        if (s[i] & ~d[i] & raised_exception)
+                            why[dst * batch_block + i] = why[src * batch_block + i];
+                    }
+                }
+                for (std::size_t i = 0; i < n; i++)
+                    d[i] |= s[i];
+            };
+            // f(a...) for row i of the entry at pos; a callable that throws
+            // yields NaN there when the errors are tracked or masked
+            const auto call = [&](const uint32_t pos, const std::size_t i, const auto& f, const auto... a) -> T {
+                if (!Masked && !track)
+                    return f(a...);
+                try {
+                    return f(a...);
+                } catch (...) {
+                    if (!Masked && !(msk(pos)[i] & raised_exception)) {
+                        why.resize(masks.size());
+                        why[pos * batch_block + i] = std::current_exception();
+                        msk(pos)[i] |= raised_exception;
+                    }
+                    return std::numeric_limits<T>::quiet_NaN();
+                }
+            };
+            for (std::size_t k = 0; k < m_code.size(); k++) {
+                const auto& in = m_code[k];
+                [[maybe_unused]] const auto timer = time_instruction(k, n);
+                const auto arity = operand_count(in.op);
+                // results go to the lowest operand's position, whose mask
+                // gathers those of the others; a select picks per row
+                const uint32_t pos = top - arity;
+                if (selective && arity > 1 && in.op != opcode::select) {
+                    for (uint32_t j = 1; j < arity; j++)
+                        merge(pos, pos + j);
+                }
+                uint32_t* const mask = track ? msk(pos) : nullptr;
+                const bool report = Masked && track && m_flagged[k];
+                // dst may alias an operand, so each result is checked before it is stored
+                const auto apply_unary = [&](T* const dst, const T* a, const auto& f) {
+                    if (report) {
+                        for (std::size_t i = 0; i < n; i++) {
+                            const T r = f(i, a[i]);
+                            mask[i] |= detail::domain_errors(r, a[i], a[i]);
+                            dst[i] = r;
+                        }
+                    } else {
+                        for (std::size_t i = 0; i < n; i++)
+                            dst[i] = f(i, a[i]);
+                    }
+                };
+                switch (in.op) {
+                    case opcode::push_const:
+                        std::fill_n(reg(top), n, m_consts[in.arg]);
+                        st[top] = reg(top);
+                        if (selective)
+                            std::fill_n(msk(top), n, eval_ok);
+                        top++;
+                        continue;
+                    case opcode::push_var: {
+                        const auto& col = columns[in.arg];
+                        if (col.size() == 1) {
+                            std::fill_n(reg(top), n, col[0]);
+                            st[top] = reg(top);
+                        } else {
+                            st[top] = col.data() + row;
+                        }
+                        if (selective)
+                            std::fill_n(msk(top), n, eval_ok);
+                        top++;
+                        continue;
+                    }
+                    case opcode::call_func: {
+                        T* const dst = reg(pos);
+                        const T* a = st[pos];
+                        if (const auto kernel = m_array_ptrs[in.arg]; kernel && report) {
+                            // dst may be a, whose values the checks still need
+                            T r[batch_block];
+                            kernel(a, r, n);
+                            for (std::size_t i = 0; i < n; i++) {
+                                mask[i] |= detail::domain_errors(r[i], a[i], a[i]);
+                                dst[i] = r[i];
+                            }
+                        } else if (kernel) {
+                            kernel(a, dst, n);
+                        } else {
+                            const auto fn = m_func_ptrs[in.arg];
+                            apply_unary(dst, a, [&](const std::size_t i, const T x) { return call(pos, i, fn, x); });
+                        }
+                        st[pos] = dst;
+                        continue;
+                    }
+                    case opcode::call_func_obj: {
+                        T* const dst = reg(pos);
+                        const auto& fn = m_func_objs[in.arg];
+                        apply_unary(dst, st[pos], [&](const std::size_t i, const T x) { return call(pos, i, fn, x); });
+                        st[pos] = dst;
+                        continue;
+                    }
+                    case opcode::square:
+                    case opcode::sqrt:
+                    case opcode::powi: {
+                        T* const dst = reg(pos);
+                        if (in.op == opcode::square)
+                            apply_unary(dst, st[pos], [](std::size_t, const T x) { return x * x; });
+                        else if (in.op == opcode::sqrt)
+                            apply_unary(dst, st[pos], [](std::size_t, const T x) { return fused_sqrt(x); });
+                        else
+                            apply_unary(dst, st[pos], [n = in.arg](std::size_t, const T x) { return powi(x, n); });
+                        st[pos] = dst;
+                        continue;
+                    }
+                    case opcode::recip: {
+                        T* const dst = reg(pos);
+                        const T* a = st[pos];
+                        if (track) {
+                            for (std::size_t i = 0; i < n; i++) {
+                                const T r = T(1) / a[i];
+                                if (fabs(a[i]) < m_epsilon)
+                                    mask[i] |= raised_div | (report ? eval_div_by_zero : eval_ok);
+                                else if (report)
+                                    mask[i] |= detail::domain_errors(r, a[i], a[i]);
+                                dst[i] = r;
+                            }
+                            st[pos] = dst;
+                            continue;
+                        }
+                        if constexpr (!Masked) {
+                            bool near_zero = false;
+                            for (std::size_t i = 0; i < n; i++)
+                                near_zero |= fabs(a[i]) < m_epsilon;
+                            if (near_zero)
+                                throw std::runtime_error("Division by zero");
+                        }
+                        for (std::size_t i = 0; i < n; i++)
+                            dst[i] = T(1) / a[i];
+                        st[pos] = dst;
+                        continue;
+                    }
+                    case opcode::fma: {
+                        T* const dst = reg(pos);
+                        const T* a = st[pos];
+                        const T* b = st[pos + 1];
+                        const T* c = st[pos + 2];
+                        if (report) {
+                            for (std::size_t i = 0; i < n; i++) {
+                                const T r = fused_fma(a[i], b[i], c[i]);
+                                mask[i] |= detail::domain_errors(r, a[i], b[i]) & detail::domain_errors(r, c[i], c[i]);
+                                dst[i] = r;
+                            }
+                        } else {
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = fused_fma(a[i], b[i], c[i]);
+                        }
+                        st[pos] = dst;
+                        top -= 2;
+                        continue;
+                    }
+                    case opcode::select: {
+                        // a blend, which vectorizes, not a branch per row
+                        T* const dst = reg(pos);
+                        const T* c = st[pos];
+                        const T* a = st[pos + 1];
+                        const T* b = st[pos + 2];
+                        if (track) {
+                            // the condition's errors and those of the operand picked
+                            const uint32_t* const ma = msk(pos + 1);
+                            const uint32_t* const mb = msk(pos + 2);
+                            for (std::size_t i = 0; i < n; i++) {
+                                const bool first = c[i] != T(0);
+                                const uint32_t from = first ? pos + 1 : pos + 2;
+                                if (!why.empty() && ((first ? ma : mb)[i] & ~mask[i] & raised_exception))
+                                    why[pos * batch_block + i] = why[from * batch_block + i];
+                                mask[i] |= first ? ma[i] : mb[i];
+                            }
+                        }
+                        for (std::size_t i = 0; i < n; i++)
+                            dst[i] = select(c[i], a[i], b[i]);
+                        st[pos] = dst;
+                        top -= 2;
+                        continue;
+                    }
+                    default:
+                        break;
+                }
+                T* const dst = reg(pos);
+                const T* a = st[pos];
+                const T* b = st[pos + 1];
+                const auto apply = [&](const auto& f) {
+                    if (report) {
+                        for (std::size_t i = 0; i < n; i++) {
+                            const T r = f(i, a[i], b[i]);
+                            mask[i] |= detail::domain_errors(r, a[i], b[i]);
+                            dst[i] = r;
+                        }
+                    } else {
+                        for (std::size_t i = 0; i < n; i++)
+                            dst[i] = f(i, a[i], b[i]);
+                    }
+                };
+                switch (in.op) {
+                    case opcode::add:
+                        apply([](std::size_t, const T x, const T y) { return x + y; });
+                        break;
+                    case opcode::sub:
+                        apply([](std::size_t, const T x, const T y) { return x - y; });
+                        break;
+                    case opcode::mul:
+                        apply([](std::size_t, const T x, const T y) { return x * y; });
+                        break;
+                    case opcode::div:
+                        if (track) {
+                            for (std::size_t i = 0; i < n; i++) {
+                                const T r = a[i] / b[i];
+                                if (fabs(b[i]) < m_epsilon)
+                                    mask[i] |= raised_div | (report ? eval_div_by_zero : eval_ok);
+                                else if (report)
+                                    mask[i] |= detail::domain_errors(r, a[i], b[i]);
+                                dst[i] = r;
+                            }
+                            break;
+                        }
+                        if constexpr (!Masked) {
+                            bool near_zero = false;
+                            for (std::size_t i = 0; i < n; i++)
+                                near_zero |= fabs(b[i]) < m_epsilon;
+                            if (near_zero)
+                                throw std::runtime_error("Division by zero");
+                        }
+                        for (std::size_t i = 0; i < n; i++)
+                            dst[i] = a[i] / b[i];
+                        break;
+                    case opcode::mod:
+                        apply([this](std::size_t, const T x, const T y) { return mod(x, y, m_epsilon); });
+                        break;
+                    case opcode::pow:
+                        apply([this](std::size_t, const T x, const T y) { return pow(x, y, m_epsilon); });
+                        break;
+                    case opcode::call_op: {
+                        const auto fn = m_op_ptrs[in.arg];
+                        apply([&](const std::size_t i, const T x, const T y) {
+                            return call(pos, i, fn, x, y, m_epsilon);
+                        });
+                        break;
+                    }
+                    case opcode::call_op_obj: {
+                        const auto& fn = m_op_objs[in.arg];
+                        apply([&](const std::size_t i, const T x, const T y) {
+                            return call(pos, i, fn, x, y, m_epsilon);
+                        });
+                        break;
+                    }
+                    case opcode::hypot:
+                        apply([](std::size_t, const T x, const T y) { return fused_hypot(x, y); });
+                        break;
+                    case opcode::lt:
+                        apply([](std::size_t, const T x, const T y) { return lt(x, y); });
+                        break;
+                    case opcode::le:
+                        apply([](std::size_t, const T x, const T y) { return le(x, y); });
+                        break;
+                    case opcode::gt:
+                        apply([](std::size_t, const T x, const T y) { return gt(x, y); });
+                        break;
+                    case opcode::ge:
+                        apply([](std::size_t, const T x, const T y) { return ge(x, y); });
+                        break;
+                    case opcode::eq:
+                        apply([](std::size_t, const T x, const T y) { return eq(x, y); });
+                        break;
+                    case opcode::ne:
+                        apply([](std::size_t, const T x, const T y) { return ne(x, y); });
+                        break;
+                    default:
+                        break;
+                }
+                st[pos] = dst;
+                top--;
+            }
+            if (track && Masked) {
+                for (std::size_t i = 0; i < n; i++)
+                    errors[row + i] = msk(0)[i] & reported;
+            } else if (track) {
+                for (std::size_t i = 0; i < n; i++) {
+                    if (msk(0)[i] & raised_exception)
+                        std::rethrow_exception(why[i]);
+                    if (msk(0)[i] & raised_div)
+                        throw std::runtime_error("Division by zero");
+                }
+            }
+            std::copy_n(st[0], n, out.data() + row);
+        }
+    }
+
+    template<typename T>
+    std::vector<typename basic_math_expr<T>::token> basic_math_expr<T>::tokenize(const symbol_tables* symbols) {
+        detail::phase_timer timer(stats_phase::tokenize);
+        reset_token_str_pos();
+        const std::string_view src(m_expr);
+        std::vector<token> tokens;
+        tokens.reserve(src.size());
+        // names are matched against the tries when given, else against the maps
+        struct lexicon {
+            const basic_math_expr& expr;
+            const symbol_tables* symbols;
+
+            static std::size_t read(const token_type type, const std::string_view name, token& tok) {
+                tok = {type, T(0), name};
+                return name.size();
+            }
+            std::size_t variable(const std::string_view text, token& tok) const {
+                return read(token_type::variable,
+                            symbols ? symbols->vars.longest_match(text) : longest_key(*expr.m_vars, text), tok);
+            }
+            std::size_t function(const std::string_view text, token& tok) const {
+                return read(token_type::function,
+                            symbols ? symbols->funcs.longest_match(text) : longest_key(*expr.m_funcs, text), tok);
+            }
+            std::size_t operator_binary(const std::string_view text, token& tok) const {
+                return read(token_type::operator_binary,
+                            symbols ? symbols->ops.longest_match(text) : longest_key(*expr.m_ops, text), tok);
+            }
+        } lex{*this, symbols};
+        detail::tokenize(src, tokens, m_current_token_str_pos, lex);
+        return tokens;
+    }
+
+    template<typename T>
+    void basic_math_expr<T>::reset_token_str_pos() {
+        m_current_token_str_pos = 0;
+    }
+
+    template<typename T>
+    typename basic_math_expr<T>::token_type basic_math_expr<T>::get_token_type(std::string_view token) const {
+        if (token.empty()) return token_type::eof;
+        auto tk_symbol = token[0];
+        if (tk_symbol == sym_func_start) return token_type::function;
+        if (tk_symbol == sym_var_start) return token_type::variable;
+        if (std::isdigit(tk_symbol) || (tk_symbol == '.')) return token_type::number;
+        if (tk_symbol == bracket.first) return token_type::open_bracket;
+        if (tk_symbol == bracket.second) return token_type::close_bracket;
+        if (tk_symbol == ternary.first) return token_type::conditional;
+        if (tk_symbol == ternary.second) return token_type::alternative;
+
+        if (m_ops->contains(token)) {
+            return token_type::operator_binary;
+        }
+        throw meval_error("Unknown token: " + std::string(token),
+                          meval_error::error_type::unknown_token,
+                          m_current_token_str_pos);
+    }
+}
+
+#endif //MEVAL_IMPL_H
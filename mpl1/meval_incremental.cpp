@@ -0,0 +1,250 @@
+//
+// Incremental re-evaluation of a compiled_expr when only some variables change.
+//
+
+#include "meval_incremental.h"
+#include "def_math.h"
+#include "meval_opt.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+namespace meval {
+
+    incremental_binding::incremental_binding(std::shared_ptr<const compiled_expr> expr)
+        : m_expr(std::move(expr)),
+          m_slots(m_expr->slot_names().size(), 0.0),
+          m_dependents(m_slots.size()),
+          m_slot_changed(m_slots.size(), false) {
+        for (const auto& nd : expr_rewriter::to_tree(*m_expr))
+            m_nodes.push_back({nd.in, nd.lhs, nd.rhs, nd.addend});
+        m_values.resize(m_nodes.size());
+        if (m_expr->has_select())
+            m_errors.resize(m_nodes.size());
+        m_changed.reserve(m_slots.size());
+
+        // the program is a tree, so a node's dependents are its chain of parents
+        std::vector<int32_t> parent(m_nodes.size(), -1);
+        for (std::size_t i = 0; i < m_nodes.size(); i++) {
+            if (m_nodes[i].lhs >= 0)
+                parent[m_nodes[i].lhs] = static_cast<int32_t>(i);
+            if (m_nodes[i].rhs >= 0)
+                parent[m_nodes[i].rhs] = static_cast<int32_t>(i);
+            if (m_nodes[i].addend >= 0)
+                parent[m_nodes[i].addend] = static_cast<int32_t>(i);
+        }
+        const auto chain = [&parent](std::vector<uint32_t>& into, int32_t i) {
+            for (; i >= 0; i = parent[i])
+                into.push_back(static_cast<uint32_t>(i));
+        };
+        for (std::size_t i = 0; i < m_nodes.size(); i++) {
+            const auto& in = m_nodes[i].in;
+            if (in.op == opcode::push_var)
+                chain(m_dependents[in.arg], static_cast<int32_t>(i));
+            else if (operand_count(in.op) > 0 && !expr_rewriter::is_pure(*m_expr, in))
+                chain(m_volatile, static_cast<int32_t>(i));
+        }
+        std::sort(m_volatile.begin(), m_volatile.end());
+        m_volatile.erase(std::unique(m_volatile.begin(), m_volatile.end()), m_volatile.end());
+        for (auto& list : m_dependents) {
+            std::sort(list.begin(), list.end());
+            list.erase(std::unique(list.begin(), list.end()), list.end());
+        }
+    }
+
+    incremental_binding::incremental_binding(std::shared_ptr<const compiled_expr> expr, const var_map& initial)
+        : incremental_binding(std::move(expr)) {
+        const auto& names = m_expr->slot_names();
+        for (std::size_t i = 0; i < names.size(); i++) {
+            if (const auto v = initial.find(names[i]); v != initial.end())
+                m_slots[i] = v->second;
+        }
+    }
+
+    int32_t incremental_binding::slot_of(const std::string_view name) const noexcept {
+        const auto& names = m_expr->slot_names();
+        const auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? -1 : static_cast<int32_t>(it - names.begin());
+    }
+
+    void incremental_binding::set_var(const std::string_view name, const double value) {
+        const auto slot = slot_of(name);
+        if (slot < 0)
+            throw meval_error("Variable not used by expression: " + std::string(name),
+                meval_error::error_type::unknown_variable);
+        set_var(static_cast<uint32_t>(slot), value);
+    }
+
+    void incremental_binding::set_var(const uint32_t slot, const double value) {
+        if (std::bit_cast<uint64_t>(m_slots[slot]) == std::bit_cast<uint64_t>(value))
+            return;
+        m_slots[slot] = value;
+        if (!m_slot_changed[slot]) {
+            m_slot_changed[slot] = true;
+            m_changed.push_back(slot);
+        }
+    }
+
+    double incremental_binding::get_var(const std::string_view name) const {
+        const auto slot = slot_of(name);
+        if (slot < 0)
+            throw meval_error("Variable not used by expression: " + std::string(name),
+                meval_error::error_type::unknown_variable);
+        return m_slots[slot];
+    }
+
+    double incremental_binding::eval() {
+        // changes stay pending until a pass completes, so an eval that throws
+        // is retried in full by the next one; a tracked pass always completes
+        const bool tracked = !m_errors.empty();
+        const std::vector<uint32_t>* work = &m_work;
+        if (!m_valid) {
+            m_work.resize(m_nodes.size());
+            for (uint32_t i = 0; i < m_nodes.size(); i++)
+                m_work[i] = i;
+        } else {
+            const std::size_t sources = m_changed.size() + (m_volatile.empty() ? 0 : 1);
+            if (sources == 1) {
+                work = m_changed.empty() ? &m_volatile : &m_dependents[m_changed[0]];
+            } else if (sources > 1) {
+                m_work.assign(m_volatile.begin(), m_volatile.end());
+                for (const auto slot : m_changed)
+                    m_work.insert(m_work.end(), m_dependents[slot].begin(), m_dependents[slot].end());
+                std::sort(m_work.begin(), m_work.end());
+                m_work.erase(std::unique(m_work.begin(), m_work.end()), m_work.end());
+            } else {
+                m_work.clear();
+            }
+        }
+        for (const auto i : *work) {
+            if (tracked)
+                recompute_tracked(i);
+            else
+                recompute(i);
+        }
+        m_valid = true;
+        m_last_recomputed = work->size();
+        for (const auto slot : m_changed)
+            m_slot_changed[slot] = false;
+        m_changed.clear();
+        if (tracked && m_errors.back())
+            std::rethrow_exception(m_errors.back());
+        return m_values.back();
+    }
+
+    void incremental_binding::recompute_tracked(const uint32_t index) {
+        const auto& nd = m_nodes[index];
+        auto& why = m_errors[index];
+        if (nd.in.op == opcode::select) {
+            // the errors of the condition, else those of the operand picked
+            why = m_errors[nd.lhs];
+            if (!why)
+                why = m_errors[m_values[nd.lhs] != 0 ? nd.rhs : nd.addend];
+            recompute(index);
+            return;
+        }
+        why = nullptr;
+        for (const auto operand : {nd.lhs, nd.rhs, nd.addend}) {
+            if (operand >= 0 && m_errors[operand]) {
+                why = m_errors[operand];
+                break;
+            }
+        }
+        if (!why) {
+            try {
+                recompute(index);
+                return;
+            } catch (...) {
+                why = std::current_exception();
+            }
+        }
+        m_values[index] = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    void incremental_binding::recompute(const uint32_t index) {
+        const auto& nd = m_nodes[index];
+        const double a = nd.lhs >= 0 ? m_values[nd.lhs] : 0;
+        const double b = nd.rhs >= 0 ? m_values[nd.rhs] : 0;
+        const double eps = m_expr->get_epsilon();
+        double& v = m_values[index];
+        switch (nd.in.op) {
+            case opcode::push_const:
+                v = m_expr->constants()[nd.in.arg];
+                break;
+            case opcode::push_var:
+                v = m_slots[nd.in.arg];
+                break;
+            case opcode::add:
+                v = a + b;
+                break;
+            case opcode::sub:
+                v = a - b;
+                break;
+            case opcode::mul:
+                v = a * b;
+                break;
+            case opcode::div:
+                v = div(a, b, eps);
+                break;
+            case opcode::mod:
+                v = std::fmod(a, b);
+                break;
+            case opcode::pow:
+                v = std::pow(a, b);
+                break;
+            case opcode::call_func:
+                v = m_expr->func_ptrs()[nd.in.arg](a);
+                break;
+            case opcode::call_func_obj:
+                v = m_expr->func_objs()[nd.in.arg](a);
+                break;
+            case opcode::call_op:
+                v = m_expr->op_ptrs()[nd.in.arg](a, b, eps);
+                break;
+            case opcode::call_op_obj:
+                v = m_expr->op_objs()[nd.in.arg](a, b, eps);
+                break;
+            case opcode::square:
+                v = square(a);
+                break;
+            case opcode::recip:
+                v = recip(a, eps);
+                break;
+            case opcode::sqrt:
+                v = std::sqrt(a);
+                break;
+            case opcode::powi:
+                v = powi(a, nd.in.arg);
+                break;
+            case opcode::hypot:
+                v = std::hypot(a, b);
+                break;
+            case opcode::fma:
+                v = std::fma(a, b, m_values[nd.addend]);
+                break;
+            case opcode::lt:
+                v = lt(a, b);
+                break;
+            case opcode::le:
+                v = le(a, b);
+                break;
+            case opcode::gt:
+                v = gt(a, b);
+                break;
+            case opcode::ge:
+                v = ge(a, b);
+                break;
+            case opcode::eq:
+                v = eq(a, b);
+                break;
+            case opcode::ne:
+                v = ne(a, b);
+                break;
+            case opcode::select:
+                v = select(a, b, m_values[nd.addend]);
+                break;
+        }
+    }
+
+} // meval
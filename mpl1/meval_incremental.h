@@ -0,0 +1,66 @@
+//
+// Incremental re-evaluation of a compiled_expr when only some variables change.
+//
+
+#ifndef MEVAL_INCREMENTAL_H
+#define MEVAL_INCREMENTAL_H
+
+#include "meval.h"
+#include <exception>
+
+namespace meval {
+
+    // Like var_binding, but caches the value of every subexpression and on
+    // eval() recomputes only those that depend on a variable changed through
+    // set_var since the last successful eval(). Subexpressions calling a
+    // function or operator the optimizer does not know to be pure are
+    // recomputed on every eval(), as are their parents. In an expression with
+    // a select every subexpression keeps what it failed with, so that a select
+    // drops the error of the operand it does not pick in place; the pass then
+    // always completes, and only an error reaching the result is thrown.
+    class incremental_binding {
+    public:
+        explicit incremental_binding(std::shared_ptr<const compiled_expr> expr);
+        incremental_binding(std::shared_ptr<const compiled_expr> expr, const var_map& initial);
+
+        // setting a variable to its current value does not invalidate anything
+        void set_var(std::string_view name, double value);
+        void set_var(uint32_t slot, double value);
+        [[nodiscard]] double get_var(std::string_view name) const;
+        [[nodiscard]] int32_t slot_of(std::string_view name) const noexcept;
+
+        [[nodiscard]] double eval();
+        // subexpressions recomputed by the last eval()
+        [[nodiscard]] std::size_t last_recomputed() const noexcept{return m_last_recomputed;}
+        [[nodiscard]] const std::shared_ptr<const compiled_expr>& get_expr() const noexcept{return m_expr;}
+    private:
+        struct node {
+            instruction in;
+            int32_t lhs;
+            int32_t rhs;
+            int32_t addend;
+        };
+
+        std::shared_ptr<const compiled_expr> m_expr;
+        std::vector<node> m_nodes;
+        std::vector<double> m_values;
+        // per node, what its value failed with; only kept with a select
+        std::vector<std::exception_ptr> m_errors;
+        std::vector<double> m_slots;
+        // per slot, the nodes whose value depends on it, in evaluation order
+        std::vector<std::vector<uint32_t>> m_dependents;
+        // impure nodes and their ancestors, in evaluation order
+        std::vector<uint32_t> m_volatile;
+        std::vector<uint32_t> m_changed;
+        std::vector<bool> m_slot_changed;
+        std::vector<uint32_t> m_work;
+        bool m_valid=false;
+        std::size_t m_last_recomputed=0;
+
+        void recompute(uint32_t index);
+        void recompute_tracked(uint32_t index);
+    };
+
+} // meval
+
+#endif //MEVAL_INCREMENTAL_H
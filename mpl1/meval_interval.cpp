@@ -0,0 +1,550 @@
+//
+// Interval evaluation of compiled_expr, with adaptive sampling and root
+// bracketing built on it.
+//
+
+#include "meval_interval.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+namespace meval {
+    namespace {
+        typedef compiled_expr::func_ptr fp;
+
+        constexpr double inf = std::numeric_limits<double>::infinity();
+        constexpr double pi = std::numbers::pi;
+
+        // Outward rounding. Arithmetic is correctly rounded, so one ulp is
+        // enough; libm is only faithful to a few ulp, so its results get a
+        // relative margin. NaN (inf - inf, 0 * inf) widens to the whole line.
+        double down(const double v) { return v != v ? -inf : std::nextafter(v, -inf); }
+        double up(const double v) { return v != v ? inf : std::nextafter(v, inf); }
+        double libm_down(const double v) {
+            if (v != v)
+                return -inf;
+            return std::isinf(v) ? v : v - std::fabs(v) * 8 * std::numeric_limits<double>::epsilon() -
+                                       std::numeric_limits<double>::denorm_min();
+        }
+        double libm_up(const double v) { return -libm_down(-v); }
+
+        interval hull(const interval a, const interval b) {
+            if (a.is_empty())
+                return b;
+            if (b.is_empty())
+                return a;
+            return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+        }
+
+        // [1, 1] where a comparison holds for every pair of points, [0, 0] where it holds for none
+        interval truth(const bool always, const bool never) {
+            return always ? interval::point(1) : never ? interval::point(0) : interval{0, 1};
+        }
+        interval less(const interval a, const interval b) { return truth(a.hi < b.lo, a.lo >= b.hi); }
+        interval less_equal(const interval a, const interval b) { return truth(a.hi <= b.lo, a.lo > b.hi); }
+        interval equal(const interval a, const interval b) {
+            return truth(a.lo == a.hi && b.lo == b.hi && a.lo == b.lo, a.hi < b.lo || b.hi < a.lo);
+        }
+        interval not_equal(const interval a, const interval b) {
+            return truth(a.hi < b.lo || b.hi < a.lo, a.lo == a.hi && b.lo == b.hi && a.lo == b.lo);
+        }
+
+        interval add(const interval a, const interval b) { return {down(a.lo + b.lo), up(a.hi + b.hi)}; }
+        interval sub(const interval a, const interval b) { return {down(a.lo - b.hi), up(a.hi - b.lo)}; }
+
+        interval mul(const interval a, const interval b) {
+            // an exact zero bound times an infinite one contributes zero
+            const auto p = [](const double x, const double y) { return x == 0 || y == 0 ? 0.0 : x * y; };
+            const double c[] = {p(a.lo, b.lo), p(a.lo, b.hi), p(a.hi, b.lo), p(a.hi, b.hi)};
+            return {down(*std::min_element(std::begin(c), std::end(c))),
+                    up(*std::max_element(std::begin(c), std::end(c)))};
+        }
+
+        // b must not contain zero
+        interval quotient(const interval a, const interval b) {
+            const double c[] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+            double lo = inf, hi = -inf;
+            for (const double v : c) {
+                if (v != v)
+                    return interval::entire();
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+            return {down(lo), up(hi)};
+        }
+
+        // div throws for |b| < epsilon, so only the parts of b outside that band count
+        interval div(const interval a, const interval b, const double eps) {
+            interval r = interval::empty();
+            if (b.lo <= -eps)
+                r = hull(r, quotient(a, {b.lo, std::min(b.hi, -eps)}));
+            if (b.hi >= eps)
+                r = hull(r, quotient(a, {std::max(b.lo, eps), b.hi}));
+            return r;
+        }
+
+        interval mod(const interval a, const interval b) {
+            const double m = std::max(std::fabs(b.lo), std::fabs(b.hi));
+            if (m == 0)
+                return interval::empty();
+            if (b.lo == b.hi && std::isfinite(a.lo) && std::isfinite(a.hi) && (a.lo >= 0 || a.hi <= 0)) {
+                // fmod is exact and rises with a until it wraps at a multiple of b;
+                // a range narrower than |b| wraps at most once, and then ends lower
+                const double lo = std::fmod(a.lo, b.lo), hi = std::fmod(a.hi, b.lo);
+                if (up(a.hi - a.lo) < m && lo <= hi)
+                    return {lo, hi};
+            }
+            // the result has the sign of a and is smaller than |b|
+            return {a.lo >= 0 ? 0 : std::max(a.lo, -m), a.hi <= 0 ? 0 : std::min(a.hi, m)};
+        }
+
+        interval pow(const interval a, const interval b) {
+            const auto span = [](const double x, const double y) {
+                return interval{libm_down(std::min(x, y)), libm_up(std::max(x, y))};
+            };
+            if (b.lo == b.hi && std::trunc(b.lo) == b.lo && std::fabs(b.lo) < 0x1p53) {
+                const double n = b.lo;
+                if (n == 0)
+                    return interval::point(1);
+                const bool odd = std::fmod(n, 2) != 0;
+                const double pl = std::pow(a.lo, n), ph = std::pow(a.hi, n);
+                if (n > 0) {
+                    if (odd || a.lo >= 0 || a.hi <= 0)
+                        return span(pl, ph);
+                    return {0, libm_up(std::max(pl, ph))};
+                }
+                // negative powers are unbounded at zero
+                if (a.contains(0))
+                    return interval::entire();
+                return span(pl, ph);
+            }
+            // pow(x, y) for x >= 0 is monotonic in each argument, so the corners bound it;
+            // negative bases are only defined for integer exponents
+            if (a.lo < 0 && b.lo != b.hi)
+                return interval::entire();
+            const double lo = std::max(a.lo, 0.0);
+            if (!(lo <= a.hi))
+                return interval::empty();
+            const double c[] = {std::pow(lo, b.lo), std::pow(lo, b.hi), std::pow(a.hi, b.lo), std::pow(a.hi, b.hi)};
+            return span(*std::min_element(std::begin(c), std::end(c)), *std::max_element(std::begin(c), std::end(c)));
+        }
+
+        // follows the multiplications of def_math's powi so that its rounding is enclosed
+        interval powi(const interval a, const uint32_t n) {
+            interval r = a;
+            for (int bit = std::bit_width(n) - 2; bit >= 0; bit--) {
+                r = pow(r, interval::point(2));
+                if (n >> bit & 1)
+                    r = mul(r, a);
+            }
+            return r;
+        }
+
+        // f increasing on [dlo, dhi]; exact functions need no widening
+        template<double (*F)(double), bool exact = false>
+        interval increasing(const interval a, const double dlo = -inf, const double dhi = inf) {
+            const double lo = std::max(a.lo, dlo), hi = std::min(a.hi, dhi);
+            if (!(lo <= hi))
+                return interval::empty();
+            if constexpr (exact)
+                return {F(lo), F(hi)};
+            return {libm_down(F(lo)), libm_up(F(hi))};
+        }
+
+        double libm_exp(const double x) { return std::exp(x); }
+        double libm_log(const double x) { return std::log(x); }
+        double libm_log10(const double x) { return std::log10(x); }
+        double libm_asin(const double x) { return std::asin(x); }
+        double libm_neg_acos(const double x) { return -std::acos(x); }
+        double libm_atan(const double x) { return std::atan(x); }
+        double libm_sinh(const double x) { return std::sinh(x); }
+        double libm_cosh(const double x) { return std::cosh(x); }
+        double libm_tanh(const double x) { return std::tanh(x); }
+        double libm_asinh(const double x) { return std::asinh(x); }
+        double libm_acosh(const double x) { return std::acosh(x); }
+        double libm_atanh(const double x) { return std::atanh(x); }
+        double libm_tan(const double x) { return std::tan(x); }
+        double libm_ceil(const double x) { return std::ceil(x); }
+        double libm_floor(const double x) { return std::floor(x); }
+        double libm_round(const double x) { return std::round(x); }
+
+        interval iv_fabs(const interval a) {
+            if (a.lo >= 0)
+                return a;
+            if (a.hi <= 0)
+                return {-a.hi, -a.lo};
+            return {0, std::max(-a.lo, a.hi)};
+        }
+
+        // sin and cos: the maximum sits at phase + 2k*pi and the minimum half a turn later
+        template<double (*F)(double)>
+        interval periodic(const interval a, const double phase) {
+            if (!std::isfinite(a.lo) || !std::isfinite(a.hi) || a.hi - a.lo >= 2 * pi)
+                return {-1, 1};
+            // pi is rounded, so widen the search window rather than risk missing an extremum
+            const double slack = (std::fabs(a.lo) + std::fabs(a.hi)) * 1e-15 + 1e-15;
+            const auto reaches = [&](const double at) {
+                return std::ceil((a.lo - slack - at) / (2 * pi)) * 2 * pi + at <= a.hi + slack;
+            };
+            const double x = F(a.lo), y = F(a.hi);
+            return {reaches(phase + pi) ? -1 : std::max(-1.0, libm_down(std::min(x, y))),
+                    reaches(phase) ? 1 : std::min(1.0, libm_up(std::max(x, y)))};
+        }
+
+        double libm_sin(const double x) { return std::sin(x); }
+        double libm_cos(const double x) { return std::cos(x); }
+
+        interval iv_sin(const interval a) { return periodic<libm_sin>(a, pi / 2); }
+        interval iv_cos(const interval a) { return periodic<libm_cos>(a, 0); }
+        interval iv_tan(const interval a) {
+            if (!std::isfinite(a.lo) || !std::isfinite(a.hi) || a.hi - a.lo >= pi)
+                return interval::entire();
+            // increasing between poles; a pole inside shows up as the ends out of order
+            const auto r = increasing<libm_tan>(a);
+            return r.is_empty() || std::floor((a.lo - pi / 2) / pi) != std::floor((a.hi - pi / 2) / pi)
+                       ? interval::entire() : r;
+        }
+        interval iv_exp(const interval a) {
+            const auto r = increasing<libm_exp>(a);
+            return {std::max(r.lo, 0.0), r.hi};
+        }
+        interval iv_log(const interval a) { return increasing<libm_log>(a, 0); }
+        interval iv_log10(const interval a) { return increasing<libm_log10>(a, 0); }
+        interval iv_sqrt(const interval a) {
+            // correctly rounded
+            const double lo = std::max(a.lo, 0.0);
+            if (!(lo <= a.hi))
+                return interval::empty();
+            return {std::max(0.0, down(std::sqrt(lo))), up(std::sqrt(a.hi))};
+        }
+        interval iv_asin(const interval a) { return increasing<libm_asin>(a, -1, 1); }
+        interval iv_acos(const interval a) {
+            const auto r = increasing<libm_neg_acos>(a, -1, 1);
+            return {-r.hi, -r.lo};
+        }
+        interval iv_atan(const interval a) { return increasing<libm_atan>(a); }
+        interval iv_sinh(const interval a) { return increasing<libm_sinh>(a); }
+        interval iv_cosh(const interval a) {
+            const auto r = increasing<libm_cosh>(iv_fabs(a));
+            return {std::max(r.lo, 1.0), r.hi};
+        }
+        interval iv_tanh(const interval a) {
+            const auto r = increasing<libm_tanh>(a);
+            return {std::max(r.lo, -1.0), std::min(r.hi, 1.0)};
+        }
+        interval iv_asinh(const interval a) { return increasing<libm_asinh>(a); }
+        interval iv_acosh(const interval a) { return increasing<libm_acosh>(a, 1); }
+        interval iv_atanh(const interval a) { return increasing<libm_atanh>(a, -1, 1); }
+        interval iv_ceil(const interval a) { return increasing<libm_ceil, true>(a); }
+        interval iv_floor(const interval a) { return increasing<libm_floor, true>(a); }
+        interval iv_round(const interval a) { return increasing<libm_round, true>(a); }
+
+        interval (*builtin_rule(const fp f))(interval) {
+            static const std::pair<fp, interval (*)(interval)> table[] = {
+                {static_cast<fp>(std::sin), iv_sin}, {static_cast<fp>(std::cos), iv_cos},
+                {static_cast<fp>(std::tan), iv_tan}, {static_cast<fp>(std::asin), iv_asin},
+                {static_cast<fp>(std::acos), iv_acos}, {static_cast<fp>(std::atan), iv_atan},
+                {static_cast<fp>(std::sinh), iv_sinh}, {static_cast<fp>(std::cosh), iv_cosh},
+                {static_cast<fp>(std::tanh), iv_tanh}, {static_cast<fp>(std::asinh), iv_asinh},
+                {static_cast<fp>(std::acosh), iv_acosh}, {static_cast<fp>(std::atanh), iv_atanh},
+                {static_cast<fp>(std::sqrt), iv_sqrt}, {static_cast<fp>(std::log), iv_log},
+                {static_cast<fp>(std::log10), iv_log10}, {static_cast<fp>(std::exp), iv_exp},
+                {static_cast<fp>(std::fabs), iv_fabs}, {static_cast<fp>(std::ceil), iv_ceil},
+                {static_cast<fp>(std::floor), iv_floor}, {static_cast<fp>(std::round), iv_round},
+            };
+            for (const auto& [fn, r] : table) {
+                if (fn == f)
+                    return r;
+            }
+            return nullptr;
+        }
+
+        // point copies of slots for the scalar and interval evaluations of a one-variable sweep
+        struct sweep {
+            const interval_expr& f;
+            uint32_t slot;
+            std::vector<double> point;
+            std::vector<interval> box;
+
+            sweep(const interval_expr& fn, const std::span<const double> slots, const uint32_t s,
+                  const double x0, const double x1)
+                : f(fn), slot(s), point(slots.begin(), slots.end()) {
+                const auto n = f.get_expr()->slot_names().size();
+                if (slots.size() != n)
+                    throw meval_error("Expected " + std::to_string(n) + " slot values, got " +
+                                      std::to_string(slots.size()),
+                                      meval_error::error_type::invalid_argument);
+                if (slot >= n)
+                    throw meval_error("Slot out of range: " + std::to_string(slot),
+                                      meval_error::error_type::invalid_argument);
+                if (!(x0 < x1))
+                    throw meval_error("Empty range", meval_error::error_type::invalid_argument);
+                for (const double v : slots)
+                    box.push_back(interval::point(v));
+            }
+
+            interval over(const double lo, const double hi) {
+                box[slot] = {lo, hi};
+                return f.eval(box.data());
+            }
+            // NaN where f is undefined, including a division by zero
+            double at(const double x) {
+                point[slot] = x;
+                try {
+                    return f.get_expr()->eval(point.data());
+                } catch (const std::runtime_error&) {
+                    return std::nan("");
+                }
+            }
+        };
+
+        struct cell {
+            double lo;
+            double hi;
+            uint32_t depth;
+        };
+    }
+
+    // Implementation of interval_expr
+    interval_expr::interval_expr(std::shared_ptr<const compiled_expr> expr, std::shared_ptr<const interval_rules> rules)
+        : m_expr(std::move(expr)),
+          m_rules(std::move(rules)),
+          m_rule(m_expr->code().size()) {
+        for (std::size_t i = 0; i < m_rule.size(); i++) {
+            const auto& in = m_expr->code()[i];
+            const auto name = m_expr->callable_name(in);
+            switch (in.op) {
+                case opcode::call_func:
+                case opcode::call_func_obj:
+                    if (m_rules) {
+                        if (const auto it = m_rules->funcs.find(name); it != m_rules->funcs.end()) {
+                            m_rule[i].func = &it->second;
+                            break;
+                        }
+                    }
+                    if (in.op == opcode::call_func)
+                        m_rule[i].builtin = builtin_rule(m_expr->func_ptrs()[in.arg]);
+                    m_complete &= m_rule[i].builtin != nullptr;
+                    break;
+                case opcode::call_op:
+                case opcode::call_op_obj:
+                    if (m_rules) {
+                        if (const auto it = m_rules->ops.find(name); it != m_rules->ops.end())
+                            m_rule[i].op = &it->second;
+                    }
+                    m_complete &= m_rule[i].op != nullptr;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    interval interval_expr::eval(const interval* slots) const {
+        constexpr uint32_t local_stack = 32;
+        interval local[local_stack];
+        std::vector<interval> heap;
+        interval* st = local;
+        if (m_expr->max_stack() > local_stack) {
+            heap.resize(m_expr->max_stack());
+            st = heap.data();
+        }
+        const auto& code = m_expr->code();
+        const double eps = m_expr->get_epsilon();
+        uint32_t top = 0;
+        for (std::size_t i = 0; i < code.size(); i++) {
+            const auto& in = code[i];
+            const auto& r = m_rule[i];
+            switch (in.op) {
+                case opcode::push_const:
+                    st[top++] = interval::point(m_expr->constants()[in.arg]);
+                    continue;
+                case opcode::push_var: {
+                    const auto v = slots[in.arg];
+                    st[top++] = v.lo != v.lo || v.hi != v.hi ? interval::entire() : v;
+                    continue;
+                }
+                case opcode::call_func:
+                case opcode::call_func_obj: {
+                    auto& a = st[top - 1];
+                    if (!a.is_empty())
+                        a = r.func ? (*r.func)(a) : r.builtin ? r.builtin(a) : interval::entire();
+                    continue;
+                }
+                // fused opcodes are bounded by the operations they replace
+                case opcode::square:
+                case opcode::recip:
+                case opcode::sqrt:
+                case opcode::powi: {
+                    auto& a = st[top - 1];
+                    if (a.is_empty())
+                        continue;
+                    if (in.op == opcode::square)
+                        a = pow(a, interval::point(2));
+                    else if (in.op == opcode::recip)
+                        a = div(interval::point(1), a, eps);
+                    else if (in.op == opcode::sqrt)
+                        a = iv_sqrt(a);
+                    else
+                        a = powi(a, in.arg);
+                    continue;
+                }
+                case opcode::fma: {
+                    top -= 2;
+                    const interval b = st[top], c = st[top + 1];
+                    interval& a = st[top - 1];
+                    a = a.is_empty() || b.is_empty() || c.is_empty() ? interval::empty() : add(mul(a, b), c);
+                    continue;
+                }
+                case opcode::select: {
+                    top -= 2;
+                    const interval b = st[top], c = st[top + 1];
+                    interval& a = st[top - 1];
+                    // the branch not taken may be empty without emptying the result
+                    if (a.is_empty())
+                        continue;
+                    if (a.lo == 0 && a.hi == 0)
+                        a = c;
+                    else if (a.lo > 0 || a.hi < 0)
+                        a = b;
+                    else
+                        a = hull(b, c);
+                    continue;
+                }
+                default:
+                    break;
+            }
+            const interval b = st[--top];
+            interval& a = st[top - 1];
+            if (a.is_empty() || b.is_empty()) {
+                a = interval::empty();
+                continue;
+            }
+            switch (in.op) {
+                case opcode::add:
+                    a = add(a, b);
+                    break;
+                case opcode::sub:
+                    a = sub(a, b);
+                    break;
+                case opcode::mul:
+                    a = mul(a, b);
+                    break;
+                case opcode::div:
+                    a = div(a, b, eps);
+                    break;
+                case opcode::mod:
+                    a = mod(a, b);
+                    break;
+                case opcode::pow:
+                    a = pow(a, b);
+                    break;
+                case opcode::hypot:
+                    a = iv_sqrt(add(pow(a, interval::point(2)), pow(b, interval::point(2))));
+                    break;
+                case opcode::lt:
+                    a = less(a, b);
+                    break;
+                case opcode::le:
+                    a = less_equal(a, b);
+                    break;
+                case opcode::gt:
+                    a = less(b, a);
+                    break;
+                case opcode::ge:
+                    a = less_equal(b, a);
+                    break;
+                case opcode::eq:
+                    a = equal(a, b);
+                    break;
+                case opcode::ne:
+                    a = not_equal(a, b);
+                    break;
+                default:
+                    a = r.op ? (*r.op)(a, b, eps) : interval::entire();
+                    break;
+            }
+        }
+        return st[0];
+    }
+
+    sample_result adaptive_sample(const interval_expr& f, const std::span<const double> slots, const uint32_t slot,
+                                  const double x0, const double x1, const sample_options& options) {
+        sweep sw(f, slots, slot, x0, x1);
+        sample_result res;
+        bool open = false;  // the last polyline may be extended
+        const auto point = [&](const double x) {
+            res.point_evals++;
+            const double y = sw.at(x);
+            if (y != y) {
+                open = false;
+                return;
+            }
+            if (!open)
+                res.polylines.emplace_back();
+            open = true;
+            res.polylines.back().push_back({x, y});
+            res.range = hull(res.range, interval::point(y));
+        };
+        // cells come off the stack left to right, so neighbours share their common end
+        std::vector<cell> todo{{x0, x1, 0}};
+        while (!todo.empty()) {
+            const cell c = todo.back();
+            todo.pop_back();
+            const interval y = sw.over(c.lo, c.hi);
+            res.interval_evals++;
+            if (!y.intersects(options.viewport)) {
+                open = false;
+                continue;
+            }
+            const double mid = c.lo + (c.hi - c.lo) / 2;
+            const bool leaf = c.depth >= options.max_depth || mid <= c.lo || mid >= c.hi;
+            if (!leaf && !(y.width() <= options.tolerance)) {
+                todo.push_back({mid, c.hi, c.depth + 1});
+                todo.push_back({c.lo, mid, c.depth + 1});
+                continue;
+            }
+            // an unresolved cell that is provably unbounded holds a pole; do not draw across it
+            if (f.complete() && !(std::isfinite(y.lo) && std::isfinite(y.hi))) {
+                open = false;
+                continue;
+            }
+            if (!open || res.polylines.back().back().x != c.lo)
+                point(c.lo);
+            point(c.hi);
+            res.bound = hull(res.bound, y);
+        }
+        return res;
+    }
+
+    std::vector<root_bracket> bracket_roots(const interval_expr& f, const std::span<const double> slots,
+                                            const uint32_t slot, const double x0, const double x1,
+                                            const double x_tolerance) {
+        sweep sw(f, slots, slot, x0, x1);
+        std::vector<root_bracket> found;
+        std::vector<cell> todo{{x0, x1, 0}};
+        while (!todo.empty()) {
+            const cell c = todo.back();
+            todo.pop_back();
+            if (!sw.over(c.lo, c.hi).contains(0))
+                continue;
+            const double mid = c.lo + (c.hi - c.lo) / 2;
+            if (c.hi - c.lo > x_tolerance && mid > c.lo && mid < c.hi) {
+                todo.push_back({mid, c.hi, c.depth + 1});
+                todo.push_back({c.lo, mid, c.depth + 1});
+            } else if (!found.empty() && found.back().x.hi == c.lo) {
+                found.back().x.hi = c.hi;
+            } else {
+                found.push_back({{c.lo, c.hi}, false});
+            }
+        }
+        for (auto& b : found) {
+            const double lo = sw.at(b.x.lo), hi = sw.at(b.x.hi);
+            b.sign_change = (lo <= 0 && hi >= 0) || (lo >= 0 && hi <= 0);
+        }
+        return found;
+    }
+
+} // meval
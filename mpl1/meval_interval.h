@@ -0,0 +1,122 @@
+//
+// Interval evaluation of compiled_expr, with adaptive sampling and root
+// bracketing built on it.
+//
+
+#ifndef MEVAL_INTERVAL_H
+#define MEVAL_INTERVAL_H
+
+#include "meval.h"
+#include <limits>
+
+namespace meval {
+
+    // Closed range [lo, hi]; lo > hi marks the empty interval.
+    struct interval {
+        double lo;
+        double hi;
+
+        static constexpr interval point(const double v) noexcept{return {v, v};}
+        static constexpr interval entire() noexcept{
+            return {-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+        }
+        static constexpr interval empty() noexcept{
+            return {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+        }
+
+        [[nodiscard]] constexpr bool is_empty() const noexcept{return !(lo <= hi);}
+        [[nodiscard]] constexpr bool contains(const double v) const noexcept{return lo <= v && v <= hi;}
+        [[nodiscard]] constexpr bool intersects(const interval& o) const noexcept{
+            return !is_empty() && !o.is_empty() && lo <= o.hi && o.lo <= hi;
+        }
+        [[nodiscard]] constexpr double width() const noexcept{return is_empty() ? 0 : hi - lo;}
+    };
+
+    // Interval extensions of functions and operators by the name they are
+    // registered under, used in place of the built-in rules. A rule must
+    // return an interval containing every value the callable takes on its
+    // argument intervals.
+    struct interval_rules {
+        std::map<std::string, std::function<interval(interval)>, std::less<>> funcs;
+        std::map<std::string, std::function<interval(interval,interval,double)>, std::less<>> ops;
+    };
+
+    // Evaluates a compiled_expr over boxes of variable values. The result
+    // encloses every value the expression takes where it is defined inside
+    // the box, and is empty where it is defined nowhere (sqrt of a negative
+    // range, say). Every rounded operation is widened outwards, so the
+    // enclosure holds under floating point too. A divisor range reaching zero
+    // counts only outside the epsilon band where div throws, so the quotient
+    // stays finite but huge; callables without a rule give entire(). Thread
+    // safe.
+    class interval_expr {
+    public:
+        explicit interval_expr(std::shared_ptr<const compiled_expr> expr,
+                               std::shared_ptr<const interval_rules> rules = nullptr);
+
+        // slots holds one interval per slot of the compiled expression
+        [[nodiscard]] interval eval(const interval* slots) const;
+        // every callable has a rule, so an unbounded enclosure means a pole rather than missing information
+        [[nodiscard]] bool complete() const noexcept{return m_complete;}
+        [[nodiscard]] const std::shared_ptr<const compiled_expr>& get_expr() const noexcept{return m_expr;}
+    private:
+        // interval rule resolved for one call instruction; none set means no rule
+        struct rule {
+            interval (*builtin)(interval)=nullptr;
+            const std::function<interval(interval)>* func=nullptr;
+            const std::function<interval(interval,interval,double)>* op=nullptr;
+        };
+
+        std::shared_ptr<const compiled_expr> m_expr;
+        std::shared_ptr<const interval_rules> m_rules;
+        std::vector<rule> m_rule;
+        bool m_complete=true;
+    };
+
+    struct sample_options {
+        // a cell is accepted once the enclosure of f over it is at most this tall
+        double tolerance = 1e-3;
+        // cells are never split below (x1 - x0) / 2^max_depth
+        uint32_t max_depth = 12;
+        // cells whose enclosure misses this range are skipped
+        interval viewport = interval::entire();
+    };
+
+    struct sample_point {
+        double x;
+        double y;
+    };
+
+    struct sample_result {
+        // connected runs of points, split wherever a cell was culled or f is undefined
+        std::vector<std::vector<sample_point>> polylines;
+        // smallest and largest sampled value
+        interval range = interval::empty();
+        // guaranteed enclosure of f over the accepted cells
+        interval bound = interval::empty();
+        std::size_t point_evals = 0;
+        std::size_t interval_evals = 0;
+    };
+
+    // Samples f along slot over [x0, x1], the other slots held at their
+    // values in slots. Cells are halved only while their enclosure is wider
+    // than the tolerance, so flat stretches cost a handful of evaluations and
+    // steep ones are refined down to max_depth.
+    sample_result adaptive_sample(const interval_expr& f, std::span<const double> slots, uint32_t slot,
+                                  double x0, double x1, const sample_options& options = {});
+
+    struct root_bracket {
+        interval x;
+        // f has opposite signs (or a zero) at the ends, so a continuous f has a root inside
+        bool sign_change;
+    };
+
+    // Ranges of at most x_tolerance (merged where adjacent) outside which f
+    // has no root on [x0, x1]. Subranges whose enclosure excludes zero are
+    // discarded without further evaluation.
+    std::vector<root_bracket> bracket_roots(const interval_expr& f, std::span<const double> slots, uint32_t slot,
+                                            double x0, double x1, double x_tolerance);
+
+} // meval
+
+#endif //MEVAL_INTERVAL_H
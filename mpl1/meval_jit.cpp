@@ -0,0 +1,817 @@
+//
+// x86-64 native code backend for compiled_expr.
+//
+
+#include "meval_jit.h"
+#include "meval_opt.h"
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#if !defined(MEVAL_NO_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define MEVAL_HAS_JIT 1
+#include <sys/mman.h>
+#endif
+
+namespace meval {
+#ifdef MEVAL_HAS_JIT
+    namespace {
+        // exceptions cannot unwind through generated code, so guarded calls park
+        // the first one here and the wrappers rethrow it
+        thread_local std::exception_ptr t_error;
+
+        void remember(std::exception_ptr e) noexcept {
+            if (!t_error)
+                t_error = std::move(e);
+        }
+
+        void rethrow_pending() {
+            if (t_error)
+                std::rethrow_exception(std::exchange(t_error, nullptr));
+        }
+
+        constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+        double guarded_func(const compiled_expr::func_ptr f, const double x) noexcept {
+            try {
+                return f(x);
+            } catch (...) {
+                remember(std::current_exception());
+                return nan;
+            }
+        }
+
+        double guarded_func_obj(const func_unary* f, const double x) noexcept {
+            try {
+                return (*f)(x);
+            } catch (...) {
+                remember(std::current_exception());
+                return nan;
+            }
+        }
+
+        double guarded_op(const compiled_expr::op_ptr f, const double a, const double b, const double eps) noexcept {
+            try {
+                return f(a, b, eps);
+            } catch (...) {
+                remember(std::current_exception());
+                return nan;
+            }
+        }
+
+        double guarded_op_obj(const func_binary* f, const double a, const double b, const double eps) noexcept {
+            try {
+                return (*f)(a, b, eps);
+            } catch (...) {
+                remember(std::current_exception());
+                return nan;
+            }
+        }
+
+        enum gpr : int { rax = 0, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+
+        struct operand {
+            bool is_reg;
+            int reg;
+            int base;
+            int index;  // scaled by 8 when present
+            int32_t disp;
+        };
+
+        operand reg(const int r) { return {true, r, 0, -1, 0}; }
+        operand mem(const int base, const int32_t disp, const int index = -1) { return {false, 0, base, index, disp}; }
+
+        class assembler {
+        public:
+            std::vector<uint8_t> code;
+
+            void byte(const uint8_t v) { code.push_back(v); }
+
+            void dword(const uint32_t v) {
+                for (int i = 0; i < 4; i++)
+                    byte(static_cast<uint8_t>(v >> 8 * i));
+            }
+
+            void qword(const uint64_t v) {
+                for (int i = 0; i < 8; i++)
+                    byte(static_cast<uint8_t>(v >> 8 * i));
+            }
+
+            // [prefix] [REX] opcode modrm; memory operands always use disp32
+            void legacy(const uint8_t prefix, const bool w, const std::initializer_list<uint8_t> op, const int r,
+                        const operand& o) {
+                if (prefix)
+                    byte(prefix);
+                const uint8_t rex = 0x40 | w << 3 | (r >> 3 & 1) << 2 | x_bit(o) << 1 | b_bit(o);
+                if (rex != 0x40)
+                    byte(rex);
+                for (const auto b : op)
+                    byte(b);
+                modrm(r, o);
+            }
+
+            // three byte VEX, 256-bit unless l is 0; map 1=0F 2=0F38 3=0F3A, pp 1=66
+            void vex(const int map, const int r, const int v, const operand& o, const uint8_t op, const int w = 0,
+                     const int l = 1) {
+                byte(0xC4);
+                byte(static_cast<uint8_t>((~r >> 3 & 1) << 7 | (~x_bit(o) & 1) << 6 | (~b_bit(o) & 1) << 5 | map));
+                byte(static_cast<uint8_t>(w << 7 | (~v & 15) << 3 | l << 2 | 1));
+                byte(op);
+                modrm(r, o);
+            }
+
+            void push(const int r) {
+                if (r >= 8)
+                    byte(0x41);
+                byte(0x50 | (r & 7));
+            }
+
+            void pop(const int r) {
+                if (r >= 8)
+                    byte(0x41);
+                byte(0x58 | (r & 7));
+            }
+
+            void mov_imm(const int r, const uint64_t v) {
+                byte(0x48 | r >> 3);
+                byte(0xB8 | (r & 7));
+                qword(v);
+            }
+
+            void call_rax() {
+                byte(0xFF);
+                byte(0xD0);
+            }
+
+            // jcc rel32 with the displacement patched by bind()
+            std::size_t jcc(const uint8_t cc) {
+                byte(0x0F);
+                byte(0x80 | cc);
+                dword(0);
+                return code.size();
+            }
+
+            void bind(const std::size_t after_jump, const std::size_t target) {
+                const auto rel = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(after_jump));
+                std::memcpy(code.data() + after_jump - 4, &rel, 4);
+            }
+
+            // lea r, [rip+disp] addressing `offset` bytes from the start of this code
+            void lea_rip(const int r, const int64_t offset) {
+                byte(0x48 | (r >> 3) << 2);
+                byte(0x8D);
+                byte(static_cast<uint8_t>((r & 7) << 3 | 5));
+                dword(static_cast<uint32_t>(offset - static_cast<int64_t>(code.size() + 4)));
+            }
+
+        private:
+            static int b_bit(const operand& o) { return ((o.is_reg ? o.reg : o.base) >> 3) & 1; }
+            static int x_bit(const operand& o) { return !o.is_reg && o.index >= 0 ? o.index >> 3 & 1 : 0; }
+
+            void modrm(const int r, const operand& o) {
+                if (o.is_reg) {
+                    byte(static_cast<uint8_t>(0xC0 | (r & 7) << 3 | (o.reg & 7)));
+                    return;
+                }
+                if (o.index >= 0) {
+                    byte(static_cast<uint8_t>(0x80 | (r & 7) << 3 | 4));
+                    byte(static_cast<uint8_t>(0xC0 | (o.index & 7) << 3 | (o.base & 7)));
+                } else if ((o.base & 7) == 4) {
+                    byte(static_cast<uint8_t>(0x80 | (r & 7) << 3 | 4));
+                    byte(0x24);
+                } else {
+                    byte(static_cast<uint8_t>(0x80 | (r & 7) << 3 | (o.base & 7)));
+                }
+                dword(static_cast<uint32_t>(o.disp));
+            }
+        };
+
+        // constant pool at the start of the mapping, addressed through r12
+        constexpr int32_t pool_abs_mask = 0;
+        constexpr int32_t pool_epsilon = 32;
+        constexpr int32_t pool_one = 64;
+        constexpr int32_t pool_zero = 96;
+        constexpr int32_t pool_consts = 128;
+
+        constexpr uint8_t op_add = 0x58, op_mul = 0x59, op_sub = 0x5C, op_div = 0x5E;
+
+        // Stack position k lives in register 3+k (xmm for scalar code, ymm or a
+        // pair of ymm for batches) while registers last and in its frame home
+        // otherwise; registers 0-2 are scratch. Every position also has a home
+        // that is used to save it around calls.
+        class codegen {
+        public:
+            codegen(const compiled_expr& expr, const unsigned lanes)
+                : m_expr(expr),
+                  m_lanes(lanes),
+                  m_parts(lanes == 1 ? 1 : lanes / 4),
+                  m_regs(13 / m_parts) {
+                const uint32_t homes = expr.max_stack() * 8 * lanes;
+                m_frame = static_cast<int32_t>((homes + 15) / 16 * 16 + 8);
+            }
+
+            std::vector<uint8_t> scalar(const int64_t pool_offset) {
+                prologue(pool_offset);
+                body();
+                const int x = acquire(0, 0, 0);
+                if (x != 0)
+                    movapd(0, x);
+                m_a.legacy(0, false, {0x89}, r14, mem(r13, 0));
+                epilogue();
+                return std::move(m_a.code);
+            }
+
+            std::vector<uint8_t> batch(const int64_t pool_offset) {
+                prologue(pool_offset);
+                m_a.legacy(0, false, {0x31}, rbp, reg(rbp));
+                m_a.legacy(0, true, {0x85}, r15, reg(r15));
+                const auto skip = m_a.jcc(0x04);
+                const auto loop = m_a.code.size();
+                body();
+                for (unsigned g = 0; g < m_parts; g++)
+                    m_a.vex(1, acquire(0, g, 0), 0, mem(r13, static_cast<int32_t>(32 * g), rbp), 0x11);
+                m_a.legacy(0, true, {0x81}, 0, reg(rbp));
+                m_a.dword(m_lanes);
+                m_a.legacy(0, true, {0x39}, r15, reg(rbp));
+                m_a.bind(m_a.jcc(0x02), loop);
+                m_a.bind(skip, m_a.code.size());
+                vzeroupper();
+                m_a.legacy(0, false, {0x89}, r14, reg(rax));
+                epilogue();
+                return std::move(m_a.code);
+            }
+
+        private:
+            const compiled_expr& m_expr;
+            const unsigned m_lanes;
+            const unsigned m_parts;
+            const uint32_t m_regs;
+            int32_t m_frame;
+            assembler m_a;
+
+            [[nodiscard]] bool vec() const { return m_lanes > 1; }
+
+            [[nodiscard]] int part(const uint32_t k, const unsigned g) const {
+                return k < m_regs ? static_cast<int>(3 + k * m_parts + g) : -1;
+            }
+
+            [[nodiscard]] operand home(const uint32_t k, const unsigned g, const unsigned lane = 0) const {
+                return mem(rsp, static_cast<int32_t>(k * 8 * m_lanes + 32 * g + 8 * lane));
+            }
+
+            void prologue(const int64_t pool_offset) {
+                for (const int r : {rbx, rbp, r12, r13, r14, r15})
+                    m_a.push(r);
+                m_a.legacy(0, true, {0x81}, 5, reg(rsp));
+                m_a.dword(static_cast<uint32_t>(m_frame));
+                m_a.legacy(0, true, {0x89}, rdi, reg(rbx));
+                m_a.legacy(0, true, {0x89}, rsi, reg(r13));
+                m_a.legacy(0, true, {0x89}, rdx, reg(r15));
+                m_a.lea_rip(r12, pool_offset);
+                m_a.legacy(0, false, {0x31}, r14, reg(r14));
+            }
+
+            void epilogue() {
+                m_a.legacy(0, true, {0x81}, 0, reg(rsp));
+                m_a.dword(static_cast<uint32_t>(m_frame));
+                for (const int r : {r15, r14, r13, r12, rbp, rbx})
+                    m_a.pop(r);
+                m_a.byte(0xC3);
+            }
+
+            void vzeroupper() {
+                m_a.byte(0xC5);
+                m_a.byte(0xF8);
+                m_a.byte(0x77);
+            }
+
+            void movsd_load(const int x, const operand& m) { m_a.legacy(0xF2, false, {0x0F, 0x10}, x, m); }
+            void movsd_store(const operand& m, const int x) { m_a.legacy(0xF2, false, {0x0F, 0x11}, x, m); }
+            void movapd(const int dst, const int src) { m_a.legacy(0x66, false, {0x0F, 0x28}, dst, reg(src)); }
+
+            void load(const int x, const operand& m) {
+                if (vec())
+                    m_a.vex(1, x, 0, m, 0x10);
+                else
+                    movsd_load(x, m);
+            }
+
+            void store(const operand& m, const int x) {
+                if (vec())
+                    m_a.vex(1, x, 0, m, 0x11);
+                else
+                    movsd_store(m, x);
+            }
+
+            void arith(const uint8_t op, const int dst, const int src) {
+                if (vec())
+                    m_a.vex(1, dst, dst, reg(src), op);
+                else
+                    m_a.legacy(0xF2, false, {0x0F, op}, dst, reg(src));
+            }
+
+            // register holding part g of position k, loaded into scratch if k lives in memory
+            int acquire(const uint32_t k, const unsigned g, const int scratch) {
+                const int p = part(k, g);
+                if (p >= 0)
+                    return p;
+                load(scratch, home(k, g));
+                return scratch;
+            }
+
+            int target(const uint32_t k, const unsigned g, const int scratch) const {
+                const int p = part(k, g);
+                return p >= 0 ? p : scratch;
+            }
+
+            void commit(const uint32_t k, const unsigned g, const int x) {
+                if (part(k, g) < 0)
+                    store(home(k, g), x);
+            }
+
+            void spill(const uint32_t count) {
+                for (uint32_t k = 0; k < count && k < m_regs; k++) {
+                    for (unsigned g = 0; g < m_parts; g++)
+                        store(home(k, g), part(k, g));
+                }
+            }
+
+            void reload(const uint32_t count) {
+                for (uint32_t k = 0; k < count && k < m_regs; k++) {
+                    for (unsigned g = 0; g < m_parts; g++)
+                        load(part(k, g), home(k, g));
+                }
+            }
+
+            // sets a bit in r14d for every lane where |x| < epsilon
+            void check_divisor(const int x) {
+                if (vec()) {
+                    m_a.vex(1, 2, x, mem(r12, pool_abs_mask), 0x54);
+                    m_a.vex(1, 2, 2, mem(r12, pool_epsilon), 0xC2);
+                    m_a.byte(0x01);
+                    m_a.vex(1, rax, 0, reg(2), 0x50);
+                } else {
+                    movapd(2, x);
+                    m_a.legacy(0x66, false, {0x0F, 0x54}, 2, mem(r12, pool_abs_mask));
+                    m_a.legacy(0xF2, false, {0x0F, 0xC2}, 2, mem(r12, pool_epsilon));
+                    m_a.byte(0x01);
+                    m_a.legacy(0x66, false, {0x0F, 0x50}, rax, reg(2));
+                }
+                m_a.legacy(0, false, {0x09}, rax, reg(r14));
+            }
+
+            struct callee {
+                uint64_t fn;
+                uint64_t obj;  // passed in rdi when non-zero
+                bool epsilon;  // passed in xmm2
+            };
+
+            // calls fn on the operands at k (and k+1) and leaves the result at k
+            void call(const uint32_t k, const uint32_t arity, const callee& c) {
+                const auto setup = [&](const unsigned lane) {
+                    if (c.epsilon)
+                        movsd_load(2, mem(r12, pool_epsilon));
+                    if (c.obj)
+                        m_a.mov_imm(rdi, c.obj);
+                    m_a.mov_imm(rax, c.fn);
+                    m_a.call_rax();
+                    (void)lane;
+                };
+                if (!vec()) {
+                    spill(k);
+                    for (uint32_t i = 0; i < arity; i++) {
+                        if (part(k + i, 0) >= 0)
+                            movapd(static_cast<int>(i), part(k + i, 0));
+                        else
+                            movsd_load(static_cast<int>(i), home(k + i, 0));
+                    }
+                    setup(0);
+                    if (part(k, 0) >= 0)
+                        movapd(part(k, 0), 0);
+                    else
+                        movsd_store(home(k, 0), 0);
+                    reload(k);
+                    return;
+                }
+                spill(k + arity);
+                vzeroupper();
+                for (unsigned lane = 0; lane < m_lanes; lane++) {
+                    for (uint32_t i = 0; i < arity; i++)
+                        movsd_load(static_cast<int>(i), home(k + i, 0, lane));
+                    setup(lane);
+                    movsd_store(home(k, 0, lane), 0);
+                }
+                reload(k + 1);
+            }
+
+            // runs an array kernel over the lanes of position k, which lie
+            // contiguously in its home
+            void call_array(const uint32_t k, const compiled_expr::array_ptr fn) {
+                spill(k + 1);
+                vzeroupper();
+                m_a.legacy(0, true, {0x8D}, rdi, home(k, 0));
+                m_a.legacy(0, true, {0x89}, rdi, reg(rsi));
+                m_a.mov_imm(rdx, m_lanes);
+                m_a.mov_imm(rax, std::bit_cast<uint64_t>(fn));
+                m_a.call_rax();
+                reload(k + 1);
+            }
+
+            void unary_inline(const uint32_t k, const compiled_expr::func_ptr f) {
+                for (unsigned g = 0; g < m_parts; g++) {
+                    const int x = acquire(k, g, 0);
+                    if (f == static_cast<compiled_expr::func_ptr>(std::sqrt)) {
+                        if (vec())
+                            m_a.vex(1, x, 0, reg(x), 0x51);
+                        else
+                            m_a.legacy(0xF2, false, {0x0F, 0x51}, x, reg(x));
+                    } else if (f == static_cast<compiled_expr::func_ptr>(std::fabs)) {
+                        if (vec())
+                            m_a.vex(1, x, x, mem(r12, pool_abs_mask), 0x54);
+                        else
+                            m_a.legacy(0x66, false, {0x0F, 0x54}, x, mem(r12, pool_abs_mask));
+                    } else {
+                        // vroundpd with the precision exception suppressed
+                        m_a.vex(3, x, 0, reg(x), 0x09);
+                        m_a.byte(f == static_cast<compiled_expr::func_ptr>(std::floor) ? 0x09 : 0x0A);
+                    }
+                    commit(k, g, x);
+                }
+            }
+
+            void move(const int dst, const int src) {
+                if (vec())
+                    m_a.vex(1, dst, 0, reg(src), 0x28);
+                else
+                    movapd(dst, src);
+            }
+
+            // the fused opcodes of the optimizer that need no call
+            void fused_inline(const instruction& in, const uint32_t k) {
+                for (unsigned g = 0; g < m_parts; g++) {
+                    const int x = acquire(k, g, 0);
+                    switch (in.op) {
+                        case opcode::square:
+                            arith(op_mul, x, x);
+                            break;
+                        case opcode::recip:
+                            check_divisor(x);
+                            load(1, mem(r12, pool_one));
+                            arith(op_div, 1, x);
+                            move(x, 1);
+                            break;
+                        case opcode::sqrt:
+                            if (vec())
+                                m_a.vex(1, x, 0, reg(x), 0x51);
+                            else
+                                m_a.legacy(0xF2, false, {0x0F, 0x51}, x, reg(x));
+                            break;
+                        case opcode::powi:
+                            move(1, x);
+                            for (int bit = std::bit_width(in.arg) - 2; bit >= 0; bit--) {
+                                arith(op_mul, 1, 1);
+                                if (in.arg >> bit & 1)
+                                    arith(op_mul, 1, x);
+                            }
+                            move(x, 1);
+                            break;
+                        case opcode::fma: {
+                            // vfmadd213pd/sd: a = a * b + c
+                            const int b = acquire(k + 1, g, 1);
+                            const int c = acquire(k + 2, g, 2);
+                            m_a.vex(2, x, b, reg(c), vec() ? 0xA8 : 0xA9, 1, vec() ? 1 : 0);
+                            break;
+                        }
+                        default:
+                            break;
+                    }
+                    commit(k, g, x);
+                }
+            }
+
+            // 1.0 where the comparison of k and k+1 holds, 0.0 elsewhere; cmppd
+            // only has the less-than forms, so > and >= swap their operands
+            void compare(const opcode op, const uint32_t k) {
+                const bool swap = op == opcode::gt || op == opcode::ge;
+                const uint8_t predicate = op == opcode::eq ? 0x00 :    // EQ_OQ
+                                          op == opcode::ne ? 0x04 :    // NEQ_UQ
+                                          op == opcode::lt || op == opcode::gt ? 0x01 : 0x02;  // LT_OS, LE_OS
+                for (unsigned g = 0; g < m_parts; g++) {
+                    const int a = acquire(k, g, 0);
+                    const int b = acquire(k + 1, g, 1);
+                    if (vec()) {
+                        if (swap)
+                            m_a.vex(1, a, b, reg(a), 0xC2);
+                        else
+                            m_a.vex(1, a, a, reg(b), 0xC2);
+                        m_a.byte(predicate);
+                        m_a.vex(1, a, a, mem(r12, pool_one), 0x54);
+                    } else {
+                        if (swap) {
+                            m_a.legacy(0xF2, false, {0x0F, 0xC2}, b, reg(a));
+                            m_a.byte(predicate);
+                            movapd(a, b);
+                        } else {
+                            m_a.legacy(0xF2, false, {0x0F, 0xC2}, a, reg(b));
+                            m_a.byte(predicate);
+                        }
+                        m_a.legacy(0x66, false, {0x0F, 0x54}, a, mem(r12, pool_one));
+                    }
+                    commit(k, g, a);
+                }
+            }
+
+            // blends k+1 and k+2 on a mask of k != 0, which NaN satisfies like in select()
+            void select_inline(const uint32_t k) {
+                for (unsigned g = 0; g < m_parts; g++) {
+                    const int c = acquire(k, g, 0);
+                    const int a = acquire(k + 1, g, 1);
+                    const int b = acquire(k + 2, g, 2);
+                    if (vec()) {
+                        m_a.vex(1, c, c, mem(r12, pool_zero), 0xC2);
+                        m_a.byte(0x04);
+                        // vblendvpd takes its mask register in the top bits of an immediate
+                        m_a.vex(3, c, b, reg(a), 0x4B);
+                        m_a.byte(static_cast<uint8_t>(c << 4));
+                    } else {
+                        m_a.legacy(0xF2, false, {0x0F, 0xC2}, c, mem(r12, pool_zero));
+                        m_a.byte(0x04);
+                        m_a.legacy(0x66, false, {0x0F, 0x54}, a, reg(c));
+                        m_a.legacy(0x66, false, {0x0F, 0x55}, c, reg(b));
+                        m_a.legacy(0x66, false, {0x0F, 0x56}, c, reg(a));
+                    }
+                    commit(k, g, c);
+                }
+            }
+
+            [[nodiscard]] bool inlinable(const compiled_expr::func_ptr f) const {
+                typedef compiled_expr::func_ptr fp;
+                return f == static_cast<fp>(std::sqrt) || f == static_cast<fp>(std::fabs) ||
+                       (vec() && (f == static_cast<fp>(std::floor) || f == static_cast<fp>(std::ceil)));
+            }
+
+            void body() {
+                uint32_t top = 0;
+                for (const auto& in : m_expr.code()) {
+                    switch (in.op) {
+                        case opcode::push_const: {
+                            const auto src = mem(r12, static_cast<int32_t>(pool_consts + 8 * in.arg));
+                            for (unsigned g = 0; g < m_parts; g++) {
+                                const int x = target(top, g, 0);
+                                if (vec())
+                                    m_a.vex(2, x, 0, src, 0x19);
+                                else
+                                    movsd_load(x, src);
+                                commit(top, g, x);
+                            }
+                            top++;
+                            break;
+                        }
+                        case opcode::push_var:
+                            if (vec())
+                                m_a.legacy(0, true, {0x8B}, rax, mem(rbx, static_cast<int32_t>(8 * in.arg)));
+                            for (unsigned g = 0; g < m_parts; g++) {
+                                const int x = target(top, g, 0);
+                                if (vec())
+                                    load(x, mem(rax, static_cast<int32_t>(32 * g), rbp));
+                                else
+                                    movsd_load(x, mem(rbx, static_cast<int32_t>(8 * in.arg)));
+                                commit(top, g, x);
+                            }
+                            top++;
+                            break;
+                        case opcode::add:
+                        case opcode::sub:
+                        case opcode::mul:
+                        case opcode::div: {
+                            const uint8_t op = in.op == opcode::add ? op_add :
+                                               in.op == opcode::sub ? op_sub :
+                                               in.op == opcode::mul ? op_mul : op_div;
+                            for (unsigned g = 0; g < m_parts; g++) {
+                                const int a = acquire(top - 2, g, 0);
+                                const int b = acquire(top - 1, g, 1);
+                                if (in.op == opcode::div)
+                                    check_divisor(b);
+                                arith(op, a, b);
+                                commit(top - 2, g, a);
+                            }
+                            top--;
+                            break;
+                        }
+                        case opcode::mod:
+                            call(top - 2, 2, {std::bit_cast<uint64_t>(
+                                                  static_cast<double (*)(double, double)>(std::fmod)), 0, false});
+                            top--;
+                            break;
+                        case opcode::pow:
+                            call(top - 2, 2, {std::bit_cast<uint64_t>(
+                                                  static_cast<double (*)(double, double)>(std::pow)), 0, false});
+                            top--;
+                            break;
+                        case opcode::call_func: {
+                            const auto f = m_expr.func_ptrs()[in.arg];
+                            if (inlinable(f))
+                                unary_inline(top - 1, f);
+                            else if (vec() && m_expr.array_ptrs()[in.arg])
+                                call_array(top - 1, m_expr.array_ptrs()[in.arg]);
+                            else if (expr_rewriter::is_pure(m_expr, in))
+                                call(top - 1, 1, {std::bit_cast<uint64_t>(f), 0, false});
+                            else
+                                call(top - 1, 1, {std::bit_cast<uint64_t>(&guarded_func),
+                                                  std::bit_cast<uint64_t>(f), false});
+                            break;
+                        }
+                        case opcode::call_func_obj:
+                            call(top - 1, 1, {std::bit_cast<uint64_t>(&guarded_func_obj),
+                                              std::bit_cast<uint64_t>(&m_expr.func_objs()[in.arg]), false});
+                            break;
+                        case opcode::call_op:
+                            call(top - 2, 2, {std::bit_cast<uint64_t>(&guarded_op),
+                                              std::bit_cast<uint64_t>(m_expr.op_ptrs()[in.arg]), true});
+                            top--;
+                            break;
+                        case opcode::call_op_obj:
+                            call(top - 2, 2, {std::bit_cast<uint64_t>(&guarded_op_obj),
+                                              std::bit_cast<uint64_t>(&m_expr.op_objs()[in.arg]), true});
+                            top--;
+                            break;
+                        case opcode::square:
+                        case opcode::recip:
+                        case opcode::sqrt:
+                        case opcode::powi:
+                            fused_inline(in, top - 1);
+                            break;
+                        case opcode::hypot:
+                            call(top - 2, 2, {std::bit_cast<uint64_t>(
+                                                  static_cast<double (*)(double, double)>(std::hypot)), 0, false});
+                            top--;
+                            break;
+                        case opcode::fma:
+                            if (__builtin_cpu_supports("fma"))
+                                fused_inline(in, top - 3);
+                            else
+                                call(top - 3, 3, {std::bit_cast<uint64_t>(
+                                                      static_cast<double (*)(double, double, double)>(std::fma)),
+                                                  0, false});
+                            top -= 2;
+                            break;
+                        case opcode::lt:
+                        case opcode::le:
+                        case opcode::gt:
+                        case opcode::ge:
+                        case opcode::eq:
+                        case opcode::ne:
+                            compare(in.op, top - 2);
+                            top--;
+                            break;
+                        case opcode::select:
+                            select_inline(top - 3);
+                            top -= 2;
+                            break;
+                    }
+                }
+            }
+        };
+
+        constexpr std::size_t align_up(const std::size_t v, const std::size_t a) { return (v + a - 1) / a * a; }
+    }
+#endif
+
+    bool jit_expr::available() noexcept {
+#ifdef MEVAL_HAS_JIT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool jit_expr::batch_available() noexcept {
+#ifdef MEVAL_HAS_JIT
+        return __builtin_cpu_supports("avx");
+#else
+        return false;
+#endif
+    }
+
+    jit_expr::jit_expr(std::shared_ptr<const compiled_expr> expr, const unsigned batch_width)
+        : m_expr(std::move(expr)),
+          m_width(batch_width >= 8 ? 8 : 4) {
+#ifdef MEVAL_HAS_JIT
+        std::vector<double> pool(pool_consts / 8, std::bit_cast<double>(~uint64_t{0} >> 1));
+        std::fill(pool.begin() + pool_epsilon / 8, pool.begin() + pool_one / 8, m_expr->get_epsilon());
+        std::fill(pool.begin() + pool_one / 8, pool.begin() + pool_zero / 8, 1.0);
+        std::fill(pool.begin() + pool_zero / 8, pool.end(), 0.0);
+        pool.insert(pool.end(), m_expr->constants().begin(), m_expr->constants().end());
+        const std::size_t pool_bytes = align_up(pool.size() * 8, 64);
+
+        const auto scalar = codegen(*m_expr, 1).scalar(-static_cast<int64_t>(pool_bytes));
+        const std::size_t batch_offset = align_up(pool_bytes + scalar.size(), 64);
+        std::vector<uint8_t> batch;
+        if (batch_available())
+            batch = codegen(*m_expr, m_width).batch(-static_cast<int64_t>(batch_offset));
+
+        const std::size_t size = batch_offset + batch.size();
+        void* const code = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED)
+            return;
+        auto* const bytes = static_cast<uint8_t*>(code);
+        std::memcpy(bytes, pool.data(), pool.size() * 8);
+        std::memcpy(bytes + pool_bytes, scalar.data(), scalar.size());
+        if (!batch.empty())
+            std::memcpy(bytes + batch_offset, batch.data(), batch.size());
+        if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, size);
+            return;
+        }
+        m_code = code;
+        m_code_size = size;
+        m_scalar = reinterpret_cast<scalar_fn>(bytes + pool_bytes);
+        if (!batch.empty())
+            m_batch = reinterpret_cast<batch_fn>(bytes + batch_offset);
+#endif
+    }
+
+    jit_expr::~jit_expr() {
+#ifdef MEVAL_HAS_JIT
+        if (m_code)
+            munmap(m_code, m_code_size);
+#endif
+    }
+
+    double jit_expr::eval(const double* slots) const {
+#ifdef MEVAL_HAS_JIT
+        if (m_scalar) {
+            uint32_t flags = 0;
+            const double r = m_scalar(slots, &flags);
+            if ((flags || t_error) && m_expr->has_select()) {
+                // the interpreter raises only the errors the selects keep
+                t_error = nullptr;
+                return m_expr->eval(slots);
+            }
+            rethrow_pending();
+            if (flags)
+                throw std::runtime_error("Division by zero");
+            return r;
+        }
+#endif
+        return m_expr->eval(slots);
+    }
+
+    void jit_expr::eval_batch(const std::span<const std::span<const double>> columns,
+                              const std::span<double> out) const {
+#ifdef MEVAL_HAS_JIT
+        if (m_batch) {
+            const auto& names = m_expr->slot_names();
+            if (columns.size() != names.size())
+                throw meval_error("Expected " + std::to_string(names.size()) + " columns, got " +
+                                  std::to_string(columns.size()),
+                                  meval_error::error_type::invalid_argument);
+            constexpr std::size_t block = compiled_expr::batch_block;
+            std::vector<std::vector<double>> broadcast(columns.size());
+            for (std::size_t i = 0; i < columns.size(); i++) {
+                if (columns[i].size() == 1)
+                    broadcast[i].assign(block, columns[i][0]);
+                else if (columns[i].size() < out.size())
+                    throw meval_error("Column for $" + names[i] + " is shorter than the output",
+                                      meval_error::error_type::invalid_argument);
+            }
+            std::vector<const double*> ptrs(columns.size());
+            std::vector<double> slots(columns.size());
+            for (std::size_t row = 0; row < out.size(); row += block) {
+                const std::size_t n = std::min(block, out.size() - row);
+                const std::size_t wide = n - n % m_width;
+                for (std::size_t i = 0; i < columns.size(); i++)
+                    ptrs[i] = broadcast[i].empty() ? columns[i].data() + row : broadcast[i].data();
+                uint32_t flags = wide ? m_batch(ptrs.data(), out.data() + row, wide) : 0;
+                for (std::size_t r = wide; r < n; r++) {
+                    for (std::size_t i = 0; i < columns.size(); i++)
+                        slots[i] = ptrs[i][r];
+                    uint32_t f = 0;
+                    out[row + r] = m_scalar(slots.data(), &f);
+                    flags |= f;
+                }
+                if ((flags || t_error) && m_expr->has_select()) {
+                    // the block again through the interpreter, which raises
+                    // only the errors the selects keep
+                    t_error = nullptr;
+                    std::vector<std::span<const double>> block_columns(columns.size());
+                    for (std::size_t i = 0; i < columns.size(); i++)
+                        block_columns[i] = columns[i].size() == 1 ? columns[i] : columns[i].subspan(row, n);
+                    m_expr->eval_batch(block_columns, out.subspan(row, n));
+                    continue;
+                }
+                rethrow_pending();
+                if (flags)
+                    throw std::runtime_error("Division by zero");
+            }
+            return;
+        }
+#endif
+        m_expr->eval_batch(columns, out);
+    }
+
+} // meval
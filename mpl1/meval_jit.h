@@ -0,0 +1,53 @@
+//
+// x86-64 native code backend for compiled_expr.
+//
+
+#ifndef MEVAL_JIT_H
+#define MEVAL_JIT_H
+
+#include "meval.h"
+
+namespace meval {
+
+    // Lowers a compiled_expr to SSE2 machine code for scalar evaluation and,
+    // on CPUs with AVX, to a 4- or 8-lane loop for batches. Built-in
+    // arithmetic, sqrt and abs are inlined; libm functions, fmod and pow are
+    // called directly; any other function or operator is called through a
+    // guard that catches its exceptions and rethrows them after the native
+    // code returns. An expression with a select that fails is evaluated again
+    // by the interpreter, which raises only the errors of the operands the
+    // selects pick. Where no executable memory can be had (or the build sets
+    // MEVAL_NO_JIT) every entry point falls back to the interpreter.
+    class jit_expr {
+    public:
+        explicit jit_expr(std::shared_ptr<const compiled_expr> expr, unsigned batch_width = 4);
+        ~jit_expr();
+        jit_expr(const jit_expr&) = delete;
+        jit_expr& operator=(const jit_expr&) = delete;
+
+        [[nodiscard]] double eval(const double* slots) const;
+        // same contract as compiled_expr::eval_batch
+        void eval_batch(std::span<const std::span<const double>> columns, std::span<double> out) const;
+
+        [[nodiscard]] bool is_native() const noexcept{return m_scalar != nullptr;}
+        // rows per iteration of the native batch loop, 0 when batches use the interpreter
+        [[nodiscard]] unsigned batch_width() const noexcept{return m_batch ? m_width : 0;}
+        [[nodiscard]] const std::shared_ptr<const compiled_expr>& get_expr() const noexcept{return m_expr;}
+
+        [[nodiscard]] static bool available() noexcept;
+        [[nodiscard]] static bool batch_available() noexcept;
+    private:
+        typedef double (*scalar_fn)(const double* slots, uint32_t* flags);
+        typedef uint32_t (*batch_fn)(const double* const* columns, double* out, std::size_t rows);
+
+        std::shared_ptr<const compiled_expr> m_expr;
+        void* m_code=nullptr;
+        std::size_t m_code_size=0;
+        scalar_fn m_scalar=nullptr;
+        batch_fn m_batch=nullptr;
+        unsigned m_width=0;
+    };
+
+} // meval
+
+#endif //MEVAL_JIT_H
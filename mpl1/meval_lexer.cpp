@@ -0,0 +1,78 @@
+//
+// Longest-match name lookup used by the math_expr tokenizer.
+//
+
+#include "meval_lexer.h"
+#include <algorithm>
+
+namespace meval {
+
+    symbol_trie::symbol_trie(std::vector<std::string_view> names)
+        : m_names(std::move(names)) {
+        std::sort(m_names.begin(), m_names.end());
+        m_names.erase(std::unique(m_names.begin(), m_names.end()), m_names.end());
+        build(0, m_names.size(), 0);
+    }
+
+    // names[lo,hi) share their first depth characters; returns the node for that prefix
+    uint32_t symbol_trie::build(std::size_t lo, const std::size_t hi, const std::size_t depth) {
+        const auto index = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.push_back(node{-1, 0, 0});
+        if (lo < hi && m_names[lo].size() == depth)
+            m_nodes[index].name = static_cast<int32_t>(lo++);
+
+        // reserve this node's edges first so that they stay contiguous
+        uint32_t groups = 0;
+        for (std::size_t i = lo; i < hi; i++) {
+            if (i == lo || m_names[i][depth] != m_names[i - 1][depth])
+                groups++;
+        }
+        const auto first = static_cast<uint32_t>(m_edges.size());
+        m_nodes[index].first_edge = first;
+        m_nodes[index].edge_count = groups;
+        m_edges.resize(m_edges.size() + groups);
+
+        uint32_t e = first;
+        for (std::size_t i = lo; i < hi;) {
+            std::size_t j = i + 1;
+            while (j < hi && m_names[j][depth] == m_names[i][depth])
+                j++;
+            const char c = m_names[i][depth];
+            const auto child = build(i, j, depth + 1);
+            m_edges[e++] = edge{c, child};
+            i = j;
+        }
+        return index;
+    }
+
+    std::string_view symbol_trie::longest_match(const std::string_view text) const noexcept {
+        const int32_t id = longest_match_id(text);
+        return id < 0 ? std::string_view{} : m_names[id];
+    }
+
+    int32_t symbol_trie::longest_match_id(const std::string_view text) const noexcept {
+        if (m_nodes.empty())
+            return -1;
+        int32_t best = -1;
+        uint32_t current = 0;
+        for (std::size_t i = 0;; i++) {
+            const auto& nd = m_nodes[current];
+            if (nd.name >= 0)
+                best = nd.name;
+            if (i == text.size() || nd.edge_count == 0)
+                break;
+            const auto begin = m_edges.begin() + nd.first_edge;
+            const auto end = begin + nd.edge_count;
+            const auto it = std::lower_bound(begin, end, text[i],
+                                             [](const edge& e, const char c) {
+                                                 // same order as the string_view sort above
+                                                 return static_cast<unsigned char>(e.c) < static_cast<unsigned char>(c);
+                                             });
+            if (it == end || it->c != text[i])
+                break;
+            current = it->child;
+        }
+        return best;
+    }
+
+} // meval
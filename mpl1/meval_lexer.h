@@ -0,0 +1,90 @@
+//
+// Longest-match name lookup used by the math_expr tokenizer.
+//
+
+#ifndef MEVAL_LEXER_H
+#define MEVAL_LEXER_H
+
+#include "meval.h"
+
+namespace meval {
+
+    // Immutable trie over a set of names. The names are views, so the
+    // strings they refer to (normally the keys of the symbol maps) must
+    // outlive the trie.
+    class symbol_trie {
+    public:
+        symbol_trie() = default;
+        explicit symbol_trie(std::vector<std::string_view> names);
+
+        template<typename Map>
+        static symbol_trie from_keys(const Map& map) {
+            std::vector<std::string_view> names;
+            names.reserve(map.size());
+            for (const auto& key : map)
+                names.emplace_back(key.first);
+            return symbol_trie(std::move(names));
+        }
+
+        // longest registered name that is a prefix of text, empty if none
+        [[nodiscard]] std::string_view longest_match(std::string_view text) const noexcept;
+        // the same as an id, -1 if none; ids number the names in sorted order
+        [[nodiscard]] int32_t longest_match_id(std::string_view text) const noexcept;
+        [[nodiscard]] std::string_view name(const uint32_t id) const noexcept{return m_names[id];}
+        [[nodiscard]] std::size_t size() const noexcept{return m_names.size();}
+    private:
+        struct node {
+            int32_t name;
+            uint32_t first_edge;
+            uint32_t edge_count;
+        };
+        struct edge {
+            char c;
+            uint32_t child;
+        };
+
+        std::vector<std::string_view> m_names;
+        std::vector<node> m_nodes;
+        std::vector<edge> m_edges;
+
+        uint32_t build(std::size_t lo, std::size_t hi, std::size_t depth);
+    };
+
+    // longest key of a map ordered on string_view that is a prefix of text,
+    // empty if none; each step narrows the candidates to those extending the
+    // prefix, so it stops as soon as no key does
+    template<typename Map>
+    [[nodiscard]] std::string_view longest_key(const Map& map, const std::string_view text) {
+        std::string_view best;
+        for (std::size_t n = 1; n <= text.size(); n++) {
+            const auto prefix = text.substr(0, n);
+            const auto it = map.lower_bound(prefix);
+            if (it == map.end() || !std::string_view(it->first).starts_with(prefix))
+                break;
+            if (it->first.size() == n)
+                best = it->first;
+        }
+        return best;
+    }
+
+    // Tries for the three symbol maps of a math_expr. Building them costs a
+    // pass over every registered name, so they pay off for callers compiling
+    // many formulas against the same maps, which build them once and pass
+    // them through compile_options::symbols; without them the maps are
+    // searched directly. They must be rebuilt when the maps change.
+    struct symbol_tables {
+        symbol_trie vars;
+        symbol_trie funcs;
+        symbol_trie ops;
+
+        template<typename T>
+        symbol_tables(const basic_var_map<T>& v, const basic_func_map<T>& f, const basic_operator_map<T>& o)
+            : vars(symbol_trie::from_keys(v)),
+              funcs(symbol_trie::from_keys(f)),
+              ops(symbol_trie::from_keys(o)) {
+        }
+    };
+
+} // meval
+
+#endif //MEVAL_LEXER_H
@@ -0,0 +1,495 @@
+//
+// On-disk libraries of compiled expressions, opened from a memory-mapped
+// file and evaluated without reparsing.
+//
+
+#include "meval_library.h"
+#include "meval_impl.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MEVAL_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace meval {
+    namespace {
+        constexpr char magic[8] = {'M', 'E', 'V', 'A', 'L', 'L', 'I', 'B'};
+        constexpr uint32_t version = 2;
+        constexpr uint32_t byte_order = 0x01020304;
+        constexpr std::size_t header_size = 64;
+        constexpr std::size_t symbol_size = 3 * sizeof(uint32_t);
+        constexpr std::size_t index_size = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+        constexpr std::size_t record_size = 6 * sizeof(uint32_t) + sizeof(double);
+        constexpr uint32_t max_arg = (1u << 24) - 1;
+        constexpr uint32_t code_flagged = 1u << 31;
+
+        // what a symbol is used as; one name may be several
+        constexpr uint32_t kind_var = 1;
+        constexpr uint32_t kind_func = 2;
+        constexpr uint32_t kind_op = 4;
+        constexpr uint32_t kind_expr = 8;
+
+        // record flags
+        constexpr uint32_t flag_vector_math = 1;
+
+        struct header {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t exprs;
+            uint32_t symbols;
+            uint64_t symbol_offset;
+            uint64_t string_offset;
+            uint64_t string_size;
+            uint64_t index_offset;
+        };
+        static_assert(sizeof(header) <= header_size);
+
+        std::size_t align8(const std::size_t n) { return (n + 7) & ~std::size_t{7}; }
+
+        template<typename V>
+        void put(std::vector<char>& out, const V& v) {
+            const auto at = out.size();
+            out.resize(at + sizeof v);
+            std::memcpy(out.data() + at, &v, sizeof v);
+        }
+
+        template<typename V>
+        V load(const char* p) {
+            V v;
+            std::memcpy(&v, p, sizeof v);
+            return v;
+        }
+
+        opcode code_op(const uint32_t word) { return static_cast<opcode>(word >> 24 & 0x7f); }
+
+        [[noreturn]] void invalid(const std::string& what) {
+            throw meval_error("Invalid library: " + what, meval_error::error_type::invalid_argument);
+        }
+    }
+
+    // Implementation of library_writer
+    uint32_t library_writer::intern(const std::string_view name, const uint32_t kind) {
+        auto it = m_symbol_ids.find(name);
+        if (it == m_symbol_ids.end()) {
+            if (m_symbols.size() > max_arg)
+                throw meval_error("Library symbol table is full", meval_error::error_type::invalid_argument);
+            it = m_symbol_ids.emplace(std::string(name), static_cast<uint32_t>(m_symbols.size())).first;
+            m_symbols.emplace_back(it->first);
+            m_kinds.push_back(0);
+        }
+        m_kinds[it->second] |= kind;
+        return it->second;
+    }
+
+    void library_writer::add(const std::string_view name, const compiled_expr& expr) {
+        if (const auto it = m_symbol_ids.find(name); it != m_symbol_ids.end() && m_kinds[it->second] & kind_expr)
+            throw meval_error("Duplicate expression name: " + std::string(name),
+                meval_error::error_type::invalid_argument);
+        if (expr.constants().size() > max_arg + std::size_t{1} || expr.slot_names().size() > max_arg + std::size_t{1})
+            throw meval_error("Expression too large for a library: " + std::string(name),
+                meval_error::error_type::invalid_argument);
+        std::vector<char> rec;
+        put(rec, static_cast<uint32_t>(expr.code().size()));
+        put(rec, static_cast<uint32_t>(expr.constants().size()));
+        put(rec, static_cast<uint32_t>(expr.slot_names().size()));
+        put(rec, expr.max_stack());
+        put(rec, expr.vector_math() ? flag_vector_math : uint32_t{0});
+        put(rec, uint32_t{0});
+        put(rec, expr.get_epsilon());
+        for (const double c : expr.constants())
+            put(rec, c);
+        for (const auto& slot : expr.slot_names())
+            put(rec, intern(slot, kind_var));
+        for (std::size_t k = 0; k < expr.code().size(); k++) {
+            const auto& in = expr.code()[k];
+            auto op = in.op;
+            uint32_t arg = in.arg;
+            // callables are stored by name and rebound when the library is opened
+            if (op == opcode::call_func || op == opcode::call_func_obj) {
+                op = opcode::call_func;
+                arg = intern(expr.callable_name(in), kind_func);
+            } else if (op == opcode::call_op || op == opcode::call_op_obj) {
+                op = opcode::call_op;
+                arg = intern(expr.callable_name(in), kind_op);
+            }
+            put(rec, (expr.flagged()[k] ? code_flagged : 0) | static_cast<uint32_t>(op) << 24 | arg);
+        }
+        rec.resize(align8(rec.size()));
+        const auto offset = m_records.size() * sizeof(uint64_t);
+        m_records.resize(m_records.size() + rec.size() / sizeof(uint64_t));
+        std::memcpy(reinterpret_cast<char*>(m_records.data()) + offset, rec.data(), rec.size());
+        m_exprs.push_back({intern(name, kind_expr), offset});
+    }
+
+    std::vector<char> library_writer::bytes() const {
+        std::vector<entry> index = m_exprs;
+        std::sort(index.begin(), index.end(), [this](const entry& a, const entry& b) {
+            return m_symbols[a.name] < m_symbols[b.name];
+        });
+        std::size_t strings = 0;
+        for (const auto& s : m_symbols)
+            strings += s.size();
+        if (strings > UINT32_MAX)
+            throw meval_error("Library symbol text exceeds 4 GiB", meval_error::error_type::invalid_argument);
+
+        header h{};
+        std::memcpy(h.magic, magic, sizeof magic);
+        h.version = version;
+        h.byte_order = byte_order;
+        h.exprs = static_cast<uint32_t>(index.size());
+        h.symbols = static_cast<uint32_t>(m_symbols.size());
+        h.symbol_offset = header_size;
+        h.string_offset = align8(h.symbol_offset + m_symbols.size() * symbol_size);
+        h.string_size = strings;
+        h.index_offset = align8(h.string_offset + strings);
+        const std::size_t records = h.index_offset + index.size() * index_size;
+
+        std::vector<char> out;
+        out.reserve(records + m_records.size() * sizeof(uint64_t));
+        put(out, h);
+        out.resize(h.symbol_offset);
+        uint32_t at = 0;
+        for (std::size_t i = 0; i < m_symbols.size(); i++) {
+            put(out, at);
+            put(out, static_cast<uint32_t>(m_symbols[i].size()));
+            put(out, m_kinds[i]);
+            at += static_cast<uint32_t>(m_symbols[i].size());
+        }
+        out.resize(h.string_offset);
+        for (const auto& s : m_symbols)
+            out.insert(out.end(), s.begin(), s.end());
+        out.resize(h.index_offset);
+        for (const auto& e : index) {
+            put(out, e.name);
+            put(out, uint32_t{0});
+            put(out, static_cast<uint64_t>(records + e.offset));
+        }
+        const auto data = reinterpret_cast<const char*>(m_records.data());
+        out.insert(out.end(), data, data + m_records.size() * sizeof(uint64_t));
+        return out;
+    }
+
+    void library_writer::write(const std::string& path) const {
+        const auto data = bytes();
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!file)
+            throw meval_error("Cannot write library: " + path, meval_error::error_type::invalid_argument);
+    }
+
+    // Implementation of compiled_library
+    compiled_library::compiled_library(const std::string& path, const func_map& funcs, const operator_map& ops,
+                                       const bool verify, const bool cache_unpacked) {
+#ifdef MEVAL_HAS_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw meval_error("Cannot open library: " + path, meval_error::error_type::invalid_argument);
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < header_size) {
+            ::close(fd);
+            invalid("truncated header in " + path);
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        void* const p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw meval_error("Cannot map library: " + path, meval_error::error_type::invalid_argument);
+        m_data = static_cast<const char*>(p);
+        m_mapped = true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            throw meval_error("Cannot open library: " + path, meval_error::error_type::invalid_argument);
+        m_size = static_cast<std::size_t>(file.tellg());
+        m_buffer.resize((m_size + 7) / 8);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(m_buffer.data()), static_cast<std::streamsize>(m_size));
+        if (!file)
+            throw meval_error("Cannot read library: " + path, meval_error::error_type::invalid_argument);
+        m_data = reinterpret_cast<const char*>(m_buffer.data());
+#endif
+        try {
+            open(funcs, ops, verify, cache_unpacked);
+        } catch (...) {
+#ifdef MEVAL_HAS_MMAP
+            ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+            throw;
+        }
+    }
+
+    compiled_library::compiled_library(std::vector<char> bytes, const func_map& funcs, const operator_map& ops,
+                                       const bool verify, const bool cache_unpacked)
+        : m_size(bytes.size()),
+          m_buffer((bytes.size() + 7) / 8) {
+        // copied into 64-bit words so that the records are aligned
+        std::memcpy(m_buffer.data(), bytes.data(), bytes.size());
+        m_data = reinterpret_cast<const char*>(m_buffer.data());
+        open(funcs, ops, verify, cache_unpacked);
+    }
+
+    compiled_library::~compiled_library() {
+#ifdef MEVAL_HAS_MMAP
+        if (m_mapped)
+            ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
+
+    void compiled_library::open(const func_map& funcs, const operator_map& ops, const bool verify,
+                                const bool cache_unpacked) {
+        if (m_size < header_size)
+            invalid("truncated header");
+        const auto h = load<header>(m_data);
+        if (std::memcmp(h.magic, magic, sizeof magic) != 0)
+            invalid("bad magic");
+        if (h.byte_order != byte_order)
+            invalid("written with a different byte order");
+        if (h.version != version)
+            invalid("unsupported version " + std::to_string(h.version));
+        const auto fits = [this](const uint64_t offset, const uint64_t count, const uint64_t size) {
+            return offset <= m_size && count <= (m_size - offset) / size;
+        };
+        if (h.symbol_offset % 4 || !fits(h.symbol_offset, h.symbols, symbol_size) ||
+            !fits(h.string_offset, h.string_size, 1) ||
+            h.index_offset % 8 || !fits(h.index_offset, h.exprs, index_size))
+            invalid("section out of bounds");
+        m_exprs = h.exprs;
+        m_symbols = h.symbols;
+        m_symbol_table = reinterpret_cast<const uint32_t*>(m_data + h.symbol_offset);
+        m_strings = m_data + h.string_offset;
+        m_index = m_data + h.index_offset;
+
+        m_links.resize(m_symbols);
+        for (uint32_t i = 0; i < m_symbols; i++) {
+            const uint32_t* sym = m_symbol_table + 3 * i;
+            if (sym[0] > h.string_size || sym[1] > h.string_size - sym[0])
+                invalid("symbol out of bounds");
+            const auto name = symbol(i);
+            if (sym[2] & kind_func) {
+                const auto fn = funcs.find(name);
+                if (fn == funcs.end())
+                    throw meval_error("Unknown function: " + std::string(name),
+                        meval_error::error_type::unknown_function);
+                m_links[i].func = detail::target_ptr(fn->second);
+                if (!m_links[i].func) {
+                    m_links[i].func_obj = static_cast<int32_t>(m_func_objs.size());
+                    m_func_objs.push_back(fn->second);
+                }
+            }
+            if (sym[2] & kind_op) {
+                const auto op = ops.find(name);
+                if (op == ops.end())
+                    throw meval_error("Unknown operator: " + std::string(name),
+                        meval_error::error_type::unknown_operator);
+                m_links[i].op = detail::target_ptr(op->second.first);
+                if (!m_links[i].op) {
+                    m_links[i].op_obj = static_cast<int32_t>(m_op_objs.size());
+                    m_op_objs.push_back(op->second.first);
+                }
+            }
+        }
+        if (cache_unpacked)
+            m_unpacked = std::make_unique<unpacked[]>(m_exprs);
+        for (uint32_t i = 0; i < m_exprs; i++) {
+            const auto offset = load<uint64_t>(m_index + i * index_size + 8);
+            if (load<uint32_t>(m_index + i * index_size) >= m_symbols || offset % 8 || !fits(offset, 1, record_size))
+                invalid("index entry out of bounds");
+            if (verify)
+                check(i);
+        }
+    }
+
+    compiled_library::record compiled_library::get(const uint32_t index) const {
+        const char* p = m_data + load<uint64_t>(m_index + index * index_size + 8);
+        record r{};
+        r.code_count = load<uint32_t>(p);
+        r.const_count = load<uint32_t>(p + 4);
+        r.slot_count = load<uint32_t>(p + 8);
+        r.max_stack = load<uint32_t>(p + 12);
+        r.flags = load<uint32_t>(p + 16);
+        r.epsilon = load<double>(p + 24);
+        r.consts = reinterpret_cast<const double*>(p + record_size);
+        r.slots = reinterpret_cast<const uint32_t*>(r.consts + r.const_count);
+        r.code = r.slots + r.slot_count;
+        return r;
+    }
+
+    void compiled_library::check(const uint32_t index) const {
+        const auto offset = load<uint64_t>(m_index + index * index_size + 8);
+        const auto r = get(index);
+        const uint64_t size = record_size + uint64_t{8} * r.const_count + uint64_t{4} * r.slot_count +
+                              uint64_t{4} * r.code_count;
+        if (size > m_size - offset)
+            invalid("record out of bounds");
+        const auto kinds = [this](const uint32_t id) { return id < m_symbols ? m_symbol_table[3 * id + 2] : 0; };
+        for (uint32_t s = 0; s < r.slot_count; s++) {
+            if (!(kinds(r.slots[s]) & kind_var))
+                invalid("bad slot symbol");
+        }
+        int64_t depth = 0, max_depth = 0;
+        for (uint32_t k = 0; k < r.code_count; k++) {
+            const auto op = code_op(r.code[k]);
+            const uint32_t arg = r.code[k] & max_arg;
+            bool ok;
+            switch (op) {
+                case opcode::push_const:
+                    ok = arg < r.const_count;
+                    break;
+                case opcode::push_var:
+                    ok = arg < r.slot_count;
+                    break;
+                case opcode::add:
+                case opcode::sub:
+                case opcode::mul:
+                case opcode::div:
+                case opcode::mod:
+                case opcode::pow:
+                case opcode::square:
+                case opcode::recip:
+                case opcode::sqrt:
+                case opcode::hypot:
+                case opcode::fma:
+                case opcode::lt:
+                case opcode::le:
+                case opcode::gt:
+                case opcode::ge:
+                case opcode::eq:
+                case opcode::ne:
+                case opcode::select:
+                    ok = true;
+                    break;
+                case opcode::powi:
+                    ok = arg >= 2;
+                    break;
+                case opcode::call_func:
+                    ok = kinds(arg) & kind_func;
+                    break;
+                case opcode::call_op:
+                    ok = kinds(arg) & kind_op;
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+            const auto n = static_cast<int64_t>(operand_count(op));
+            if (!ok || depth < n)
+                invalid("bad instruction in " + std::string(name(index)));
+            depth += 1 - n;
+            max_depth = std::max(max_depth, depth);
+        }
+        if (depth != 1 || max_depth != r.max_stack)
+            invalid("bad stack shape in " + std::string(name(index)));
+    }
+
+    int64_t compiled_library::find(const std::string_view name) const noexcept {
+        uint32_t lo = 0, hi = m_exprs;
+        while (lo < hi) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            const auto s = symbol(load<uint32_t>(m_index + mid * index_size));
+            if (s == name)
+                return mid;
+            if (s < name)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return -1;
+    }
+
+    void compiled_library::check_index(const uint32_t index) const {
+        if (index >= m_exprs)
+            throw meval_error("Expression index out of range: " + std::to_string(index),
+                meval_error::error_type::invalid_argument);
+    }
+
+    std::string_view compiled_library::name(const uint32_t index) const {
+        check_index(index);
+        return symbol(load<uint32_t>(m_index + index * index_size));
+    }
+
+    std::string_view compiled_library::symbol(const uint32_t id) const {
+        if (id >= m_symbols)
+            throw meval_error("Symbol id out of range: " + std::to_string(id),
+                meval_error::error_type::invalid_argument);
+        const uint32_t* sym = m_symbol_table + 3 * id;
+        return {m_strings + sym[0], sym[1]};
+    }
+
+    std::span<const uint32_t> compiled_library::slot_symbols(const uint32_t index) const {
+        check_index(index);
+        const auto r = get(index);
+        return {r.slots, r.slot_count};
+    }
+
+    std::vector<std::string_view> compiled_library::slot_names(const uint32_t index) const {
+        std::vector<std::string_view> names;
+        for (const auto id : slot_symbols(index))
+            names.push_back(symbol(id));
+        return names;
+    }
+
+    double compiled_library::eval(const uint32_t index, const double* slots) const {
+        check_index(index);
+        if (!m_unpacked)
+            return unpack(index)->eval(slots);
+        auto& u = m_unpacked[index];
+        std::call_once(u.once, [&] { u.expr = unpack(index); });
+        return u.expr->eval(slots);
+    }
+
+    std::shared_ptr<const compiled_expr> compiled_library::unpack(const uint32_t index) const {
+        check_index(index);
+        const auto r = get(index);
+        compiled_expr ce;
+        ce.m_consts.assign(r.consts, r.consts + r.const_count);
+        for (uint32_t s = 0; s < r.slot_count; s++)
+            ce.m_slots.emplace_back(symbol(r.slots[s]));
+        ce.m_max_stack = r.max_stack;
+        ce.m_epsilon = r.epsilon;
+        std::map<uint32_t, uint32_t> funcs, ops;
+        for (uint32_t k = 0; k < r.code_count; k++) {
+            instruction in{code_op(r.code[k]), r.code[k] & max_arg};
+            if (in.op == opcode::call_func) {
+                const auto& l = m_links[in.arg];
+                const auto [it, inserted] = funcs.try_emplace(in.arg, static_cast<uint32_t>(
+                    l.func ? ce.m_func_ptrs.size() : ce.m_func_objs.size()));
+                if (inserted && l.func) {
+                    ce.m_func_ptrs.push_back(l.func);
+                    ce.m_func_ptr_names.emplace_back(symbol(in.arg));
+                } else if (inserted) {
+                    ce.m_func_objs.push_back(m_func_objs[l.func_obj]);
+                    ce.m_func_obj_names.emplace_back(symbol(in.arg));
+                }
+                in = {l.func ? opcode::call_func : opcode::call_func_obj, it->second};
+            } else if (in.op == opcode::call_op) {
+                const auto& l = m_links[in.arg];
+                const auto [it, inserted] = ops.try_emplace(in.arg, static_cast<uint32_t>(
+                    l.op ? ce.m_op_ptrs.size() : ce.m_op_objs.size()));
+                if (inserted && l.op) {
+                    ce.m_op_ptrs.push_back(l.op);
+                    ce.m_op_ptr_names.emplace_back(symbol(in.arg));
+                } else if (inserted) {
+                    ce.m_op_objs.push_back(m_op_objs[l.op_obj]);
+                    ce.m_op_obj_names.emplace_back(symbol(in.arg));
+                }
+                in = {l.op ? opcode::call_op : opcode::call_op_obj, it->second};
+            }
+            ce.m_code.push_back(in);
+        }
+        std::array<domain_mode, 6> builtin;
+        builtin.fill(domain_mode::flag);
+        ce.finalize(nullptr, builtin, r.flags & flag_vector_math);
+        // the error policy the expression was compiled under, as it resolved
+        for (uint32_t k = 0; k < r.code_count; k++)
+            ce.m_flagged[k] = (r.code[k] & code_flagged) != 0;
+        return std::make_shared<const compiled_expr>(std::move(ce));
+    }
+
+} // meval
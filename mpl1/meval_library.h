@@ -0,0 +1,145 @@
+//
+// On-disk libraries of compiled expressions, opened from a memory-mapped
+// file and evaluated without reparsing.
+//
+// File layout (host byte order; byte_order is checked on open):
+//
+//   char     magic[8] = "MEVALLIB"
+//   uint32   version = 2
+//   uint32   byte_order = 0x01020304
+//   uint32   exprs
+//   uint32   symbols
+//   uint64   symbol_offset    symbols x { uint32 offset; uint32 length; uint32 kinds; }
+//   uint64   string_offset    symbol text, offsets relative to string_offset
+//   uint64   string_size
+//   uint64   index_offset     exprs x { uint32 name; uint32 unused; uint64 offset; }, sorted by name
+//
+// followed by one record per expression, each starting on a multiple of 8:
+//
+//   uint32   code, consts, slots, max_stack
+//   uint32   flags            1: vector_math
+//   uint32   unused
+//   float64  epsilon
+//   float64  consts[consts]
+//   uint32   slot[slots]      symbol of each variable slot
+//   uint32   code[code]       flagged << 31 | opcode << 24 | argument
+//
+// where flagged is set for instructions whose domain errors the
+// non-throwing evaluators report (see compiled_expr::flagged).
+//
+// Variables, functions, operators and expression names share one interned
+// symbol table; call instructions carry the callable's symbol, which is
+// bound to a function or operator when the library is opened. eval unpacks
+// a record into a compiled_expr; with cache_unpacked that copy is kept for
+// the life of the library.
+//
+
+#ifndef MEVAL_LIBRARY_H
+#define MEVAL_LIBRARY_H
+
+#include "meval.h"
+#include <mutex>
+
+namespace meval {
+
+    // Accumulates compiled expressions under unique names and serializes them.
+    class library_writer {
+    public:
+        void add(std::string_view name, const compiled_expr& expr);
+        [[nodiscard]] std::size_t size() const noexcept{return m_exprs.size();}
+        [[nodiscard]] std::vector<char> bytes() const;
+        void write(const std::string& path) const;
+    private:
+        struct entry {
+            uint32_t name;
+            std::size_t offset;  // into m_records
+        };
+
+        std::map<std::string, uint32_t, std::less<>> m_symbol_ids;
+        std::vector<std::string_view> m_symbols;  // keys of m_symbol_ids
+        std::vector<uint32_t> m_kinds;
+        std::vector<entry> m_exprs;
+        std::vector<uint64_t> m_records;
+
+        uint32_t intern(std::string_view name, uint32_t kind);
+    };
+
+    // A library file mapped read-only. Only the header, symbol table and
+    // index are read on open; expression records are paged in as they are
+    // first evaluated. Callables are bound once per symbol against funcs and ops,
+    // which are copied, so the maps need not outlive the library. An index
+    // past size() throws meval_error. Thread safe.
+    class compiled_library {
+    public:
+        // verify checks every record (bounds, arguments, stack shape), which
+        // reads the whole file; skip it only for files this process trusts.
+        // cache_unpacked keeps what eval unpacks, one compiled_expr per
+        // expression evaluated; without it every eval unpacks a temporary.
+        compiled_library(const std::string& path, const func_map& funcs, const operator_map& ops,
+                         bool verify = true, bool cache_unpacked = false);
+        compiled_library(std::vector<char> bytes, const func_map& funcs, const operator_map& ops,
+                         bool verify = true, bool cache_unpacked = false);
+        ~compiled_library();
+        compiled_library(const compiled_library&) = delete;
+        compiled_library& operator=(const compiled_library&) = delete;
+
+        [[nodiscard]] uint32_t size() const noexcept{return m_exprs;}
+        // index of the expression called name, -1 if there is none
+        [[nodiscard]] int64_t find(std::string_view name) const noexcept;
+        [[nodiscard]] std::string_view name(uint32_t index) const;
+        [[nodiscard]] std::string_view symbol(uint32_t id) const;
+        // symbols of the variables read by an expression, in slot order
+        [[nodiscard]] std::span<const uint32_t> slot_symbols(uint32_t index) const;
+        [[nodiscard]] std::vector<std::string_view> slot_names(uint32_t index) const;
+
+        [[nodiscard]] double eval(uint32_t index, const double* slots) const;
+        // copy of an expression as a compiled_expr, for batch evaluation or the jit
+        [[nodiscard]] std::shared_ptr<const compiled_expr> unpack(uint32_t index) const;
+    private:
+        struct record {
+            uint32_t code_count;
+            uint32_t const_count;
+            uint32_t slot_count;
+            uint32_t max_stack;
+            uint32_t flags;
+            double epsilon;
+            const double* consts;
+            const uint32_t* slots;
+            const uint32_t* code;
+        };
+        // a symbol bound as a function and/or an operator
+        struct link {
+            compiled_expr::func_ptr func=nullptr;
+            compiled_expr::op_ptr op=nullptr;
+            int32_t func_obj=-1;
+            int32_t op_obj=-1;
+        };
+
+        const char* m_data=nullptr;
+        std::size_t m_size=0;
+        bool m_mapped=false;
+        std::vector<uint64_t> m_buffer;  // the file when it is not mapped
+        uint32_t m_exprs=0;
+        uint32_t m_symbols=0;
+        const uint32_t* m_symbol_table=nullptr;
+        const char* m_strings=nullptr;
+        const char* m_index=nullptr;
+        std::vector<link> m_links;
+        std::vector<func_unary> m_func_objs;
+        std::vector<func_binary> m_op_objs;
+        // with cache_unpacked, per expression, its unpacked copy once it has been evaluated
+        struct unpacked {
+            std::once_flag once;
+            std::shared_ptr<const compiled_expr> expr;
+        };
+        std::unique_ptr<unpacked[]> m_unpacked;
+
+        void open(const func_map& funcs, const operator_map& ops, bool verify, bool cache_unpacked);
+        [[nodiscard]] record get(uint32_t index) const;
+        void check(uint32_t index) const;
+        void check_index(uint32_t index) const;
+    };
+
+} // meval
+
+#endif //MEVAL_LIBRARY_H
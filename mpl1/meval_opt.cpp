@@ -0,0 +1,14 @@
+//
+// Rewrites of compiled_expr programs: tree view, constant folding and
+// algebraic simplification.
+//
+
+#include "meval_opt_impl.h"
+
+namespace meval {
+
+    template struct basic_expr_rewriter<float>;
+    template struct basic_expr_rewriter<double>;
+    template struct basic_expr_rewriter<long double>;
+
+} // meval
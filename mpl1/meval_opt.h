@@ -0,0 +1,57 @@
+//
+// Rewrites of compiled_expr programs: tree view, constant folding,
+// algebraic simplification and fusion into the fused opcodes.
+//
+
+#ifndef MEVAL_OPT_H
+#define MEVAL_OPT_H
+
+#include "meval.h"
+#include <optional>
+
+namespace meval {
+
+    template<typename T>
+    struct basic_expr_rewriter {
+        // one instruction with the nodes producing its operands; children
+        // always precede their parent, so the root is the last node
+        struct node {
+            instruction in;
+            int32_t lhs;
+            int32_t rhs;
+            int32_t addend = -1;  // third operand of fma and select
+        };
+
+        [[nodiscard]] static std::vector<node> to_tree(const basic_compiled_expr<T>& expr);
+
+        // Replaces the program of expr with the nodes reachable from root, in
+        // operand order. Rewrites may append nodes and share leaves, so a node
+        // is emitted once per use. Constants are pooled and unused slots
+        // dropped; the result maps every old slot to its new index, or -1 if
+        // it is no longer read.
+        static std::vector<int32_t> emit(basic_compiled_expr<T>& expr, const std::vector<node>& tree, int32_t root);
+
+        // immutable holds the value of every slot that may be folded as a constant
+        static std::vector<int32_t> optimize(basic_compiled_expr<T>& expr, opt_level level,
+                                             std::span<const std::optional<T>> immutable, bool fast_math = false);
+
+        // Peephole pass of opt_level::full over the nodes reachable from root:
+        // x*x as square and 1/x as recip, which round the same, and with
+        // fast_math the rewrites listed at compile_options::fast_math.
+        static void fuse(basic_compiled_expr<T>& expr, std::vector<node>& tree, int32_t root, bool fast_math);
+
+        [[nodiscard]] static bool is_pure(const basic_compiled_expr<T>& expr, const instruction& in);
+        [[nodiscard]] static std::optional<T> fold(const basic_compiled_expr<T>& expr, const instruction& in,
+                                                   T a, T b);
+    };
+
+    typedef basic_expr_rewriter<double> expr_rewriter;
+
+    // instantiated in meval_opt.cpp, definitions in meval_opt_impl.h
+    extern template struct basic_expr_rewriter<float>;
+    extern template struct basic_expr_rewriter<double>;
+    extern template struct basic_expr_rewriter<long double>;
+
+} // meval
+
+#endif //MEVAL_OPT_H
@@ -0,0 +1,565 @@
+//
+// Template definitions of basic_expr_rewriter, instantiated in meval_opt.cpp.
+//
+
+#ifndef MEVAL_OPT_IMPL_H
+#define MEVAL_OPT_IMPL_H
+
+#include "meval_opt.h"
+#include "def_math.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <map>
+
+namespace meval {
+    namespace detail {
+        // eval_error bits for the result r of an operation on a and b (a twice for functions)
+        template<typename T>
+        uint32_t domain_errors(const T r, const T a, const T b) noexcept {
+            uint32_t bits = r != r && a == a && b == b ? eval_invalid : eval_ok;
+            if constexpr (std::numeric_limits<T>::has_infinity) {
+                using std::fabs;
+                constexpr T inf = std::numeric_limits<T>::infinity();
+                if (fabs(r) == inf && fabs(a) != inf && fabs(b) != inf)
+                    bits |= eval_overflow;
+            }
+            return bits;
+        }
+    }
+
+    template<typename T>
+    std::vector<typename basic_expr_rewriter<T>::node> basic_expr_rewriter<T>::to_tree(const basic_compiled_expr<T>& expr) {
+        std::vector<node> tree;
+        std::vector<int32_t> st;
+        tree.reserve(expr.m_code.size());
+        for (const auto& in : expr.m_code) {
+            node nd{in, -1, -1};
+            switch (operand_count(in.op)) {
+                case 3:
+                    nd.addend = st.back();
+                    st.pop_back();
+                    [[fallthrough]];
+                case 2:
+                    nd.rhs = st.back();
+                    st.pop_back();
+                    [[fallthrough]];
+                case 1:
+                    nd.lhs = st.back();
+                    st.pop_back();
+                    break;
+                default:
+                    break;
+            }
+            st.push_back(static_cast<int32_t>(tree.size()));
+            tree.push_back(nd);
+        }
+        return tree;
+    }
+
+    template<typename T>
+    std::vector<int32_t> basic_expr_rewriter<T>::emit(basic_compiled_expr<T>& expr, const std::vector<node>& tree,
+                                                      const int32_t root) {
+        std::vector<int32_t> slot_map(expr.m_slots.size(), -1);
+        std::vector<std::string> slots;
+        std::vector<T> consts;
+        std::map<uint64_t, uint32_t> pooled;
+        std::vector<instruction> code;
+        uint32_t depth = 0, max_depth = 0;
+        // post-order walk; next counts the operands of a node already emitted
+        std::vector<std::pair<int32_t, uint32_t>> todo{{root, 0}};
+        while (!todo.empty()) {
+            const auto [i, next] = todo.back();
+            const int32_t operands[] = {tree[i].lhs, tree[i].rhs, tree[i].addend};
+            if (next < operand_count(tree[i].in.op)) {
+                todo.back().second++;
+                todo.push_back({operands[next], 0});
+                continue;
+            }
+            todo.pop_back();
+            instruction in = tree[i].in;
+            if (in.op == opcode::push_const) {
+                const T v = expr.m_consts[in.arg];
+                if constexpr (std::is_same_v<T, double>) {
+                    const auto [it, inserted] = pooled.try_emplace(std::bit_cast<uint64_t>(v),
+                                                                   static_cast<uint32_t>(consts.size()));
+                    if (inserted)
+                        consts.push_back(v);
+                    in.arg = it->second;
+                } else {
+                    // no fixed-width bit pattern to key on; pool by value
+                    const auto it = std::find_if(consts.begin(), consts.end(), [&v](const T& c) { return c == v; });
+                    in.arg = static_cast<uint32_t>(it - consts.begin());
+                    if (it == consts.end())
+                        consts.push_back(v);
+                }
+            } else if (in.op == opcode::push_var) {
+                if (slot_map[in.arg] < 0) {
+                    slot_map[in.arg] = static_cast<int32_t>(slots.size());
+                    slots.push_back(expr.m_slots[in.arg]);
+                }
+                in.arg = slot_map[in.arg];
+            }
+            depth = depth + 1 - operand_count(in.op);
+            max_depth = std::max(max_depth, depth);
+            code.push_back(in);
+        }
+        expr.m_code = std::move(code);
+        expr.m_consts = std::move(consts);
+        expr.m_slots = std::move(slots);
+        expr.m_max_stack = max_depth;
+        return slot_map;
+    }
+
+    template<typename T>
+    bool basic_expr_rewriter<T>::is_pure(const basic_compiled_expr<T>& expr, const instruction& in) {
+        switch (in.op) {
+            case opcode::add:
+            case opcode::sub:
+            case opcode::mul:
+            case opcode::div:
+            case opcode::mod:
+            case opcode::pow:
+            case opcode::square:
+            case opcode::recip:
+            case opcode::sqrt:
+            case opcode::powi:
+            case opcode::hypot:
+            case opcode::fma:
+            case opcode::lt:
+            case opcode::le:
+            case opcode::gt:
+            case opcode::ge:
+            case opcode::eq:
+            case opcode::ne:
+            case opcode::select:
+                return true;
+            case opcode::call_func: {
+                // only the libm overloads installed by init_def_funcs are known to be pure
+                if constexpr (std::is_floating_point_v<T>) {
+                    typedef typename basic_compiled_expr<T>::func_ptr fp;
+                    static const fp libm[] = {
+                        static_cast<fp>(std::sin), static_cast<fp>(std::cos), static_cast<fp>(std::tan),
+                        static_cast<fp>(std::asin), static_cast<fp>(std::acos), static_cast<fp>(std::atan),
+                        static_cast<fp>(std::sinh), static_cast<fp>(std::cosh), static_cast<fp>(std::tanh),
+                        static_cast<fp>(std::asinh), static_cast<fp>(std::acosh), static_cast<fp>(std::atanh),
+                        static_cast<fp>(std::sqrt), static_cast<fp>(std::log), static_cast<fp>(std::log10),
+                        static_cast<fp>(std::exp), static_cast<fp>(std::fabs), static_cast<fp>(std::ceil),
+                        static_cast<fp>(std::floor), static_cast<fp>(std::round),
+                    };
+                    return std::find(std::begin(libm), std::end(libm), expr.m_func_ptrs[in.arg]) != std::end(libm);
+                } else {
+                    return false;
+                }
+            }
+            default:
+                return false;
+        }
+    }
+
+    template<typename T>
+    std::optional<T> basic_expr_rewriter<T>::fold(const basic_compiled_expr<T>& expr, const instruction& in,
+                                                  const T a, const T b) {
+        using std::fabs;
+        T r;
+        switch (in.op) {
+            case opcode::add:
+                r = a + b;
+                break;
+            case opcode::sub:
+                r = a - b;
+                break;
+            case opcode::mul:
+                r = a * b;
+                break;
+            case opcode::div:
+                // leave the division in place so it still reports at eval time
+                if (fabs(b) < expr.m_epsilon)
+                    return std::nullopt;
+                r = a / b;
+                break;
+            case opcode::mod:
+                r = mod(a, b, expr.m_epsilon);
+                break;
+            case opcode::pow:
+                r = pow(a, b, expr.m_epsilon);
+                break;
+            case opcode::call_func:
+                r = expr.m_func_ptrs[in.arg](a);
+                break;
+            case opcode::lt:
+                r = lt(a, b);
+                break;
+            case opcode::le:
+                r = le(a, b);
+                break;
+            case opcode::gt:
+                r = gt(a, b);
+                break;
+            case opcode::ge:
+                r = ge(a, b);
+                break;
+            case opcode::eq:
+                r = eq(a, b);
+                break;
+            case opcode::ne:
+                r = ne(a, b);
+                break;
+            default:
+                return std::nullopt;
+        }
+        // likewise for other domain errors, which the non-throwing paths report
+        if (detail::domain_errors(r, a, operand_count(in.op) == 1 ? a : b))
+            return std::nullopt;
+        return r;
+    }
+
+    template<typename T>
+    std::vector<int32_t> basic_expr_rewriter<T>::optimize(basic_compiled_expr<T>& expr, const opt_level level,
+                                                          const std::span<const std::optional<T>> immutable,
+                                                          const bool fast_math) {
+        auto tree = to_tree(expr);
+        std::vector<std::optional<T>> value(tree.size());
+        std::vector<int32_t> alias(tree.size());
+        const auto make_const = [&](const int32_t i, const T v) {
+            tree[i] = node{{opcode::push_const, static_cast<uint32_t>(expr.m_consts.size())}, -1, -1};
+            expr.m_consts.push_back(v);
+            value[i] = v;
+        };
+        const auto is = [&](const int32_t i, const int v) { return value[i] && *value[i] == T(v); };
+
+        for (int32_t i = 0; i < static_cast<int32_t>(tree.size()); i++) {
+            auto& nd = tree[i];
+            alias[i] = i;
+            if (nd.lhs >= 0)
+                nd.lhs = alias[nd.lhs];
+            if (nd.rhs >= 0)
+                nd.rhs = alias[nd.rhs];
+            if (nd.addend >= 0)
+                nd.addend = alias[nd.addend];
+            const auto in = nd.in;
+            switch (operand_count(in.op)) {
+                case 0:
+                    if (in.op == opcode::push_const)
+                        value[i] = expr.m_consts[in.arg];
+                    else if (immutable.size() > in.arg && immutable[in.arg])
+                        make_const(i, *immutable[in.arg]);
+                    break;
+                case 1:
+                    if (value[nd.lhs] && is_pure(expr, in)) {
+                        if (const auto v = fold(expr, in, *value[nd.lhs], 0))
+                            make_const(i, *v);
+                    }
+                    break;
+                case 3:
+                    if (in.op != opcode::select)
+                        break;
+                    if (value[nd.lhs] && value[nd.rhs] && value[nd.addend]) {
+                        make_const(i, select(*value[nd.lhs], *value[nd.rhs], *value[nd.addend]));
+                    } else if (level == opt_level::full && value[nd.lhs]) {
+                        // the operand not picked is dropped, and with it any error it would report
+                        alias[i] = *value[nd.lhs] != T(0) ? nd.rhs : nd.addend;
+                    }
+                    break;
+                default: {
+                    if (value[nd.lhs] && value[nd.rhs] && is_pure(expr, in)) {
+                        if (const auto v = fold(expr, in, *value[nd.lhs], *value[nd.rhs])) {
+                            make_const(i, *v);
+                            break;
+                        }
+                    }
+                    if (level != opt_level::full)
+                        break;
+                    // exact except that x+0 yields x where IEEE gives +0 for x=-0
+                    const auto lhs = nd.lhs, rhs = nd.rhs;
+                    if ((in.op == opcode::add && is(rhs, 0)) || (in.op == opcode::sub && is(rhs, 0)) ||
+                        (in.op == opcode::mul && is(rhs, 1)) || (in.op == opcode::div && is(rhs, 1)) ||
+                        (in.op == opcode::pow && is(rhs, 1))) {
+                        alias[i] = lhs;
+                    } else if ((in.op == opcode::add && is(lhs, 0)) || (in.op == opcode::mul && is(lhs, 1))) {
+                        alias[i] = rhs;
+                    } else if (in.op == opcode::pow && (is(rhs, 0) || is(lhs, 1))) {
+                        make_const(i, T(1));
+                    }
+                    break;
+                }
+            }
+        }
+        if (level == opt_level::full)
+            fuse(expr, tree, alias.back(), fast_math && std::is_floating_point_v<T>);
+        return emit(expr, tree, alias.back());
+    }
+
+    template<typename T>
+    void basic_expr_rewriter<T>::fuse(basic_compiled_expr<T>& expr, std::vector<node>& tree, const int32_t root,
+                                      const bool fast_math) {
+        typedef typename basic_compiled_expr<T>::func_ptr fp;
+        const auto add_node = [&tree](const opcode op, const uint32_t arg, const int32_t lhs, const int32_t rhs = -1,
+                                      const int32_t addend = -1) {
+            tree.push_back({{op, arg}, lhs, rhs, addend});
+            return static_cast<int32_t>(tree.size() - 1);
+        };
+        const auto constant = [&](const T v) {
+            expr.m_consts.push_back(v);
+            return add_node(opcode::push_const, static_cast<uint32_t>(expr.m_consts.size() - 1), -1);
+        };
+        const auto op_of = [&tree](const int32_t i) { return tree[i].in.op; };
+        const auto value_of = [&](const int32_t i) -> std::optional<T> {
+            if (op_of(i) != opcode::push_const)
+                return std::nullopt;
+            return expr.m_consts[tree[i].in.arg];
+        };
+        const auto is = [&](const int32_t i, const T v) {
+            const auto c = value_of(i);
+            return c && *c == v;
+        };
+        // leaves may be shared by several parents; anything else would be evaluated once per use
+        const auto is_leaf = [&](const int32_t i) { return operand_count(op_of(i)) == 0; };
+        const auto is_call = [&](const int32_t i, const fp f) {
+            return op_of(i) == opcode::call_func && expr.m_func_ptrs[tree[i].in.arg] == f;
+        };
+        // structurally equal pure subtrees; constants compare with their sign so that -0 differs from 0
+        const auto same = [&](const int32_t x, const int32_t y) {
+            std::vector<std::pair<int32_t, int32_t>> todo{{x, y}};
+            while (!todo.empty()) {
+                const auto [i, j] = todo.back();
+                todo.pop_back();
+                if (i == j)
+                    continue;
+                const auto &a = tree[i], &b = tree[j];
+                if (a.in.op != b.in.op)
+                    return false;
+                if (a.in.op == opcode::push_const) {
+                    const T u = expr.m_consts[a.in.arg], v = expr.m_consts[b.in.arg];
+                    if (!(u == v))
+                        return false;
+                    if constexpr (std::is_floating_point_v<T>) {
+                        if (std::signbit(u) != std::signbit(v))
+                            return false;
+                    }
+                    continue;
+                }
+                if (a.in.arg != b.in.arg || (operand_count(a.in.op) > 0 && !is_pure(expr, a.in)))
+                    return false;
+                if (a.lhs >= 0)
+                    todo.push_back({a.lhs, b.lhs});
+                if (a.rhs >= 0)
+                    todo.push_back({a.rhs, b.rhs});
+                if (a.addend >= 0)
+                    todo.push_back({a.addend, b.addend});
+            }
+            return true;
+        };
+        // the subtree at i calls nothing whose order of evaluation could be observed
+        const auto pure = [&](const int32_t i) {
+            std::vector<int32_t> todo{i};
+            while (!todo.empty()) {
+                const auto& nd = tree[todo.back()];
+                todo.pop_back();
+                if (operand_count(nd.in.op) > 0 && !is_pure(expr, nd.in))
+                    return false;
+                for (const auto c : {nd.lhs, nd.rhs, nd.addend}) {
+                    if (c >= 0)
+                        todo.push_back(c);
+                }
+            }
+            return true;
+        };
+        // visits the nodes reachable from root, parents first when pre is set
+        const auto walk = [&tree, root](const bool pre, const auto& visit) {
+            std::vector<bool> seen(tree.size());
+            std::vector<std::pair<int32_t, bool>> todo{{root, false}};
+            while (!todo.empty()) {
+                const auto [i, expanded] = todo.back();
+                todo.pop_back();
+                if (expanded) {
+                    visit(i);
+                    continue;
+                }
+                if (i >= static_cast<int32_t>(seen.size()) || seen[i])
+                    continue;
+                seen[i] = true;
+                if (pre && !visit(i))
+                    continue;
+                if (!pre)
+                    todo.push_back({i, true});
+                for (const auto c : {tree[i].addend, tree[i].rhs, tree[i].lhs}) {
+                    if (c >= 0)
+                        todo.push_back({c, false});
+                }
+            }
+        };
+
+        if (fast_math) {
+            // Sums and differences of c, x, c*x, x^k and c*x^k in one variable x
+            // become Horner chains of fma. Parents are visited first, so only the
+            // outermost sum is rewritten.
+            walk(true, [&](const int32_t i) {
+                if (op_of(i) != opcode::add && op_of(i) != opcode::sub)
+                    return true;
+                std::map<uint32_t, T> coef;
+                int32_t x = -1;
+                uint32_t terms = 0;
+                // the first variable seen is the one the polynomial is in
+                const auto is_x = [&](const int32_t j) {
+                    if (op_of(j) != opcode::push_var)
+                        return false;
+                    if (x < 0)
+                        x = j;
+                    return same(x, j);
+                };
+                const auto power = [&](const int32_t j) -> uint32_t {
+                    if (is_x(j))
+                        return 1;
+                    if (op_of(j) == opcode::mul && is_x(tree[j].lhs) && same(tree[j].lhs, tree[j].rhs))
+                        return 2;
+                    if (op_of(j) != opcode::pow || !is_x(tree[j].lhs))
+                        return 0;
+                    const auto k = value_of(tree[j].rhs);
+                    if (!k || !(*k >= 2 && *k <= 64) || *k != static_cast<T>(static_cast<uint32_t>(*k)))
+                        return 0;
+                    return static_cast<uint32_t>(*k);
+                };
+                std::vector<std::pair<int32_t, T>> todo{{i, T(1)}};
+                while (!todo.empty()) {
+                    const auto [j, sign] = todo.back();
+                    todo.pop_back();
+                    const auto& nd = tree[j];
+                    if (nd.in.op == opcode::add || nd.in.op == opcode::sub) {
+                        todo.push_back({nd.lhs, sign});
+                        todo.push_back({nd.rhs, nd.in.op == opcode::sub ? -sign : sign});
+                        continue;
+                    }
+                    T c = sign;
+                    uint32_t k = 0;
+                    if (const auto v = value_of(j)) {
+                        coef[0] += c * *v;
+                        continue;
+                    }
+                    if (nd.in.op == opcode::mul && value_of(nd.lhs)) {
+                        c *= *value_of(nd.lhs);
+                        k = power(nd.rhs);
+                    } else if (nd.in.op == opcode::mul && value_of(nd.rhs)) {
+                        c *= *value_of(nd.rhs);
+                        k = power(nd.lhs);
+                    } else {
+                        k = power(j);
+                    }
+                    if (k == 0)
+                        return true;
+                    coef[k] += c;
+                    terms++;
+                }
+                std::erase_if(coef, [](const auto& c) { return c.second == T(0); });
+                if (terms < 2 || coef.empty() || coef.rbegin()->first < 2)
+                    return true;
+                const uint32_t degree = coef.rbegin()->first;
+                const auto coef_of = [&coef](const uint32_t k) {
+                    const auto c = coef.find(k);
+                    return c == coef.end() ? T(0) : c->second;
+                };
+                // a leading 1 starts the chain at x, which already holds one multiplication
+                int32_t acc = constant(coef_of(degree));
+                uint32_t k = degree;
+                if (coef_of(degree) == T(1)) {
+                    acc = x;
+                    if (const T c = coef_of(--k); c != T(0))
+                        acc = add_node(opcode::add, 0, acc, constant(c));
+                }
+                while (k-- > 0) {
+                    if (const T c = coef_of(k); c != T(0))
+                        acc = add_node(opcode::fma, 0, acc, x, constant(c));
+                    else
+                        acc = add_node(opcode::mul, 0, acc, x);
+                }
+                tree[i] = tree[acc];
+                return false;
+            });
+        }
+
+        walk(false, [&](const int32_t i) {
+            // a copy, add_node may move the tree
+            auto nd = tree[i];
+            const auto lhs = nd.lhs, rhs = nd.rhs;
+            // hypot from sqrt over a sum of squares, in the shapes the rules below leave it
+            const auto try_hypot = [&](const int32_t sum) {
+                const auto& s = tree[sum];
+                if (s.in.op == opcode::add && op_of(s.lhs) == opcode::square && op_of(s.rhs) == opcode::square)
+                    nd = {{opcode::hypot, 0}, tree[s.lhs].lhs, tree[s.rhs].lhs};
+                else if (s.in.op == opcode::fma && same(s.lhs, s.rhs) && op_of(s.addend) == opcode::square)
+                    nd = {{opcode::hypot, 0}, s.lhs, tree[s.addend].lhs};
+            };
+            switch (nd.in.op) {
+                case opcode::mul:
+                    if (same(lhs, rhs)) {
+                        nd = {{opcode::square, 0}, lhs, -1};
+                    } else if constexpr (std::is_floating_point_v<T>) {
+                        const auto exp = static_cast<fp>(std::exp);
+                        if (fast_math && is_call(lhs, exp) && is_call(rhs, exp))
+                            nd = {tree[lhs].in, add_node(opcode::add, 0, tree[lhs].lhs, tree[rhs].lhs), -1, -1};
+                    }
+                    break;
+                case opcode::div:
+                    if (is(lhs, T(1)))
+                        nd = {{opcode::recip, 0}, rhs, -1};
+                    break;
+                case opcode::pow: {
+                    const auto n = value_of(rhs);
+                    if (!fast_math || !n)
+                        break;
+                    // negative powers stay calls: pow(0, -n) is inf, where recip would throw
+                    const T k = *n;
+                    if (k == T(0.5)) {
+                        nd = {{opcode::sqrt, 0}, lhs, -1};
+                        try_hypot(lhs);
+                    } else if (k == T(2)) {
+                        nd = {{opcode::square, 0}, lhs, -1};
+                    } else if (k >= 3 && k <= 64 && k == static_cast<T>(static_cast<uint32_t>(k))) {
+                        nd = {{opcode::powi, static_cast<uint32_t>(k)}, lhs, -1};
+                    }
+                    break;
+                }
+                case opcode::call_func:
+                    if constexpr (std::is_floating_point_v<T>) {
+                        if (fast_math && is_call(i, static_cast<fp>(std::sqrt)))
+                            try_hypot(lhs);
+                    }
+                    break;
+                case opcode::add:
+                case opcode::sub: {
+                    if (!fast_math || !pure(i))
+                        break;
+                    // a*b+c, c+a*b and a*b-constant; a square only shares a leaf
+                    const auto product = [&](const int32_t j) {
+                        return op_of(j) == opcode::mul || (op_of(j) == opcode::square && is_leaf(tree[j].lhs));
+                    };
+                    const auto factors = [&](const int32_t j) {
+                        const auto& p = tree[j];
+                        return std::pair{p.lhs, p.in.op == opcode::square ? p.lhs : p.rhs};
+                    };
+                    if (nd.in.op == opcode::sub) {
+                        if (const auto c = value_of(rhs); c && product(lhs)) {
+                            const auto [a, b] = factors(lhs);
+                            nd = {{opcode::fma, 0}, a, b, constant(-*c)};
+                        }
+                    } else if (product(lhs)) {
+                        const auto [a, b] = factors(lhs);
+                        nd = {{opcode::fma, 0}, a, b, rhs};
+                    } else if (product(rhs)) {
+                        const auto [a, b] = factors(rhs);
+                        nd = {{opcode::fma, 0}, a, b, lhs};
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            tree[i] = nd;
+            return true;
+        });
+    }
+
+} // meval
+
+#endif //MEVAL_OPT_IMPL_H
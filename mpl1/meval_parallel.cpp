@@ -0,0 +1,181 @@
+//
+// Work-stealing thread pool and parallel evaluation over row ranges.
+//
+
+#include "meval_parallel.h"
+#include <algorithm>
+#include <limits>
+
+namespace meval {
+
+    namespace {
+        // a worker's remaining chunks [lo,hi) packed into one word so that the
+        // owner (taking from the front) and thieves (taking from the back) agree
+        // through a single compare-exchange
+        constexpr uint64_t pack(const uint64_t lo, const uint64_t hi) { return lo << 32 | hi; }
+        constexpr uint64_t range_lo(const uint64_t r) { return r >> 32; }
+        constexpr uint64_t range_hi(const uint64_t r) { return r & 0xffffffffu; }
+    }
+
+    struct thread_pool::job {
+        const range_func* body;
+        std::size_t begin;
+        std::size_t end;
+        std::size_t grain;
+        std::vector<std::atomic<uint64_t>> ranges;
+        std::atomic<unsigned> active;
+        std::atomic<bool> failed{false};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        job(const range_func& b, const std::size_t first, const std::size_t last, const std::size_t g,
+            const unsigned participants)
+            : body(&b), begin(first), end(last), grain(g), ranges(participants), active(participants) {
+        }
+
+        void run_chunk(const uint64_t chunk) {
+            if (failed.load(std::memory_order_relaxed))
+                return;
+            const std::size_t first = begin + chunk * grain;
+            const std::size_t last = std::min(end, first + grain);
+            try {
+                (*body)(first, last);
+            } catch (...) {
+                std::lock_guard lk(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+                failed.store(true, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    thread_pool::thread_pool(const unsigned threads) {
+        const unsigned n = std::max(1u, threads);
+        m_workers.reserve(n - 1);
+        for (unsigned i = 1; i < n; i++)
+            m_workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+
+    thread_pool::~thread_pool() {
+        {
+            std::lock_guard lk(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& w : m_workers)
+            w.join();
+    }
+
+    thread_pool& thread_pool::shared() {
+        static thread_pool pool;
+        return pool;
+    }
+
+    void thread_pool::worker_loop(const unsigned index) {
+        uint64_t seen = 0;
+        for (;;) {
+            job* jb;
+            {
+                std::unique_lock lk(m_mutex);
+                m_wake.wait(lk, [&] { return m_stop || m_generation != seen; });
+                if (m_stop)
+                    return;
+                seen = m_generation;
+                jb = m_job;
+            }
+            if (!jb)
+                continue;
+            work(*jb, index);
+            if (jb->active.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                { std::lock_guard lk(m_mutex); }
+                m_done.notify_all();
+            }
+        }
+    }
+
+    void thread_pool::work(job& jb, const unsigned index) {
+        auto& mine = jb.ranges[index];
+        const auto n = static_cast<unsigned>(jb.ranges.size());
+        for (;;) {
+            uint64_t cur = mine.load(std::memory_order_acquire);
+            if (range_lo(cur) < range_hi(cur)) {
+                if (mine.compare_exchange_weak(cur, pack(range_lo(cur) + 1, range_hi(cur)),
+                                               std::memory_order_acq_rel))
+                    jb.run_chunk(range_lo(cur));
+                continue;
+            }
+            bool stolen = false;
+            for (unsigned k = 1; k < n && !stolen; k++) {
+                auto& victim = jb.ranges[(index + k) % n];
+                uint64_t v = victim.load(std::memory_order_acquire);
+                while (range_lo(v) < range_hi(v)) {
+                    const uint64_t take = (range_hi(v) - range_lo(v) + 1) / 2;
+                    const uint64_t split = range_hi(v) - take;
+                    if (victim.compare_exchange_weak(v, pack(range_lo(v), split), std::memory_order_acq_rel)) {
+                        mine.store(pack(split + 1, split + take), std::memory_order_release);
+                        jb.run_chunk(split);
+                        stolen = true;
+                        break;
+                    }
+                }
+            }
+            if (!stolen)
+                return;
+        }
+    }
+
+    void thread_pool::parallel_for(const std::size_t begin, const std::size_t end, std::size_t grain,
+                                   const range_func& body) {
+        if (begin >= end)
+            return;
+        const std::size_t count = end - begin;
+        grain = std::max<std::size_t>(grain, 1);
+        constexpr std::size_t max_chunks = std::numeric_limits<uint32_t>::max();
+        if (count / grain >= max_chunks)
+            grain = count / max_chunks + 1;
+        const std::size_t chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || m_workers.empty()) {
+            for (std::size_t first = begin; first < end; first += grain)
+                body(first, std::min(end, first + grain));
+            return;
+        }
+
+        std::lock_guard run(m_run_mutex);
+        job jb(body, begin, end, grain, size());
+        for (unsigned i = 0; i < size(); i++)
+            jb.ranges[i].store(pack(chunks * i / size(), chunks * (i + 1) / size()), std::memory_order_relaxed);
+        {
+            std::lock_guard lk(m_mutex);
+            m_job = &jb;
+            m_generation++;
+        }
+        m_wake.notify_all();
+        work(jb, 0);
+        {
+            std::unique_lock lk(m_mutex);
+            jb.active.fetch_sub(1, std::memory_order_acq_rel);
+            m_done.wait(lk, [&] { return jb.active.load(std::memory_order_acquire) == 0; });
+            m_job = nullptr;
+        }
+        if (jb.error)
+            std::rethrow_exception(jb.error);
+    }
+
+    void eval_range(const compiled_expr& expr, const std::span<const std::span<const double>> columns,
+                    const std::span<double> out, thread_pool& pool, const std::size_t grain) {
+        for (const auto& col : columns) {
+            if (col.size() != 1 && col.size() < out.size())
+                throw meval_error("Input column is shorter than the output",
+                                  meval_error::error_type::invalid_argument);
+        }
+        pool.parallel_for(0, out.size(), grain, [&](const std::size_t first, const std::size_t last) {
+            std::vector<std::span<const double>> cols(columns.begin(), columns.end());
+            for (auto& col : cols) {
+                if (col.size() != 1)
+                    col = col.subspan(first, last - first);
+            }
+            expr.eval_batch(cols, out.subspan(first, last - first));
+        });
+    }
+
+} // meval
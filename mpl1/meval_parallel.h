@@ -0,0 +1,62 @@
+//
+// Work-stealing thread pool and parallel evaluation over row ranges.
+//
+
+#ifndef MEVAL_PARALLEL_H
+#define MEVAL_PARALLEL_H
+
+#include "meval.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace meval {
+
+    class thread_pool {
+    public:
+        typedef std::function<void(std::size_t,std::size_t)> range_func;
+
+        // threads counts the calling thread, which always takes part in parallel_for
+        explicit thread_pool(unsigned threads = std::thread::hardware_concurrency());
+        ~thread_pool();
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        // Calls body(first,last) for consecutive sub-ranges of [begin,end) of at
+        // most grain items. Each worker starts on its own share of the range and
+        // steals half of another worker's remainder when it runs dry. The first
+        // exception thrown by body is rethrown here once all workers are done.
+        // Calls from several threads are serialised; body must not call back
+        // into the same pool.
+        void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, const range_func& body);
+
+        [[nodiscard]] unsigned size() const noexcept{return static_cast<unsigned>(m_workers.size()) + 1;}
+
+        static thread_pool& shared();
+    private:
+        struct job;
+
+        std::vector<std::thread> m_workers;
+        std::mutex m_run_mutex;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+        job* m_job=nullptr;
+        uint64_t m_generation=0;
+        bool m_stop=false;
+
+        void worker_loop(unsigned index);
+        static void work(job& jb, unsigned index);
+    };
+
+    // Evaluates expr for every row of out, splitting the rows across the pool.
+    // Columns follow compiled_expr::eval_batch (slot order, size 1 broadcasts).
+    void eval_range(const compiled_expr& expr, std::span<const std::span<const double>> columns,
+                    std::span<double> out, thread_pool& pool = thread_pool::shared(),
+                    std::size_t grain = 16 * compiled_expr::batch_block);
+
+} // meval
+
+#endif //MEVAL_PARALLEL_H
@@ -0,0 +1,281 @@
+//
+// Tokenizer, shunting-yard and bytecode emitter shared by math_expr and
+// bulk_compiler, which differ only in how a token names its symbol.
+//
+
+#ifndef MEVAL_PARSE_H
+#define MEVAL_PARSE_H
+
+#include "meval.h"
+#include "def_math.h"
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace meval {
+    namespace detail {
+        // Tokens are aggregates with a type and a number member; the type
+        // enumerates at least the token kinds of math_expr::token_type.
+        template<typename Token>
+        using token_kind = decltype(Token::type);
+
+        // The opcode of a binary operator whose callable is the plain function
+        // ptr: the builtin opcode of a def_math kernel, call_op for any other
+        // function and call_op_obj where there is no plain function. For
+        // double both the templates and the plain double forms are known.
+        template<typename T>
+        opcode binary_opcode(const typename basic_compiled_expr<T>::op_ptr ptr) {
+            static const std::pair<typename basic_compiled_expr<T>::op_ptr, opcode> builtin[] = {
+                {add<T>, opcode::add}, {sub<T>, opcode::sub}, {mul<T>, opcode::mul},
+                {div<T>, opcode::div}, {mod<T>, opcode::mod}, {pow<T>, opcode::pow},
+                {lt<T>, opcode::lt}, {le<T>, opcode::le}, {gt<T>, opcode::gt},
+                {ge<T>, opcode::ge}, {eq<T>, opcode::eq}, {ne<T>, opcode::ne},
+            };
+            if (!ptr)
+                return opcode::call_op_obj;
+            for (const auto& [fp, code] : builtin) {
+                if (fp == ptr)
+                    return code;
+            }
+            if constexpr (std::is_same_v<T, double>) {
+                typedef double (*plain_ptr)(double, double, double);
+                static const std::pair<plain_ptr, opcode> plain[] = {
+                    {static_cast<plain_ptr>(add), opcode::add}, {static_cast<plain_ptr>(sub), opcode::sub},
+                    {static_cast<plain_ptr>(mul), opcode::mul}, {static_cast<plain_ptr>(div), opcode::div},
+                    {static_cast<plain_ptr>(mod), opcode::mod}, {static_cast<plain_ptr>(pow), opcode::pow},
+                };
+                for (const auto& [fp, code] : plain) {
+                    if (fp == ptr)
+                        return code;
+                }
+            }
+            return opcode::call_op;
+        }
+
+        // Appends the tokens of src from pos on, leaving pos at the end or
+        // where it failed. The lexicon reads names with
+        //   std::size_t variable(std::string_view text, Token& tok)
+        // and likewise function and operator_binary, each returning the length
+        // of the longest registered name text starts with, 0 if none, and
+        // setting tok to the token of that name.
+        template<typename Token, typename Lexicon>
+        void tokenize(const std::string_view src, std::vector<Token>& tokens, uint32_t& pos, Lexicon& lexicon) {
+            using kind = token_kind<Token>;
+            using number_type = decltype(Token::number);
+            const auto single = [&](const kind type) {
+                Token tok{};
+                tok.type = type;
+                tokens.push_back(tok);
+                pos++;
+            };
+            while (pos < src.size()) {
+                const uint32_t start = pos;
+                const char c = src[start];
+                Token tok{};
+                if (c == basic_math_expr<double>::sym_var_start) {
+                    const auto n = lexicon.variable(src.substr(start + 1), tok);
+                    if (!n)
+                        throw meval_error("Unexpected variable name", meval_error::error_type::unknown_variable,
+                                          start + 1);
+                    pos += 1 + static_cast<uint32_t>(n);
+                    tokens.push_back(tok);
+                } else if (c == basic_math_expr<double>::sym_func_start) {
+                    const auto n = lexicon.function(src.substr(start + 1), tok);
+                    if (!n)
+                        throw meval_error("Unexpected function name", meval_error::error_type::unknown_function,
+                                          start + 1);
+                    pos += 1 + static_cast<uint32_t>(n);
+                    if (pos >= src.size() || src[pos] != basic_math_expr<double>::bracket.first)
+                        throw meval_error("function name must be followed by brackets",
+                                          meval_error::error_type::invalid_expression, pos);
+                    tokens.push_back(tok);
+                } else if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                    // literals are read at full precision for the built-in
+                    // floating types; other scalar types are constructed from
+                    // a double
+                    std::conditional_t<std::is_floating_point_v<number_type>, number_type, double> value{};
+                    const auto [end, ec] = std::from_chars(src.data() + start, src.data() + src.size(), value,
+                                                           std::chars_format::fixed);
+                    if (ec != std::errc())
+                        throw meval_error("Unexpected number", meval_error::error_type::invalid_expression, start);
+                    pos = static_cast<uint32_t>(end - src.data());
+                    tok.type = kind::number;
+                    tok.number = number_type(value);
+                    tokens.push_back(tok);
+                } else if (c == basic_math_expr<double>::bracket.first) {
+                    single(kind::open_bracket);
+                } else if (c == basic_math_expr<double>::bracket.second) {
+                    single(kind::close_bracket);
+                } else if (c == basic_math_expr<double>::ternary.first) {
+                    single(kind::conditional);
+                } else if (c == basic_math_expr<double>::ternary.second) {
+                    single(kind::alternative);
+                } else {
+                    const auto n = lexicon.operator_binary(src.substr(start), tok);
+                    if (!n)
+                        throw meval_error("Unexpected operator name", meval_error::error_type::unknown_operator,
+                                          start);
+                    pos += static_cast<uint32_t>(n);
+                    tokens.push_back(tok);
+                }
+            }
+        }
+
+        // Shunting-yard from infix tokens to postfix, with stack as working
+        // memory. precedence(tok) is that of an operator token, and throws
+        // for operators it does not know.
+        template<typename Token, typename Precedence>
+        void to_postfix(const std::vector<Token>& tokens, std::vector<Token>& stack, std::vector<Token>& postfix,
+                        Precedence precedence) {
+            using kind = token_kind<Token>;
+            //validate expression like brackets containing data and matching open close
+            int obc{};
+            stack.clear();
+            postfix.clear();
+            for (const auto& tok : tokens) {
+                switch (tok.type) {
+                    case kind::number:
+                    case kind::variable:
+                        postfix.push_back(tok);
+                        break;
+                    case kind::function:
+                        stack.push_back(tok);
+                        break;
+                    case kind::operator_binary:
+                        // brackets and functions on the stack act as barriers
+                        while (!stack.empty() && stack.back().type == kind::operator_binary &&
+                               precedence(tok) <= precedence(stack.back())) {
+                            postfix.push_back(stack.back());
+                            stack.pop_back();
+                        }
+                        stack.push_back(tok);
+                        break;
+                    case kind::conditional:
+                        // the condition is complete; an unfinished conditional
+                        // on the stack is where this one nests, as its else part
+                        while (!stack.empty() && stack.back().type == kind::operator_binary) {
+                            postfix.push_back(stack.back());
+                            stack.pop_back();
+                        }
+                        stack.push_back(tok);
+                        break;
+                    case kind::alternative:
+                        // completes the then part of the nearest open '?', and
+                        // any conditionals nested in it
+                        while (!stack.empty() && (stack.back().type == kind::operator_binary ||
+                                                  stack.back().type == kind::alternative)) {
+                            postfix.push_back(stack.back());
+                            stack.pop_back();
+                        }
+                        if (stack.empty() || stack.back().type != kind::conditional)
+                            throw meval_error("Invalid: ':' without '?'",
+                                              meval_error::error_type::invalid_expression);
+                        stack.back() = tok;
+                        break;
+                    case kind::open_bracket:
+                        obc++;
+                        stack.push_back(tok);
+                        break;
+                    case kind::close_bracket:
+                        if (obc < 1)
+                            throw meval_error("Invalid[1]: mismatched closed bracket",
+                                              meval_error::error_type::invalid_expression);
+                        obc--;
+                        while (!stack.empty() && stack.back().type != kind::open_bracket) {
+                            if (stack.back().type == kind::conditional)
+                                throw meval_error("Invalid: '?' without ':'",
+                                                  meval_error::error_type::invalid_expression);
+                            postfix.push_back(stack.back());
+                            stack.pop_back();
+                        }
+                        if (stack.empty())
+                            throw meval_error("Invalid[2]: mismatched closed bracket",
+                                              meval_error::error_type::invalid_expression);
+                        stack.pop_back();
+                        // a function applies to the bracket that directly follows it
+                        if (!stack.empty() && stack.back().type == kind::function) {
+                            postfix.push_back(stack.back());
+                            stack.pop_back();
+                        }
+                        break;
+                    default:
+                        throw meval_error("Unexpected token type", meval_error::error_type::unknown_token);
+                }
+            }
+            if (obc)
+                throw meval_error("Invalid: mismatched open bracket", meval_error::error_type::invalid_expression);
+        }
+
+        // Appends the bytecode of postfix to code and its literals to consts,
+        // checking that every operation has its operands, and returns the
+        // deepest stack it reaches. The resolver interns the symbols:
+        //   std::string_view name(const Token&)
+        //   uint32_t variable(const Token&)        the slot of the variable
+        //   instruction function(const Token&)     call_func or call_func_obj
+        //   std::pair<instruction, bool> operator_binary(const Token&)
+        // each throwing for names missing from the maps; the bool is set for a
+        // builtin opcode reached through a name the error policy flags, whose
+        // entry of builtin_modes then becomes domain_mode::flag.
+        template<typename T, typename Token, typename Resolver>
+        uint32_t emit(const std::vector<Token>& postfix, std::vector<instruction>& code, std::vector<T>& consts,
+                      std::array<domain_mode, 6>& builtin_modes, Resolver& resolver) {
+            using kind = token_kind<Token>;
+            code.reserve(code.size() + postfix.size());
+            uint32_t max_stack = 0;
+            int64_t depth = 0;
+            for (const auto& tkn : postfix) {
+                instruction in{};
+                switch (tkn.type) {
+                    case kind::number:
+                        in = {opcode::push_const, static_cast<uint32_t>(consts.size())};
+                        consts.push_back(tkn.number);
+                        depth++;
+                        break;
+                    case kind::variable:
+                        in = {opcode::push_var, resolver.variable(tkn)};
+                        depth++;
+                        break;
+                    case kind::function:
+                        in = resolver.function(tkn);
+                        if (depth < 1)
+                            throw meval_error("Function without argument: " + std::string(resolver.name(tkn)),
+                                              meval_error::error_type::invalid_expression);
+                        break;
+                    case kind::operator_binary: {
+                        const auto [op, flags] = resolver.operator_binary(tkn);
+                        in = op;
+                        if (flags)
+                            builtin_modes[static_cast<std::size_t>(in.op) - static_cast<std::size_t>(opcode::add)] =
+                                domain_mode::flag;
+                        if (depth < 2)
+                            throw meval_error("Operator without two operands: " + std::string(resolver.name(tkn)),
+                                              meval_error::error_type::invalid_expression);
+                        depth--;
+                        break;
+                    }
+                    case kind::alternative:
+                        in.op = opcode::select;
+                        if (depth < 3)
+                            throw meval_error("Conditional without three operands",
+                                              meval_error::error_type::invalid_expression);
+                        depth -= 2;
+                        break;
+                    default:
+                        throw meval_error("Unexpected token type in postfix expression",
+                                          meval_error::error_type::invalid_expression);
+                }
+                code.push_back(in);
+                max_stack = std::max(max_stack, static_cast<uint32_t>(depth));
+            }
+            if (depth != 1)
+                throw meval_error("Expression does not reduce to a single value",
+                                  meval_error::error_type::invalid_expression);
+            return max_stack;
+        }
+    }
+}
+
+#endif //MEVAL_PARSE_H
@@ -0,0 +1,742 @@
+//
+// Multi-statement programs with named intermediates, several outputs and
+// common subexpression elimination across all of them.
+//
+
+#include "meval_program.h"
+#include "def_math.h"
+#include "meval_opt.h"
+#include "meval_opt_impl.h"
+#include "meval_vecmath.h"
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <tuple>
+
+namespace meval {
+    namespace {
+        std::string_view trim(std::string_view s) {
+            while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+                s.remove_prefix(1);
+            while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+                s.remove_suffix(1);
+            return s;
+        }
+
+        bool is_name(const std::string_view s) {
+            return !s.empty() && std::all_of(s.begin(), s.end(), [](const char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+            });
+        }
+
+        struct statement {
+            std::string_view name;              // empty for an output statement
+            std::vector<std::string_view> exprs;
+            uint32_t pos;
+        };
+
+        std::vector<statement> split_statements(const std::string_view src) {
+            std::vector<statement> statements;
+            std::size_t begin = 0;
+            while (begin <= src.size()) {
+                const auto end = std::min(src.find(';', begin), src.size());
+                const auto text = trim(src.substr(begin, end - begin));
+                const auto pos = static_cast<uint32_t>(text.empty() ? begin : text.data() - src.data());
+                begin = end + 1;
+                if (text.empty())
+                    continue;
+                statement st{{}, {}, pos};
+                // a ':' after a '?' belongs to a conditional
+                if (const auto colon = text.find(':'); colon < text.find('?')) {
+                    const auto name = trim(text.substr(0, colon));
+                    if (name.size() < 2 || name[0] != math_expr::sym_var_start || !is_name(name.substr(1)))
+                        throw meval_error("Expected $name before ':'",
+                            meval_error::error_type::invalid_expression, pos);
+                    st.name = name.substr(1);
+                    st.exprs.push_back(trim(text.substr(colon + 1)));
+                } else {
+                    // split on commas outside brackets
+                    int depth = 0;
+                    std::size_t first = 0;
+                    for (std::size_t i = 0; i <= text.size(); i++) {
+                        if (i < text.size() && text[i] == math_expr::bracket.first)
+                            depth++;
+                        else if (i < text.size() && text[i] == math_expr::bracket.second)
+                            depth--;
+                        else if (i == text.size() || (text[i] == ',' && depth == 0)) {
+                            st.exprs.push_back(trim(text.substr(first, i - first)));
+                            first = i + 1;
+                        }
+                    }
+                }
+                for (const auto& e : st.exprs) {
+                    if (e.empty())
+                        throw meval_error("Empty expression", meval_error::error_type::invalid_expression, pos);
+                }
+                statements.push_back(std::move(st));
+            }
+            return statements;
+        }
+    }
+
+    math_program::math_program(const std::string& source,
+                               const std::shared_ptr<var_map>& vars,
+                               const std::shared_ptr<func_map>& funcs,
+                               const std::shared_ptr<operator_map>& ops,
+                               const compile_options& options)
+        : m_source(source),
+          m_vars(vars),
+          m_funcs(funcs),
+          m_ops(ops),
+          m_options(options) {
+        compile();
+    }
+
+    void math_program::compile() {
+        compiled_program cp;
+        cp.m_epsilon = m_options.epsilon;
+
+        // DAG of the whole program; operand ids always precede their user
+        struct dag_node {
+            instruction in;
+            int32_t lhs;
+            int32_t rhs;
+            int32_t addend;
+            // reports its domain errors, through any statement that reaches it
+            bool flagged;
+        };
+        std::vector<dag_node> nodes;
+        std::vector<std::optional<double>> value;
+        std::map<std::tuple<opcode, uint32_t, int32_t, int32_t, int32_t>, int32_t> index;
+        std::map<uint64_t, uint32_t> pooled;
+        std::map<std::string_view, uint32_t> slots, func_ids, op_ids;
+        std::vector<const double*> slot_refs;
+
+        const auto make = [&](const instruction in, int32_t lhs, int32_t rhs, const int32_t addend = -1,
+                              const bool flagged = false) {
+            // IEEE addition and multiplication are commutative, so x*y and y*x share a node
+            if ((in.op == opcode::add || in.op == opcode::mul) && lhs > rhs)
+                std::swap(lhs, rhs);
+            const auto [it, inserted] = index.try_emplace({in.op, in.arg, lhs, rhs, addend},
+                                                          static_cast<int32_t>(nodes.size()));
+            if (inserted) {
+                nodes.push_back({in, lhs, rhs, addend, flagged});
+                value.emplace_back(in.op == opcode::push_const ? std::optional(cp.m_consts[in.arg]) : std::nullopt);
+            } else {
+                nodes[it->second].flagged |= flagged;
+            }
+            return it->second;
+        };
+        const auto constant = [&](const double v) {
+            const auto [it, inserted] = pooled.try_emplace(std::bit_cast<uint64_t>(v),
+                                                           static_cast<uint32_t>(cp.m_consts.size()));
+            if (inserted)
+                cp.m_consts.push_back(v);
+            return make({opcode::push_const, it->second}, -1, -1);
+        };
+        const auto intern = [](std::map<std::string_view, uint32_t>& ids, const std::string_view name, auto& table,
+                               const auto& fn) {
+            const auto [it, inserted] = ids.try_emplace(name, static_cast<uint32_t>(table.size()));
+            if (inserted)
+                table.push_back(fn);
+            return it->second;
+        };
+        const auto is = [&value](const int32_t n, const double v) { return value[n] && *value[n] == v; };
+
+        // intermediates are visible to the lexer of later statements as variables
+        const auto scope = std::make_shared<var_map>(*m_vars);
+        std::map<std::string_view, int32_t> named;
+        std::vector<int32_t> outputs;
+        const compile_options parse_only{.level = opt_level::none, .epsilon = m_options.epsilon,
+                                         .errors = m_options.errors};
+        const bool fold = m_options.level != opt_level::none;
+
+        for (const auto& st : split_statements(m_source)) {
+            for (const auto& text : st.exprs) {
+                const math_expr expr(std::string(text), scope, m_funcs, m_ops, parse_only);
+                const compiled_expr& ce = *expr.get_compiled();
+                // without optimisation every postfix token compiles to one instruction
+                std::vector<int32_t> stack;
+                for (std::size_t i = 0; i < ce.code().size(); i++) {
+                    instruction in = ce.code()[i];
+                    const std::string_view name = expr.m_postfix[i].name;
+                    switch (in.op) {
+                        case opcode::push_const:
+                            stack.push_back(constant(ce.constants()[in.arg]));
+                            continue;
+                        case opcode::push_var: {
+                            const std::string_view var = ce.slot_names()[in.arg];
+                            if (const auto it = named.find(var); it != named.end()) {
+                                stack.push_back(it->second);
+                                continue;
+                            }
+                            const auto ref = m_vars->find(var);
+                            if (fold && m_options.consts && m_options.consts->contains(var)) {
+                                stack.push_back(constant(ref->second));
+                                continue;
+                            }
+                            const auto [slot, inserted] = slots.try_emplace(ref->first,
+                                static_cast<uint32_t>(cp.m_slots.size()));
+                            if (inserted) {
+                                cp.m_slots.emplace_back(ref->first);
+                                slot_refs.push_back(&ref->second);
+                            }
+                            stack.push_back(make({opcode::push_var, slot->second}, -1, -1));
+                            continue;
+                        }
+                        default:
+                            break;
+                    }
+                    int32_t lhs = -1, rhs = -1, addend = -1;
+                    if (operand_count(in.op) == 3) {
+                        addend = stack.back();
+                        stack.pop_back();
+                    }
+                    if (operand_count(in.op) >= 2) {
+                        rhs = stack.back();
+                        stack.pop_back();
+                    }
+                    lhs = stack.back();
+                    stack.pop_back();
+                    if (in.op == opcode::select) {
+                        if (fold && value[lhs] && value[rhs] && value[addend])
+                            stack.push_back(constant(select(*value[lhs], *value[rhs], *value[addend])));
+                        else if (m_options.level == opt_level::full && value[lhs])
+                            stack.push_back(*value[lhs] != 0 ? rhs : addend);
+                        else
+                            stack.push_back(make({opcode::select, 0}, lhs, rhs, addend));
+                        continue;
+                    }
+                    if (fold && value[lhs] && (rhs < 0 || value[rhs]) && expr_rewriter::is_pure(ce, in)) {
+                        if (const auto v = expr_rewriter::fold(ce, in, *value[lhs], rhs < 0 ? 0 : *value[rhs])) {
+                            stack.push_back(constant(*v));
+                            continue;
+                        }
+                    }
+                    if (m_options.level == opt_level::full && rhs >= 0) {
+                        // the same identities as expr_rewriter::optimize
+                        if ((in.op == opcode::add && is(rhs, 0)) || (in.op == opcode::sub && is(rhs, 0)) ||
+                            (in.op == opcode::mul && is(rhs, 1)) || (in.op == opcode::div && is(rhs, 1)) ||
+                            (in.op == opcode::pow && is(rhs, 1))) {
+                            stack.push_back(lhs);
+                            continue;
+                        }
+                        if ((in.op == opcode::add && is(lhs, 0)) || (in.op == opcode::mul && is(lhs, 1))) {
+                            stack.push_back(rhs);
+                            continue;
+                        }
+                        if ((in.op == opcode::pow && is(rhs, 0)) || (in.op == opcode::pow && is(lhs, 1))) {
+                            stack.push_back(constant(1));
+                            continue;
+                        }
+                    }
+                    switch (in.op) {
+                        case opcode::call_func:
+                            in.arg = intern(func_ids, name, cp.m_func_ptrs, ce.func_ptrs()[in.arg]);
+                            break;
+                        case opcode::call_func_obj:
+                            in.arg = intern(func_ids, name, cp.m_func_objs, ce.func_objs()[in.arg]);
+                            break;
+                        case opcode::call_op:
+                            in.arg = intern(op_ids, name, cp.m_op_ptrs, ce.op_ptrs()[in.arg]);
+                            break;
+                        case opcode::call_op_obj:
+                            in.arg = intern(op_ids, name, cp.m_op_objs, ce.op_objs()[in.arg]);
+                            break;
+                        default:
+                            in.arg = 0;
+                            break;
+                    }
+                    stack.push_back(make(in, lhs, rhs, -1, ce.flagged()[i]));
+                }
+                if (st.name.empty()) {
+                    outputs.push_back(stack.back());
+                    const bool plain_var = text.size() > 1 && text[0] == math_expr::sym_var_start &&
+                                           is_name(text.substr(1));
+                    cp.m_output_names.emplace_back(plain_var ? text.substr(1) : text);
+                } else {
+                    named[st.name] = stack.back();
+                    scope->try_emplace(st.name, 0.0);
+                }
+            }
+        }
+        if (outputs.empty())
+            throw meval_error("Program has no outputs", meval_error::error_type::invalid_expression);
+
+        // schedule the nodes reachable from an output, reusing a register once
+        // its last reader has run; outputs keep theirs to the end
+        constexpr auto pinned = std::numeric_limits<int32_t>::max();
+        std::vector<int32_t> last_use(nodes.size(), -1);
+        for (const auto out : outputs)
+            last_use[out] = pinned;
+        for (auto i = static_cast<int32_t>(nodes.size()) - 1; i >= 0; i--) {
+            if (last_use[i] < 0)
+                continue;
+            for (const auto operand : {nodes[i].lhs, nodes[i].rhs, nodes[i].addend}) {
+                if (operand >= 0 && last_use[operand] < i)
+                    last_use[operand] = i;
+            }
+        }
+        std::vector<uint32_t> reg(nodes.size());
+        std::vector<uint32_t> free;
+        std::vector<int32_t> slot_map(cp.m_slots.size(), -1);
+        std::vector<std::string> used_slots;
+        m_slot_refs.clear();
+        for (int32_t i = 0; i < static_cast<int32_t>(nodes.size()); i++) {
+            if (last_use[i] < 0)
+                continue;
+            instruction in = nodes[i].in;
+            const auto lhs = nodes[i].lhs, rhs = nodes[i].rhs, addend = nodes[i].addend;
+            if (lhs >= 0 && last_use[lhs] == i)
+                free.push_back(reg[lhs]);
+            if (rhs >= 0 && rhs != lhs && last_use[rhs] == i)
+                free.push_back(reg[rhs]);
+            if (addend >= 0 && addend != lhs && addend != rhs && last_use[addend] == i)
+                free.push_back(reg[addend]);
+            if (free.empty()) {
+                reg[i] = cp.m_registers++;
+            } else {
+                reg[i] = free.back();
+                free.pop_back();
+            }
+            if (in.op == opcode::push_var) {
+                // drop slots only read by unused intermediates
+                if (slot_map[in.arg] < 0) {
+                    slot_map[in.arg] = static_cast<int32_t>(used_slots.size());
+                    used_slots.push_back(cp.m_slots[in.arg]);
+                    m_slot_refs.push_back(slot_refs[in.arg]);
+                }
+                in.arg = slot_map[in.arg];
+            }
+            cp.m_steps.push_back({in, reg[i], lhs >= 0 ? reg[lhs] : 0, rhs >= 0 ? reg[rhs] : 0,
+                                  addend >= 0 ? reg[addend] : 0});
+            cp.m_flagged.push_back(nodes[i].flagged);
+            cp.m_has_select |= in.op == opcode::select;
+        }
+        cp.m_slots = std::move(used_slots);
+        for (const auto f : cp.m_func_ptrs)
+            cp.m_array_ptrs.push_back(m_options.vector_math ? find_array_kernel(f) : nullptr);
+        for (const auto out : outputs)
+            cp.m_outputs.push_back(reg[out]);
+        m_compiled = std::make_shared<const compiled_program>(std::move(cp));
+    }
+
+    std::vector<double> math_program::eval() const {
+        std::vector<double> out(m_compiled->outputs().size());
+        m_compiled->eval(m_slot_refs.data(), out.data());
+        return out;
+    }
+
+    void math_program::eval(const std::span<double> out) const {
+        if (out.size() < m_compiled->outputs().size())
+            throw meval_error("Expected room for " + std::to_string(m_compiled->outputs().size()) + " outputs",
+                              meval_error::error_type::invalid_argument);
+        m_compiled->eval(m_slot_refs.data(), out.data());
+    }
+
+    std::vector<std::span<const double>> math_program::bind_columns(const column_map& columns) const {
+        const auto& names = m_compiled->slot_names();
+        std::vector<std::span<const double>> cols;
+        cols.reserve(names.size());
+        for (std::size_t i = 0; i < names.size(); i++) {
+            const auto col = columns.find(names[i]);
+            cols.push_back(col != columns.end() ? col->second : std::span<const double>(m_slot_refs[i], 1));
+        }
+        return cols;
+    }
+
+    void math_program::eval_batch(const column_map& columns, const std::span<const std::span<double>> outs) const {
+        m_compiled->eval_batch(bind_columns(columns), outs);
+    }
+
+    void math_program::eval(const std::span<double> out, const std::span<uint32_t> errors) const {
+        const auto n = m_compiled->outputs().size();
+        if (out.size() < n || errors.size() < n)
+            throw meval_error("Expected room for " + std::to_string(n) + " outputs and masks",
+                              meval_error::error_type::invalid_argument);
+        m_compiled->eval(m_slot_refs.data(), out.data(), errors.data());
+    }
+
+    void math_program::eval_batch(const column_map& columns, const std::span<const std::span<double>> outs,
+                                  const std::span<const std::span<uint32_t>> errors) const {
+        m_compiled->eval_batch(bind_columns(columns), outs, errors);
+    }
+
+    // Implementation of compiled_program
+    double compiled_program::compute(const step& s, const double* r) const {
+        switch (s.in.op) {
+            case opcode::add:
+                return r[s.lhs] + r[s.rhs];
+            case opcode::sub:
+                return r[s.lhs] - r[s.rhs];
+            case opcode::mul:
+                return r[s.lhs] * r[s.rhs];
+            case opcode::div:
+                return div(r[s.lhs], r[s.rhs], m_epsilon);
+            case opcode::mod:
+                return std::fmod(r[s.lhs], r[s.rhs]);
+            case opcode::pow:
+                return std::pow(r[s.lhs], r[s.rhs]);
+            case opcode::call_func:
+                return m_func_ptrs[s.in.arg](r[s.lhs]);
+            case opcode::call_func_obj:
+                return m_func_objs[s.in.arg](r[s.lhs]);
+            case opcode::call_op:
+                return m_op_ptrs[s.in.arg](r[s.lhs], r[s.rhs], m_epsilon);
+            case opcode::call_op_obj:
+                return m_op_objs[s.in.arg](r[s.lhs], r[s.rhs], m_epsilon);
+            case opcode::lt:
+                return lt(r[s.lhs], r[s.rhs]);
+            case opcode::le:
+                return le(r[s.lhs], r[s.rhs]);
+            case opcode::gt:
+                return gt(r[s.lhs], r[s.rhs]);
+            case opcode::ge:
+                return ge(r[s.lhs], r[s.rhs]);
+            case opcode::eq:
+                return eq(r[s.lhs], r[s.rhs]);
+            case opcode::ne:
+                return ne(r[s.lhs], r[s.rhs]);
+            case opcode::select:
+                return select(r[s.lhs], r[s.rhs], r[s.addend]);
+            default:
+                // programs are parsed with opt_level::none, so there are no fused opcodes
+                return 0;
+        }
+    }
+
+    template<bool Tracked, typename Load>
+    void compiled_program::run(Load load, double* out) const {
+        constexpr uint32_t local_registers = 64;
+        double local[local_registers];
+        std::vector<double> heap;
+        double* r = local;
+        if (m_registers > local_registers) {
+            heap.resize(m_registers);
+            r = heap.data();
+        }
+        std::vector<std::exception_ptr> why(Tracked ? m_registers : 0);
+        const auto exec = [&](const step& s) {
+            if (s.in.op == opcode::push_const)
+                r[s.dst] = m_consts[s.in.arg];
+            else if (s.in.op == opcode::push_var)
+                r[s.dst] = load(s.in.arg);
+            else
+                r[s.dst] = compute(s, r);
+        };
+        for (const auto& s : m_steps) {
+            if constexpr (!Tracked) {
+                exec(s);
+                continue;
+            }
+            // dst may be an operand's register, so its errors are gathered first
+            std::exception_ptr e;
+            if (s.in.op == opcode::select) {
+                e = why[s.lhs] ? why[s.lhs] : why[r[s.lhs] != 0 ? s.rhs : s.addend];
+            } else {
+                const uint32_t operands[] = {s.lhs, s.rhs, s.addend};
+                for (uint32_t j = 0; j < operand_count(s.in.op) && !e; j++)
+                    e = why[operands[j]];
+            }
+            try {
+                exec(s);
+            } catch (...) {
+                if (!e)
+                    e = std::current_exception();
+                r[s.dst] = std::numeric_limits<double>::quiet_NaN();
+            }
+            why[s.dst] = e;
+        }
+        if constexpr (Tracked) {
+            for (const auto o : m_outputs) {
+                if (why[o])
+                    std::rethrow_exception(why[o]);
+            }
+        }
+        for (std::size_t i = 0; i < m_outputs.size(); i++)
+            out[i] = r[m_outputs[i]];
+    }
+
+    template<typename Load>
+    void compiled_program::run_raising(Load load, double* out) const {
+        try {
+            run<false>(load, out);
+        } catch (...) {
+            if (!m_has_select)
+                throw;
+            // a select may drop the error, so the program runs again keeping track
+            run<true>(load, out);
+        }
+    }
+
+    void compiled_program::eval(const double* slots, double* out) const {
+        run_raising([slots](const uint32_t i) { return slots[i]; }, out);
+    }
+
+    void compiled_program::eval(const double* const* slot_refs, double* out) const {
+        run_raising([slot_refs](const uint32_t i) { return *slot_refs[i]; }, out);
+    }
+
+    template<typename Load>
+    void compiled_program::run_masked(Load load, double* out, uint32_t* errors) const noexcept {
+        constexpr uint32_t local_registers = 64;
+        double local[local_registers];
+        uint32_t local_mask[local_registers];
+        std::vector<double> heap;
+        std::vector<uint32_t> heap_mask;
+        double* r = local;
+        uint32_t* mask = local_mask;
+        if (m_registers > local_registers) {
+            heap.resize(m_registers);
+            heap_mask.resize(m_registers);
+            r = heap.data();
+            mask = heap_mask.data();
+        }
+        for (std::size_t k = 0; k < m_steps.size(); k++) {
+            const auto& s = m_steps[k];
+            if (s.in.op == opcode::push_const || s.in.op == opcode::push_var) {
+                r[s.dst] = s.in.op == opcode::push_const ? m_consts[s.in.arg] : load(s.in.arg);
+                mask[s.dst] = eval_ok;
+                continue;
+            }
+            // dst may be an operand's register, so its operands are read first
+            const double a = r[s.lhs], b = operand_count(s.in.op) > 1 ? r[s.rhs] : a;
+            uint32_t m;
+            if (s.in.op == opcode::select) {
+                // only the errors of the operand picked
+                m = mask[s.lhs] | mask[a != 0 ? s.rhs : s.addend];
+                r[s.dst] = select(a, b, r[s.addend]);
+                mask[s.dst] = m;
+                continue;
+            }
+            m = mask[s.lhs] | (operand_count(s.in.op) > 1 ? mask[s.rhs] : eval_ok);
+            double v;
+            if (s.in.op == opcode::div && std::fabs(b) < m_epsilon) {
+                v = a / b;
+                m |= m_flagged[k] ? eval_div_by_zero : eval_ok;
+            } else {
+                try {
+                    v = compute(s, r);
+                } catch (...) {
+                    // a callable that throws yields NaN
+                    v = std::numeric_limits<double>::quiet_NaN();
+                }
+                if (m_flagged[k] && s.in.op < opcode::lt)
+                    m |= detail::domain_errors(v, a, b);
+            }
+            r[s.dst] = v;
+            mask[s.dst] = m;
+        }
+        for (std::size_t i = 0; i < m_outputs.size(); i++) {
+            out[i] = r[m_outputs[i]];
+            errors[i] = mask[m_outputs[i]];
+        }
+    }
+
+    void compiled_program::eval(const double* slots, double* out, uint32_t* errors) const noexcept {
+        run_masked([slots](const uint32_t i) { return slots[i]; }, out, errors);
+    }
+
+    void compiled_program::eval(const double* const* slot_refs, double* out, uint32_t* errors) const noexcept {
+        run_masked([slot_refs](const uint32_t i) { return *slot_refs[i]; }, out, errors);
+    }
+
+    void compiled_program::check_batch(const std::span<const std::span<const double>> columns,
+                                       const std::span<const std::span<double>> outs) const {
+        if (columns.size() != m_slots.size())
+            throw meval_error("Expected " + std::to_string(m_slots.size()) + " columns, got " +
+                              std::to_string(columns.size()),
+                              meval_error::error_type::invalid_argument);
+        if (outs.size() != m_outputs.size())
+            throw meval_error("Expected " + std::to_string(m_outputs.size()) + " output columns, got " +
+                              std::to_string(outs.size()),
+                              meval_error::error_type::invalid_argument);
+        const std::size_t rows = outs[0].size();
+        for (const auto& o : outs) {
+            if (o.size() != rows)
+                throw meval_error("Output columns differ in length", meval_error::error_type::invalid_argument);
+        }
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].size() != 1 && columns[i].size() < rows)
+                throw meval_error("Column for $" + m_slots[i] + " is shorter than the output",
+                                  meval_error::error_type::invalid_argument);
+        }
+    }
+
+    void compiled_program::eval_batch(const std::span<const std::span<const double>> columns,
+                                      const std::span<const std::span<double>> outs,
+                                      const std::span<const std::span<uint32_t>> errors) const {
+        check_batch(columns, outs);
+        const std::size_t rows = outs[0].size();
+        if (!errors.empty() && errors.size() != m_outputs.size())
+            throw meval_error("Expected " + std::to_string(m_outputs.size()) + " mask columns, got " +
+                              std::to_string(errors.size()),
+                              meval_error::error_type::invalid_argument);
+        for (const auto& e : errors) {
+            if (e.size() != rows)
+                throw meval_error("Mask columns differ in length from the output",
+                                  meval_error::error_type::invalid_argument);
+        }
+        std::vector<double> slots(columns.size());
+        std::vector<double> values(m_outputs.size());
+        std::vector<uint32_t> masks(m_outputs.size());
+        for (std::size_t k = 0; k < rows; k++) {
+            for (std::size_t i = 0; i < columns.size(); i++)
+                slots[i] = columns[i].size() == 1 ? columns[i][0] : columns[i][k];
+            run_masked([&slots](const uint32_t i) { return slots[i]; }, values.data(), masks.data());
+            for (std::size_t i = 0; i < m_outputs.size(); i++) {
+                outs[i][k] = values[i];
+                if (!errors.empty())
+                    errors[i][k] = masks[i];
+            }
+        }
+    }
+
+    void compiled_program::eval_batch(const std::span<const std::span<const double>> columns,
+                                      const std::span<const std::span<double>> outs) const {
+        check_batch(columns, outs);
+        const std::size_t rows = outs[0].size();
+        constexpr std::size_t block = compiled_expr::batch_block;
+        // one scratch block per register; a register holding an input column
+        // points straight into it
+        std::vector<double> scratch(static_cast<std::size_t>(m_registers) * block);
+        std::vector<const double*> val(m_registers);
+        const auto reg = [&scratch](const uint32_t r) { return scratch.data() + r * block; };
+        for (std::size_t row = 0; row < rows; row += block) {
+            const std::size_t n = std::min(block, rows - row);
+            try {
+                for (const auto& s : m_steps) {
+                    double* const dst = reg(s.dst);
+                    const double* a = val[s.lhs];
+                    const double* b = val[s.rhs];
+                    switch (s.in.op) {
+                        case opcode::push_const:
+                            std::fill_n(dst, n, m_consts[s.in.arg]);
+                            break;
+                        case opcode::push_var: {
+                            const auto& col = columns[s.in.arg];
+                            if (col.size() != 1) {
+                                val[s.dst] = col.data() + row;
+                                continue;
+                            }
+                            std::fill_n(dst, n, col[0]);
+                            break;
+                        }
+                        case opcode::add:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = a[i] + b[i];
+                            break;
+                        case opcode::sub:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = a[i] - b[i];
+                            break;
+                        case opcode::mul:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = a[i] * b[i];
+                            break;
+                        case opcode::div: {
+                            bool near_zero = false;
+                            for (std::size_t i = 0; i < n; i++)
+                                near_zero |= std::fabs(b[i]) < m_epsilon;
+                            if (near_zero)
+                                throw std::runtime_error("Division by zero");
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = a[i] / b[i];
+                            break;
+                        }
+                        case opcode::mod:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = std::fmod(a[i], b[i]);
+                            break;
+                        case opcode::pow:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = std::pow(a[i], b[i]);
+                            break;
+                        case opcode::call_func: {
+                            if (const auto kernel = m_array_ptrs[s.in.arg]) {
+                                kernel(a, dst, n);
+                                break;
+                            }
+                            const auto fn = m_func_ptrs[s.in.arg];
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = fn(a[i]);
+                            break;
+                        }
+                        case opcode::call_func_obj: {
+                            const auto& fn = m_func_objs[s.in.arg];
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = fn(a[i]);
+                            break;
+                        }
+                        case opcode::call_op: {
+                            const auto fn = m_op_ptrs[s.in.arg];
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = fn(a[i], b[i], m_epsilon);
+                            break;
+                        }
+                        case opcode::call_op_obj: {
+                            const auto& fn = m_op_objs[s.in.arg];
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = fn(a[i], b[i], m_epsilon);
+                            break;
+                        }
+                        case opcode::lt:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = lt(a[i], b[i]);
+                            break;
+                        case opcode::le:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = le(a[i], b[i]);
+                            break;
+                        case opcode::gt:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = gt(a[i], b[i]);
+                            break;
+                        case opcode::ge:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = ge(a[i], b[i]);
+                            break;
+                        case opcode::eq:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = eq(a[i], b[i]);
+                            break;
+                        case opcode::ne:
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = ne(a[i], b[i]);
+                            break;
+                        case opcode::select: {
+                            const double* c = val[s.addend];
+                            for (std::size_t i = 0; i < n; i++)
+                                dst[i] = select(a[i], b[i], c[i]);
+                            break;
+                        }
+                        default:
+                            break;
+                    }
+                    val[s.dst] = dst;
+                }
+            } catch (...) {
+                if (!m_has_select)
+                    throw;
+                // a select may drop the error, so the block's rows run again one
+                // by one, keeping track
+                std::vector<double> slots(columns.size());
+                std::vector<double> values(m_outputs.size());
+                for (std::size_t k = row; k < row + n; k++) {
+                    for (std::size_t i = 0; i < columns.size(); i++)
+                        slots[i] = columns[i].size() == 1 ? columns[i][0] : columns[i][k];
+                    run<true>([&slots](const uint32_t i) { return slots[i]; }, values.data());
+                    for (std::size_t i = 0; i < m_outputs.size(); i++)
+                        outs[i][k] = values[i];
+                }
+                continue;
+            }
+            for (std::size_t i = 0; i < m_outputs.size(); i++)
+                std::copy_n(val[m_outputs[i]], n, outs[i].data() + row);
+        }
+    }
+
+} // meval
@@ -0,0 +1,140 @@
+//
+// Multi-statement programs with named intermediates, several outputs and
+// common subexpression elimination across all of them.
+//
+
+#ifndef MEVAL_PROGRAM_H
+#define MEVAL_PROGRAM_H
+
+#include "meval.h"
+
+namespace meval {
+
+    // Register program over the DAG of distinct subexpressions of a
+    // math_program. Each step writes one register from registers written by
+    // earlier steps, so a subterm shared by several statements is computed
+    // once per record. Immutable, like compiled_expr.
+    class compiled_program {
+    public:
+        struct step {
+            instruction in;  // push_const and push_var load their value into dst
+            uint32_t dst;
+            uint32_t lhs;
+            uint32_t rhs;
+            uint32_t addend;  // third operand of select
+        };
+        typedef compiled_expr::func_ptr func_ptr;
+        typedef compiled_expr::op_ptr op_ptr;
+        typedef compiled_expr::array_ptr array_ptr;
+
+        // out receives one value per output
+        void eval(const double* slots, double* out) const;
+        void eval(const double* const* slot_refs, double* out) const;
+        // columns as in compiled_expr::eval_batch; outs[i] receives output i
+        void eval_batch(std::span<const std::span<const double>> columns,
+                        std::span<const std::span<double>> outs) const;
+
+        // Non-throwing evaluation, as compiled_expr: errors receives one mask
+        // per output, of the flagged domain errors reaching it.
+        void eval(const double* slots, double* out, uint32_t* errors) const noexcept;
+        void eval(const double* const* slot_refs, double* out, uint32_t* errors) const noexcept;
+        // errors is empty or holds one mask column per output, as long as the
+        // outputs; only mismatched sizes throw, before any row is evaluated
+        void eval_batch(std::span<const std::span<const double>> columns,
+                        std::span<const std::span<double>> outs,
+                        std::span<const std::span<uint32_t>> errors) const;
+
+        [[nodiscard]] const std::vector<step>& steps() const noexcept{return m_steps;}
+        [[nodiscard]] const std::vector<uint32_t>& outputs() const noexcept{return m_outputs;}
+        [[nodiscard]] const std::vector<std::string>& output_names() const noexcept{return m_output_names;}
+        [[nodiscard]] const std::vector<double>& constants() const noexcept{return m_consts;}
+        [[nodiscard]] const std::vector<std::string>& slot_names() const noexcept{return m_slots;}
+        [[nodiscard]] uint32_t registers() const noexcept{return m_registers;}
+        [[nodiscard]] double get_epsilon() const noexcept{return m_epsilon;}
+        // per step, whether the non-throwing paths report its domain errors
+        [[nodiscard]] const std::vector<uint8_t>& flagged() const noexcept{return m_flagged;}
+    private:
+        friend class math_program;
+
+        std::vector<step> m_steps;
+        std::vector<uint32_t> m_outputs;
+        std::vector<std::string> m_output_names;
+        std::vector<double> m_consts;
+        std::vector<std::string> m_slots;
+        std::vector<func_ptr> m_func_ptrs;
+        // per m_func_ptrs entry, as compiled_expr::array_ptrs
+        std::vector<array_ptr> m_array_ptrs;
+        std::vector<func_unary> m_func_objs;
+        std::vector<op_ptr> m_op_ptrs;
+        std::vector<func_binary> m_op_objs;
+        std::vector<uint8_t> m_flagged;
+        uint32_t m_registers=0;
+        double m_epsilon=1e-20;
+        bool m_has_select=false;
+
+        // Tracked keeps going past errors, remembering per register what its
+        // value failed with, and throws those that reach an output: a select
+        // drops the errors of the operand it does not pick
+        template<bool Tracked, typename Load>
+        void run(Load load, double* out) const;
+        template<typename Load>
+        void run_raising(Load load, double* out) const;
+        template<typename Load>
+        void run_masked(Load load, double* out, uint32_t* errors) const noexcept;
+        void check_batch(std::span<const std::span<const double>> columns,
+                         std::span<const std::span<double>> outs) const;
+        // value of a step other than a push over the registers r, throwing as eval does
+        [[nodiscard]] double compute(const step& s, const double* r) const;
+    };
+
+    // Source is a list of statements separated by ';':
+    //
+    //   $name: expr         named intermediate, readable as $name by later statements
+    //   expr, expr, ...     outputs, returned in order of appearance
+    //
+    // Every statement is parsed like a math_expr against the same symbol maps.
+    // The statements are then merged into one hash-consed DAG, so identical
+    // subexpressions are shared whether they were spelled out repeatedly or
+    // bound to a name; constants are folded unless options.level is none.
+    // options.errors chooses the domain errors the non-throwing evaluators
+    // report, as for math_expr. options.fast_math and options.symbols have no
+    // effect: programs keep the rounding of the formulas as written, and each
+    // statement is lexed against the maps and the intermediates before it,
+    // which the prebuilt tables do not hold.
+    class math_program {
+    public:
+        math_program(const std::string& source,
+            const std::shared_ptr<var_map>& vars,
+            const std::shared_ptr<func_map>& funcs,
+            const std::shared_ptr<operator_map>& ops,
+            const compile_options& options = {});
+
+        [[nodiscard]] std::vector<double> eval() const;
+        // out must hold one value per output
+        void eval(std::span<double> out) const;
+        // variables missing from columns are broadcast from their current var_map value
+        void eval_batch(const column_map& columns, std::span<const std::span<double>> outs) const;
+        // non-throwing counterparts of eval and eval_batch, see compiled_program
+        void eval(std::span<double> out, std::span<uint32_t> errors) const;
+        void eval_batch(const column_map& columns, std::span<const std::span<double>> outs,
+                        std::span<const std::span<uint32_t>> errors) const;
+        [[nodiscard]] std::vector<std::span<const double>> bind_columns(const column_map& columns) const;
+
+        [[nodiscard]] const std::shared_ptr<const compiled_program>& get_compiled() const noexcept{return m_compiled;}
+        [[nodiscard]] const std::vector<std::string>& output_names() const noexcept{return m_compiled->output_names();}
+        [[nodiscard]] const std::string& get_source() const noexcept{return m_source;}
+    private:
+        std::string m_source;
+        std::shared_ptr<var_map> m_vars;
+        std::shared_ptr<func_map> m_funcs;
+        std::shared_ptr<operator_map> m_ops;
+        compile_options m_options;
+        std::shared_ptr<const compiled_program> m_compiled;
+        std::vector<const double*> m_slot_refs;
+
+        void compile();
+    };
+
+} // meval
+
+#endif //MEVAL_PROGRAM_H
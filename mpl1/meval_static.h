@@ -0,0 +1,420 @@
+//
+// Formulas parsed at compile time: static_expr<"...">.
+//
+// The formula text is a template argument and is parsed during constant
+// evaluation with the grammar math_expr uses under init_def_funcs and
+// init_def_ops: numbers, $variables, @functions with bracketed arguments,
+// brackets, the operators + - * / % ^, all of equal precedence and applied
+// left to right, the comparisons < <= > >= == !=, which bind more loosely
+// and give 1 or 0, and c ? a : b, loosest of all and grouped to the right.
+// The parse becomes a tree of inline templates, so
+// static_expr<"($x^2+4)^(1/2)">{}(x) compiles to the code of
+// std::pow(std::pow(x, 2) + 4, 1.0 / 2).
+//
+// Differences from math_expr:
+//  - $pi and $e are the constants; any other $name is a parameter of the
+//    callable, in order of first appearance. A name is the longest run of
+//    letters, digits and underscores after the '$'.
+//  - evaluation never throws: division follows IEEE arithmetic instead of
+//    checking against epsilon, as in compiled_expr's non-throwing eval.
+//
+// A malformed formula stops compilation in a call to one of the functions
+// in meval::static_expr_errors, whose name the diagnostic shows.
+//
+
+#ifndef MEVAL_STATIC_H
+#define MEVAL_STATIC_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <string_view>
+
+namespace meval {
+
+    // String literal usable as a template argument.
+    template<std::size_t N>
+    struct fixed_string {
+        char data[N]{};
+
+        constexpr fixed_string(const char (&s)[N]) noexcept {
+            std::copy_n(s, N, data);
+        }
+        [[nodiscard]] constexpr std::string_view view() const noexcept{return {data, N - 1};}
+    };
+
+    // Declared only: reaching one during constant evaluation is a compile error naming it.
+    namespace static_expr_errors {
+        void unknown_function();
+        void unknown_operator();
+        void invalid_number();
+        void empty_name();
+        void function_without_brackets();
+        void mismatched_bracket();
+        void missing_operand();
+        void mismatched_conditional();
+        void not_a_single_value();
+    }
+
+    namespace detail {
+        inline constexpr std::string_view static_funcs[] = {
+            "sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh", "tanh", "asinh", "acosh", "atanh",
+            "sqrt", "log", "log10", "exp", "abs", "ceil", "floor", "round",
+        };
+
+        struct static_node {
+            enum kind_type : uint8_t { number, constant, variable, function, binary, conditional };
+
+            kind_type kind = number;
+            // binary: the operator character, or for the two character
+            // comparisons one of l (<=), g (>=), = (==) and ! (!=)
+            char op = 0;
+            uint8_t index = 0;  // function: into static_funcs; constant: 0 for pi, 1 for e
+            uint32_t var = 0;   // variable: parameter index
+            // number: mantissa * 10^exponent
+            uint64_t mantissa = 0;
+            int32_t exponent = 0;
+            int32_t lhs = -1;
+            int32_t rhs = -1;
+            int32_t otherwise = -1;  // conditional: lhs ? rhs : otherwise
+        };
+
+        template<std::size_t N>
+        struct static_program {
+            // the formula without spaces, wrapped in brackets as math_expr does
+            std::array<char, N + 2> text{};
+            std::size_t length = 0;
+            // nodes in postfix order, so the root is the last one
+            std::array<static_node, N + 2> nodes{};
+            std::size_t size = 0;
+            // parameter names as offsets into text
+            std::array<uint32_t, N + 1> var_offset{};
+            std::array<uint32_t, N + 1> var_length{};
+            std::size_t vars = 0;
+        };
+
+        constexpr bool is_name_char(const char c) noexcept {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        }
+
+        constexpr bool is_digit(const char c) noexcept {return c >= '0' && c <= '9';}
+
+        constexpr bool is_arithmetic(const char op) noexcept {
+            return op == '+' || op == '-' || op == '*' || op == '/' || op == '%' || op == '^';
+        }
+
+        template<std::size_t N>
+        consteval static_program<N> parse_static(const fixed_string<N>& s) {
+            static_program<N> p;
+            p.text[p.length++] = '(';
+            for (const char c : s.view()) {
+                if (c != ' ')
+                    p.text[p.length++] = c;
+            }
+            p.text[p.length++] = ')';
+            const std::string_view text(p.text.data(), p.length);
+
+            // pending functions, operators and open brackets (shunting-yard)
+            std::array<static_node, N + 2> ops{};
+            std::size_t op_top = 0;
+            // nodes whose value is not yet consumed
+            std::array<int32_t, N + 2> operands{};
+            std::size_t operand_top = 0;
+            const auto emit = [&](static_node nd) {
+                if (nd.kind == static_node::conditional) {
+                    if (operand_top < 3)
+                        static_expr_errors::missing_operand();
+                    nd.otherwise = operands[--operand_top];
+                    nd.rhs = operands[--operand_top];
+                    nd.lhs = operands[--operand_top];
+                } else if (nd.kind == static_node::binary) {
+                    if (operand_top < 2)
+                        static_expr_errors::missing_operand();
+                    nd.rhs = operands[--operand_top];
+                    nd.lhs = operands[--operand_top];
+                } else if (nd.kind == static_node::function) {
+                    if (operand_top < 1)
+                        static_expr_errors::missing_operand();
+                    nd.lhs = operands[--operand_top];
+                }
+                p.nodes[p.size] = nd;
+                operands[operand_top++] = static_cast<int32_t>(p.size++);
+            };
+            const auto name_end = [&](std::size_t i) {
+                while (i < text.size() && is_name_char(text[i]))
+                    i++;
+                return i;
+            };
+
+            constexpr char open = 0;  // marks a bracket on the operator stack
+            const auto pending_binary = [&] {
+                return op_top > 0 && ops[op_top - 1].kind == static_node::binary && ops[op_top - 1].op != open;
+            };
+            int brackets = 0;
+            for (std::size_t i = 0; i < text.size();) {
+                const char c = text[i];
+                if (c == '$') {
+                    const auto end = name_end(i + 1);
+                    const auto name = text.substr(i + 1, end - i - 1);
+                    if (name.empty())
+                        static_expr_errors::empty_name();
+                    static_node nd;
+                    if (name == "pi" || name == "e") {
+                        nd.kind = static_node::constant;
+                        nd.index = name == "pi" ? 0 : 1;
+                    } else {
+                        nd.kind = static_node::variable;
+                        nd.var = static_cast<uint32_t>(p.vars);
+                        for (std::size_t v = 0; v < p.vars; v++) {
+                            if (text.substr(p.var_offset[v], p.var_length[v]) == name)
+                                nd.var = static_cast<uint32_t>(v);
+                        }
+                        if (nd.var == p.vars) {
+                            p.var_offset[p.vars] = static_cast<uint32_t>(i + 1);
+                            p.var_length[p.vars++] = static_cast<uint32_t>(name.size());
+                        }
+                    }
+                    emit(nd);
+                    i = end;
+                } else if (c == '@') {
+                    const auto end = name_end(i + 1);
+                    const auto name = text.substr(i + 1, end - i - 1);
+                    static_node nd;
+                    nd.kind = static_node::function;
+                    nd.index = 0xff;
+                    for (std::size_t f = 0; f < std::size(static_funcs); f++) {
+                        if (static_funcs[f] == name)
+                            nd.index = static_cast<uint8_t>(f);
+                    }
+                    if (nd.index == 0xff)
+                        static_expr_errors::unknown_function();
+                    if (end >= text.size() || text[end] != '(')
+                        static_expr_errors::function_without_brackets();
+                    ops[op_top++] = nd;
+                    i = end;
+                } else if (is_digit(c) || c == '.') {
+                    // fixed notation as read by std::from_chars: digits[.digits]
+                    static_node nd;
+                    bool digits = false;
+                    bool fraction = false;
+                    for (; i < text.size() && (is_digit(text[i]) || (text[i] == '.' && !fraction)); i++) {
+                        if (text[i] == '.') {
+                            fraction = true;
+                            continue;
+                        }
+                        digits = true;
+                        if (nd.mantissa < (uint64_t{1} << 59)) {
+                            nd.mantissa = nd.mantissa * 10 + static_cast<uint64_t>(text[i] - '0');
+                            nd.exponent -= fraction;
+                        } else {
+                            // beyond the precision of any T; keep the magnitude
+                            nd.exponent += !fraction;
+                        }
+                    }
+                    if (!digits)
+                        static_expr_errors::invalid_number();
+                    emit(nd);
+                } else if (c == '(') {
+                    brackets++;
+                    static_node nd;
+                    nd.kind = static_node::binary;
+                    nd.op = open;
+                    ops[op_top++] = nd;
+                    i++;
+                } else if (c == ')') {
+                    if (brackets < 1)
+                        static_expr_errors::mismatched_bracket();
+                    brackets--;
+                    while (ops[op_top - 1].kind != static_node::binary || ops[op_top - 1].op != open) {
+                        if (ops[op_top - 1].kind == static_node::conditional && ops[op_top - 1].op == '?')
+                            static_expr_errors::mismatched_conditional();
+                        emit(ops[--op_top]);
+                    }
+                    op_top--;
+                    // a function applies to the bracket that directly follows it
+                    if (op_top > 0 && ops[op_top - 1].kind == static_node::function)
+                        emit(ops[--op_top]);
+                    i++;
+                } else if (is_arithmetic(c)) {
+                    // equal precedence: all arithmetic back to the last barrier applies first
+                    while (pending_binary() && is_arithmetic(ops[op_top - 1].op))
+                        emit(ops[--op_top]);
+                    static_node nd;
+                    nd.kind = static_node::binary;
+                    nd.op = c;
+                    ops[op_top++] = nd;
+                    i++;
+                } else if (c == '<' || c == '>' || c == '=' || c == '!') {
+                    const bool equals = i + 1 < text.size() && text[i + 1] == '=';
+                    if ((c == '=' || c == '!') && !equals)
+                        static_expr_errors::unknown_operator();
+                    // nothing binds more loosely, so every pending operator applies first
+                    while (pending_binary())
+                        emit(ops[--op_top]);
+                    static_node nd;
+                    nd.kind = static_node::binary;
+                    nd.op = !equals ? c : c == '<' ? 'l' : c == '>' ? 'g' : c;
+                    ops[op_top++] = nd;
+                    i += equals ? 2 : 1;
+                } else if (c == '?') {
+                    while (pending_binary())
+                        emit(ops[--op_top]);
+                    static_node nd;
+                    nd.kind = static_node::conditional;
+                    nd.op = '?';
+                    ops[op_top++] = nd;
+                    i++;
+                } else if (c == ':') {
+                    // completes the then part of the nearest open '?' and any conditional nested in it
+                    const auto then_done = [&] {
+                        return op_top > 0 && ops[op_top - 1].kind == static_node::conditional &&
+                               ops[op_top - 1].op == ':';
+                    };
+                    while (pending_binary() || then_done())
+                        emit(ops[--op_top]);
+                    if (op_top == 0 || ops[op_top - 1].kind != static_node::conditional)
+                        static_expr_errors::mismatched_conditional();
+                    ops[op_top - 1].op = ':';
+                    i++;
+                } else {
+                    static_expr_errors::unknown_operator();
+                }
+            }
+            if (brackets)
+                static_expr_errors::mismatched_bracket();
+            if (operand_top != 1)
+                static_expr_errors::not_a_single_value();
+            return p;
+        }
+
+        template<typename T>
+        constexpr T static_number(const uint64_t mantissa, const int32_t exponent) noexcept {
+            // exact, and so correctly rounded, while mantissa and the power of ten fit T's significand
+            T scale = 1;
+            for (int32_t e = exponent < 0 ? -exponent : exponent; e > 0; e--)
+                scale *= 10;
+            return exponent < 0 ? T(mantissa) / scale : T(mantissa) * scale;
+        }
+
+        template<typename T>
+        inline T static_call(const uint8_t f, const T x) noexcept {
+            using std::sin, std::cos, std::tan, std::asin, std::acos, std::atan, std::sinh, std::cosh, std::tanh,
+                std::asinh, std::acosh, std::atanh, std::sqrt, std::log, std::log10, std::exp, std::fabs, std::ceil,
+                std::floor, std::round;
+            switch (f) {
+                case 0: return sin(x);
+                case 1: return cos(x);
+                case 2: return tan(x);
+                case 3: return asin(x);
+                case 4: return acos(x);
+                case 5: return atan(x);
+                case 6: return sinh(x);
+                case 7: return cosh(x);
+                case 8: return tanh(x);
+                case 9: return asinh(x);
+                case 10: return acosh(x);
+                case 11: return atanh(x);
+                case 12: return sqrt(x);
+                case 13: return log(x);
+                case 14: return log10(x);
+                case 15: return exp(x);
+                case 16: return fabs(x);
+                case 17: return ceil(x);
+                case 18: return floor(x);
+                default: return round(x);
+            }
+        }
+    }
+
+    // Callable for a formula fixed at compile time; T is the scalar type of
+    // the parameters and the result.
+    template<fixed_string S, typename T = double>
+    class static_expr {
+        static constexpr auto m_program = detail::parse_static(S);
+
+        static constexpr auto make_variables() noexcept {
+            std::array<std::string_view, m_program.vars> names{};
+            for (std::size_t v = 0; v < names.size(); v++)
+                names[v] = std::string_view(m_program.text.data() + m_program.var_offset[v], m_program.var_length[v]);
+            return names;
+        }
+    public:
+        typedef T value_type;
+
+        static constexpr std::size_t arity = m_program.vars;
+        // parameter names without the '$', in parameter order
+        static constexpr std::array<std::string_view, arity> variables = make_variables();
+
+        // parameter index of $name, arity if the formula does not use it
+        [[nodiscard]] static consteval std::size_t slot(const std::string_view name) {
+            return static_cast<std::size_t>(std::find(variables.begin(), variables.end(), name) - variables.begin());
+        }
+
+        template<typename... A>
+            requires (sizeof...(A) == arity && (std::convertible_to<A, T> && ...))
+        [[nodiscard]] constexpr T operator()(const A... args) const noexcept {
+            const std::array<T, arity> slots{static_cast<T>(args)...};
+            return node<static_cast<int32_t>(m_program.size) - 1>(slots.data());
+        }
+
+        // slots holds the parameters in the order of variables
+        [[nodiscard]] constexpr T eval(std::span<const T, arity> slots) const noexcept {
+            return node<static_cast<int32_t>(m_program.size) - 1>(slots.data());
+        }
+    private:
+        template<int32_t I>
+        static constexpr T node(const T* const slots) noexcept {
+            constexpr detail::static_node nd = m_program.nodes[I];
+            if constexpr (nd.kind == detail::static_node::number) {
+                return detail::static_number<T>(nd.mantissa, nd.exponent);
+            } else if constexpr (nd.kind == detail::static_node::constant) {
+                return nd.index == 0 ? std::numbers::pi_v<T> : std::numbers::e_v<T>;
+            } else if constexpr (nd.kind == detail::static_node::variable) {
+                return slots[nd.var];
+            } else if constexpr (nd.kind == detail::static_node::function) {
+                return detail::static_call<T>(nd.index, node<nd.lhs>(slots));
+            } else if constexpr (nd.kind == detail::static_node::conditional) {
+                // both branches are evaluated, as in compiled_expr
+                const T c = node<nd.lhs>(slots);
+                const T a = node<nd.rhs>(slots);
+                const T b = node<nd.otherwise>(slots);
+                return c != T(0) ? a : b;
+            } else {
+                using std::fmod, std::pow;
+                const T a = node<nd.lhs>(slots);
+                const T b = node<nd.rhs>(slots);
+                if constexpr (nd.op == '+')
+                    return a + b;
+                else if constexpr (nd.op == '-')
+                    return a - b;
+                else if constexpr (nd.op == '*')
+                    return a * b;
+                else if constexpr (nd.op == '/')
+                    return a / b;
+                else if constexpr (nd.op == '%')
+                    return fmod(a, b);
+                else if constexpr (nd.op == '^')
+                    return pow(a, b);
+                else if constexpr (nd.op == '<')
+                    return a < b ? T(1) : T(0);
+                else if constexpr (nd.op == 'l')
+                    return a <= b ? T(1) : T(0);
+                else if constexpr (nd.op == '>')
+                    return a > b ? T(1) : T(0);
+                else if constexpr (nd.op == 'g')
+                    return a >= b ? T(1) : T(0);
+                else if constexpr (nd.op == '=')
+                    return a == b ? T(1) : T(0);
+                else
+                    return a != b ? T(1) : T(0);
+            }
+        }
+    };
+
+} // meval
+
+#endif //MEVAL_STATIC_H
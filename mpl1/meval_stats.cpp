@@ -0,0 +1,281 @@
+//
+// Optional instrumentation of parsing, compilation and evaluation.
+//
+
+#include "meval_stats.h"
+#include "meval_cache.h"
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+namespace meval {
+    namespace {
+        struct latency_counters {
+            detail::stats_counter summary;
+            std::array<std::atomic<uint64_t>, stats_latency_buckets> buckets{};
+        };
+
+        struct registry {
+            std::array<detail::stats_counter, stats_phase_count> phases;
+            std::array<detail::stats_counter, stats_opcode_count> opcodes;
+            latency_counters eval;
+            latency_counters batch;
+            std::mutex mutex;  // guards callables and caches
+            std::map<std::string, std::unique_ptr<detail::stats_counter>, std::less<>> callables;
+            std::set<const expr_cache*> caches;
+        };
+
+        registry& stats() {
+            static registry r;
+            return r;
+        }
+
+        void reset(detail::stats_counter& c) noexcept {
+            c.count.store(0, std::memory_order_relaxed);
+            c.total.store(0, std::memory_order_relaxed);
+        }
+
+        stats_snapshot::counter load(const detail::stats_counter& c) noexcept {
+            return {c.count.load(std::memory_order_relaxed), c.total.load(std::memory_order_relaxed)};
+        }
+
+        stats_snapshot::latency load(const latency_counters& c) noexcept {
+            stats_snapshot::latency l;
+            l.summary = load(c.summary);
+            for (std::size_t i = 0; i < stats_latency_buckets; i++)
+                l.buckets[i] = c.buckets[i].load(std::memory_order_relaxed);
+            return l;
+        }
+
+        uint64_t bucket_bound(const std::size_t i) noexcept {
+            return uint64_t{1} << i;
+        }
+
+        // quotes, backslashes and newlines, as both label values and JSON strings need
+        std::string escape(const std::string_view s) {
+            std::string out;
+            for (const char c : s) {
+                if (c == '"' || c == '\\')
+                    out += '\\';
+                if (c == '\n')
+                    out += "\\n";
+                else
+                    out += c;
+            }
+            return out;
+        }
+    }
+
+    double stats_snapshot::latency::percentile(const double p) const noexcept {
+        uint64_t total = 0;
+        for (const auto b : buckets)
+            total += b;
+        if (total == 0)
+            return 0;
+        const auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < stats_latency_buckets; i++) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return static_cast<double>(bucket_bound(i));
+        }
+        return static_cast<double>(bucket_bound(stats_latency_buckets - 1));
+    }
+
+    detail::stats_counter& detail::phase_counter(const stats_phase phase) noexcept {
+        return stats().phases[static_cast<std::size_t>(phase)];
+    }
+
+    detail::stats_counter& detail::opcode_counter(const opcode op) noexcept {
+        return stats().opcodes[static_cast<std::size_t>(op)];
+    }
+
+    detail::stats_counter* detail::callable_counter(const std::string_view name) {
+        auto& r = stats();
+        std::lock_guard lock(r.mutex);
+        auto it = r.callables.find(name);
+        if (it == r.callables.end())
+            it = r.callables.emplace(std::string(name), std::make_unique<stats_counter>()).first;
+        return it->second.get();
+    }
+
+    void detail::record_latency(const bool batch, const uint64_t ns) noexcept {
+        auto& c = batch ? stats().batch : stats().eval;
+        c.summary.add(1, ns);
+        const auto bucket = std::min<std::size_t>(std::bit_width(ns), stats_latency_buckets - 1);
+        c.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void detail::register_cache(const expr_cache* const cache) {
+        auto& r = stats();
+        std::lock_guard lock(r.mutex);
+        r.caches.insert(cache);
+    }
+
+    void detail::unregister_cache(const expr_cache* const cache) {
+        auto& r = stats();
+        std::lock_guard lock(r.mutex);
+        r.caches.erase(cache);
+    }
+
+    stats_snapshot snapshot_stats() {
+        stats_snapshot s;
+        if constexpr (!stats_enabled)
+            return s;
+        auto& r = stats();
+        for (std::size_t i = 0; i < stats_phase_count; i++)
+            s.phases[i] = load(r.phases[i]);
+        for (std::size_t i = 0; i < stats_opcode_count; i++)
+            s.opcodes[i] = load(r.opcodes[i]);
+        s.eval = load(r.eval);
+        s.batch = load(r.batch);
+        std::lock_guard lock(r.mutex);
+        for (const auto& [name, c] : r.callables)
+            s.callables.push_back({name, load(*c)});
+        for (const auto* cache : r.caches) {
+            const auto cs = cache->get_stats();
+            s.caches.push_back({cs.hits, cs.misses, cs.evictions, cs.entries});
+        }
+        return s;
+    }
+
+    void reset_stats() {
+        auto& r = stats();
+        for (auto& c : r.phases)
+            reset(c);
+        for (auto& c : r.opcodes)
+            reset(c);
+        for (auto* l : {&r.eval, &r.batch}) {
+            reset(l->summary);
+            for (auto& b : l->buckets)
+                b.store(0, std::memory_order_relaxed);
+        }
+        // callable counters stay registered; compiled expressions point at them
+        std::lock_guard lock(r.mutex);
+        for (auto& [name, c] : r.callables)
+            reset(*c);
+    }
+
+    std::string_view stats_phase_name(const stats_phase phase) noexcept {
+        static constexpr std::string_view names[] = {"symbols", "tokenize", "to_postfix", "compile"};
+        return names[static_cast<std::size_t>(phase)];
+    }
+
+    std::string_view opcode_name(const opcode op) noexcept {
+        static constexpr std::string_view names[] = {
+            "push_const", "push_var", "add", "sub", "mul", "div", "mod", "pow",
+            "call_func", "call_func_obj", "call_op", "call_op_obj",
+            "square", "recip", "sqrt", "powi", "hypot", "fma",
+            "lt", "le", "gt", "ge", "eq", "ne", "select",
+        };
+        return names[static_cast<std::size_t>(op)];
+    }
+
+    std::string stats_text(const stats_snapshot& s) {
+        std::ostringstream os;
+        const auto family = [&os](const char* name, const char* type, const char* help) {
+            os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+        };
+        family("meval_stats_enabled", "gauge", "1 if the library was built with MEVAL_STATS");
+        os << "meval_stats_enabled " << (s.enabled ? 1 : 0) << '\n';
+
+        family("meval_phase_runs_total", "counter", "Parse and compile phases run");
+        for (std::size_t i = 0; i < stats_phase_count; i++)
+            os << "meval_phase_runs_total{phase=\"" << stats_phase_name(static_cast<stats_phase>(i)) << "\"} "
+               << s.phases[i].count << '\n';
+        family("meval_phase_ns_total", "counter", "Time spent in parse and compile phases");
+        for (std::size_t i = 0; i < stats_phase_count; i++)
+            os << "meval_phase_ns_total{phase=\"" << stats_phase_name(static_cast<stats_phase>(i)) << "\"} "
+               << s.phases[i].total << '\n';
+
+        family("meval_opcode_executions_total", "counter", "Instructions executed, one per row in batches");
+        for (std::size_t i = 0; i < stats_opcode_count; i++)
+            os << "meval_opcode_executions_total{opcode=\"" << opcode_name(static_cast<opcode>(i)) << "\"} "
+               << s.opcodes[i].count << '\n';
+        family("meval_opcode_cycles_total", "counter", "Cycles spent executing instructions");
+        for (std::size_t i = 0; i < stats_opcode_count; i++)
+            os << "meval_opcode_cycles_total{opcode=\"" << opcode_name(static_cast<opcode>(i)) << "\"} "
+               << s.opcodes[i].total << '\n';
+
+        family("meval_callable_calls_total", "counter", "Calls of functions and operators by registered name");
+        for (const auto& c : s.callables)
+            os << "meval_callable_calls_total{name=\"" << escape(c.name) << "\"} " << c.calls.count << '\n';
+        family("meval_callable_cycles_total", "counter", "Cycles spent in functions and operators");
+        for (const auto& c : s.callables)
+            os << "meval_callable_cycles_total{name=\"" << escape(c.name) << "\"} " << c.calls.total << '\n';
+
+        const auto histogram = [&](const char* name, const char* help, const stats_snapshot::latency& l) {
+            family(name, "histogram", help);
+            uint64_t cumulative = 0;
+            for (std::size_t i = 0; i < stats_latency_buckets - 1; i++) {
+                cumulative += l.buckets[i];
+                os << name << "_bucket{le=\"" << bucket_bound(i) << "\"} " << cumulative << '\n';
+            }
+            os << name << "_bucket{le=\"+Inf\"} " << l.summary.count << '\n'
+               << name << "_sum " << l.summary.total << '\n'
+               << name << "_count " << l.summary.count << '\n';
+        };
+        histogram("meval_eval_latency_ns", "Latency of compiled_expr::eval", s.eval);
+        histogram("meval_batch_latency_ns", "Latency of compiled_expr::eval_batch", s.batch);
+
+        const auto cache_family = [&](const char* name, const char* type, const char* help, auto field) {
+            family(name, type, help);
+            for (std::size_t i = 0; i < s.caches.size(); i++)
+                os << name << "{cache=\"" << i << "\"} " << s.caches[i].*field << '\n';
+        };
+        cache_family("meval_cache_hits_total", "counter", "expr_cache lookups served from the cache",
+                     &stats_snapshot::cache::hits);
+        cache_family("meval_cache_misses_total", "counter", "expr_cache lookups that compiled",
+                     &stats_snapshot::cache::misses);
+        cache_family("meval_cache_evictions_total", "counter", "expr_cache entries evicted",
+                     &stats_snapshot::cache::evictions);
+        cache_family("meval_cache_entries", "gauge", "expr_cache entries held",
+                     &stats_snapshot::cache::entries);
+        return os.str();
+    }
+
+    std::string stats_json(const stats_snapshot& s) {
+        std::ostringstream os;
+        const auto counter = [&os](const stats_snapshot::counter& c, const char* total) {
+            os << "{\"count\": " << c.count << ", \"" << total << "\": " << c.total << '}';
+        };
+        const auto latency = [&](const stats_snapshot::latency& l) {
+            os << "{\"count\": " << l.summary.count << ", \"total_ns\": " << l.summary.total
+               << ", \"p50_ns\": " << l.percentile(50) << ", \"p90_ns\": " << l.percentile(90)
+               << ", \"p99_ns\": " << l.percentile(99) << ", \"buckets\": [";
+            for (std::size_t i = 0; i < stats_latency_buckets; i++)
+                os << (i ? ", " : "") << l.buckets[i];
+            os << "]}";
+        };
+        os << "{\n  \"enabled\": " << (s.enabled ? "true" : "false") << ",\n  \"phases\": {";
+        for (std::size_t i = 0; i < stats_phase_count; i++) {
+            os << (i ? ", " : "") << '"' << stats_phase_name(static_cast<stats_phase>(i)) << "\": ";
+            counter(s.phases[i], "total_ns");
+        }
+        os << "},\n  \"opcodes\": {";
+        for (std::size_t i = 0; i < stats_opcode_count; i++) {
+            os << (i ? ",\n    " : "\n    ") << '"' << opcode_name(static_cast<opcode>(i)) << "\": ";
+            counter(s.opcodes[i], "cycles");
+        }
+        os << "\n  },\n  \"callables\": {";
+        for (std::size_t i = 0; i < s.callables.size(); i++) {
+            os << (i ? ",\n    " : "\n    ") << '"' << escape(s.callables[i].name) << "\": ";
+            counter(s.callables[i].calls, "cycles");
+        }
+        os << (s.callables.empty() ? "}" : "\n  }") << ",\n  \"eval_latency\": ";
+        latency(s.eval);
+        os << ",\n  \"batch_latency\": ";
+        latency(s.batch);
+        os << ",\n  \"caches\": [";
+        for (std::size_t i = 0; i < s.caches.size(); i++) {
+            const auto& c = s.caches[i];
+            os << (i ? ", " : "") << "{\"hits\": " << c.hits << ", \"misses\": " << c.misses
+               << ", \"evictions\": " << c.evictions << ", \"entries\": " << c.entries << '}';
+        }
+        os << "]\n}\n";
+        return os.str();
+    }
+
+} // meval
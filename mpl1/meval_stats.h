@@ -0,0 +1,194 @@
+//
+// Optional instrumentation of parsing, compilation and evaluation.
+//
+// Counters are collected only when the library is built with MEVAL_STATS
+// (cmake -DMEVAL_STATS=ON). Otherwise every hook is an empty inline
+// function, the engine compiles to the same code as without them, and
+// snapshots come back empty with enabled == false.
+//
+
+#ifndef MEVAL_STATS_H
+#define MEVAL_STATS_H
+
+#include "meval.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#if defined(MEVAL_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+namespace meval {
+
+#ifdef MEVAL_STATS
+    inline constexpr bool stats_enabled = true;
+#else
+    inline constexpr bool stats_enabled = false;
+#endif
+
+    class expr_cache;
+
+    enum class stats_phase : uint8_t {
+        symbols,     // building symbol_tables
+        tokenize,
+        to_postfix,  // excluding tokenize
+        compile,     // bytecode generation, optimization and validation
+    };
+
+    inline constexpr std::size_t stats_phase_count = 4;
+    inline constexpr std::size_t stats_opcode_count = static_cast<std::size_t>(opcode::select) + 1;
+    // bucket 0 counts latencies under 1 ns, bucket i those in [2^(i-1), 2^i) ns
+    inline constexpr std::size_t stats_latency_buckets = 40;
+
+    struct stats_snapshot {
+        struct counter {
+            uint64_t count = 0;
+            // ns for phases and latencies; cycles for opcodes and callables
+            // (ns on targets without a cycle counter)
+            uint64_t total = 0;
+        };
+        struct callable {
+            std::string name;
+            counter calls;
+        };
+        struct latency {
+            counter summary;
+            std::array<uint64_t, stats_latency_buckets> buckets{};
+
+            // upper bound in ns of the bucket holding the p-th percentile
+            [[nodiscard]] double percentile(double p) const noexcept;
+        };
+        struct cache {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            uint64_t entries;
+        };
+
+        bool enabled = stats_enabled;
+        std::array<counter, stats_phase_count> phases{};
+        // batch evaluation counts one execution per row
+        std::array<counter, stats_opcode_count> opcodes{};
+        // functions and operators called through call instructions, by registered name
+        std::vector<callable> callables;
+        latency eval;   // per compiled_expr::eval
+        latency batch;  // per compiled_expr::eval_batch
+        // every live expr_cache
+        std::vector<cache> caches;
+    };
+
+    // Counters are process-wide and cumulative. The interpreter paths of
+    // compiled_expr (and so math_expr and var_binding) are instrumented; the
+    // jit, math_program and compiled_library are not.
+    [[nodiscard]] stats_snapshot snapshot_stats();
+    void reset_stats();
+    [[nodiscard]] std::string_view stats_phase_name(stats_phase phase) noexcept;
+    [[nodiscard]] std::string_view opcode_name(opcode op) noexcept;
+    // Prometheus text exposition format
+    [[nodiscard]] std::string stats_text(const stats_snapshot& s);
+    [[nodiscard]] std::string stats_json(const stats_snapshot& s);
+
+    namespace detail {
+        struct stats_counter {
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> total{0};
+
+            void add(const uint64_t n, const uint64_t t) noexcept {
+                count.fetch_add(n, std::memory_order_relaxed);
+                total.fetch_add(t, std::memory_order_relaxed);
+            }
+        };
+
+        inline uint64_t now_ns() noexcept {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        inline uint64_t cycles() noexcept {
+#if defined(MEVAL_STATS) && (defined(__x86_64__) || defined(__i386__))
+            return __rdtsc();
+#else
+            return now_ns();
+#endif
+        }
+
+        stats_counter& phase_counter(stats_phase phase) noexcept;
+        stats_counter& opcode_counter(opcode op) noexcept;
+        // created on first use and never freed, so compiled expressions may hold on to it
+        stats_counter* callable_counter(std::string_view name);
+        void record_latency(bool batch, uint64_t ns) noexcept;
+        void register_cache(const expr_cache* cache);
+        void unregister_cache(const expr_cache* cache);
+
+        // Times a parse phase until stop() or destruction, exceptions included.
+        class phase_timer {
+        public:
+            explicit phase_timer(const stats_phase phase) noexcept : m_phase(phase) {
+                if constexpr (stats_enabled)
+                    m_start = now_ns();
+            }
+            ~phase_timer() {stop();}
+            phase_timer(const phase_timer&) = delete;
+            phase_timer& operator=(const phase_timer&) = delete;
+
+            void stop() noexcept {
+                if constexpr (stats_enabled) {
+                    if (m_start) {
+                        phase_counter(m_phase).add(1, now_ns() - m_start);
+                        m_start = 0;
+                    }
+                }
+            }
+        private:
+            stats_phase m_phase;
+            uint64_t m_start=0;
+        };
+
+        // Records one eval or eval_batch call in its latency histogram.
+        class latency_timer {
+        public:
+            explicit latency_timer(const bool batch) noexcept : m_batch(batch) {
+                if constexpr (stats_enabled)
+                    m_start = now_ns();
+            }
+            ~latency_timer() {
+                if constexpr (stats_enabled)
+                    record_latency(m_batch, now_ns() - m_start);
+            }
+            latency_timer(const latency_timer&) = delete;
+            latency_timer& operator=(const latency_timer&) = delete;
+        private:
+            bool m_batch;
+            uint64_t m_start=0;
+        };
+
+        // Charges the cycles of one instruction, run over rows rows, to its
+        // opcode and, for calls, to the callable.
+        class instruction_timer {
+        public:
+            instruction_timer(const opcode op, stats_counter* const callable, const uint64_t rows) noexcept
+                : m_op(op), m_callable(callable), m_rows(rows) {
+                if constexpr (stats_enabled)
+                    m_start = cycles();
+            }
+            ~instruction_timer() {
+                if constexpr (stats_enabled) {
+                    const uint64_t c = cycles() - m_start;
+                    opcode_counter(m_op).add(m_rows, c);
+                    if (m_callable)
+                        m_callable->add(m_rows, c);
+                }
+            }
+            instruction_timer(const instruction_timer&) = delete;
+            instruction_timer& operator=(const instruction_timer&) = delete;
+        private:
+            opcode m_op;
+            stats_counter* m_callable;
+            uint64_t m_rows;
+            uint64_t m_start=0;
+        };
+    }
+
+} // meval
+
+#endif //MEVAL_STATS_H
@@ -0,0 +1,166 @@
+//
+// Variable values shared between one writer and many evaluating threads.
+//
+
+#include "meval_store.h"
+#include <bit>
+#include <thread>
+
+namespace meval {
+
+    namespace {
+        // lets a waiting reader yield once the writer has held the sequence odd for a while
+        void backoff(unsigned& spins) {
+            if (++spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    var_store::var_store(const var_map& initial)
+        : m_values(initial.size()) {
+        m_names.reserve(initial.size());
+        for (const auto& [name, value] : initial) {
+            m_index.emplace(name, static_cast<uint32_t>(m_names.size()));
+            m_values[m_names.size()].store(std::bit_cast<uint64_t>(value), std::memory_order_relaxed);
+            m_names.emplace_back(name);
+        }
+    }
+
+    int32_t var_store::slot_of(const std::string_view name) const noexcept {
+        const auto it = m_index.find(name);
+        return it == m_index.end() ? -1 : static_cast<int32_t>(it->second);
+    }
+
+    void var_store::check_slot(const uint32_t slot) const {
+        if (slot >= m_values.size())
+            throw meval_error("Slot " + std::to_string(slot) + " out of range for " +
+                              std::to_string(m_values.size()) + " variables",
+                              meval_error::error_type::invalid_argument);
+    }
+
+    template<typename Store>
+    void var_store::publish(Store store) {
+        const uint64_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store();
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    template<typename Load>
+    void var_store::consistent(Load load) const {
+        unsigned spins = 0;
+        while (true) {
+            const uint64_t seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                backoff(spins);
+                continue;
+            }
+            load();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == seq)
+                return;
+            backoff(spins);
+        }
+    }
+
+    void var_store::set(const uint32_t slot, const double value) {
+        check_slot(slot);
+        publish([&] { m_values[slot].store(std::bit_cast<uint64_t>(value), std::memory_order_relaxed); });
+    }
+
+    void var_store::set(const std::string_view name, const double value) {
+        const auto slot = slot_of(name);
+        if (slot < 0)
+            throw meval_error("Variable not in store: " + std::string(name),
+                meval_error::error_type::unknown_variable);
+        set(static_cast<uint32_t>(slot), value);
+    }
+
+    void var_store::update(const std::span<const slot_value> values) {
+        // checked up front, so that a bad slot cannot leave half an update published
+        for (const auto& [slot, value] : values)
+            check_slot(slot);
+        publish([&] {
+            for (const auto& [slot, value] : values)
+                m_values[slot].store(std::bit_cast<uint64_t>(value), std::memory_order_relaxed);
+        });
+    }
+
+    void var_store::read(const std::span<const uint32_t> slots, const std::span<double> out) const {
+        if (out.size() < slots.size())
+            throw meval_error("Expected room for " + std::to_string(slots.size()) + " values, got " +
+                              std::to_string(out.size()),
+                              meval_error::error_type::invalid_argument);
+        for (const auto slot : slots)
+            check_slot(slot);
+        consistent([&] {
+            for (std::size_t i = 0; i < slots.size(); i++)
+                out[i] = std::bit_cast<double>(m_values[slots[i]].load(std::memory_order_relaxed));
+        });
+    }
+
+    void var_store::snapshot(const std::span<double> out) const {
+        if (out.size() < m_values.size())
+            throw meval_error("Expected room for " + std::to_string(m_values.size()) + " values, got " +
+                              std::to_string(out.size()),
+                              meval_error::error_type::invalid_argument);
+        consistent([&] {
+            for (std::size_t i = 0; i < m_values.size(); i++)
+                out[i] = std::bit_cast<double>(m_values[i].load(std::memory_order_relaxed));
+        });
+    }
+
+    std::vector<uint32_t> var_store::slots_for(const compiled_expr& expr) const {
+        std::vector<uint32_t> slots;
+        slots.reserve(expr.slot_names().size());
+        for (const auto& name : expr.slot_names()) {
+            const auto slot = slot_of(name);
+            if (slot < 0)
+                throw meval_error("Variable not in store: " + name, meval_error::error_type::unknown_variable);
+            slots.push_back(static_cast<uint32_t>(slot));
+        }
+        return slots;
+    }
+
+    double var_store::eval(const compiled_expr& expr, const std::span<const uint32_t> slots) const {
+        if (slots.size() != expr.slot_names().size())
+            throw meval_error("Expected " + std::to_string(expr.slot_names().size()) + " slots, got " +
+                              std::to_string(slots.size()),
+                              meval_error::error_type::invalid_argument);
+        constexpr std::size_t local_slots = 32;
+        double local[local_slots];
+        std::vector<double> heap;
+        double* values = local;
+        if (slots.size() > local_slots) {
+            heap.resize(slots.size());
+            values = heap.data();
+        }
+        read(slots, {values, slots.size()});
+        return expr.eval(values);
+    }
+
+    double var_store::eval(const compiled_expr& expr, const std::span<const uint32_t> slots,
+                           uint32_t& errors) const noexcept {
+        constexpr std::size_t local_slots = 32;
+        double local[local_slots];
+        std::vector<double> heap;
+        double* values = local;
+        if (slots.size() > local_slots) {
+            heap.resize(slots.size());
+            values = heap.data();
+        }
+        // slots must come from slots_for, as nothing can be reported here
+        consistent([&] {
+            for (std::size_t i = 0; i < slots.size(); i++)
+                values[i] = std::bit_cast<double>(m_values[slots[i]].load(std::memory_order_relaxed));
+        });
+        return expr.eval(values, errors);
+    }
+
+} // meval
@@ -0,0 +1,67 @@
+//
+// Variable values shared between one writer and many evaluating threads.
+//
+
+#ifndef MEVAL_STORE_H
+#define MEVAL_STORE_H
+
+#include "meval.h"
+#include <atomic>
+
+namespace meval {
+
+    // A fixed set of variables in a flat slot array, published under a
+    // seqlock: the writer makes the sequence odd, stores the values and makes
+    // it even again, and readers copy the slots they need and retry if the
+    // sequence moved meanwhile. Readers take no lock and never see part of an
+    // update; the writer never waits for them. There must be one writer at a
+    // time; concurrent writers have to be serialised by the caller.
+    class var_store {
+    public:
+        typedef std::pair<uint32_t, double> slot_value;
+
+        explicit var_store(const var_map& initial);
+        var_store(const var_store&) = delete;
+        var_store& operator=(const var_store&) = delete;
+
+        [[nodiscard]] int32_t slot_of(std::string_view name) const noexcept;
+        [[nodiscard]] const std::vector<std::string>& names() const noexcept{return m_names;}
+        [[nodiscard]] std::size_t size() const noexcept{return m_names.size();}
+        // number of updates published so far
+        [[nodiscard]] uint64_t version() const noexcept{return m_seq.load(std::memory_order_acquire) / 2;}
+
+        // writer side; each call is published as one update
+        void set(uint32_t slot, double value);
+        void set(std::string_view name, double value);
+        void update(std::span<const slot_value> values);
+        void update(std::initializer_list<slot_value> values) {
+            update(std::span<const slot_value>(values.begin(), values.size()));
+        }
+
+        // reader side: out[i] = value of slots[i], all from the same update
+        void read(std::span<const uint32_t> slots, std::span<double> out) const;
+        void snapshot(std::span<double> out) const;
+
+        // store slot of each slot of expr, for eval
+        [[nodiscard]] std::vector<uint32_t> slots_for(const compiled_expr& expr) const;
+        // evaluates expr on one snapshot of the slots it reads; slots comes from slots_for
+        [[nodiscard]] double eval(const compiled_expr& expr, std::span<const uint32_t> slots) const;
+        [[nodiscard]] double eval(const compiled_expr& expr, std::span<const uint32_t> slots,
+                                  uint32_t& errors) const noexcept;
+    private:
+        std::vector<std::string> m_names;
+        std::map<std::string, uint32_t, std::less<>> m_index;
+        // doubles by bit pattern, so that racing reads are not undefined behaviour
+        std::vector<std::atomic<uint64_t>> m_values;
+        alignas(64) std::atomic<uint64_t> m_seq{0};
+
+        void check_slot(uint32_t slot) const;
+        template<typename Store>
+        void publish(Store store);
+        template<typename Load>
+        void consistent(Load load) const;
+    };
+
+} // meval
+
+#endif //MEVAL_STORE_H
@@ -0,0 +1,141 @@
+//
+// Registry of the array kernels and the CPU dispatch between their builds.
+//
+
+#include "meval_vecmath.h"
+#include "meval.h"
+#include <array>
+#include <cmath>
+#include <utility>
+
+namespace meval {
+
+    namespace {
+        typedef double (*scalar_fn)(double);
+
+        struct builtin {
+            std::string_view name;
+            scalar_fn scalar;
+            double max_ulp;
+        };
+
+        // as def_math registers them, indexed by detail::vec_func
+        const builtin builtins[detail::vf_count] = {
+            {"sin", static_cast<scalar_fn>(std::sin), 1},
+            {"cos", static_cast<scalar_fn>(std::cos), 1},
+            {"tan", static_cast<scalar_fn>(std::tan), 3},
+            {"asin", static_cast<scalar_fn>(std::asin), 1},
+            {"acos", static_cast<scalar_fn>(std::acos), 1},
+            {"atan", static_cast<scalar_fn>(std::atan), 1},
+            {"sinh", static_cast<scalar_fn>(std::sinh), 2},
+            {"cosh", static_cast<scalar_fn>(std::cosh), 2},
+            {"tanh", static_cast<scalar_fn>(std::tanh), 3},
+            {"asinh", static_cast<scalar_fn>(std::asinh), 3},
+            {"acosh", static_cast<scalar_fn>(std::acosh), 3},
+            {"atanh", static_cast<scalar_fn>(std::atanh), 3},
+            {"sqrt", static_cast<scalar_fn>(std::sqrt), 0},
+            {"log", static_cast<scalar_fn>(std::log), 1},
+            {"log10", static_cast<scalar_fn>(std::log10), 1},
+            {"exp", static_cast<scalar_fn>(std::exp), 1},
+            {"abs", static_cast<scalar_fn>(std::fabs), 0},
+            {"ceil", static_cast<scalar_fn>(std::ceil), 0},
+            {"floor", static_cast<scalar_fn>(std::floor), 0},
+            {"round", static_cast<scalar_fn>(std::round), 0},
+        };
+
+        template<std::size_t F>
+        void scalar_loop(const double* const in, double* const out, const std::size_t n) {
+            const auto f = builtins[F].scalar;
+            for (std::size_t i = 0; i < n; i++)
+                out[i] = f(in[i]);
+        }
+        template<std::size_t... F>
+        constexpr std::array<array_func, detail::vf_count> scalar_table(std::index_sequence<F...>) {
+            return {scalar_loop<F>...};
+        }
+        constexpr auto scalar_kernels = scalar_table(std::make_index_sequence<detail::vf_count>());
+
+        const array_func* table_of(const simd_level level) noexcept {
+            switch (level) {
+                case simd_level::scalar: return scalar_kernels.data();
+                case simd_level::sse2: return detail::sse2_kernels();
+                case simd_level::avx2: return detail::avx2_kernels();
+                case simd_level::avx512: return detail::avx512_kernels();
+            }
+            return nullptr;
+        }
+
+        bool cpu_has(const simd_level level) noexcept {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+            switch (level) {
+                case simd_level::avx2: return __builtin_cpu_supports("avx2");
+                case simd_level::avx512: return __builtin_cpu_supports("avx512f");
+                default: return true;
+            }
+#else
+            return level <= simd_level::sse2;
+#endif
+        }
+
+        struct level_tables {
+            std::array<std::array<array_kernel, detail::vf_count>, 4> kernels{};
+            simd_level best = simd_level::scalar;
+
+            level_tables() {
+                for (std::size_t l = 0; l < kernels.size(); l++) {
+                    const auto level = static_cast<simd_level>(l);
+                    const array_func* fns = table_of(level);
+                    if (!fns || !cpu_has(level))
+                        continue;
+                    best = level;
+                    for (std::size_t f = 0; f < detail::vf_count; f++) {
+                        const auto& b = builtins[f];
+                        // the scalar level is libm itself
+                        kernels[l][f] = {b.name, b.scalar, fns[f], level == simd_level::scalar ? 0 : b.max_ulp};
+                    }
+                }
+            }
+        };
+
+        const level_tables& tables() {
+            static const level_tables t;
+            return t;
+        }
+    }
+
+    bool simd_supported(const simd_level level) noexcept {
+        const auto l = static_cast<std::size_t>(level);
+        return l < 4 && tables().kernels[l][0].fn != nullptr;
+    }
+
+    simd_level best_simd_level() noexcept {
+        return tables().best;
+    }
+
+    std::string_view simd_level_name(const simd_level level) noexcept {
+        switch (level) {
+            case simd_level::scalar: return "scalar";
+            case simd_level::sse2: return "sse2";
+            case simd_level::avx2: return "avx2";
+            case simd_level::avx512: return "avx512";
+        }
+        return "unknown";
+    }
+
+    std::span<const array_kernel> array_kernels(const simd_level level) {
+        if (!simd_supported(level))
+            throw meval_error("SIMD level not supported here: " + std::string(simd_level_name(level)),
+                              meval_error::error_type::invalid_argument);
+        return tables().kernels[static_cast<std::size_t>(level)];
+    }
+
+    array_func find_array_kernel(const scalar_fn scalar) noexcept {
+        const auto& t = tables();
+        for (const auto& k : t.kernels[static_cast<std::size_t>(t.best)]) {
+            if (k.scalar == scalar)
+                return k.fn;
+        }
+        return nullptr;
+    }
+
+} // meval
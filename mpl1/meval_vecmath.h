@@ -0,0 +1,79 @@
+//
+// Array-at-a-time kernels for the built-in functions of def_math.
+//
+
+#ifndef MEVAL_VECMATH_H
+#define MEVAL_VECMATH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace meval {
+
+    // Instruction sets the kernels are compiled for, picked at run time by
+    // best_simd_level(). sse2 is the 2-lane build, which uses the target's
+    // own vectors outside x86-64; scalar loops over libm.
+    enum class simd_level : uint8_t {
+        scalar,
+        sse2,
+        avx2,
+        avx512,
+    };
+
+    // out[i] = f(in[i]) for i < n; in and out may be the same array
+    typedef void (*array_func)(const double* in, double* out, std::size_t n);
+
+    // One built-in function. The kernels are polynomial approximations after
+    // range reduction. max_ulp bounds their error against the exact result
+    // over the whole double range, or is 0 where the results are libm's bit
+    // for bit:
+    //
+    //   sqrt abs ceil floor round                  0
+    //   sin cos exp log log10 asin acos atan       1
+    //   sinh cosh                                  2
+    //   tan tanh asinh acosh atanh                 3
+    //
+    // libm is not exact either (glibc's hyperbolic functions and log10 are
+    // off by up to 2 ulp), so the two can differ by both errors combined.
+    // Special values (NaN, infinities, signed zeros, arguments outside the
+    // domain) give the libm results. sin, cos and tan hand arguments beyond
+    // 2^20*pi/2 to libm, whose reduction is exact there.
+    struct array_kernel {
+        std::string_view name;
+        double (*scalar)(double);
+        array_func fn;
+        double max_ulp;
+    };
+
+    [[nodiscard]] bool simd_supported(simd_level level) noexcept;
+    // widest level both compiled in and supported by this CPU, detected once
+    [[nodiscard]] simd_level best_simd_level() noexcept;
+    [[nodiscard]] std::string_view simd_level_name(simd_level level) noexcept;
+
+    // kernels of every built-in at level, in def_math registration order;
+    // throws meval_error if the level is not supported
+    [[nodiscard]] std::span<const array_kernel> array_kernels(simd_level level);
+    [[nodiscard]] inline std::span<const array_kernel> array_kernels() {
+        return array_kernels(best_simd_level());
+    }
+    // kernel at best_simd_level() for a built-in registered as scalar, else null
+    [[nodiscard]] array_func find_array_kernel(double (*scalar)(double)) noexcept;
+
+    namespace detail {
+        // kernel tables of the per-ISA translation units, null when not compiled in
+        enum vec_func : uint32_t {
+            vf_sin, vf_cos, vf_tan, vf_asin, vf_acos, vf_atan,
+            vf_sinh, vf_cosh, vf_tanh, vf_asinh, vf_acosh, vf_atanh,
+            vf_sqrt, vf_log, vf_log10, vf_exp, vf_abs, vf_ceil, vf_floor, vf_round,
+            vf_count
+        };
+        const array_func* sse2_kernels() noexcept;
+        const array_func* avx2_kernels() noexcept;
+        const array_func* avx512_kernels() noexcept;
+    }
+
+} // meval
+
+#endif //MEVAL_VECMATH_H
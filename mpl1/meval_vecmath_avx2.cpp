@@ -0,0 +1,22 @@
+//
+// 4-lane kernels, built with -mavx2 when the compiler targets x86-64.
+//
+
+#if defined(__AVX2__)
+#define MEVAL_VEC_LANES 4
+#include "meval_vecmath_impl.h"
+#else
+#include "meval_vecmath.h"
+#endif
+
+namespace meval::detail {
+
+    const array_func* avx2_kernels() noexcept {
+#if defined(__AVX2__)
+        return kernels;
+#else
+        return nullptr;
+#endif
+    }
+
+} // meval::detail
@@ -0,0 +1,22 @@
+//
+// 8-lane kernels, built with -mavx512f when the compiler targets x86-64.
+//
+
+#if defined(__AVX512F__)
+#define MEVAL_VEC_LANES 8
+#include "meval_vecmath_impl.h"
+#else
+#include "meval_vecmath.h"
+#endif
+
+namespace meval::detail {
+
+    const array_func* avx512_kernels() noexcept {
+#if defined(__AVX512F__)
+        return kernels;
+#else
+        return nullptr;
+#endif
+    }
+
+} // meval::detail
@@ -0,0 +1,492 @@
+//
+// Kernels of meval_vecmath.h, written once with GCC/Clang vector extensions.
+// Each meval_vecmath_<isa>.cpp defines MEVAL_VEC_LANES and includes this file
+// compiled for its instruction set. Everything here has internal linkage, so
+// the linker cannot hand code built for a wider ISA to another caller.
+//
+// The algorithms and coefficients are fdlibm's (as in FreeBSD msun). Its
+// branches become per-lane selects: every lane computes each path and
+// keeps the one its argument needs.
+//
+
+#ifndef MEVAL_VECMATH_IMPL_H
+#define MEVAL_VECMATH_IMPL_H
+
+#ifndef MEVAL_VEC_LANES
+#error "MEVAL_VEC_LANES must be defined before including meval_vecmath_impl.h"
+#endif
+
+#include "meval_vecmath.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace meval::detail {
+namespace {
+
+    constexpr int lanes = MEVAL_VEC_LANES;
+    typedef double vd __attribute__((vector_size(8 * lanes)));
+    // type of a comparison of two vd, all bits set in the lanes where it holds
+    typedef decltype(vd{} < vd{}) vi;
+    typedef uint64_t vu __attribute__((vector_size(8 * lanes)));
+
+    constexpr double inf = __builtin_inf();
+    constexpr double nan = __builtin_nan("");
+    constexpr int64_t sign_bit = INT64_MIN;
+
+    constexpr double bits(const uint64_t u) {
+        return __builtin_bit_cast(double, u);
+    }
+
+    inline vd sel(const vi m, const vd a, const vd b) {
+        return (vd)((m & (vi)a) | (~m & (vi)b));
+    }
+    inline vd vabs(const vd x) {
+        return (vd)((vi)x & ~sign_bit);
+    }
+    // |r| with the sign of x
+    inline vd with_sign(const vd r, const vd x) {
+        return (vd)(((vi)r & ~sign_bit) | ((vi)x & sign_bit));
+    }
+    // Integers below 2^51 in magnitude are added to and read from the low
+    // mantissa bits of 1.5*2^52, as SSE2 and AVX2 have no conversion
+    // between double and 64-bit integer lanes.
+    constexpr double shifter = 0x1.8p52;
+    constexpr int64_t shifter_bits = __builtin_bit_cast(int64_t, shifter);
+
+    // nearest integer, ties to even, for |x| < 2^51
+    inline vd round_even(const vd x) {
+        return (x + shifter) - shifter;
+    }
+    // the same as an integer
+    inline vi round_to_int(const vd x) {
+        return (vi)(x + shifter) - shifter_bits;
+    }
+    inline vd to_double(const vi k) {
+        return (vd)(k + shifter_bits) - shifter;
+    }
+    // logical shift, as SSE2 and AVX2 have no arithmetic one for 64-bit lanes
+    inline vi shift_right(const vi v, const int n) {
+        return (vi)((vu)v >> n);
+    }
+    // the same for x >= 0, up to 2^52
+    inline vd round_even_pos(const vd x) {
+        constexpr double shifter = 0x1p52;
+        return (x + shifter) - shifter;
+    }
+    // 2^k for -1022 <= k <= 1023
+    inline vd pow2(const vi k) {
+        return (vd)((k + 1023) << 52);
+    }
+    inline vd clear_low_word(const vd x) {
+        return (vd)((vi)x & int64_t(0xffffffff00000000));
+    }
+    inline vd vsqrt(vd x) {
+#if MEVAL_VEC_LANES == 8 && defined(__AVX512F__)
+        return _mm512_mask_sqrt_pd(x, 0xff, x);
+#elif MEVAL_VEC_LANES == 4 && defined(__AVX__)
+        return _mm256_sqrt_pd(x);
+#elif MEVAL_VEC_LANES == 2 && defined(__SSE2__)
+        return _mm_sqrt_pd(x);
+#else
+        for (int i = 0; i < lanes; i++)
+            x[i] = __builtin_sqrt(x[i]);
+        return x;
+#endif
+    }
+    // r with the lanes selected by use recomputed by the scalar function
+    template<typename Scalar>
+    inline vd patch(const vi use, const vd x, vd r, const Scalar f) {
+        for (int i = 0; i < lanes; i++) {
+            if (use[i])
+                r[i] = f(x[i]);
+        }
+        return r;
+    }
+
+    // exp(x)/2^scale: x = k*ln2 + r with |r| <= ln2/2, exp(r) from a
+    // rational fit, times 2^(k-scale) in two steps so that subnormal results
+    // round once
+    template<int scale>
+    inline vd exp_scaled(const vd x) {
+        constexpr double ln2_hi = bits(0x3fe62e42fee00000), ln2_lo = bits(0x3dea39ef35793c76);
+        constexpr double inv_ln2 = bits(0x3ff71547652b82fe);
+        constexpr double o_threshold = bits(0x40862e42fefa39ef) + scale * ln2_hi;
+        constexpr double u_threshold = bits(0xc0874910d52d3051) + scale * ln2_hi;
+        constexpr double P1 = 1.66666666666666019037e-01, P2 = -2.77777777770155933842e-03,
+                         P3 = 6.61375632143793436117e-05, P4 = -1.65339022054652515390e-06,
+                         P5 = 4.13813679705723846039e-08;
+        // clamped and NaN-free, so that k converts to an integer in range
+        vd xc = sel(x > o_threshold, vd{} + o_threshold, x);
+        xc = sel(xc < u_threshold, vd{} + u_threshold, xc);
+        xc = sel(x == x, xc, vd{});
+        const vd kf = round_even(xc * inv_ln2);
+        const vi k = round_to_int(xc * inv_ln2) - scale;
+        const vd hi = xc - kf * ln2_hi;
+        const vd lo = kf * ln2_lo;
+        const vd r = hi - lo;
+        const vd t = r * r;
+        const vd c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+        const vd y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+        const vi k1 = shift_right(k + 2048, 1) - 1024;
+        vd res = y * pow2(k1) * pow2(k - k1);
+        res = sel(x > o_threshold, vd{} + inf, res);
+        res = sel(x < u_threshold, vd{}, res);
+        return sel(x == x, res, x);
+    }
+    inline vd v_exp(const vd x) {
+        return exp_scaled<0>(x);
+    }
+
+    // x = 2^k * (1+f) with sqrt(2)/2 <= 1+f < sqrt(2); hx holds the high
+    // mantissa bits fdlibm picks the rounding of log by
+    struct log_split {
+        vd f;
+        vd k;
+        vi hx;
+    };
+    inline log_split log_reduce(vd x) {
+        const vi tiny = x < 0x1p-1022;
+        x = sel(tiny, x * 0x1p54, x);
+        vi hx = shift_right((vi)x, 32);
+        vi k = shift_right(hx, 20) - 1023 - (tiny & 54);
+        hx &= 0x000fffff;
+        const vi i = (hx + 0x95f64) & 0x100000;
+        const vi norm = ((hx | (i ^ 0x3ff00000)) << 32) | ((vi)x & 0xffffffff);
+        k += shift_right(i, 20);
+        return {(vd)norm - 1.0, to_double(k), hx};
+    }
+    // s = f/(2+f) and the fit R with log(1+f) = f - f*f/2 + s*(f*f/2 + R)
+    struct log_fit {
+        vd s;
+        vd R;
+    };
+    inline log_fit log_poly(const vd f) {
+        constexpr double Lg1 = 6.666666666666735130e-01, Lg2 = 3.999999999940941908e-01,
+                         Lg3 = 2.857142874366239149e-01, Lg4 = 2.222219843214978396e-01,
+                         Lg5 = 1.818357216161805012e-01, Lg6 = 1.531383769920937332e-01,
+                         Lg7 = 1.479819860511658591e-01;
+        const vd s = f / (2.0 + f);
+        const vd z = s * s;
+        const vd w = z * z;
+        return {s, z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7))) + w * (Lg2 + w * (Lg4 + w * Lg6))};
+    }
+    // results of log-like functions at x = 0, x < 0, +inf and NaN
+    inline vd log_special(const vd x, vd r) {
+        r = sel(x == 0.0, vd{} - inf, r);
+        r = sel(x < 0.0, vd{} + nan, r);
+        r = sel(x == inf, vd{} + inf, r);
+        return sel(x == x, r, x);
+    }
+
+    inline vd v_log(const vd x) {
+        constexpr double ln2_hi = bits(0x3fe62e42fee00000), ln2_lo = bits(0x3dea39ef35793c76);
+        const auto [f, k, hx] = log_reduce(x);
+        const auto [s, R] = log_poly(f);
+        const vd hfsq = 0.5 * f * f;
+        const vd a = k * ln2_hi - ((hfsq - (s * (hfsq + R) + k * ln2_lo)) - f);
+        const vd b = k * ln2_hi - ((s * (f - R) - k * ln2_lo) - f);
+        const vi with_hfsq = to_double((hx - 0x6147a) | (0x6b851 - hx)) > 0.0;
+        return log_special(x, sel(with_hfsq, a, b));
+    }
+
+    inline vd v_log10(const vd x) {
+        constexpr double ivln10_hi = bits(0x3fdbcb7b15200000), ivln10_lo = bits(0x3dbb9438ca9aadd5);
+        constexpr double log10_2hi = bits(0x3fd34413509f6000), log10_2lo = bits(0x3d59fef311f12b36);
+        const auto [f, k, hx] = log_reduce(x);
+        const auto [s, R] = log_poly(f);
+        const vd hfsq = 0.5 * f * f;
+        const vd r = s * (hfsq + R);
+        const vd hi = clear_low_word(f - hfsq);
+        const vd lo = (f - hi) - hfsq + r;
+        const vd y2 = k * log10_2hi;
+        const vd val_hi = hi * ivln10_hi;
+        const vd val_lo = k * log10_2lo + (lo + hi) * ivln10_lo + lo * ivln10_hi;
+        const vd w = y2 + val_hi;
+        return log_special(x, (val_lo + ((y2 - w) + val_hi)) + w);
+    }
+
+    // a - b = d + error exactly, whatever the magnitudes
+    inline vd two_diff(const vd a, const vd b, vd& error) {
+        const vd d = a - b;
+        const vd bb = a - d;
+        error = (a - (d + bb)) + (bb - b);
+        return d;
+    }
+
+    // x = n*pi/2 + y0 + y1 for |x| <= 2^20*pi/2. pi/2 is split as in fdlibm's
+    // __ieee754_rem_pio2 into 33-bit parts whose products with n are exact;
+    // every lane subtracts all three and keeps the rounding errors of the
+    // last two, instead of branching on how much cancelled.
+    struct pio2_split {
+        vd y0;
+        vd y1;
+        vd n;
+    };
+    inline pio2_split rem_pio2(const vd x) {
+        constexpr double inv_pio2 = bits(0x3fe45f306dc9c883);
+        constexpr double pio2_1 = bits(0x3ff921fb54400000);
+        constexpr double pio2_2 = bits(0x3dd0b4611a600000);
+        constexpr double pio2_3 = bits(0x3ba3198a2e000000), pio2_3t = bits(0x397b839a252049c1);
+        const vd fn = round_even(x * inv_pio2);
+        const vd r1 = x - fn * pio2_1;
+        vd e2, e3;
+        const vd r2 = two_diff(r1, fn * pio2_2, e2);
+        const vd r3 = two_diff(r2, fn * pio2_3, e3);
+        const vd tail = (e2 + e3) - fn * pio2_3t;
+        // n == 0 leaves x as it is, which keeps the sign of -0
+        const vd y0 = sel(fn == 0.0, x, r3 + tail);
+        return {y0, (r3 - y0) + tail, fn};
+    }
+    // sin(y0+y1) and cos(y0+y1) for |y0| <= pi/4
+    inline vd k_sin(const vd x, const vd y) {
+        constexpr double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+                         S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+                         S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+        const vd z = x * x;
+        const vd w = z * z;
+        const vd r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+        const vd v = z * x;
+        return x - ((z * (0.5 * y - v * r) - y) - v * S1);
+    }
+    inline vd k_cos(const vd x, const vd y) {
+        constexpr double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+                         C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+                         C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+        const vd z = x * x;
+        const vd w = z * z;
+        const vd r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+        const vd hz = 0.5 * z;
+        const vd u = 1.0 - hz;
+        return u + (((1.0 - u) - hz) + (z * r - x * y));
+    }
+    // lanes rem_pio2 cannot reduce: beyond 2^20*pi/2, infinities and NaN
+    inline vi trig_unreduced(const vd x) {
+        return ~(vabs(x) < bits(0x413921fc00000000));
+    }
+    // the sign bit where bit b of the quadrant n is set
+    inline vi quadrant_sign(const vd n, const int b) {
+        return round_to_int(n) << (63 - b);
+    }
+    inline vi quadrant_odd(const vd n) {
+        return 0.5 * n != round_even(0.5 * n);
+    }
+
+    inline vd v_sin(const vd x) {
+        const auto [y0, y1, n] = rem_pio2(x);
+        const vd s = k_sin(y0, y1);
+        const vd c = k_cos(y0, y1);
+        const vd r = (vd)((vi)sel(quadrant_odd(n), c, s) ^ (quadrant_sign(n, 1) & sign_bit));
+        return patch(trig_unreduced(x), x, r, [](const double v) { return __builtin_sin(v); });
+    }
+    inline vd v_cos(const vd x) {
+        const auto [y0, y1, n] = rem_pio2(x);
+        const vd s = k_sin(y0, y1);
+        const vd c = k_cos(y0, y1);
+        const vd r = (vd)((vi)sel(quadrant_odd(n), s, c) ^ (quadrant_sign(n + 1.0, 1) & sign_bit));
+        return patch(trig_unreduced(x), x, r, [](const double v) { return __builtin_cos(v); });
+    }
+    inline vd v_tan(const vd x) {
+        const auto [y0, y1, n] = rem_pio2(x);
+        const vd s = k_sin(y0, y1);
+        const vd c = k_cos(y0, y1);
+        const vi odd = quadrant_odd(n);
+        const vd r = sel(odd, -c, s) / sel(odd, s, c);
+        return patch(trig_unreduced(x), x, r, [](const double v) { return __builtin_tan(v); });
+    }
+
+    // rational fit shared by asin and acos, for 0 <= t <= 0.25
+    inline vd asin_ratio(const vd t) {
+        constexpr double pS0 = 1.66666666666666657415e-01, pS1 = -3.25565818622400915405e-01,
+                         pS2 = 2.01212532134862925881e-01, pS3 = -4.00555345006794114027e-02,
+                         pS4 = 7.91534994289814532176e-04, pS5 = 3.47933107596021167570e-05;
+        constexpr double qS1 = -2.40339491173441421878e+00, qS2 = 2.02094576023350569471e+00,
+                         qS3 = -6.88283971605453293030e-01, qS4 = 7.70381505559019352791e-02;
+        const vd p = t * (pS0 + t * (pS1 + t * (pS2 + t * (pS3 + t * (pS4 + t * pS5)))));
+        const vd q = 1.0 + t * (qS1 + t * (qS2 + t * (qS3 + t * qS4)));
+        return p / q;
+    }
+    constexpr double pio2_hi = bits(0x3ff921fb54442d18), pio2_lo = bits(0x3c91a62633145c07);
+    constexpr double pio4_hi = bits(0x3fe921fb54442d18);
+
+    inline vd v_asin(const vd x) {
+        const vd ax = vabs(x);
+        const vi small = ax < 0.5;
+        const vd t = sel(small, ax * ax, (1.0 - ax) * 0.5);
+        const vd r = asin_ratio(t);
+        const vd s = vsqrt(t);
+        const vd near_one = pio2_hi - (2.0 * (s + s * r) - pio2_lo);
+        const vd w = clear_low_word(s);
+        const vd c = (t - w * w) / (s + w);
+        const vd p = 2.0 * s * r - (pio2_lo - 2.0 * c);
+        const vd middle = pio4_hi - (p - (pio4_hi - 2.0 * w));
+        const vd res = sel(small, ax + ax * r, sel(ax >= 0.975, near_one, middle));
+        return with_sign(sel(ax > 1.0, vd{} + nan, res), x);
+    }
+    inline vd v_acos(const vd x) {
+        constexpr double pi = bits(0x400921fb54442d18);
+        const vd ax = vabs(x);
+        const vi small = ax < 0.5;
+        const vd z = sel(small, x * x, (1.0 - ax) * 0.5);
+        const vd r = asin_ratio(z);
+        const vd s = vsqrt(z);
+        const vd neg = pi - 2.0 * (s + (r * s - pio2_lo));
+        const vd df = clear_low_word(s);
+        const vd c = (z - df * df) / (s + df);
+        const vd pos = 2.0 * (df + (r * s + c));
+        vd res = sel(small, pio2_hi - (x - (pio2_lo - x * r)), sel(x < 0.0, neg, pos));
+        res = sel(x == 1.0, vd{}, res);
+        return sel(ax > 1.0, vd{} + nan, res);
+    }
+    inline vd v_atan(const vd x) {
+        constexpr double aT0 = 3.33333333333329318027e-01, aT1 = -1.99999999998764832476e-01,
+                         aT2 = 1.42857142725034663711e-01, aT3 = -1.11111104054623557880e-01,
+                         aT4 = 9.09088713343650656196e-02, aT5 = -7.69187620504482999495e-02,
+                         aT6 = 6.66107313738753120669e-02, aT7 = -5.83357013379057348645e-02,
+                         aT8 = 4.97687799461593236017e-02, aT9 = -3.65315727442169155270e-02,
+                         aT10 = 1.62858201153657823623e-02;
+        const vd ax = vabs(x);
+        // fdlibm's five intervals, each reduced to |t| <= 7/16 around atan(0), atan(0.5), ..., atan(inf)
+        const vi i0 = ax < 0.4375, i1 = ax < 0.6875, i2 = ax < 1.1875, i3 = ax < 2.4375;
+        const vd num = sel(i0, ax, sel(i1, 2.0 * ax - 1.0, sel(i2, ax - 1.0, sel(i3, ax - 1.5, vd{} - 1.0))));
+        const vd den = sel(i0, vd{} + 1.0, sel(i1, 2.0 + ax, sel(i2, ax + 1.0, sel(i3, 1.0 + 1.5 * ax, ax))));
+        const vd hi = sel(i0, vd{}, sel(i1, vd{} + bits(0x3fddac670561bb4f),
+                          sel(i2, vd{} + bits(0x3fe921fb54442d18),
+                          sel(i3, vd{} + bits(0x3fef730bd281f69b), vd{} + bits(0x3ff921fb54442d18)))));
+        const vd lo = sel(i0, vd{}, sel(i1, vd{} + bits(0x3c7a2b7f222f65e2),
+                          sel(i2, vd{} + bits(0x3c81a62633145c07),
+                          sel(i3, vd{} + bits(0x3c7007887af0cbbd), vd{} + bits(0x3c91a62633145c07)))));
+        const vd t = num / den;
+        const vd z = t * t;
+        const vd w = z * z;
+        const vd s1 = z * (aT0 + w * (aT2 + w * (aT4 + w * (aT6 + w * (aT8 + w * aT10)))));
+        const vd s2 = w * (aT1 + w * (aT3 + w * (aT5 + w * (aT7 + w * aT9))));
+        return with_sign(hi - ((t * (s1 + s2) - lo) - t), x);
+    }
+
+    // Taylor series of sinh and cosh, good to half an ulp for |x| <= 1
+    inline vd sinh_series(const vd x) {
+        constexpr double c3 = 1.0 / 6, c5 = c3 / 20, c7 = c5 / 42, c9 = c7 / 72, c11 = c9 / 110,
+                         c13 = c11 / 156, c15 = c13 / 210, c17 = c15 / 272, c19 = c17 / 342;
+        const vd z = x * x;
+        return x + x * z * (c3 + z * (c5 + z * (c7 + z * (c9 + z * (c11 + z * (c13 + z * (c15 + z * (c17 + z * c19))))))));
+    }
+    inline vd cosh_series(const vd x) {
+        constexpr double c2 = 0.5, c4 = c2 / 12, c6 = c4 / 30, c8 = c6 / 56, c10 = c8 / 90,
+                         c12 = c10 / 132, c14 = c12 / 182, c16 = c14 / 240, c18 = c16 / 306, c20 = c18 / 380;
+        const vd z = x * x;
+        return 1.0 + z * (c2 + z * (c4 + z * (c6 + z * (c8 + z * (c10 + z * (c12 + z * (c14 + z * (c16 + z * (c18 + z * c20)))))))));
+    }
+    inline vd v_sinh(const vd x) {
+        const vd ax = vabs(x);
+        const vd h = exp_scaled<1>(ax);
+        return with_sign(sel(ax < 1.0, sinh_series(ax), h - 0.25 / h), x);
+    }
+    inline vd v_cosh(const vd x) {
+        const vd ax = vabs(x);
+        const vd h = exp_scaled<1>(ax);
+        return sel(ax < 1.0, cosh_series(ax), h + 0.25 / h);
+    }
+    inline vd v_tanh(const vd x) {
+        const vd ax = vabs(x);
+        const vd small = sinh_series(ax) / cosh_series(ax);
+        const vd big = 1.0 - 2.0 / (v_exp(2.0 * ax) + 1.0);
+        return with_sign(sel(ax < 0.625, small, big), x);
+    }
+
+    // log(1+u) for u >= 0 and finite is log(w) + c, with w = 1+u and c
+    // correcting for the rounding of w; callers select among several
+    // (w, c) pairs so that every lane goes through a single log
+    struct log_arg {
+        vd w;
+        vd c;
+    };
+    inline log_arg log1p_arg(const vd u) {
+        const vd w = 1.0 + u;
+        return {w, (u - (w - 1.0)) / w};
+    }
+
+    constexpr double ln2 = bits(0x3fe62e42fefa39ef);
+    inline vd v_asinh(const vd x) {
+        const vd ax = vabs(x);
+        const vd t = ax * ax;
+        const vi huge = ax > 0x1p28, big = ax > 2.0;
+        const auto [w, c] = log1p_arg(ax + t / (1.0 + vsqrt(1.0 + t)));
+        const vd arg = sel(huge, ax, sel(big, 2.0 * ax + 1.0 / (vsqrt(t + 1.0) + ax), w));
+        const vd corr = sel(huge, vd{} + ln2, sel(big, vd{}, c));
+        return with_sign(v_log(arg) + corr, x);
+    }
+    inline vd v_acosh(const vd x) {
+        const vi huge = x >= 0x1p28, big = x > 2.0;
+        const vd t = x - 1.0;
+        const auto [w, c] = log1p_arg(t + vsqrt(2.0 * t + t * t));
+        const vd arg = sel(huge, x, sel(big, 2.0 * x - 1.0 / (x + vsqrt(x * x - 1.0)), w));
+        const vd corr = sel(huge, vd{} + ln2, sel(big, vd{}, c));
+        return sel(x < 1.0, vd{} + nan, v_log(arg) + corr);
+    }
+    inline vd v_atanh(const vd x) {
+        const vd ax = vabs(x);
+        const vd t = ax + ax;
+        const vd u = sel(ax < 0.5, t + t * ax / (1.0 - ax), t / (1.0 - ax));
+        const auto [w, c] = log1p_arg(u);
+        vd res = 0.5 * (v_log(w) + c);
+        res = sel(ax == 1.0, vd{} + inf, res);
+        res = sel(ax > 1.0, vd{} + nan, res);
+        return with_sign(res, x);
+    }
+
+    inline vd v_sqrt(const vd x) {
+        return vsqrt(x);
+    }
+    inline vd v_abs(const vd x) {
+        return vabs(x);
+    }
+    // integral results carry the sign of x, which also gives -0.0 where libm does
+    inline vd v_round(const vd x) {
+        const vd ax = vabs(x);
+        vd t = round_even_pos(ax);
+        t = sel(ax - t >= 0.5, t + 1.0, t);
+        return with_sign(sel(ax < 0x1p52, t, ax), x);
+    }
+    inline vd v_floor(const vd x) {
+        const vd ax = vabs(x);
+        vd r = with_sign(round_even_pos(ax), x);
+        r = sel(r > x, r - 1.0, r);
+        return with_sign(sel(ax < 0x1p52, r, x), x);
+    }
+    inline vd v_ceil(const vd x) {
+        const vd ax = vabs(x);
+        vd r = with_sign(round_even_pos(ax), x);
+        r = sel(r < x, r + 1.0, r);
+        return with_sign(sel(ax < 0x1p52, r, x), x);
+    }
+
+    template<vd (*F)(vd)>
+    void apply(const double* const in, double* const out, const std::size_t n) {
+        std::size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            vd x;
+            __builtin_memcpy(&x, in + i, sizeof x);
+            const vd r = F(x);
+            __builtin_memcpy(out + i, &r, sizeof r);
+        }
+        if (i < n) {
+            vd x{};
+            __builtin_memcpy(&x, in + i, (n - i) * sizeof(double));
+            const vd r = F(x);
+            __builtin_memcpy(out + i, &r, (n - i) * sizeof(double));
+        }
+    }
+
+    // indexed by vec_func
+    constexpr array_func kernels[vf_count] = {
+        apply<v_sin>, apply<v_cos>, apply<v_tan>, apply<v_asin>, apply<v_acos>, apply<v_atan>,
+        apply<v_sinh>, apply<v_cosh>, apply<v_tanh>, apply<v_asinh>, apply<v_acosh>, apply<v_atanh>,
+        apply<v_sqrt>, apply<v_log>, apply<v_log10>, apply<v_exp>, apply<v_abs>, apply<v_ceil>,
+        apply<v_floor>, apply<v_round>,
+    };
+
+} // namespace
+} // meval::detail
+
+#endif //MEVAL_VECMATH_IMPL_H
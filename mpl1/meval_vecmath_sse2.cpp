@@ -0,0 +1,15 @@
+//
+// 2-lane kernels: SSE2 on x86-64, where it is the baseline, and the
+// target's own 128-bit vectors elsewhere.
+//
+
+#define MEVAL_VEC_LANES 2
+#include "meval_vecmath_impl.h"
+
+namespace meval::detail {
+
+    const array_func* sse2_kernels() noexcept {
+        return kernels;
+    }
+
+} // meval::detail
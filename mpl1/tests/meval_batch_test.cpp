@@ -0,0 +1,56 @@
+//
+// Compares compiled_expr::eval and eval_batch with the postfix interpreter
+// over the corpus, with columns of full length and broadcast, and checks the
+// column contract.
+//
+
+#include "tests/meval_test.h"
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+
+    for (const auto& src : test::corpus()) {
+        const math_expr expr(src, sym.vars, sym.funcs, sym.ops);
+        const auto& compiled = expr.get_compiled();
+        const auto want = s.reference(expr, *sym.vars);
+        std::vector<double> got(s.rows);
+        test::guarded(src + " scalar", [&] {
+            for (std::size_t i = 0; i < s.rows; i++)
+                got[i] = compiled->eval(s.row(compiled->slot_names(), *sym.vars, i).data());
+            test::compare(src + " scalar", got, want);
+        });
+        test::guarded(src + " batch", [&] {
+            expr.eval_batch(s.columns(), got);
+            test::compare(src + " batch", got, want);
+        });
+        // ragged tails, shorter than one block
+        test::guarded(src + " batch tail", [&] {
+            const std::size_t n = 13;
+            const column_map columns{{"x", {s.x.data(), n}}, {"y", {s.y.data(), n}}};
+            std::vector<double> tail(n);
+            compiled->eval_batch(expr.bind_columns(columns), tail);
+            test::compare(src + " batch tail", tail, {want.begin(), want.begin() + n});
+        });
+    }
+
+    // $y missing from the columns is broadcast from its var_map value
+    const math_expr expr("$x*$y+1", sym.vars, sym.funcs, sym.ops);
+    (*sym.vars)["y"] = 2;
+    const std::vector<double> x{1, 2, 3};
+    std::vector<double> out(3);
+    expr.eval_batch({{"x", x}}, out);
+    MEVAL_CHECK(out[0] == 3 && out[1] == 5 && out[2] == 7);
+    const std::vector<double> one{10};
+    expr.eval_batch({{"x", x}, {"y", one}}, out);
+    MEVAL_CHECK(out[0] == 11 && out[2] == 31);
+
+    const auto& compiled = expr.get_compiled();
+    const std::vector<double> shorter{1, 2};
+    const std::span<const double> short_columns[] = {x, shorter};
+    test::throws<meval_error>("short column", [&] {compiled->eval_batch(short_columns, out);});
+    const std::span<const double> missing[] = {x};
+    test::throws<meval_error>("missing column", [&] {compiled->eval_batch(missing, out);});
+    return test::failures() != 0;
+}
@@ -0,0 +1,63 @@
+//
+// bulk_compiler emits the program math_expr compiles for every formula of
+// the corpus at every opt_level, in parallel or not, and reports the error
+// math_expr throws for a formula without stopping the others.
+//
+
+#include "meval_bulk.h"
+#include "tests/meval_test.h"
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+    thread_pool pool(4);
+
+    for (const auto level : {opt_level::none, opt_level::basic, opt_level::full}) {
+        compile_options options;
+        options.level = level;
+        const bulk_compiler bulk(sym.vars, sym.funcs, sym.ops, options);
+        const auto results = bulk.compile(std::span<const std::string>(test::corpus()), pool, 1);
+        MEVAL_CHECK(results.size() == test::corpus().size());
+        for (std::size_t i = 0; i < results.size() && i < test::corpus().size(); i++) {
+            const auto& src = test::corpus()[i];
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            if (!test::check(results[i].ok(), name + ": " + (results[i].error ? results[i].error->what() : "")))
+                continue;
+            const math_expr expr(src, sym.vars, sym.funcs, sym.ops, options);
+            const auto& want = *expr.get_compiled();
+            const auto& got = *results[i].expr;
+            bool same = got.code().size() == want.code().size() && got.constants() == want.constants() &&
+                        got.slot_names() == want.slot_names() && got.flagged() == want.flagged();
+            for (std::size_t k = 0; same && k < want.code().size(); k++)
+                same = got.code()[k].op == want.code()[k].op && got.code()[k].arg == want.code()[k].arg;
+            test::check(same, name + ": program differs from math_expr");
+            std::vector<double> values(s.rows);
+            test::guarded(name, [&] {
+                for (std::size_t r = 0; r < s.rows; r++)
+                    values[r] = got.eval(s.row(got.slot_names(), *sym.vars, r).data());
+                test::compare(name, values, s.reference(expr, *sym.vars));
+            });
+        }
+    }
+
+    // the error of each bad formula is the one math_expr throws
+    const bulk_compiler bulk(sym.vars, sym.funcs, sym.ops);
+    const std::vector<std::string> formulas = {"$x+1", "$x+", "$q*2", "@nope($x)", "$x#2", "($x", "$y-1"};
+    const auto results = bulk.compile(std::span<const std::string>(formulas), pool, 1);
+    for (std::size_t i = 0; i < formulas.size(); i++) {
+        std::optional<meval_error> want;
+        try {
+            (void) math_expr(formulas[i], sym.vars, sym.funcs, sym.ops);
+        } catch (const meval_error& e) {
+            want = e;
+        }
+        const auto& got = results[i];
+        test::check(got.ok() == !want && (!want || (got.error && got.error->get_error_type() ==
+                    want->get_error_type())), formulas[i] + ": error differs from math_expr");
+    }
+    MEVAL_CHECK(results.front().ok() && results.back().ok() && !results[1].ok());
+    const auto one = bulk.compile("$x*$y");
+    MEVAL_CHECK(one.ok() && one.expr->code().size() == 3);
+    return test::failures() != 0;
+}
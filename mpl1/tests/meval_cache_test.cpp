@@ -0,0 +1,67 @@
+//
+// expr_cache hits on the same text, maps and options, misses on any change
+// of them, evicts down to its capacity and never serves an entry compiled
+// against maps that have since been freed.
+//
+
+#include "meval_cache.h"
+#include "tests/meval_test.h"
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const double x[] = {2};
+
+    {
+        expr_cache cache(64, 4);
+        const auto a = cache.get("$x*2+1", sym.vars, sym.funcs, sym.ops);
+        const auto b = cache.get("$x * 2 + 1", sym.vars, sym.funcs, sym.ops);
+        MEVAL_CHECK(a == b && a->eval(x) == 5);
+        auto stats = cache.get_stats();
+        MEVAL_CHECK(stats.hits == 1 && stats.misses == 1 && stats.entries == 1 && stats.evictions == 0);
+
+        compile_options full;
+        full.level = opt_level::full;
+        MEVAL_CHECK(cache.get("$x*2+1", sym.vars, sym.funcs, sym.ops, full) != a);
+        MEVAL_CHECK(cache.get("$x*2+1", sym.vars, sym.funcs, sym.ops, {}, 1) != a);
+        auto other_funcs = std::make_shared<func_map>(*sym.funcs);
+        MEVAL_CHECK(cache.get("$x*2+1", sym.vars, other_funcs, sym.ops) != a);
+        stats = cache.get_stats();
+        MEVAL_CHECK(stats.hits == 1 && stats.misses == 4 && stats.entries == 4);
+
+        test::throws<meval_error>("compile error", [&] {(void) cache.get("$x+", sym.vars, sym.funcs, sym.ops);});
+        MEVAL_CHECK(cache.get_stats().entries == 4);
+        cache.clear();
+        MEVAL_CHECK(cache.get_stats().entries == 0);
+        MEVAL_CHECK(cache.get("$x*2+1", sym.vars, sym.funcs, sym.ops) != a);
+    }
+
+    {
+        // one shard, so the clock hand sees every entry
+        expr_cache cache(4, 1);
+        for (int i = 0; i < 10; i++)
+            (void) cache.get("$x+" + std::to_string(i), sym.vars, sym.funcs, sym.ops);
+        auto stats = cache.get_stats();
+        MEVAL_CHECK(stats.entries == 4 && stats.evictions == 6 && stats.misses == 10);
+        // the most recent entry survives the next insertions' first sweep
+        (void) cache.get("$x+9", sym.vars, sym.funcs, sym.ops);
+        (void) cache.get("$x+10", sym.vars, sym.funcs, sym.ops);
+        (void) cache.get("$x+9", sym.vars, sym.funcs, sym.ops);
+        stats = cache.get_stats();
+        MEVAL_CHECK(stats.hits == 2 && stats.entries == 4 && stats.evictions == 7);
+    }
+
+    // A map freed and another allocated, likely at the same address: the
+    // entry of the first must not be served for the second.
+    auto& shared = expr_cache::shared();
+    const auto before = shared.get_stats();
+    for (const double k : {2.0, 3.0, 4.0}) {
+        const std::shared_ptr<func_map> funcs(new func_map(*sym.funcs));
+        (*funcs)["g"] = [k](const double v) {return v * k;};
+        const auto expr = shared.get("@g($x)", sym.vars, funcs, sym.ops);
+        test::check(expr->eval(x) == 2 * k, "fresh func_map with k=" + std::to_string(k) + " gives " +
+                    std::to_string(expr->eval(x)));
+    }
+    MEVAL_CHECK(shared.get_stats().hits == before.hits);
+    return test::failures() != 0;
+}
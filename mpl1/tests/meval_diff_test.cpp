@@ -0,0 +1,108 @@
+//
+// forward_diff and reverse_diff agree with each other and with central
+// finite differences over the corpus, on the rows where the formula is
+// smooth; user rules override the built-in ones and a callable without a
+// rule is rejected.
+//
+
+#include "meval_diff.h"
+#include "tests/meval_test.h"
+
+namespace {
+    using namespace meval;
+
+    // central difference in slot, or NaN where the one-sided differences
+    // disagree or halving the step moves it: near a kink, a jump or a pole
+    double finite_difference(const compiled_expr& expr, std::vector<double> slots, const uint32_t slot) {
+        const double at = slots[slot];
+        const auto f = [&](const double h) {
+            slots[slot] = at + h;
+            return expr.eval(slots.data());
+        };
+        double coarse, fine, left, right;
+        try {
+            const double h = 1e-5;
+            coarse = (f(h) - f(-h)) / (2 * h);
+            fine = (f(h / 2) - f(-h / 2)) / h;
+            left = (f(0) - f(-h)) / h;
+            right = (f(h) - f(0)) / h;
+        } catch (const std::exception&) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        if (!std::isfinite(coarse) || !test::close(coarse, fine, 1e-5) || !test::close(left, right, 1e-2))
+            return std::numeric_limits<double>::quiet_NaN();
+        return fine;
+    }
+}
+
+int main() {
+    test::symbols sym;
+    const test::samples s;
+
+    for (const auto level : {opt_level::none, opt_level::full}) {
+        compile_options options;
+        options.level = level;
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            const auto expr = math_expr(src, sym.vars, sym.funcs, sym.ops, options).get_compiled();
+            test::guarded(name, [&] {
+                const forward_diff forward(expr);
+                reverse_diff reverse(expr);
+                const auto slots = expr->slot_names().size();
+                std::vector<double> grad(slots);
+                std::size_t checked = 0;
+                for (std::size_t i = 0; i < s.rows; i++) {
+                    const auto row = s.row(expr->slot_names(), *sym.vars, i);
+                    double value;
+                    try {
+                        value = expr->eval(row.data());
+                    } catch (const std::exception&) {
+                        continue;
+                    }
+                    const std::string at = name + ": row " + std::to_string(i);
+                    test::check(test::close(reverse.gradient(row.data(), grad.data()), value), at + " reverse value");
+                    for (uint32_t k = 0; k < slots; k++) {
+                        const auto d = forward.eval(row.data(), k);
+                        test::check(test::close(d.value, value), at + " forward value");
+                        test::check(test::close(d.deriv, grad[k]), at + " forward and reverse differ in " +
+                                    expr->slot_names()[k]);
+                        const double want = finite_difference(*expr, row, k);
+                        if (std::isnan(want))
+                            continue;
+                        checked++;
+                        test::check(test::close(d.deriv, want, 1e-5), at + " d/d" + expr->slot_names()[k] + " is " +
+                                    std::to_string(d.deriv) + ", finite difference " + std::to_string(want));
+                    }
+                }
+                test::check(checked > 0, name + ": no smooth rows");
+            });
+        }
+    }
+
+    // a directional derivative is the gradient projected on the direction
+    const auto expr = math_expr("@sin($x)*$y", sym.vars, sym.funcs, sym.ops).get_compiled();
+    const auto& names = expr->slot_names();
+    const std::size_t ix = names[0] == "x" ? 0 : 1;
+    double slots[2], direction[2];
+    slots[ix] = 0.5;
+    slots[1 - ix] = 3;
+    direction[ix] = 2;
+    direction[1 - ix] = -1;
+    const auto along = forward_diff(expr).eval(slots, direction);
+    MEVAL_CHECK(test::close(along.deriv, 2 * std::cos(0.5) * 3 - std::sin(0.5)));
+
+    // user rules, and callables without one; (2x ~ x)*x is 1.5x^2
+    (*sym.funcs)["twice"] = [](const double v) {return 2 * v;};
+    (*sym.ops)["~"] = {[](const double a, const double b, double) {return (a + b) / 2;}, 1};
+    const auto custom = math_expr("@twice($x)~$x*$x", sym.vars, sym.funcs, sym.ops).get_compiled();
+    test::throws<meval_error>("function without a rule", [&] {forward_diff{custom};});
+    auto rules = std::make_shared<derivative_rules>();
+    rules->funcs["twice"] = [](double) {return 2.0;};
+    test::throws<meval_error>("operator without a rule", [&] {reverse_diff{custom, rules};});
+    rules->ops["~"] = [](double, double, double) {return std::pair{0.5, 0.5};};
+    const double at[] = {3};
+    MEVAL_CHECK(test::close(forward_diff(custom, rules).eval(at, 0u).deriv, 9));
+    double grad[1];
+    MEVAL_CHECK(test::close(reverse_diff(custom, rules).gradient(at, grad), 13.5) && test::close(grad[0], 9));
+    return test::failures() != 0;
+}
@@ -0,0 +1,65 @@
+//
+// The peephole pass of opt_level::full emits each fused opcode for the
+// pattern it covers, only under fast_math where it rounds differently, and
+// the fused programs keep the values of the unfused ones.
+//
+
+#include "tests/meval_test.h"
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+
+    const auto compile = [&](const std::string& src, const opt_level level, const bool fast_math) {
+        compile_options options;
+        options.level = level;
+        options.fast_math = fast_math;
+        return math_expr(src, sym.vars, sym.funcs, sym.ops, options);
+    };
+    const auto uses = [](const math_expr& expr, const opcode op) {
+        const auto& code = expr.get_compiled()->code();
+        return std::ranges::any_of(code, [op](const instruction& in) {return in.op == op;});
+    };
+
+    const struct {
+        const char* src;
+        opcode op;
+        bool fast_math;  // needed for the fused opcode to appear
+    } cases[] = {
+        {"$x*$x-$y", opcode::square, false},
+        {"1/($x*$x+1)", opcode::recip, false},
+        {"($x*$x+4)^0.5", opcode::sqrt, true},
+        {"$x^4-$y", opcode::powi, true},
+        {"@sqrt($x*$x+$y*$y)", opcode::hypot, true},
+        {"$x*$y+$x", opcode::fma, true},
+    };
+    for (const auto& c : cases) {
+        const std::string name = c.src;
+        const auto fused = compile(c.src, opt_level::full, c.fast_math);
+        test::check(uses(fused, c.op), name + ": fused opcode missing");
+        if (c.fast_math)
+            test::check(!uses(compile(c.src, opt_level::full, false), c.op), name + ": fused without fast_math");
+        test::check(!uses(compile(c.src, opt_level::basic, true), c.op), name + ": fused below full");
+        const auto want = s.reference(compile(c.src, opt_level::none, false), *sym.vars);
+        std::vector<double> got(s.rows);
+        test::guarded(name, [&] {
+            const auto& compiled = *fused.get_compiled();
+            for (std::size_t i = 0; i < s.rows; i++)
+                got[i] = compiled.eval(s.row(compiled.slot_names(), *sym.vars, i).data());
+            test::compare(name, got, want, 1e-12);
+        });
+    }
+
+    // and over the corpus, scalar and batch
+    for (const auto& src : test::corpus()) {
+        const auto fused = compile(src, opt_level::full, true);
+        const auto want = s.reference(compile(src, opt_level::none, false), *sym.vars);
+        std::vector<double> got(s.rows);
+        test::guarded(src, [&] {
+            fused.eval_batch(s.columns(), got);
+            test::compare(src + " batch", got, want, 1e-9);
+        });
+    }
+    return test::failures() != 0;
+}
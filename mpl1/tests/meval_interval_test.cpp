@@ -0,0 +1,113 @@
+//
+// interval_expr encloses every point value of the corpus over boxes around
+// the sample rows, and adaptive_sample and bracket_roots stay within their
+// tolerances on functions with known shape and roots.
+//
+
+#include "meval_interval.h"
+#include "tests/meval_test.h"
+#include <numbers>
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+
+    for (const auto level : {opt_level::none, opt_level::full}) {
+        compile_options options;
+        options.level = level;
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            const auto expr = math_expr(src, sym.vars, sym.funcs, sym.ops, options).get_compiled();
+            test::guarded(name, [&] {
+                const interval_expr enclosure(expr);
+                const auto& names = expr->slot_names();
+                for (std::size_t i = 0; i < s.rows; i += 7) {
+                    // a box 0.3 wide in x and 0.2 in y from row i, and a grid of points in it
+                    const auto lo = s.row(names, *sym.vars, i);
+                    std::vector<interval> box;
+                    for (std::size_t k = 0; k < names.size(); k++)
+                        box.push_back(names[k] == "x" ? interval{lo[k], lo[k] + 0.3} :
+                                      names[k] == "y" ? interval{lo[k], lo[k] + 0.2} : interval::point(lo[k]));
+                    const interval y = enclosure.eval(box.data());
+                    for (int a = 0; a <= 8; a++) {
+                        for (int b = 0; b <= 8; b++) {
+                            auto at = lo;
+                            for (std::size_t k = 0; k < names.size(); k++)
+                                at[k] = box[k].lo + box[k].width() * (names[k] == "x" ? a : b) / 8;
+                            double v;
+                            try {
+                                v = expr->eval(at.data());
+                            } catch (const std::exception&) {
+                                continue;
+                            }
+                            if (std::isnan(v))
+                                continue;
+                            if (!test::check(y.contains(v), name + ": box at row " + std::to_string(i) + " gives [" +
+                                             std::to_string(y.lo) + ", " + std::to_string(y.hi) + "], missing " +
+                                             std::to_string(v)))
+                                return;
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+    // the enclosure of a point box is tight, of an undefined range empty
+    const auto sqrt_x = math_expr("@sqrt($x)", sym.vars, sym.funcs, sym.ops).get_compiled();
+    const interval_expr root(sqrt_x);
+    const interval four = interval::point(4), negative{-2, -1};
+    const auto two = root.eval(&four);
+    MEVAL_CHECK(two.contains(2) && two.width() < 1e-12 && root.complete());
+    MEVAL_CHECK(root.eval(&negative).is_empty());
+
+    // a callable without a rule gives entire()
+    (*sym.funcs)["twice"] = [](const double v) {return 2 * v;};
+    const interval_expr opaque(math_expr("@twice($x)", sym.vars, sym.funcs, sym.ops).get_compiled());
+    const auto any = opaque.eval(&four);
+    MEVAL_CHECK(!opaque.complete() && any.lo == -INFINITY && any.hi == INFINITY);
+    auto rules = std::make_shared<interval_rules>();
+    rules->funcs["twice"] = [](const interval v) {return interval{2 * v.lo, 2 * v.hi};};
+    const interval_expr ruled(opaque.get_expr(), rules);
+    MEVAL_CHECK(ruled.complete() && ruled.eval(&four).contains(8) && ruled.eval(&four).width() == 0);
+
+    // sampling sin over a period: every point is on the curve, the range
+    // reaches both extremes and the bound encloses it
+    const interval_expr sine(math_expr("@sin($x)", sym.vars, sym.funcs, sym.ops).get_compiled());
+    const double none[] = {0};
+    sample_options sampling;
+    sampling.tolerance = 1e-2;
+    const auto curve = adaptive_sample(sine, none, 0, 0, 2 * std::numbers::pi, sampling);
+    MEVAL_CHECK(curve.polylines.size() == 1 && curve.polylines[0].size() > 8);
+    for (std::size_t i = 0; i < curve.polylines[0].size(); i++) {
+        const auto& p = curve.polylines[0][i];
+        MEVAL_CHECK(p.y == std::sin(p.x));
+        if (i > 0)
+            MEVAL_CHECK(p.x > curve.polylines[0][i - 1].x);
+    }
+    MEVAL_CHECK(curve.range.lo < -0.99 && curve.range.hi > 0.99);
+    MEVAL_CHECK(curve.bound.lo <= curve.range.lo && curve.bound.hi >= curve.range.hi);
+    MEVAL_CHECK(curve.point_evals < std::size_t{1} << sampling.max_depth);
+
+    // sqrt is undefined left of zero, log |x| is cut at its pole
+    const auto half = adaptive_sample(root, none, 0, -1, 1);
+    MEVAL_CHECK(!half.polylines.empty() && half.polylines.front().front().x >= 0);
+    const interval_expr log_abs(math_expr("@log(@abs($x))", sym.vars, sym.funcs, sym.ops).get_compiled());
+    const auto pole = adaptive_sample(log_abs, none, 0, -1, 1.1);
+    MEVAL_CHECK(pole.polylines.size() == 2);
+    for (const auto& line : pole.polylines)
+        MEVAL_CHECK(line.front().x * line.back().x > 0);
+
+    // x^2-2 has its roots at +-sqrt(2), x^2+1 none
+    const interval_expr parabola(math_expr("$x*$x-2", sym.vars, sym.funcs, sym.ops).get_compiled());
+    const auto brackets = bracket_roots(parabola, none, 0, -3, 3.1, 1e-6);
+    MEVAL_CHECK(brackets.size() == 2);
+    for (std::size_t i = 0; i < brackets.size() && i < 2; i++) {
+        const double want = i == 0 ? -std::numbers::sqrt2 : std::numbers::sqrt2;
+        MEVAL_CHECK(brackets[i].x.contains(want) && brackets[i].x.width() <= 4e-6 && brackets[i].sign_change);
+    }
+    const interval_expr positive(math_expr("$x*$x+1", sym.vars, sym.funcs, sym.ops).get_compiled());
+    MEVAL_CHECK(bracket_roots(positive, none, 0, -3, 3, 1e-6).empty());
+    return test::failures() != 0;
+}
@@ -0,0 +1,58 @@
+//
+// Compares the native code of jit_expr, scalar and at both batch widths,
+// with the postfix interpreter over the corpus at every opt_level, and checks
+// that errors raised in native code reach the caller.
+//
+
+#include "meval_jit.h"
+#include "tests/meval_test.h"
+#include <stdexcept>
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+    (*sym.funcs)["boom"] = [](const double x) -> double {
+        if (x > 0)
+            throw std::logic_error("boom");
+        return x;
+    };
+
+    MEVAL_CHECK(!jit_expr::available() ||
+                jit_expr(math_expr("$x+1", sym.vars, sym.funcs, sym.ops).get_compiled()).is_native());
+    for (const auto level : {opt_level::none, opt_level::basic, opt_level::full}) {
+        compile_options options;
+        options.level = level;
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            const math_expr expr(src, sym.vars, sym.funcs, sym.ops, options);
+            const auto want = s.reference(expr, *sym.vars);
+            std::vector<double> got(s.rows);
+            for (const unsigned width : {4u, 8u}) {
+                test::guarded(name + " jit", [&] {
+                    const jit_expr jit(expr.get_compiled(), width);
+                    for (std::size_t i = 0; i < s.rows; i++)
+                        got[i] = jit.eval(s.row(expr.get_compiled()->slot_names(), *sym.vars, i).data());
+                    test::compare(name + " jit", got, want);
+                    std::ranges::fill(got, 0);
+                    jit.eval_batch(expr.bind_columns(s.columns()), got);
+                    test::compare(name + " jit batch of " + std::to_string(width), got, want);
+                });
+            }
+        }
+
+        const math_expr div("1/$x+$y", sym.vars, sym.funcs, sym.ops, options);
+        const jit_expr jit_div(div.get_compiled());
+        const double zero[] = {0, 1};
+        test::throws<std::runtime_error>("1/0 in jit", [&] {(void) jit_div.eval(zero);});
+        const math_expr boom("@boom($x)*2", sym.vars, sym.funcs, sym.ops, options);
+        const jit_expr jit_boom(boom.get_compiled());
+        const double one[] = {1};
+        test::throws<std::logic_error>("callable exception in jit", [&] {(void) jit_boom.eval(one);});
+        std::vector<double> xs(s.rows, -1), out(s.rows);
+        xs[s.rows - 1] = 1;
+        const std::span<const double> columns[] = {xs};
+        test::throws<std::logic_error>("callable exception in jit batch", [&] {jit_boom.eval_batch(columns, out);});
+    }
+    return test::failures() != 0;
+}
@@ -0,0 +1,79 @@
+//
+// A library written from the corpus and opened from memory or a file
+// evaluates like math_expr with or without cache_unpacked, finds every
+// expression by name, rejects indices past its size and damaged files.
+//
+
+#include "meval_library.h"
+#include "tests/meval_test.h"
+#include <cstdio>
+#include <filesystem>
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+
+    compile_options full;
+    full.level = opt_level::full;
+    std::vector<math_expr> exprs;
+    library_writer writer;
+    for (std::size_t i = 0; i < test::corpus().size(); i++) {
+        exprs.emplace_back(test::corpus()[i], sym.vars, sym.funcs, sym.ops, i % 2 ? full : compile_options{});
+        writer.add("f" + std::to_string(i), *exprs.back().get_compiled());
+    }
+    const auto bytes = writer.bytes();
+    const auto path = (std::filesystem::temp_directory_path() / "meval_library_test.mevallib").string();
+    writer.write(path);
+
+    const auto check_library = [&](const std::string& what, const compiled_library& lib) {
+        MEVAL_CHECK(lib.size() == exprs.size());
+        for (std::size_t k = 0; k < exprs.size(); k++) {
+            // the index is sorted by name
+            const std::string name = what + " " + test::corpus()[k];
+            const auto found = lib.find("f" + std::to_string(k));
+            if (!test::check(found >= 0 && lib.name(static_cast<uint32_t>(found)) == "f" + std::to_string(k),
+                             name + ": name"))
+                continue;
+            const auto i = static_cast<uint32_t>(found);
+            const auto want = s.reference(exprs[k], *sym.vars);
+            std::vector<double> got(s.rows);
+            test::guarded(name, [&] {
+                for (std::size_t r = 0; r < s.rows; r++)
+                    got[r] = lib.eval(i, s.row(lib.slot_names(i), *sym.vars, r).data());
+                test::compare(name, got, want);
+            });
+            // the non-throwing path reports what the original does
+            const auto unpacked = lib.unpack(i);
+            const auto& original = *exprs[k].get_compiled();
+            for (std::size_t r = 0; r < s.rows; r++) {
+                uint32_t a = 0, b = 0;
+                const double va = unpacked->eval(s.row(unpacked->slot_names(), *sym.vars, r).data(), a);
+                const double vb = original.eval(s.row(original.slot_names(), *sym.vars, r).data(), b);
+                if (!test::check(a == b && test::close(va, vb), name + ": masked row " + std::to_string(r)))
+                    break;
+            }
+        }
+        MEVAL_CHECK(lib.find("g") == -1);
+        const auto past = static_cast<uint32_t>(exprs.size());
+        const double slots[2] = {};
+        test::throws<meval_error>(what + " eval past the end", [&] {(void) lib.eval(past, slots);});
+        test::throws<meval_error>(what + " name past the end", [&] {(void) lib.name(past);});
+        test::throws<meval_error>(what + " slots past the end", [&] {(void) lib.slot_symbols(past);});
+        test::throws<meval_error>(what + " unpack past the end", [&] {(void) lib.unpack(-1u);});
+    };
+    check_library("bytes", compiled_library(bytes, *sym.funcs, *sym.ops));
+    check_library("cached bytes", compiled_library(bytes, *sym.funcs, *sym.ops, true, true));
+    check_library("file", compiled_library(path, *sym.funcs, *sym.ops, false));
+    std::remove(path.c_str());
+
+    // damaged files and callables the maps lack
+    auto damaged = bytes;
+    damaged[0] = 'X';
+    test::throws<meval_error>("bad magic", [&] {compiled_library(damaged, *sym.funcs, *sym.ops);});
+    damaged = bytes;
+    damaged.resize(bytes.size() / 2);
+    test::throws<meval_error>("truncated", [&] {compiled_library(damaged, *sym.funcs, *sym.ops);});
+    test::throws<meval_error>("unknown function", [&] {compiled_library(bytes, func_map{}, *sym.ops);});
+    return test::failures() != 0;
+}
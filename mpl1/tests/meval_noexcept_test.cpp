@@ -0,0 +1,103 @@
+//
+// The non-throwing evaluators of math_expr and math_program: the values are
+// those of the throwing ones wherever those return, every row they throw at
+// is reported, batch masks equal the scalar ones, an error_policy limits what
+// is reported and a select drops the errors of the operand it does not pick.
+//
+
+#include "meval_program.h"
+#include "tests/meval_test.h"
+
+namespace {
+    using namespace meval;
+
+    std::shared_ptr<const error_policy> only_division() {
+        auto policy = std::make_shared<error_policy>();
+        policy->fallback = domain_mode::propagate;
+        policy->modes["/"] = domain_mode::flag;
+        return policy;
+    }
+}
+
+int main() {
+    test::symbols sym;
+    const test::samples s;
+
+    for (const auto level : {opt_level::none, opt_level::basic, opt_level::full}) {
+        compile_options options;
+        options.level = level;
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            const math_expr expr(src, sym.vars, sym.funcs, sym.ops, options);
+            const math_program program("$t: " + src + "; $t, 1-$t", sym.vars, sym.funcs, sym.ops, options);
+            std::vector<double> values(s.rows), first(s.rows), second(s.rows);
+            std::vector<uint32_t> masks(s.rows), first_masks(s.rows), second_masks(s.rows);
+            for (std::size_t i = 0; i < s.rows; i++) {
+                (*sym.vars)["x"] = s.x[i];
+                (*sym.vars)["y"] = s.y[i];
+                const std::string row = name + ": row " + std::to_string(i);
+                uint32_t errors = 0;
+                values[i] = expr.eval(errors);
+                masks[i] = errors;
+                double out[2];
+                uint32_t program_errors[2];
+                program.eval(out, program_errors);
+                test::check(test::close(out[0], values[i]) && program_errors[0] == errors &&
+                            program_errors[1] == errors, row + " program differs");
+                try {
+                    test::check(test::close(expr.eval(), values[i]), row + " differs from eval");
+                } catch (const std::exception&) {
+                    test::check(errors != eval_ok, row + " throws but reports nothing");
+                }
+            }
+            std::vector<double> got(s.rows);
+            std::vector<uint32_t> got_masks(s.rows);
+            expr.eval_batch(s.columns(), got, got_masks);
+            test::compare(name + " batch", got, values);
+            test::compare_errors(name + " batch", got_masks, masks);
+            const std::span<double> outs[] = {first, second};
+            const std::span<uint32_t> out_masks[] = {first_masks, second_masks};
+            program.eval_batch(s.columns(), outs, out_masks);
+            test::compare(name + " program batch", first, values);
+            test::compare_errors(name + " program batch", first_masks, masks);
+            test::compare_errors(name + " program batch", second_masks, masks);
+        }
+    }
+
+    // a policy flagging divisions only, and a select
+    compile_options options;
+    options.errors = only_division();
+    (*sym.vars)["x"] = -1;
+    (*sym.vars)["y"] = 0;
+    const char* const cases[][2] = {{"@log($x)+1/$y", "div"}, {"@log($x)+@sqrt($x)", ""}, {"$x/$y", "div"},
+                                    {"$y==0?0:$x/$y", ""}, {"$y!=0?0:$x/$y", "div"}};
+    for (const auto& [src, want] : cases) {
+        const uint32_t bits = std::string(want) == "div" ? eval_div_by_zero : eval_ok;
+        uint32_t errors = 0, all = 0;
+        (void) math_expr(src, sym.vars, sym.funcs, sym.ops, options).eval(errors);
+        test::check(errors == bits, std::string(src) + ": math_expr mask " + std::to_string(errors));
+        double out[1];
+        uint32_t program_errors[1];
+        math_program(src, sym.vars, sym.funcs, sym.ops, options).eval(out, program_errors);
+        test::check(program_errors[0] == bits, std::string(src) + ": math_program mask " +
+                    std::to_string(program_errors[0]));
+        (void) math_expr(src, sym.vars, sym.funcs, sym.ops).eval(all);
+        test::check((all & bits) == bits, std::string(src) + ": default policy");
+    }
+
+    // an error reaches every output computed from it
+    uint32_t errors[2];
+    double out[2];
+    math_program("@log($x), @log($x)+1", sym.vars, sym.funcs, sym.ops).eval(out, errors);
+    MEVAL_CHECK(errors[0] == eval_invalid && errors[1] == eval_invalid && std::isnan(out[1]));
+
+    // callables that throw yield NaN
+    (*sym.funcs)["fail"] = [](double) -> double {throw std::runtime_error("fail");};
+    const math_program failing("@fail($x), $x", sym.vars, sym.funcs, sym.ops);
+    failing.eval(out, errors);
+    MEVAL_CHECK(std::isnan(out[0]) && errors[0] == eval_invalid && out[1] == -1 && errors[1] == eval_ok);
+    test::throws<std::runtime_error>("throwing program", [&] {(void) failing.eval();});
+    std::vector<uint32_t> short_masks(1);
+    test::throws<meval_error>("room for masks", [&] {failing.eval(out, short_masks);});
+    return test::failures() != 0;
+}
@@ -0,0 +1,65 @@
+//
+// The optimizer keeps the values of the corpus at every opt_level, folds
+// constant subexpressions and constant variables, and simplifies the
+// identities of opt_level::full.
+//
+
+#include "tests/meval_test.h"
+#include <numbers>
+#include <stdexcept>
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+
+    const auto compile = [&](const std::string& src, const opt_level level,
+                             const std::shared_ptr<const_set>& consts = nullptr) {
+        compile_options options;
+        options.level = level;
+        options.consts = consts;
+        return math_expr(src, sym.vars, sym.funcs, sym.ops, options);
+    };
+
+    for (const auto level : {opt_level::basic, opt_level::full}) {
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            const auto expr = compile(src, level);
+            const auto want = s.reference(compile(src, opt_level::none), *sym.vars);
+            const auto& compiled = expr.get_compiled();
+            MEVAL_CHECK(compiled->code().size() <= compile(src, opt_level::none).get_compiled()->code().size());
+            std::vector<double> got(s.rows);
+            test::guarded(name, [&] {
+                for (std::size_t i = 0; i < s.rows; i++)
+                    got[i] = compiled->eval(s.row(compiled->slot_names(), *sym.vars, i).data());
+                test::compare(name, got, want);
+            });
+        }
+    }
+
+    (*sym.vars)["x"] = 5;
+    const auto code_size = [](const math_expr& e) {return e.get_compiled()->code().size();};
+    MEVAL_CHECK(code_size(compile("2*3+$x", opt_level::none)) == 5);
+    MEVAL_CHECK(code_size(compile("2*3+$x", opt_level::basic)) == 3);
+    MEVAL_CHECK(code_size(compile("@sqrt(16)*@cos(0)+$x", opt_level::basic)) == 3);
+    MEVAL_CHECK(compile("@sqrt(16)*@cos(0)+$x", opt_level::basic).eval() == 9);
+
+    // identities only at full
+    MEVAL_CHECK(code_size(compile("($x*1+0)/1", opt_level::basic)) == 7);
+    const auto identity = compile("($x*1+0)/1", opt_level::full);
+    MEVAL_CHECK(code_size(identity) == 1 && identity.eval() == 5);
+    MEVAL_CHECK(code_size(compile("1?$x:1/0", opt_level::full)) == 1);
+
+    // a division by a constant zero stays, to report at eval time
+    const auto div = compile("1/0+$x", opt_level::basic);
+    test::throws<std::runtime_error>("1/0 folded", [&] {(void) div.eval();});
+
+    // variables listed in consts are folded and no longer take a slot
+    auto consts = std::make_shared<const_set>();
+    init_def_consts(consts);
+    const auto folded = compile("$pi*2+$x", opt_level::basic, consts);
+    MEVAL_CHECK(folded.get_compiled()->slot_names() == std::vector<std::string>{"x"});
+    MEVAL_CHECK(code_size(folded) == 3 && test::close(folded.eval(), 2 * std::numbers::pi + 5));
+    MEVAL_CHECK(compile("$pi*2+$x", opt_level::basic).get_compiled()->slot_names().size() == 2);
+    return test::failures() != 0;
+}
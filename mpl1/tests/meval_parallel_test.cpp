@@ -0,0 +1,86 @@
+//
+// thread_pool::parallel_for covers every index exactly once and rethrows the
+// first exception; eval_range matches eval_batch; bindings of one
+// compiled_expr evaluate concurrently.
+//
+
+#include "meval_parallel.h"
+#include "tests/meval_test.h"
+#include <stdexcept>
+
+int main() {
+    using namespace meval;
+
+    for (const unsigned threads : {1u, 4u}) {
+        thread_pool pool(threads);
+        MEVAL_CHECK(pool.size() == threads);
+        for (const std::size_t grain : {std::size_t{1}, std::size_t{7}, std::size_t{1000}}) {
+            const std::size_t n = 10007;
+            std::vector<std::atomic<int>> seen(n);
+            pool.parallel_for(3, n, grain, [&](const std::size_t first, const std::size_t last) {
+                test::check(last > first && last - first <= grain, "range within grain");
+                for (std::size_t i = first; i < last; i++)
+                    seen[i]++;
+            });
+            std::size_t once = 0;
+            for (std::size_t i = 0; i < n; i++)
+                once += seen[i] == (i >= 3 ? 1 : 0);
+            test::check(once == n, std::to_string(threads) + " threads, grain " + std::to_string(grain) +
+                        ": every index once");
+        }
+        pool.parallel_for(5, 5, 1, [](std::size_t, std::size_t) {
+            test::check(false, "empty range calls the body");
+        });
+        test::throws<std::logic_error>("exception in the body", [&] {
+            pool.parallel_for(0, 1000, 10, [](const std::size_t first, std::size_t) {
+                if (first == 500)
+                    throw std::logic_error("body");
+            });
+        });
+        // still usable after an exception
+        std::atomic<std::size_t> sum = 0;
+        pool.parallel_for(0, 100, 3, [&](const std::size_t first, const std::size_t last) {
+            for (std::size_t i = first; i < last; i++)
+                sum += i;
+        });
+        MEVAL_CHECK(sum == 4950);
+    }
+
+    test::symbols sym;
+    const math_expr expr("@sin($x)*$y+@sqrt(@abs($x))", sym.vars, sym.funcs, sym.ops);
+    const auto& compiled = expr.get_compiled();
+    const std::size_t rows = 100000;
+    std::vector<double> x(rows), y(rows);
+    for (std::size_t i = 0; i < rows; i++) {
+        x[i] = static_cast<double>(i) * 1e-3 - 50;
+        y[i] = static_cast<double>(i % 97);
+    }
+    const auto columns = expr.bind_columns({{"x", x}, {"y", y}});
+    std::vector<double> want(rows), got(rows);
+    compiled->eval_batch(columns, want);
+    thread_pool pool(4);
+    eval_range(*compiled, columns, got, pool, 1000);
+    MEVAL_CHECK(got == want);
+    std::ranges::fill(got, 0);
+    eval_range(*compiled, columns, got);
+    MEVAL_CHECK(got == want);
+
+    // one binding per thread over the shared expression; batches use the
+    // array kernels, so the rows agree to rounding
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches = 0;
+    for (unsigned t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            var_binding binding(compiled);
+            for (std::size_t i = t; i < rows; i += 4) {
+                binding.set("x", x[i]);
+                binding.set("y", y[i]);
+                mismatches += !test::close(binding.eval(), want[i]);
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    MEVAL_CHECK(mismatches == 0);
+    return test::failures() != 0;
+}
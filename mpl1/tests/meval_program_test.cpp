@@ -0,0 +1,68 @@
+//
+// math_program outputs match math_expr over the corpus, scalar and batch;
+// named intermediates and repeated subterms are computed once.
+//
+
+#include "meval_program.h"
+#include "tests/meval_test.h"
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+
+    for (const auto level : {opt_level::none, opt_level::basic, opt_level::full}) {
+        compile_options options;
+        options.level = level;
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + test::level_name(level) + ")";
+            const math_expr expr(src, sym.vars, sym.funcs, sym.ops, options);
+            const auto want = s.reference(expr, *sym.vars);
+            std::vector<double> got(s.rows), second(s.rows);
+            test::guarded(name, [&] {
+                const math_program program("$t: " + src + "; $t, $t*2", sym.vars, sym.funcs, sym.ops, options);
+                for (std::size_t i = 0; i < s.rows; i++) {
+                    (*sym.vars)["x"] = s.x[i];
+                    (*sym.vars)["y"] = s.y[i];
+                    const auto out = program.eval();
+                    got[i] = out[0];
+                    test::check(test::close(out[1], 2 * out[0]), name + ": second output");
+                }
+                test::compare(name + " program", got, want);
+                std::ranges::fill(got, 0);
+                const std::span<double> outs[] = {got, second};
+                program.eval_batch(s.columns(), outs);
+                test::compare(name + " program batch", got, want);
+            });
+        }
+    }
+
+    // the sine is shared by both outputs and the intermediate
+    const math_program program("$a: @sin($x)*2; $a+1, @sin($x)*2+$y, $y", sym.vars, sym.funcs, sym.ops);
+    const auto& compiled = *program.get_compiled();
+    std::size_t calls = 0, muls = 0;
+    for (const auto& st : compiled.steps()) {
+        calls += st.in.op == opcode::call_func;
+        muls += st.in.op == opcode::mul;
+    }
+    MEVAL_CHECK(calls == 1 && muls == 1);
+    MEVAL_CHECK((program.output_names() == std::vector<std::string>{"$a+1", "@sin($x)*2+$y", "y"}));
+    (*sym.vars)["x"] = 0.5;
+    (*sym.vars)["y"] = 3;
+    const auto out = program.eval();
+    MEVAL_CHECK(out.size() == 3 && out[0] == std::sin(0.5) * 2 + 1 && out[1] == std::sin(0.5) * 2 + 3 && out[2] == 3);
+
+    // $y missing from the columns is broadcast from the var_map
+    const std::vector<double> x{0, 1};
+    std::vector<double> o0(2), o1(2), o2(2);
+    const std::span<double> outs[] = {o0, o1, o2};
+    program.eval_batch({{"x", x}}, outs);
+    MEVAL_CHECK(o0[0] == 1 && o1[1] == std::sin(1.0) * 2 + 3 && o2[0] == 3 && o2[1] == 3);
+
+    test::throws<meval_error>("no outputs", [&] {math_program("$a: $x", sym.vars, sym.funcs, sym.ops);});
+    test::throws<meval_error>("unknown name", [&] {math_program("$b+1", sym.vars, sym.funcs, sym.ops);});
+    test::throws<meval_error>("use before definition", [&] {
+        math_program("$b*2; $b: $x", sym.vars, sym.funcs, sym.ops);
+    });
+    return test::failures() != 0;
+}
@@ -0,0 +1,71 @@
+//
+// math_expr over float and long double agrees with double over the corpus;
+// the double forms of the def_math operators still take mixed arguments and
+// are recognised as the built-in opcodes when registered by hand.
+//
+
+#include "tests/meval_test.h"
+
+namespace {
+    using namespace meval;
+
+    template<typename T>
+    void compare_with_double(const std::string& type, const double tolerance) {
+        test::symbols sym;
+        const test::samples s;
+        auto vars = std::make_shared<basic_var_map<T>>();
+        auto funcs = std::make_shared<basic_func_map<T>>();
+        auto ops = std::make_shared<basic_operator_map<T>>();
+        init_def_vars(vars);
+        init_def_funcs(funcs);
+        init_def_ops(ops);
+        for (const auto& src : test::corpus()) {
+            const std::string name = src + " (" + type + ")";
+            const math_expr want(src, sym.vars, sym.funcs, sym.ops);
+            test::guarded(name, [&] {
+                const basic_math_expr<T> expr(src, vars, funcs, ops);
+                for (std::size_t i = 0; i < s.rows; i++) {
+                    // both read the inputs as rounded to T
+                    (*vars)["x"] = T(s.x[i]);
+                    (*vars)["y"] = T(s.y[i]);
+                    (*sym.vars)["x"] = static_cast<double>((*vars)["x"]);
+                    (*sym.vars)["y"] = static_cast<double>((*vars)["y"]);
+                    double reference;
+                    try {
+                        reference = want.eval();
+                    } catch (const std::exception&) {
+                        continue;
+                    }
+                    const auto got = static_cast<double>(expr.eval());
+                    if (!test::check(test::close(got, reference, tolerance), name + ": row " + std::to_string(i) +
+                                     " is " + std::to_string(got) + ", expected " + std::to_string(reference)))
+                        return;
+                }
+            });
+        }
+    }
+}
+
+int main() {
+    compare_with_double<float>("float", 1e-3);
+    compare_with_double<long double>("long double", 1e-9);
+
+    // mixed arguments convert to the double forms
+    const double x = 3;
+    MEVAL_CHECK(meval::pow(x, 2) == 9 && meval::add(x, 1) == 4 && meval::sub(x, 1) == 2);
+    MEVAL_CHECK(meval::mul(2, x) == 6 && meval::div(1, x) == 1 / x && meval::mod(7, x) == 1);
+    MEVAL_CHECK(meval::add(1.5f, 2.5f) == 4.0f);
+
+    // the double forms registered by hand still compile to the opcodes
+    test::symbols sym;
+    double (*plus)(double, double, double) = meval::add;
+    double (*divide)(double, double, double) = meval::div;
+    (*sym.ops)["+"] = {plus, 1};
+    (*sym.ops)["/"] = {divide, 1};
+    (*sym.vars)["x"] = 2;
+    const math_expr expr("$x+1/$x", sym.vars, sym.funcs, sym.ops);
+    MEVAL_CHECK(expr.eval() == 1.5);
+    for (const auto& in : expr.get_compiled()->code())
+        MEVAL_CHECK(in.op != opcode::call_op && in.op != opcode::call_op_obj);
+    return test::failures() != 0;
+}
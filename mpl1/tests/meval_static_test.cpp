@@ -0,0 +1,65 @@
+//
+// static_expr agrees with math_expr's non-throwing eval over the corpus,
+// orders its parameters by first appearance and evaluates during constant
+// evaluation.
+//
+
+#include "meval_static.h"
+#include "tests/meval_test.h"
+
+namespace {
+    using namespace meval;
+
+    template<fixed_string S>
+    void compare_with_math_expr(test::symbols& sym, const test::samples& s) {
+        typedef static_expr<S> expr;
+        const std::string src(S.view());
+        compile_options options;
+        options.level = opt_level::none;
+        const math_expr want(src, sym.vars, sym.funcs, sym.ops, options);
+        std::vector<double> got(s.rows), values(s.rows);
+        for (std::size_t i = 0; i < s.rows; i++) {
+            (*sym.vars)["x"] = s.x[i];
+            (*sym.vars)["y"] = s.y[i];
+            std::array<double, expr::arity> slots{};
+            for (std::size_t k = 0; k < expr::arity; k++)
+                slots[k] = sym.vars->at(expr::variables[k]);
+            got[i] = expr{}.eval(slots);
+            uint32_t errors = 0;
+            values[i] = want.eval(errors);
+        }
+        test::compare(src, got, values, 1e-12);
+    }
+
+    static_assert(static_expr<"1+2*3">{}() == 9);
+    static_assert(static_expr<"2<3?10:20">{}() == 10);
+    static_assert(static_expr<"$a<$b?$a:$b">{}(2, 3) == 2);
+    static_assert(static_expr<"$y*$x+$y">::arity == 2 && static_expr<"$y*$x+$y">::slot("x") == 1);
+    static_assert(static_expr<"$y*$x+$y">::slot("z") == 2);
+}
+
+int main() {
+    test::symbols sym;
+    const test::samples s;
+    compare_with_math_expr<"($x^2+4)^(1/2)">(sym, s);
+    compare_with_math_expr<"$x*$y+$pi">(sym, s);
+    compare_with_math_expr<"@sin($x)*@cos($y)">(sym, s);
+    compare_with_math_expr<"(($x+1)*($y-2)/($x+3))%7+$e^$x">(sym, s);
+    compare_with_math_expr<"@sqrt($x*$x+$y*$y)+@log(@abs($x)+1)-@exp($y/10)">(sym, s);
+    compare_with_math_expr<"$x^3-2*$x^2+3*$x-4">(sym, s);
+    compare_with_math_expr<"1/(1+@exp(0-$x))">(sym, s);
+    compare_with_math_expr<"@exp(0-($x-$y)^2/2)/@sqrt(2*$pi)">(sym, s);
+    compare_with_math_expr<"@atan($y/(@abs($x)+1))*180/$pi">(sym, s);
+    compare_with_math_expr<"@tanh($x)*(1-@tanh($x)^2)+@floor($y)%3">(sym, s);
+    compare_with_math_expr<"$x<0?0:$x>1?1:$x*$x*(3-2*$x)">(sym, s);
+    compare_with_math_expr<"1/($x*$x+1)">(sym, s);
+    compare_with_math_expr<"$x^4-$y^3+@abs($x)^0.5">(sym, s);
+    compare_with_math_expr<"(2*$x+1)*$y-$x/$y">(sym, s);
+    compare_with_math_expr<"($x<$y)+($x<=$y)*2+($x>$y)*4+($x>=$y)*8+($x==$y)*16+($x!=$y)*32">(sym, s);
+    compare_with_math_expr<"$x>$y?@sqrt(@abs($x)):$y*$y+1">(sym, s);
+    compare_with_math_expr<"($x<$y?$x:$y)*($x>=1?2:3)">(sym, s);
+    compare_with_math_expr<"@log($x)+@sqrt($y)">(sym, s);
+    // division by zero follows IEEE arithmetic
+    MEVAL_CHECK(std::isinf(static_expr<"1/$x">{}(0.0)) && std::isnan(static_expr<"$x/$x">{}(0.0)));
+    return test::failures() != 0;
+}
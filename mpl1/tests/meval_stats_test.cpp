@@ -0,0 +1,76 @@
+//
+// Under MEVAL_STATS, snapshots count the phases, opcodes, callables,
+// latencies and caches of a known workload, and the text and JSON dumps
+// carry those counts; otherwise snapshots are empty and say so.
+//
+
+#include "meval_cache.h"
+#include "meval_stats.h"
+#include "tests/meval_test.h"
+
+namespace {
+    bool has(const std::string& text, const std::string& part) {
+        return text.find(part) != std::string::npos;
+    }
+}
+
+int main() {
+    using namespace meval;
+    test::symbols sym;
+    const test::samples s;
+    reset_stats();
+
+    compile_options options;
+    options.level = opt_level::none;
+    const math_expr expr("@sin($x)*2+$y", sym.vars, sym.funcs, sym.ops, options);
+    for (int i = 0; i < 10; i++)
+        (void) expr.eval();
+    std::vector<double> out(s.rows);
+    expr.eval_batch(s.columns(), out);
+    expr_cache cache(16, 1);
+    (void) cache.get("$x+1", sym.vars, sym.funcs, sym.ops);
+    (void) cache.get("$x+1", sym.vars, sym.funcs, sym.ops);
+
+    const auto snap = snapshot_stats();
+    const auto json = stats_json(snap);
+    const auto text = stats_text(snap);
+    const auto count = [&snap](const opcode op) {return snap.opcodes[static_cast<std::size_t>(op)].count;};
+    const uint64_t runs = 10 + s.rows;
+    MEVAL_CHECK(snap.enabled == stats_enabled);
+    if constexpr (!stats_enabled) {
+        MEVAL_CHECK(count(opcode::mul) == 0 && snap.callables.empty() && snap.eval.summary.count == 0);
+        MEVAL_CHECK(has(json, "\"enabled\": false") && has(text, "meval_stats_enabled 0"));
+        return test::failures() != 0;
+    }
+
+    // the expression and the cache's miss were tokenized and compiled
+    MEVAL_CHECK(snap.phases[static_cast<std::size_t>(stats_phase::tokenize)].count >= 2);
+    MEVAL_CHECK(snap.phases[static_cast<std::size_t>(stats_phase::compile)].count >= 2);
+    MEVAL_CHECK(count(opcode::mul) == runs && count(opcode::add) == runs && count(opcode::call_func) == runs);
+    MEVAL_CHECK(count(opcode::push_var) == 2 * runs && count(opcode::div) == 0);
+    const auto sine = std::ranges::find(snap.callables, std::string("sin"), &stats_snapshot::callable::name);
+    MEVAL_CHECK(sine != snap.callables.end() && sine->calls.count == runs);
+
+    MEVAL_CHECK(snap.eval.summary.count == 10 && snap.batch.summary.count == 1);
+    uint64_t bucketed = 0;
+    for (const auto b : snap.eval.buckets)
+        bucketed += b;
+    MEVAL_CHECK(bucketed == 10 && snap.eval.percentile(50) <= snap.eval.percentile(99));
+
+    const auto mine = std::ranges::find_if(snap.caches, [](const stats_snapshot::cache& c) {
+        return c.hits == 1 && c.misses == 1 && c.entries == 1;
+    });
+    MEVAL_CHECK(mine != snap.caches.end());
+
+    const std::string n = std::to_string(runs);
+    MEVAL_CHECK(has(json, "\"enabled\": true") && has(json, "\"mul\": {\"count\": " + n));
+    MEVAL_CHECK(has(json, "\"sin\": {\"count\": " + n) && has(json, "\"eval_latency\": {\"count\": 10"));
+    MEVAL_CHECK(has(json, "{\"hits\": 1, \"misses\": 1, \"evictions\": 0, \"entries\": 1}"));
+    MEVAL_CHECK(has(text, "meval_stats_enabled 1") && has(text, "opcode=\"mul\"} " + n + "\n"));
+    MEVAL_CHECK(has(text, "meval_callable_calls_total{name=\"sin\"} " + n + "\n"));
+
+    reset_stats();
+    const auto cleared = snapshot_stats();
+    MEVAL_CHECK(cleared.opcodes[static_cast<std::size_t>(opcode::mul)].count == 0 && cleared.eval.summary.count == 0);
+    return test::failures() != 0;
+}
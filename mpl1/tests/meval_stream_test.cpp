@@ -0,0 +1,106 @@
+//
+// Runs the meval_stream given as the first argument over the same table
+// written as CSV and as mcol, in chunks smaller than the table, and checks
+// both outputs, text and binary, against math_expr row by row.
+//
+
+#include "tests/meval_test.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+namespace {
+    using namespace meval;
+
+    int run(const std::string& command) {
+        return std::system((command + " 2>/dev/null").c_str());
+    }
+
+    std::string read_file(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+
+    void write_mcol(const std::string& path, const std::vector<std::pair<std::string, std::vector<double>>>& columns) {
+        std::string buf("MEVALCOL", 8);
+        const auto put = [&buf](const auto v) {buf.append(reinterpret_cast<const char*>(&v), sizeof v);};
+        put(uint32_t{1});
+        put(static_cast<uint32_t>(columns.size()));
+        put(static_cast<uint64_t>(columns.front().second.size()));
+        for (const auto& [name, values] : columns) {
+            put(static_cast<uint32_t>(name.size()));
+            buf += name;
+        }
+        buf.resize((buf.size() + 7) / 8 * 8);
+        for (const auto& [name, values] : columns)
+            buf.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+        std::ofstream(path, std::ios::binary) << buf;
+    }
+}
+
+int main(const int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s MEVAL_STREAM\n", argv[0]);
+        return 2;
+    }
+    const std::string stream = argv[1];
+    const std::string dir = "/tmp/meval_stream_test." + std::to_string(::getpid());
+    run("mkdir -p " + dir);
+
+    const std::size_t rows = 1000;
+    std::vector<double> x(rows), y(rows);
+    std::string csv = "y,x\n";
+    for (std::size_t i = 0; i < rows; i++) {
+        x[i] = static_cast<double>(i) * 0.01 - 5;
+        y[i] = static_cast<double>(i % 17) * 0.5;
+        csv += std::to_string(y[i]) + "," + std::to_string(x[i]) + "\n";
+        // the CSV holds what to_string printed
+        y[i] = std::stod(std::to_string(y[i]));
+        x[i] = std::stod(std::to_string(x[i]));
+    }
+    std::ofstream(dir + "/in.csv") << csv;
+    write_mcol(dir + "/in.mcol", {{"x", x}, {"y", y}});
+
+    const std::string formula = "$x*$y+@sin($x)-$pi";
+    test::symbols sym;
+    const math_expr expr(formula, sym.vars, sym.funcs, sym.ops);
+    std::vector<double> want(rows);
+    for (std::size_t i = 0; i < rows; i++) {
+        (*sym.vars)["x"] = x[i];
+        (*sym.vars)["y"] = y[i];
+        want[i] = expr.eval();
+    }
+
+    for (const std::string input : {"in.csv", "in.mcol"}) {
+        for (const std::string flags : {"", " --no-jit --threads 1", " --opt full"}) {
+            const std::string name = input + flags;
+            const std::string base = stream + " --chunk 64" + flags + " '" + formula + "' " + dir + "/" + input;
+            if (!test::check(run(base + " -o " + dir + "/out.csv") == 0, name + ": exit status"))
+                continue;
+            std::vector<double> got;
+            std::ifstream text(dir + "/out.csv");
+            for (double v; text >> v;)
+                got.push_back(v);
+            if (test::check(got.size() == rows, name + ": " + std::to_string(got.size()) + " text rows"))
+                test::compare(name + " text", got, want);
+
+            if (!test::check(run(base + " --out-format bin -o " + dir + "/out.bin") == 0, name + ": exit status"))
+                continue;
+            const auto bin = read_file(dir + "/out.bin");
+            if (!test::check(bin.size() == rows * sizeof(double), name + ": binary size"))
+                continue;
+            got.resize(rows);
+            std::memcpy(got.data(), bin.data(), bin.size());
+            test::compare(name + " binary", got, want);
+        }
+    }
+
+    // a column the expression needs is missing, or the file is not mcol
+    MEVAL_CHECK(run(stream + " '$x+$z' " + dir + "/in.csv -o " + dir + "/out.csv") != 0);
+    std::ofstream(dir + "/bad.mcol") << "MEVALCOX" << std::string(16, '\0');
+    MEVAL_CHECK(run(stream + " '$x' " + dir + "/bad.mcol -o " + dir + "/out.csv") != 0);
+    run("rm -rf " + dir);
+    return test::failures() != 0;
+}
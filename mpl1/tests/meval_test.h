@@ -0,0 +1,175 @@
+//
+// Checks shared by the tests: a failed check is printed and counted, and the
+// test exits with failures() as its status. Also the formulas and sample rows
+// the evaluators are compared over.
+//
+
+#ifndef MEVAL_TEST_H
+#define MEVAL_TEST_H
+
+#include "def_math.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace meval::test {
+
+    inline int& failures() {
+        static int count = 0;
+        return count;
+    }
+
+    inline bool check(const bool ok, const std::string& what) {
+        if (!ok) {
+            failures()++;
+            std::printf("FAIL %s\n", what.c_str());
+        }
+        return ok;
+    }
+
+    // values of two evaluators of the same expression; folding, fused opcodes
+    // and the vector kernels may round differently
+    inline bool close(const double a, const double b, const double tolerance = 1e-9) {
+        if (std::isnan(a) || std::isnan(b))
+            return std::isnan(a) && std::isnan(b);
+        if (std::isinf(a) || std::isinf(b))
+            return a == b;
+        return std::fabs(a - b) <= tolerance * std::max(1.0, std::fabs(b));
+    }
+
+    // the benchmark corpus, then formulas for the fused opcodes, comparisons
+    // and selects; all of them in $x and $y
+    inline const std::vector<std::string>& corpus() {
+        static const std::vector<std::string> formulas = {
+            // bench/meval_bench.cpp
+            "($x^2+4)^(1/2)",
+            "$x*$y+$pi",
+            "@sin($x)*@cos($y)",
+            "(($x+1)*($y-2)/($x+3))%7+$e^$x",
+            "@sqrt($x*$x+$y*$y)+@log(@abs($x)+1)-@exp($y/10)",
+            "$x^3-2*$x^2+3*$x-4",
+            "1/(1+@exp(0-$x))",
+            "@exp(0-($x-$y)^2/2)/@sqrt(2*$pi)",
+            "@atan($y/(@abs($x)+1))*180/$pi",
+            "@tanh($x)*(1-@tanh($x)^2)+@floor($y)%3",
+            "$x<0?0:$x>1?1:$x*$x*(3-2*$x)",
+            // square, recip, sqrt, powi, hypot and fma
+            "$x*$x+$y*$y",
+            "1/($x*$x+1)",
+            "@sqrt($x*$x+$y*$y)",
+            "$x^4-$y^3+@abs($x)^0.5",
+            "$x*$y+$x",
+            "(2*$x+1)*$y-$x/$y",
+            // comparisons and selects
+            "($x<$y)+($x<=$y)*2+($x>$y)*4+($x>=$y)*8+($x==$y)*16+($x!=$y)*32",
+            "$x>$y?@sqrt(@abs($x)):$y*$y+1",
+            "$x>0?$x:0-$x",
+            "($x<$y?$x:$y)*($x>=1?2:3)",
+            // rows raising eval_invalid
+            "@log($x)+@sqrt($y)",
+        };
+        return formulas;
+    }
+
+    // Rows of $x and $y past one batch block, never exactly on a pole of the
+    // corpus, with one row where they are equal.
+    struct samples {
+        static constexpr std::size_t rows = 300;
+        std::vector<double> x, y;
+
+        samples() : x(rows), y(rows) {
+            for (std::size_t i = 0; i < rows; i++) {
+                x[i] = -3 + 6.0 * static_cast<double>(i) / rows + 0.001;
+                y[i] = -2 + 6.0 * static_cast<double>(i * 37 % rows) / rows + 0.003;
+            }
+            y[7] = x[7];
+        }
+
+        [[nodiscard]] column_map columns() const {return {{"x", x}, {"y", y}};}
+
+        // slot values of row i, the slots ordered by names; other names are
+        // read from vars
+        template<typename Names>
+        [[nodiscard]] std::vector<double> row(const Names& names, const var_map& vars, const std::size_t i) const {
+            std::vector<double> slots;
+            for (const auto& name : names)
+                slots.push_back(name == "x" ? x[i] : name == "y" ? y[i] : vars.at(std::string(name)));
+            return slots;
+        }
+
+        // the reference values of expr, from the postfix interpreter
+        [[nodiscard]] std::vector<double> reference(const math_expr& expr, var_map& vars) const {
+            std::vector<double> want(rows);
+            for (std::size_t i = 0; i < rows; i++) {
+                vars["x"] = x[i];
+                vars["y"] = y[i];
+                want[i] = expr.eval_postfix();
+            }
+            return want;
+        }
+    };
+
+    // maps with the definitions of def_math, $x and $y
+    struct symbols {
+        std::shared_ptr<var_map> vars = std::make_shared<var_map>();
+        std::shared_ptr<func_map> funcs = std::make_shared<func_map>();
+        std::shared_ptr<operator_map> ops = std::make_shared<operator_map>();
+
+        symbols() {
+            init_def_vars(vars);
+            init_def_funcs(funcs);
+            init_def_ops(ops);
+        }
+    };
+
+    inline std::string level_name(const opt_level level) {
+        return level == opt_level::none ? "none" : level == opt_level::basic ? "basic" : "full";
+    }
+
+    inline void compare(const std::string& what, const std::vector<double>& got, const std::vector<double>& want,
+                        const double tolerance = 1e-9) {
+        for (std::size_t i = 0; i < want.size(); i++) {
+            if (!check(close(got[i], want[i], tolerance), what + ": row " + std::to_string(i) + " is " +
+                       std::to_string(got[i]) + ", expected " + std::to_string(want[i])))
+                return;
+        }
+    }
+
+    inline void compare_errors(const std::string& what, const std::vector<uint32_t>& got,
+                               const std::vector<uint32_t>& want) {
+        for (std::size_t i = 0; i < want.size(); i++) {
+            if (!check(got[i] == want[i], what + ": errors of row " + std::to_string(i) + " are " +
+                       std::to_string(got[i]) + ", expected " + std::to_string(want[i])))
+                return;
+        }
+    }
+
+    // runs f, counting an exception as a failure
+    template<typename F>
+    void guarded(const std::string& what, F f) {
+        try {
+            f();
+        } catch (const std::exception& e) {
+            check(false, what + ": threw " + e.what());
+        }
+    }
+
+    // checks that f throws E
+    template<typename E, typename F>
+    void throws(const std::string& what, F f) {
+        try {
+            f();
+            check(false, what + ": did not throw");
+        } catch (const E&) {
+        } catch (const std::exception& e) {
+            check(false, what + ": threw " + e.what());
+        }
+    }
+
+} // meval::test
+
+#define MEVAL_CHECK(cond) ::meval::test::check((cond), std::string(__FILE__ ":") + std::to_string(__LINE__) + ": " + #cond)
+
+#endif //MEVAL_TEST_H
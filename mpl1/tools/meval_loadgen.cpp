@@ -0,0 +1,337 @@
+// meval_loadgen.cpp
+// Drives a running meval_server with pipelined eval requests and reports
+// throughput and latency.
+//
+// Usage: meval_loadgen [options] SOCKET
+//   --expr TEXT          expression to compile (default "$x*$y+@sin($x)")
+//   --connections N      client connections, one thread each (default 4)
+//   --depth N            requests in flight per connection (default 8)
+//   --rows N             rows per eval request (default 64)
+//   --seconds S          how long to send for (default 5)
+//   --opt none|basic|full
+//
+// Every connection compiles the expression, which the server resolves to
+// one shared handle, then keeps depth eval requests of random in-domain
+// values outstanding until the time is up. Latency is measured from sending
+// a request to reading its response; the server's own share, the time it
+// held the request, comes with each response. The server's counters are
+// printed at the end, including how many requests it coalesced per batch.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "meval_wire.h"
+
+namespace {
+    typedef std::chrono::steady_clock clock_type;
+
+    struct options {
+        std::string socket;
+        std::string expr="$x*$y+@sin($x)";
+        unsigned connections=4;
+        unsigned depth=8;
+        uint32_t rows=64;
+        double seconds=5;
+        uint8_t level=1;
+    };
+
+    // Blocking connection that reads whole frames.
+    class client {
+    public:
+        explicit client(const std::string& path) {
+            sockaddr_un addr{};
+            if (path.size() >= sizeof addr.sun_path)
+                throw std::runtime_error("socket path too long: " + path);
+            addr.sun_family = AF_UNIX;
+            std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+            m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd < 0 || ::connect(m_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) != 0) {
+                const int err = errno;
+                if (m_fd >= 0)
+                    ::close(m_fd);
+                throw std::runtime_error("cannot connect to " + path + ": " + std::strerror(err));
+            }
+        }
+        ~client() {
+            ::close(m_fd);
+        }
+        client(const client&) = delete;
+        client& operator=(const client&) = delete;
+
+        void send(const std::string& data) const {
+            std::size_t pos = 0;
+            while (pos < data.size()) {
+                const ssize_t n = ::send(m_fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::runtime_error(std::string("send: ") + std::strerror(errno));
+                pos += static_cast<std::size_t>(n);
+            }
+        }
+
+        // the next response frame, valid until the next call
+        std::string_view receive() {
+            if (m_pos > 0 && m_pos == m_in.size()) {
+                m_in.clear();
+                m_pos = 0;
+            }
+            while (true) {
+                const std::string_view rest(m_in.data() + m_pos, m_in.size() - m_pos);
+                if (const std::size_t frame = meval::wire::complete_frame(rest)) {
+                    m_pos += frame;
+                    return rest.substr(0, frame);
+                }
+                if (m_pos > 0) {
+                    m_in.erase(0, m_pos);
+                    m_pos = 0;
+                }
+                char buf[65536];
+                const ssize_t n = ::recv(m_fd, buf, sizeof buf, 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw std::runtime_error("connection closed by the server");
+                m_in.append(buf, static_cast<std::size_t>(n));
+            }
+        }
+    private:
+        int m_fd=-1;
+        std::string m_in;
+        std::size_t m_pos=0;
+    };
+
+    struct response {
+        uint32_t id;
+        meval::wire::status status;
+        uint64_t latency_ns;
+        meval::wire::frame_reader payload;
+    };
+
+    response parse(const std::string_view frame) {
+        meval::wire::frame_reader r(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t));
+        uint32_t id;
+        uint8_t st;
+        uint64_t ns;
+        if (!r.get(id) || !r.get(st) || !r.get(ns))
+            throw std::runtime_error("truncated response");
+        return {id, static_cast<meval::wire::status>(st), ns, r};
+    }
+
+    std::string error_text(response& res) {
+        uint8_t type;
+        res.payload.get(type);
+        return std::string(res.payload.rest());
+    }
+
+    struct compiled {
+        uint32_t handle;
+        std::vector<std::string> slots;
+    };
+
+    compiled compile(client& c, const options& opt) {
+        std::string req;
+        meval::wire::frame_writer w(req);
+        w.put(uint32_t{0}).put(meval::wire::kind::compile).put(opt.level).put(uint8_t{0});
+        w.put_bytes(opt.expr.data(), opt.expr.size());
+        w.finish();
+        c.send(req);
+        auto res = parse(c.receive());
+        if (res.status != meval::wire::status::ok)
+            throw std::runtime_error("compile failed: " + error_text(res));
+        compiled out;
+        uint32_t slots;
+        if (!res.payload.get(out.handle) || !res.payload.get(slots))
+            throw std::runtime_error("truncated compile response");
+        out.slots.resize(slots);
+        for (auto& name : out.slots) {
+            if (!res.payload.get_string(name))
+                throw std::runtime_error("truncated compile response");
+        }
+        return out;
+    }
+
+    struct connection_result {
+        uint64_t requests=0;
+        uint64_t errors=0;
+        uint64_t server_ns=0;
+        std::vector<uint64_t> latencies;
+        std::string first_error;
+    };
+
+    void drive(const options& opt, const compiled& expr, const unsigned seed, connection_result& result) {
+        client c(opt.socket);
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> dist(0.1, 1.0);
+
+        // one payload of random columns, resent under fresh ids
+        std::string body;
+        {
+            meval::wire::frame_writer w(body);
+            w.put(uint32_t{0}).put(meval::wire::kind::eval).put(expr.handle).put(opt.rows)
+             .put(static_cast<uint32_t>(expr.slots.size()));
+            for (std::size_t s = 0; s < expr.slots.size(); s++) {
+                w.put(opt.rows);
+                for (uint32_t r = 0; r < opt.rows; r++)
+                    w.put(dist(rng));
+            }
+            w.finish();
+        }
+        constexpr std::size_t id_offset = sizeof(uint32_t);
+        std::unordered_map<uint32_t, clock_type::time_point> in_flight;
+        uint32_t next_id = 1;
+        std::string batch;
+        const auto send_one = [&] {
+            const uint32_t id = next_id++;
+            std::memcpy(body.data() + id_offset, &id, sizeof id);
+            batch += body;
+            in_flight.emplace(id, clock_type::now());
+        };
+
+        const auto until = clock_type::now() + std::chrono::duration<double>(opt.seconds);
+        for (unsigned i = 0; i < opt.depth; i++)
+            send_one();
+        c.send(batch);
+        while (!in_flight.empty()) {
+            auto res = parse(c.receive());
+            const auto now = clock_type::now();
+            const auto it = in_flight.find(res.id);
+            if (it == in_flight.end())
+                throw std::runtime_error("response to unknown request " + std::to_string(res.id));
+            result.latencies.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - it->second).count()));
+            in_flight.erase(it);
+            result.requests++;
+            result.server_ns += res.latency_ns;
+            if (res.status != meval::wire::status::ok) {
+                if (result.errors++ == 0)
+                    result.first_error = error_text(res);
+            }
+            if (now < until) {
+                batch.clear();
+                send_one();
+                c.send(batch);
+            }
+        }
+    }
+
+    uint64_t percentile(const std::vector<uint64_t>& sorted, const double q) {
+        if (sorted.empty())
+            return 0;
+        return sorted[static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1))];
+    }
+
+    int usage(const char* argv0) {
+        std::fprintf(stderr, "usage: %s [--expr TEXT] [--connections N] [--depth N] [--rows N] [--seconds S]\n"
+                     "       [--opt none|basic|full] SOCKET\n", argv0);
+        return 2;
+    }
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (a == "--expr" && has_value) {
+            opt.expr = argv[++i];
+        } else if (a == "--connections" && has_value) {
+            opt.connections = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        } else if (a == "--depth" && has_value) {
+            opt.depth = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        } else if (a == "--rows" && has_value) {
+            opt.rows = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+        } else if (a == "--seconds" && has_value) {
+            opt.seconds = std::stod(argv[++i]);
+        } else if (a == "--opt" && has_value) {
+            const std::string l = argv[++i];
+            if (l == "none")
+                opt.level = 0;
+            else if (l == "basic")
+                opt.level = 1;
+            else if (l == "full")
+                opt.level = 2;
+            else
+                return usage(argv[0]);
+        } else if (a.size() > 1 && a[0] == '-') {
+            return usage(argv[0]);
+        } else {
+            positional.push_back(a);
+        }
+    }
+    if (positional.size() != 1)
+        return usage(argv[0]);
+    opt.socket = positional[0];
+
+    try {
+        client control(opt.socket);
+        const compiled expr = compile(control, opt);
+
+        std::vector<connection_result> results(opt.connections);
+        std::vector<std::exception_ptr> failures(opt.connections);
+        std::vector<std::thread> threads;
+        const auto start = clock_type::now();
+        for (unsigned i = 0; i < opt.connections; i++) {
+            threads.emplace_back([&, i] {
+                try {
+                    drive(opt, expr, i + 1, results[i]);
+                } catch (...) {
+                    failures[i] = std::current_exception();
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        const double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+        for (const auto& f : failures) {
+            if (f)
+                std::rethrow_exception(f);
+        }
+
+        std::vector<uint64_t> latencies;
+        uint64_t requests = 0, errors = 0, server_ns = 0;
+        std::string first_error;
+        for (auto& r : results) {
+            requests += r.requests;
+            errors += r.errors;
+            server_ns += r.server_ns;
+            latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+            if (first_error.empty())
+                first_error = r.first_error;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("%llu requests in %.3f s: %.0f requests/s, %.3e rows/s, %llu errors\n",
+                    static_cast<unsigned long long>(requests), seconds, static_cast<double>(requests) / seconds,
+                    static_cast<double>(requests) * opt.rows / seconds, static_cast<unsigned long long>(errors));
+        std::printf("latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us; in the server %.1f us on average\n",
+                    static_cast<double>(percentile(latencies, 0.5)) / 1e3,
+                    static_cast<double>(percentile(latencies, 0.99)) / 1e3,
+                    static_cast<double>(percentile(latencies, 0.999)) / 1e3,
+                    latencies.empty() ? 0.0 : static_cast<double>(latencies.back()) / 1e3,
+                    requests ? static_cast<double>(server_ns) / static_cast<double>(requests) / 1e3 : 0.0);
+        if (!first_error.empty())
+            std::printf("first error: %s\n", first_error.c_str());
+
+        std::string req;
+        meval::wire::frame_writer w(req);
+        w.put(uint32_t{0}).put(meval::wire::kind::stats);
+        w.finish();
+        control.send(req);
+        auto res = parse(control.receive());
+        std::printf("server: %.*s\n", static_cast<int>(res.payload.rest().size()), res.payload.rest().data());
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
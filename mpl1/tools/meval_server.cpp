@@ -0,0 +1,862 @@
+// meval_server.cpp
+// Compiles and evaluates expressions for other processes over a Unix domain
+// socket, in the binary protocol of meval_wire.h.
+//
+// Usage: meval_server [options] SOCKET
+//   --io-threads N       event loops serving connections (default 1)
+//   --workers N          evaluation threads (default: all cores)
+//   --max-batch ROWS     rows one coalesced evaluation, and so one request,
+//                        takes at most (default 65536)
+//
+// Compiled expressions are held by handle for the lifetime of the server;
+// compiling the same text with the same options again, from any connection,
+// returns the same handle. Each I/O thread runs an epoll loop over
+// non-blocking sockets and does nothing but split and frame messages.
+// Evaluations queue on their handle, and the worker that picks the handle
+// up takes everything queued on it as one batch: the requests' columns are
+// concatenated and evaluated by one masked eval_batch call, so concurrent
+// small requests for one expression cost one pass. Results go back to the
+// loop owning the connection through an eventfd. A connection holds at most
+// one frame of unread input, and stops taking requests while a frame's worth
+// of responses is unsent or 256 requests are still being worked on. On
+// SIGINT or SIGTERM the server removes the socket and prints its counters
+// and latency quantiles to stderr; the stats request returns the same as
+// JSON.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "def_math.h"
+#include "meval_wire.h"
+
+namespace {
+    typedef std::chrono::steady_clock clock_type;
+
+    // written by the signal handler; every loop watches it
+    int g_stop_fd = -1;
+
+    void on_signal(int) {
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto n = ::write(g_stop_fd, &one, sizeof one);
+    }
+
+    struct options {
+        std::string socket;
+        unsigned io_threads=1;
+        unsigned workers=std::max(1u, std::thread::hardware_concurrency());
+        std::size_t max_batch=65536;
+    };
+
+    // Request latencies in buckets of a quarter of a power of two of nanoseconds.
+    class latency_histogram {
+    public:
+        void add(const uint64_t ns) noexcept {
+            m_buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        }
+        // upper bound of the bucket holding quantile q, 0 when empty
+        [[nodiscard]] uint64_t quantile(const double q) const noexcept {
+            uint64_t total = 0;
+            for (const auto& b : m_buckets)
+                total += b.load(std::memory_order_relaxed);
+            if (total == 0)
+                return 0;
+            const auto rank = static_cast<uint64_t>(q * static_cast<double>(total - 1));
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < buckets; i++) {
+                seen += m_buckets[i].load(std::memory_order_relaxed);
+                if (seen > rank)
+                    return upper_bound(i);
+            }
+            return upper_bound(buckets - 1);
+        }
+    private:
+        static constexpr std::size_t buckets = 4 * 64;
+        std::array<std::atomic<uint64_t>, buckets> m_buckets{};
+
+        static std::size_t bucket_of(const uint64_t ns) noexcept {
+            if (ns < 4)
+                return ns;
+            const auto b = static_cast<std::size_t>(std::bit_width(ns));
+            return (b - 2) * 4 + ((ns >> (b - 3)) & 3);
+        }
+        static uint64_t upper_bound(const std::size_t i) noexcept {
+            if (i < 4)
+                return i + 1;
+            const std::size_t b = i / 4 + 2;
+            return b - 3 >= 61 ? UINT64_MAX : (4 + i % 4 + 1) << (b - 3);
+        }
+    };
+
+    struct counters {
+        std::atomic<uint64_t> compiles{0};
+        std::atomic<uint64_t> evals{0};
+        std::atomic<uint64_t> batches{0};
+        std::atomic<uint64_t> rows{0};
+        std::atomic<uint64_t> errors{0};
+        latency_histogram latency;
+    };
+
+    uint64_t latency_ns(const clock_type::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now() - start).count());
+    }
+
+    // Where a response goes: a connection of one of the loops.
+    struct reply_to {
+        unsigned loop;
+        uint64_t conn;
+        uint32_t id;
+        clock_type::time_point start;
+    };
+
+    struct pending_eval {
+        reply_to to;
+        uint32_t rows;
+        std::vector<std::vector<double>> columns;  // slot order, size rows or 1
+    };
+
+    struct handle_entry {
+        std::shared_ptr<const meval::compiled_expr> expr;
+        std::mutex mutex;
+        std::deque<pending_eval> pending;
+        bool scheduled=false;
+    };
+
+    // Unbounded queue of tasks for the workers; pop returns an empty
+    // function once the queue is closed and drained.
+    class task_queue {
+    public:
+        void push(std::function<void()> task) {
+            {
+                std::lock_guard lk(m_mutex);
+                m_items.push_back(std::move(task));
+            }
+            m_ready.notify_one();
+        }
+        std::function<void()> pop() {
+            std::unique_lock lk(m_mutex);
+            m_ready.wait(lk, [this] { return !m_items.empty() || m_closed; });
+            if (m_items.empty())
+                return {};
+            auto task = std::move(m_items.front());
+            m_items.pop_front();
+            return task;
+        }
+        void close() {
+            {
+                std::lock_guard lk(m_mutex);
+                m_closed = true;
+            }
+            m_ready.notify_all();
+        }
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_ready;
+        std::deque<std::function<void()>> m_items;
+        bool m_closed=false;
+    };
+
+    class server;
+
+    // One epoll loop over the listening socket (shared by every loop, with
+    // EPOLLEXCLUSIVE so that one of them takes each connection), its own
+    // connections, the wake-up eventfd for posted responses and the stop fd.
+    class io_loop {
+    public:
+        io_loop(server& srv, unsigned index, int listen_fd);
+        ~io_loop();
+        io_loop(const io_loop&) = delete;
+        io_loop& operator=(const io_loop&) = delete;
+
+        void run();
+        // queues a finished response frame; callable from any thread
+        void post(uint64_t conn, std::string frame);
+    private:
+        struct connection {
+            int fd=-1;
+            std::string in;
+            std::string out;
+            std::size_t out_pos=0;
+            uint32_t events=0;    // registered with epoll
+            uint32_t awaiting=0;  // requests whose responses are yet to be posted
+        };
+        static constexpr uint64_t listen_key = 0, wake_key = 1, stop_key = 2, first_conn = 16;
+        static constexpr std::size_t max_input = meval::wire::max_frame + sizeof(uint32_t);
+        static constexpr std::size_t max_unsent = meval::wire::max_frame;
+        static constexpr uint32_t max_awaiting = 256;
+
+        static bool accepting(const connection& c) noexcept {
+            return c.out.size() - c.out_pos < max_unsent && c.awaiting < max_awaiting;
+        }
+
+        server& m_server;
+        unsigned m_index;
+        int m_listen;
+        int m_epoll=-1;
+        int m_wake=-1;
+        std::unordered_map<uint64_t, connection> m_conns;
+        uint64_t m_next_conn=first_conn;
+        std::mutex m_posted_mutex;
+        std::vector<std::pair<uint64_t, std::string>> m_posted;
+
+        void accept_all();
+        void read_from(uint64_t key, connection& c);
+        bool take_requests(uint64_t key, connection& c);
+        void resume(uint64_t key, connection& c);
+        bool flush(uint64_t key, connection& c);
+        void drain_posted();
+        void close_conn(uint64_t key);
+    };
+
+    class server {
+    public:
+        explicit server(const options& opt);
+
+        // handles one complete request frame; immediate replies are appended
+        // to reply, the others are posted to the loop later. false closes the
+        // connection.
+        bool dispatch(unsigned loop, uint64_t conn, std::string_view frame, std::string& reply);
+        void serve(int listen_fd);
+    private:
+        options m_opt;
+        std::shared_ptr<meval::var_map> m_vars = std::make_shared<meval::var_map>();
+        std::shared_ptr<meval::func_map> m_funcs = std::make_shared<meval::func_map>();
+        std::shared_ptr<meval::operator_map> m_ops = std::make_shared<meval::operator_map>();
+        std::mutex m_compile_mutex;
+        mutable std::shared_mutex m_handles_mutex;
+        std::map<std::string, uint32_t, std::less<>> m_handle_of;   // level, flags, text
+        std::vector<std::shared_ptr<handle_entry>> m_handles;
+        std::vector<std::unique_ptr<io_loop>> m_loops;
+        task_queue m_tasks;
+        counters m_counters;
+
+        std::shared_ptr<handle_entry> find_handle(uint32_t handle) const;
+        void compile(const reply_to& to, uint8_t level, uint8_t flags, std::string text);
+        void enqueue(const std::shared_ptr<handle_entry>& entry, pending_eval req);
+        void run_batch(const std::shared_ptr<handle_entry>& entry);
+        void evaluate(const meval::compiled_expr& expr, std::vector<pending_eval>& batch);
+        meval::wire::frame_writer response(std::string& buf, const reply_to& to, meval::wire::status st);
+        void error_response(std::string& buf, const reply_to& to, uint8_t type, std::string_view msg);
+        [[nodiscard]] std::string stats_json() const;
+    };
+
+    io_loop::io_loop(server& srv, const unsigned index, const int listen_fd)
+        : m_server(srv), m_index(index), m_listen(listen_fd) {
+        m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        m_wake = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_epoll < 0 || m_wake < 0)
+            throw std::runtime_error(std::string("cannot create event loop: ") + std::strerror(errno));
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.u64 = listen_key;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+        ev.events = EPOLLIN;
+        ev.data.u64 = wake_key;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev);
+        ev.data.u64 = stop_key;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, g_stop_fd, &ev);
+    }
+
+    io_loop::~io_loop() {
+        for (const auto& [key, c] : m_conns)
+            ::close(c.fd);
+        ::close(m_wake);
+        ::close(m_epoll);
+    }
+
+    void io_loop::run() {
+        epoll_event events[64];
+        while (true) {
+            const int n = ::epoll_wait(m_epoll, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("epoll_wait: ") + std::strerror(errno));
+            }
+            for (int i = 0; i < n; i++) {
+                const uint64_t key = events[i].data.u64;
+                if (key == stop_key)
+                    return;
+                if (key == listen_key) {
+                    accept_all();
+                } else if (key == wake_key) {
+                    uint64_t count;
+                    [[maybe_unused]] const auto r = ::read(m_wake, &count, sizeof count);
+                    drain_posted();
+                } else if (const auto it = m_conns.find(key); it != m_conns.end()) {
+                    if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                        close_conn(key);
+                        continue;
+                    }
+                    if (events[i].events & EPOLLOUT && !flush(key, it->second))
+                        continue;
+                    if (events[i].events & EPOLLIN)
+                        read_from(key, it->second);
+                    else if (events[i].events & EPOLLOUT)
+                        resume(key, it->second);
+                }
+            }
+        }
+    }
+
+    void io_loop::post(const uint64_t conn, std::string frame) {
+        {
+            std::lock_guard lk(m_posted_mutex);
+            m_posted.emplace_back(conn, std::move(frame));
+        }
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto n = ::write(m_wake, &one, sizeof one);
+    }
+
+    void io_loop::accept_all() {
+        while (true) {
+            const int fd = ::accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;  // EAGAIN, or a connection that died before it was taken
+            const uint64_t key = m_next_conn++;
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = key;
+            if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                ::close(fd);
+                continue;
+            }
+            m_conns[key].fd = fd;
+            m_conns[key].events = ev.events;
+        }
+    }
+
+    void io_loop::read_from(const uint64_t key, connection& c) {
+        char buf[65536];
+        bool closed = false;
+        // a complete frame fits max_input, so what is left in the socket
+        // waits for that to be taken
+        while (c.in.size() < max_input) {
+            const ssize_t n = ::read(c.fd, buf, sizeof buf);
+            if (n > 0) {
+                c.in.append(buf, static_cast<std::size_t>(n));
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                closed = true;
+            if (n == 0 || errno != EINTR)
+                break;
+        }
+        if (!take_requests(key, c))
+            return;
+        if (closed) {
+            // replies already queued are still sent if the peer only shut down its side
+            flush(key, c);
+            close_conn(key);
+            return;
+        }
+        flush(key, c);
+    }
+
+    // dispatches the complete frames of c.in while c is accepting; false if
+    // the connection was closed
+    bool io_loop::take_requests(const uint64_t key, connection& c) {
+        std::size_t pos = 0;
+        while (accepting(c)) {
+            const std::string_view rest(c.in.data() + pos, c.in.size() - pos);
+            uint32_t size = 0;
+            if (rest.size() >= sizeof size) {
+                std::memcpy(&size, rest.data(), sizeof size);
+                if (size > meval::wire::max_frame) {
+                    close_conn(key);
+                    return false;
+                }
+            }
+            const std::size_t frame = meval::wire::complete_frame(rest);
+            if (frame == 0)
+                break;
+            // a request is answered either right away, into c.out, or by a post
+            const std::size_t queued = c.out.size();
+            if (!m_server.dispatch(m_index, key, rest.substr(0, frame), c.out)) {
+                close_conn(key);
+                return false;
+            }
+            if (c.out.size() == queued)
+                c.awaiting++;
+            pos += frame;
+        }
+        c.in.erase(0, pos);
+        return true;
+    }
+
+    // takes the requests held back while c was not accepting
+    void io_loop::resume(const uint64_t key, connection& c) {
+        if (take_requests(key, c))
+            flush(key, c);
+    }
+
+    // writes what it can; false if the connection was closed
+    bool io_loop::flush(const uint64_t key, connection& c) {
+        while (c.out_pos < c.out.size()) {
+            const ssize_t n = ::send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.out_pos += static_cast<std::size_t>(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            close_conn(key);
+            return false;
+        }
+        if (c.out_pos == c.out.size()) {
+            c.out.clear();
+            c.out_pos = 0;
+        } else if (c.out_pos > c.out.size() / 2) {
+            c.out.erase(0, c.out_pos);
+            c.out_pos = 0;
+        }
+        // a peer that shuts down its side is noticed once c accepts again
+        const uint32_t events = (accepting(c) ? EPOLLIN | EPOLLRDHUP : 0u) | (c.out.empty() ? 0u : EPOLLOUT);
+        if (events != c.events) {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.u64 = key;
+            ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+            c.events = events;
+        }
+        return true;
+    }
+
+    void io_loop::drain_posted() {
+        std::vector<std::pair<uint64_t, std::string>> posted;
+        {
+            std::lock_guard lk(m_posted_mutex);
+            posted.swap(m_posted);
+        }
+        std::vector<uint64_t> touched;
+        for (auto& [key, frame] : posted) {
+            // responses to connections closed meanwhile are dropped
+            const auto it = m_conns.find(key);
+            if (it == m_conns.end())
+                continue;
+            touched.push_back(key);
+            it->second.out += frame;
+            it->second.awaiting--;
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (const auto key : touched) {
+            if (const auto it = m_conns.find(key); it != m_conns.end() && flush(key, it->second))
+                resume(key, it->second);
+        }
+    }
+
+    void io_loop::close_conn(const uint64_t key) {
+        const auto it = m_conns.find(key);
+        if (it == m_conns.end())
+            return;
+        ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        ::close(it->second.fd);
+        m_conns.erase(it);
+    }
+
+    server::server(const options& opt) : m_opt(opt) {
+        meval::init_def_vars(m_vars);
+        meval::init_def_funcs(m_funcs);
+        meval::init_def_ops(m_ops);
+    }
+
+    void server::serve(const int listen_fd) {
+        for (unsigned i = 0; i < m_opt.io_threads; i++)
+            m_loops.push_back(std::make_unique<io_loop>(*this, i, listen_fd));
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < m_opt.workers; i++) {
+            workers.emplace_back([this] {
+                while (const auto task = m_tasks.pop())
+                    task();
+            });
+        }
+        std::vector<std::thread> loops;
+        for (unsigned i = 1; i < m_opt.io_threads; i++)
+            loops.emplace_back([this, i] { m_loops[i]->run(); });
+        m_loops[0]->run();
+        for (auto& t : loops)
+            t.join();
+        m_tasks.close();
+        for (auto& t : workers)
+            t.join();
+
+        const auto& c = m_counters;
+        const uint64_t batches = c.batches.load();
+        std::fprintf(stderr, "%llu compiles, %llu evals in %llu batches (%.2f per batch), %llu rows, %llu errors\n"
+                     "latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+                     static_cast<unsigned long long>(c.compiles.load()), static_cast<unsigned long long>(c.evals.load()),
+                     static_cast<unsigned long long>(batches),
+                     batches ? static_cast<double>(c.evals.load()) / static_cast<double>(batches) : 0.0,
+                     static_cast<unsigned long long>(c.rows.load()), static_cast<unsigned long long>(c.errors.load()),
+                     static_cast<double>(c.latency.quantile(0.5)) / 1e3,
+                     static_cast<double>(c.latency.quantile(0.99)) / 1e3,
+                     static_cast<double>(c.latency.quantile(0.999)) / 1e3);
+    }
+
+    meval::wire::frame_writer server::response(std::string& buf, const reply_to& to, const meval::wire::status st) {
+        const uint64_t ns = latency_ns(to.start);
+        m_counters.latency.add(ns);
+        meval::wire::frame_writer w(buf);
+        w.put(to.id).put(st).put(ns);
+        return w;
+    }
+
+    void server::error_response(std::string& buf, const reply_to& to, const uint8_t type, const std::string_view msg) {
+        m_counters.errors.fetch_add(1, std::memory_order_relaxed);
+        auto w = response(buf, to, meval::wire::status::error);
+        w.put(type).put_bytes(msg.data(), msg.size());
+        w.finish();
+    }
+
+    std::shared_ptr<handle_entry> server::find_handle(const uint32_t handle) const {
+        std::shared_lock lk(m_handles_mutex);
+        return handle < m_handles.size() ? m_handles[handle] : nullptr;
+    }
+
+    bool server::dispatch(const unsigned loop, const uint64_t conn, const std::string_view frame, std::string& reply) {
+        reply_to req{loop, conn, 0, clock_type::now()};
+        meval::wire::frame_reader r(frame.data() + sizeof(uint32_t), frame.size() - sizeof(uint32_t));
+        uint8_t k;
+        if (!r.get(req.id) || !r.get(k))
+            return false;
+        const auto malformed = [&](const std::string_view what) {
+            error_response(reply, req, meval::wire::malformed, what);
+            return true;
+        };
+        switch (static_cast<meval::wire::kind>(k)) {
+            case meval::wire::kind::compile: {
+                uint8_t level, flags;
+                if (!r.get(level) || !r.get(flags))
+                    return malformed("Truncated compile request");
+                if (level > static_cast<uint8_t>(meval::opt_level::full))
+                    return malformed("Unknown optimisation level " + std::to_string(level));
+                m_tasks.push([this, req, level, flags, text = std::string(r.rest())]() mutable {
+                    compile(req, level, flags, std::move(text));
+                });
+                return true;
+            }
+            case meval::wire::kind::eval: {
+                uint32_t handle, rows, columns;
+                if (!r.get(handle) || !r.get(rows) || !r.get(columns))
+                    return malformed("Truncated eval request");
+                if (rows > m_opt.max_batch) {
+                    error_response(reply, req, static_cast<uint8_t>(meval::meval_error::error_type::invalid_argument),
+                                   "Too many rows: " + std::to_string(rows) + ", at most " +
+                                   std::to_string(m_opt.max_batch));
+                    return true;
+                }
+                const auto entry = find_handle(handle);
+                if (!entry) {
+                    error_response(reply, req, static_cast<uint8_t>(meval::meval_error::error_type::invalid_argument),
+                                   "Unknown handle " + std::to_string(handle));
+                    return true;
+                }
+                const std::size_t slots = entry->expr->slot_names().size();
+                if (columns != slots) {
+                    error_response(reply, req, static_cast<uint8_t>(meval::meval_error::error_type::invalid_argument),
+                                   "Expected " + std::to_string(slots) + " columns, got " + std::to_string(columns));
+                    return true;
+                }
+                pending_eval p{req, rows, std::vector<std::vector<double>>(columns)};
+                for (auto& col : p.columns) {
+                    uint32_t count;
+                    if (!r.get(count) || (count != rows && count != 1) || r.remaining() / sizeof(double) < count)
+                        return malformed("Bad column in eval request");
+                    col.resize(count);
+                    r.get_bytes(col.data(), count * sizeof(double));
+                }
+                m_counters.evals.fetch_add(1, std::memory_order_relaxed);
+                if (rows == 0) {
+                    auto w = response(reply, req, meval::wire::status::ok);
+                    w.put(uint32_t{0}).put(uint8_t{0});
+                    w.finish();
+                    return true;
+                }
+                enqueue(entry, std::move(p));
+                return true;
+            }
+            case meval::wire::kind::stats: {
+                auto w = response(reply, req, meval::wire::status::ok);
+                const std::string json = stats_json();
+                w.put_bytes(json.data(), json.size());
+                w.finish();
+                return true;
+            }
+        }
+        return malformed("Unknown request kind " + std::to_string(k));
+    }
+
+    void server::compile(const reply_to& to, const uint8_t level, const uint8_t flags, std::string text) {
+        std::string key;
+        key.push_back(static_cast<char>(level));
+        key.push_back(static_cast<char>(flags & (meval::wire::flag_fast_math | meval::wire::flag_exact)));
+        key += text;
+        std::string buf;
+        try {
+            uint32_t handle = 0;
+            std::shared_ptr<handle_entry> entry;
+            {
+                std::shared_lock lk(m_handles_mutex);
+                if (const auto it = m_handle_of.find(key); it != m_handle_of.end()) {
+                    handle = it->second;
+                    entry = m_handles[handle];
+                }
+            }
+            if (!entry) {
+                // every $name must resolve when compiling; evaluation supplies the
+                // values. The var_map keys are views into names.
+                std::lock_guard compile_lk(m_compile_mutex);
+                std::vector<std::string> names;
+                for (std::size_t p = text.find('$'); p != std::string::npos; p = text.find('$', p + 1)) {
+                    std::size_t q = p + 1;
+                    while (q < text.size() && (std::isalnum(static_cast<unsigned char>(text[q])) || text[q] == '_'))
+                        q++;
+                    names.emplace_back(text.substr(p + 1, q - p - 1));
+                }
+                auto vars = std::make_shared<meval::var_map>(*m_vars);
+                for (const auto& n : names)
+                    vars->try_emplace(n, 0.0);
+                meval::compile_options copt;
+                copt.level = static_cast<meval::opt_level>(level);
+                copt.fast_math = (flags & meval::wire::flag_fast_math) != 0;
+                copt.vector_math = (flags & meval::wire::flag_exact) == 0;
+                const meval::math_expr mexp(text, vars, m_funcs, m_ops, copt);
+                auto fresh = std::make_shared<handle_entry>();
+                fresh->expr = mexp.get_compiled();
+
+                std::unique_lock lk(m_handles_mutex);
+                const auto [it, inserted] = m_handle_of.try_emplace(std::move(key), static_cast<uint32_t>(m_handles.size()));
+                if (inserted)
+                    m_handles.push_back(std::move(fresh));
+                handle = it->second;
+                entry = m_handles[handle];
+                m_counters.compiles.fetch_add(1, std::memory_order_relaxed);
+            }
+            const auto& names = entry->expr->slot_names();
+            auto w = response(buf, to, meval::wire::status::ok);
+            w.put(handle).put(static_cast<uint32_t>(names.size()));
+            for (const auto& name : names)
+                w.put_string(name);
+            w.finish();
+        } catch (const meval::meval_error& e) {
+            buf.clear();
+            error_response(buf, to, static_cast<uint8_t>(e.get_error_type()), e.what());
+        } catch (const std::exception& e) {
+            buf.clear();
+            error_response(buf, to, static_cast<uint8_t>(meval::meval_error::error_type::invalid_expression),
+                           e.what());
+        }
+        m_loops[to.loop]->post(to.conn, std::move(buf));
+    }
+
+    void server::enqueue(const std::shared_ptr<handle_entry>& entry, pending_eval req) {
+        bool schedule;
+        {
+            std::lock_guard lk(entry->mutex);
+            entry->pending.push_back(std::move(req));
+            schedule = !entry->scheduled;
+            entry->scheduled = true;
+        }
+        if (schedule)
+            m_tasks.push([this, entry] { run_batch(entry); });
+    }
+
+    // Takes the requests queued on entry, up to max_batch rows, and leaves a
+    // task behind for the rest. dispatch refuses requests of more rows, so
+    // the first always fits.
+    void server::run_batch(const std::shared_ptr<handle_entry>& entry) {
+        std::vector<pending_eval> batch;
+        bool more;
+        {
+            std::lock_guard lk(entry->mutex);
+            std::size_t rows = 0;
+            while (!entry->pending.empty() && rows + entry->pending.front().rows <= m_opt.max_batch) {
+                rows += entry->pending.front().rows;
+                batch.push_back(std::move(entry->pending.front()));
+                entry->pending.pop_front();
+            }
+            more = !entry->pending.empty();
+            entry->scheduled = more;
+        }
+        if (more)
+            m_tasks.push([this, entry] { run_batch(entry); });
+        if (!batch.empty())
+            evaluate(*entry->expr, batch);
+    }
+
+    void server::evaluate(const meval::compiled_expr& expr, std::vector<pending_eval>& batch) {
+        const std::size_t slots = expr.slot_names().size();
+        std::size_t total = 0;
+        for (const auto& p : batch)
+            total += p.rows;
+
+        std::vector<double> out;
+        std::vector<uint32_t> errors;
+        try {
+            // one request is evaluated in place; several are concatenated,
+            // except columns every request broadcasts with the same value
+            std::vector<std::vector<double>> merged(slots);
+            std::vector<std::span<const double>> columns(slots);
+            for (std::size_t s = 0; s < slots; s++) {
+                const auto& first = batch[0].columns[s];
+                const bool same = std::all_of(batch.begin(), batch.end(), [&](const pending_eval& p) {
+                    return p.columns[s].size() == 1 && first.size() == 1 &&
+                           std::bit_cast<uint64_t>(p.columns[s][0]) == std::bit_cast<uint64_t>(first[0]);
+                });
+                if (batch.size() == 1 || same) {
+                    columns[s] = first;
+                    continue;
+                }
+                merged[s].reserve(total);
+                for (const auto& p : batch) {
+                    if (p.columns[s].size() == p.rows)
+                        merged[s].insert(merged[s].end(), p.columns[s].begin(), p.columns[s].end());
+                    else
+                        merged[s].insert(merged[s].end(), p.rows, p.columns[s][0]);
+                }
+                columns[s] = merged[s];
+            }
+            out.resize(total);
+            errors.resize(total);
+            expr.eval_batch(columns, out, errors);
+        } catch (const std::exception& e) {
+            for (const auto& p : batch) {
+                std::string buf;
+                error_response(buf, p.to, static_cast<uint8_t>(meval::meval_error::error_type::invalid_argument),
+                               e.what());
+                m_loops[p.to.loop]->post(p.to.conn, std::move(buf));
+            }
+            return;
+        }
+        m_counters.batches.fetch_add(1, std::memory_order_relaxed);
+        m_counters.rows.fetch_add(total, std::memory_order_relaxed);
+
+        std::size_t row = 0;
+        for (const auto& p : batch) {
+            const bool has_errors = std::any_of(errors.begin() + row, errors.begin() + row + p.rows,
+                                                [](const uint32_t e) { return e != 0; });
+            std::string buf;
+            buf.reserve(meval::wire::response_header + 5 + p.rows * (sizeof(double) + (has_errors ? sizeof(uint32_t) : 0)));
+            auto w = response(buf, p.to, meval::wire::status::ok);
+            w.put(p.rows).put(static_cast<uint8_t>(has_errors));
+            w.put_bytes(out.data() + row, p.rows * sizeof(double));
+            if (has_errors)
+                w.put_bytes(errors.data() + row, p.rows * sizeof(uint32_t));
+            w.finish();
+            m_loops[p.to.loop]->post(p.to.conn, std::move(buf));
+            row += p.rows;
+        }
+    }
+
+    std::string server::stats_json() const {
+        const auto& c = m_counters;
+        std::size_t handles;
+        {
+            std::shared_lock lk(m_handles_mutex);
+            handles = m_handles.size();
+        }
+        char buf[512];
+        std::snprintf(buf, sizeof buf,
+                      "{\"handles\":%zu,\"compiles\":%llu,\"evals\":%llu,\"batches\":%llu,\"rows\":%llu,"
+                      "\"errors\":%llu,\"latency_ns\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu}}",
+                      handles, static_cast<unsigned long long>(c.compiles.load()),
+                      static_cast<unsigned long long>(c.evals.load()), static_cast<unsigned long long>(c.batches.load()),
+                      static_cast<unsigned long long>(c.rows.load()), static_cast<unsigned long long>(c.errors.load()),
+                      static_cast<unsigned long long>(c.latency.quantile(0.5)),
+                      static_cast<unsigned long long>(c.latency.quantile(0.99)),
+                      static_cast<unsigned long long>(c.latency.quantile(0.999)));
+        return buf;
+    }
+
+    int listen_on(const std::string& path) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof addr.sun_path)
+            throw std::runtime_error("socket path too long: " + path);
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+            const int err = errno;
+            ::close(fd);
+            throw std::runtime_error("cannot listen on " + path + ": " + std::strerror(err));
+        }
+        return fd;
+    }
+
+    int usage(const char* argv0) {
+        std::fprintf(stderr, "usage: %s [--io-threads N] [--workers N] [--max-batch ROWS] SOCKET\n", argv0);
+        return 2;
+    }
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (a == "--io-threads" && has_value) {
+            opt.io_threads = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        } else if (a == "--workers" && has_value) {
+            opt.workers = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        } else if (a == "--max-batch" && has_value) {
+            opt.max_batch = std::clamp<std::size_t>(std::stoull(argv[++i]), 1, meval::wire::max_rows);
+        } else if (a.size() > 1 && a[0] == '-') {
+            return usage(argv[0]);
+        } else {
+            positional.push_back(a);
+        }
+    }
+    if (positional.size() != 1)
+        return usage(argv[0]);
+    opt.socket = positional[0];
+
+    try {
+        g_stop_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (g_stop_fd < 0)
+            throw std::runtime_error(std::string("eventfd: ") + std::strerror(errno));
+        struct sigaction sa{};
+        sa.sa_handler = on_signal;
+        ::sigaction(SIGINT, &sa, nullptr);
+        ::sigaction(SIGTERM, &sa, nullptr);
+
+        const int fd = listen_on(opt.socket);
+        std::fprintf(stderr, "listening on %s, %u I/O threads, %u workers\n", opt.socket.c_str(), opt.io_threads,
+                     opt.workers);
+        server srv(opt);
+        srv.serve(fd);
+        ::close(fd);
+        ::unlink(opt.socket.c_str());
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,622 @@
+// meval_stream.cpp
+// Evaluates one expression over every row of a memory-mapped table and
+// streams the results out, one value per row.
+//
+// Usage: meval_stream [options] EXPRESSION INPUT
+//   -o FILE              output file (default stdout)
+//   --format csv|mcol    input format (default: mcol for *.mcol, csv otherwise)
+//   --out-format csv|bin text with one value per line, or native doubles
+//   --chunk ROWS         rows per pipeline chunk (default 65536)
+//   --threads N          evaluation threads (default: all cores)
+//   --opt none|basic|full
+//   --fast-math          let --opt full reassociate and fuse (compile_options::fast_math)
+//   --no-jit             evaluate with the interpreter only
+//   --stats FILE         write the meval_stats.h counters as JSON on exit
+//                        (builds with MEVAL_STATS; pair with --no-jit)
+//
+// Variables in the expression are bound to the input column of the same
+// name; names without a column keep their value from the default variables
+// (pi, e, ...). CSV input has a header row of names and comma separated
+// numbers, without quoting. mcol input is the raw little-endian format
+//
+//   char     magic[8] = "MEVALCOL"
+//   uint32   version = 1
+//   uint32   columns
+//   uint64   rows
+//   columns x { uint32 length; char name[length]; }
+//   zero padding to a multiple of 8 bytes
+//   columns x rows float64, column after column
+//
+// whose columns are used in place. Parsing, evaluation and writing run on
+// separate threads connected by bounded queues of chunks, and input pages
+// are released once their chunk has been written, so memory stays bounded
+// by the chunk size whatever the size of the input. Rows/s and peak RSS go
+// to stderr on exit.
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "def_math.h"
+#include "meval_jit.h"
+#include "meval_parallel.h"
+#include "meval_stats.h"
+
+namespace {
+    static_assert(std::endian::native == std::endian::little, "mcol columns are mapped in place");
+
+    class mapped_file {
+    public:
+        explicit mapped_file(const char* path) {
+            m_fd = ::open(path, O_RDONLY);
+            if (m_fd < 0)
+                throw std::runtime_error(std::string("cannot open ") + path + ": " + std::strerror(errno));
+            struct stat st{};
+            if (::fstat(m_fd, &st) != 0) {
+                ::close(m_fd);
+                throw std::runtime_error(std::string("cannot stat ") + path);
+            }
+            m_size = static_cast<std::size_t>(st.st_size);
+            if (m_size == 0)
+                return;
+            void* p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(m_fd);
+                throw std::runtime_error(std::string("cannot map ") + path + ": " + std::strerror(errno));
+            }
+            m_data = static_cast<const char*>(p);
+            ::madvise(p, m_size, MADV_SEQUENTIAL);
+        }
+        ~mapped_file() {
+            if (m_data)
+                ::munmap(const_cast<char*>(m_data), m_size);
+            if (m_fd >= 0)
+                ::close(m_fd);
+        }
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        [[nodiscard]] const char* data() const noexcept{return m_data;}
+        [[nodiscard]] std::size_t size() const noexcept{return m_size;}
+
+        // drops the pages wholly inside [begin,end) from the resident set;
+        // they are read back from the file if touched again
+        void release(const char* begin, const char* end) const noexcept {
+            static const auto page = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+            const auto first = (reinterpret_cast<std::uintptr_t>(begin) + page - 1) & ~(page - 1);
+            const auto last = reinterpret_cast<std::uintptr_t>(end) & ~(page - 1);
+            if (first < last)
+                ::madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+        }
+    private:
+        int m_fd=-1;
+        const char* m_data=nullptr;
+        std::size_t m_size=0;
+    };
+
+    struct chunk {
+        std::size_t first_row=0;
+        std::size_t rows=0;
+        std::vector<std::vector<double>> storage;     // parsed CSV values, one vector per slot
+        std::vector<std::span<const double>> columns; // slot order, size 1 broadcasts
+        std::vector<double> out;
+        // input consumed by this chunk, released after it is written
+        std::vector<std::pair<const char*, const char*>> input;
+    };
+
+    // Bounded hand-off between two pipeline stages. pop returns nullptr once
+    // the queue is closed and drained.
+    class chunk_queue {
+    public:
+        void push(chunk* c) {
+            {
+                std::lock_guard lk(m_mutex);
+                m_items.push_back(c);
+            }
+            m_ready.notify_one();
+        }
+        chunk* pop() {
+            std::unique_lock lk(m_mutex);
+            m_ready.wait(lk, [this] { return !m_items.empty() || m_closed; });
+            if (m_items.empty())
+                return nullptr;
+            chunk* c = m_items.front();
+            m_items.pop_front();
+            return c;
+        }
+        void close() {
+            {
+                std::lock_guard lk(m_mutex);
+                m_closed = true;
+            }
+            m_ready.notify_all();
+        }
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_ready;
+        std::deque<chunk*> m_items;
+        bool m_closed=false;
+    };
+
+    // first exception raised by any stage; the others wind down when it is set
+    class pipeline_error {
+    public:
+        void set(std::exception_ptr e) {
+            std::lock_guard lk(m_mutex);
+            if (!m_error)
+                m_error = std::move(e);
+        }
+        [[nodiscard]] std::exception_ptr get() {
+            std::lock_guard lk(m_mutex);
+            return m_error;
+        }
+    private:
+        std::mutex m_mutex;
+        std::exception_ptr m_error;
+    };
+
+    struct options {
+        std::string expr;
+        std::string input;
+        std::string output;
+        std::string format;
+        bool binary_out=false;
+        std::size_t chunk_rows=65536;
+        unsigned threads=std::max(1u, std::thread::hardware_concurrency());
+        meval::opt_level level=meval::opt_level::basic;
+        bool fast_math=false;
+        bool jit=true;
+        std::string stats;
+    };
+
+    // Where a slot's values come from: an input column, or a constant from the var_map.
+    struct slot_source {
+        int column=-1;
+        double value=0;
+    };
+
+    std::vector<slot_source> bind_slots(const meval::compiled_expr& expr, const std::vector<std::string>& header,
+                                        const meval::var_map& vars) {
+        std::vector<slot_source> slots;
+        for (const auto& name : expr.slot_names()) {
+            slot_source src;
+            const auto it = std::find(header.begin(), header.end(), name);
+            if (it != header.end()) {
+                src.column = static_cast<int>(it - header.begin());
+            } else if (const auto v = vars.find(name); v != vars.end()) {
+                src.value = v->second;
+            } else {
+                throw meval::meval_error("No input column for variable: " + name, meval::meval_error::error_type::unknown_variable);
+            }
+            slots.push_back(src);
+        }
+        return slots;
+    }
+
+    // Reads chunks of rows from a CSV mapping into per-slot vectors.
+    class csv_reader {
+    public:
+        csv_reader(const mapped_file& file, const meval::compiled_expr& expr, const meval::var_map& vars)
+            : m_pos(file.data()), m_end(file.data() + file.size()) {
+            std::vector<std::string> header;
+            const char* eol = line_end(m_pos);
+            for (const char* p = m_pos;;) {
+                const char* comma = std::find(p, eol, ',');
+                std::string_view name(p, comma - p);
+                while (!name.empty() && (name.front() == ' ' || name.front() == '"'))
+                    name.remove_prefix(1);
+                while (!name.empty() && (name.back() == ' ' || name.back() == '"' || name.back() == '\r'))
+                    name.remove_suffix(1);
+                header.emplace_back(name);
+                if (comma == eol)
+                    break;
+                p = comma + 1;
+            }
+            m_pos = eol == m_end ? eol : eol + 1;
+            m_line = 2;
+            m_slots = bind_slots(expr, header, vars);
+            m_slot_of_column.assign(header.size(), -1);
+            for (std::size_t s = 0; s < m_slots.size(); s++) {
+                if (m_slots[s].column >= 0)
+                    m_slot_of_column[m_slots[s].column] = static_cast<int>(s);
+            }
+            while (!m_slot_of_column.empty() && m_slot_of_column.back() < 0)
+                m_slot_of_column.pop_back();
+        }
+
+        // fills c with up to rows rows; false at end of input
+        bool read(chunk& c, const std::size_t rows) {
+            const char* start = m_pos;
+            c.storage.resize(m_slots.size());
+            c.columns.resize(m_slots.size());
+            for (std::size_t s = 0; s < m_slots.size(); s++) {
+                c.storage[s].clear();
+                if (m_slots[s].column < 0)
+                    c.storage[s].assign(1, m_slots[s].value);
+                else
+                    c.storage[s].reserve(rows);
+            }
+            std::size_t n = 0;
+            while (n < rows && m_pos < m_end) {
+                const char* eol = line_end(m_pos);
+                if (!blank(m_pos, eol)) {
+                    parse_row(m_pos, eol, c);
+                    n++;
+                }
+                m_pos = eol == m_end ? eol : eol + 1;
+                m_line++;
+            }
+            for (std::size_t s = 0; s < m_slots.size(); s++)
+                c.columns[s] = c.storage[s];
+            c.rows = n;
+            c.input.assign(1, {start, m_pos});
+            return n > 0;
+        }
+    private:
+        const char* m_pos;
+        const char* m_end;
+        std::size_t m_line=1;
+        std::vector<slot_source> m_slots;
+        std::vector<int> m_slot_of_column;
+
+        const char* line_end(const char* p) const {
+            const void* nl = std::memchr(p, '\n', m_end - p);
+            return nl ? static_cast<const char*>(nl) : m_end;
+        }
+        static bool blank(const char* p, const char* end) {
+            return std::all_of(p, end, [](const char c) { return c == ' ' || c == '\r' || c == '\t'; });
+        }
+        void parse_row(const char* p, const char* eol, chunk& c) const {
+            std::size_t col = 0;
+            for (; col < m_slot_of_column.size(); col++) {
+                const char* comma = std::find(p, eol, ',');
+                if (const int slot = m_slot_of_column[col]; slot >= 0) {
+                    const char* b = p;
+                    while (b < comma && (*b == ' ' || *b == '+'))
+                        b++;
+                    double v;
+                    const auto [ptr, ec] = std::from_chars(b, comma, v);
+                    const char* rest = ptr;
+                    while (rest < comma && (*rest == ' ' || *rest == '\r'))
+                        rest++;
+                    if (ec != std::errc() || rest != comma)
+                        throw std::runtime_error("line " + std::to_string(m_line) + ", column " +
+                                                 std::to_string(col + 1) + ": not a number");
+                    c.storage[slot].push_back(v);
+                }
+                if (comma == eol)
+                    break;
+                p = comma + 1;
+            }
+            if (col + 1 < m_slot_of_column.size())
+                throw std::runtime_error("line " + std::to_string(m_line) + ": missing columns");
+        }
+    };
+
+    // Serves chunks of an mcol mapping as views of its columns.
+    class mcol_reader {
+    public:
+        mcol_reader(const mapped_file& file, const meval::compiled_expr& expr, const meval::var_map& vars) {
+            const char* p = file.data();
+            const char* end = p + file.size();
+            const auto take = [&p, end](void* dst, const std::size_t n) {
+                if (static_cast<std::size_t>(end - p) < n)
+                    throw std::runtime_error("truncated mcol header");
+                std::memcpy(dst, p, n);
+                p += n;
+            };
+            char magic[8];
+            uint32_t version, columns;
+            uint64_t rows;
+            take(magic, sizeof magic);
+            take(&version, sizeof version);
+            take(&columns, sizeof columns);
+            take(&rows, sizeof rows);
+            if (std::memcmp(magic, "MEVALCOL", 8) != 0 || version != 1)
+                throw std::runtime_error("not an mcol version 1 file");
+            std::vector<std::string> header(columns);
+            for (auto& name : header) {
+                uint32_t length;
+                take(&length, sizeof length);
+                name.resize(length);
+                take(name.data(), length);
+            }
+            const auto offset = (static_cast<std::size_t>(p - file.data()) + 7) & ~std::size_t{7};
+            if (rows > (file.size() - std::min(offset, file.size())) / sizeof(double) / std::max(columns, 1u))
+                throw std::runtime_error("truncated mcol data");
+            m_data = reinterpret_cast<const double*>(file.data() + offset);
+            m_rows = rows;
+            m_slots = bind_slots(expr, header, vars);
+        }
+
+        bool read(chunk& c, const std::size_t rows) {
+            const std::size_t n = std::min(rows, m_rows - m_next);
+            c.storage.resize(m_slots.size());
+            c.columns.resize(m_slots.size());
+            c.input.clear();
+            for (std::size_t s = 0; s < m_slots.size(); s++) {
+                if (m_slots[s].column < 0) {
+                    c.storage[s].assign(1, m_slots[s].value);
+                    c.columns[s] = c.storage[s];
+                } else {
+                    const double* col = m_data + m_slots[s].column * m_rows + m_next;
+                    c.columns[s] = std::span<const double>(col, n);
+                    c.input.emplace_back(reinterpret_cast<const char*>(col), reinterpret_cast<const char*>(col + n));
+                }
+            }
+            c.rows = n;
+            m_next += n;
+            return n > 0;
+        }
+    private:
+        const double* m_data=nullptr;
+        std::size_t m_rows=0;
+        std::size_t m_next=0;
+        std::vector<slot_source> m_slots;
+    };
+
+    // Evaluates whole chunks, split across the pool.
+    class evaluator {
+    public:
+        evaluator(std::shared_ptr<const meval::compiled_expr> expr, const options& opt)
+            : m_expr(std::move(expr)), m_pool(opt.threads) {
+            if (opt.jit && meval::jit_expr::batch_available())
+                m_jit = std::make_unique<meval::jit_expr>(m_expr);
+        }
+
+        void run(chunk& c) {
+            c.out.resize(c.rows);
+            if (!m_jit) {
+                meval::eval_range(*m_expr, c.columns, c.out, m_pool);
+                return;
+            }
+            m_pool.parallel_for(0, c.rows, 16 * meval::compiled_expr::batch_block,
+                                [&](const std::size_t first, const std::size_t last) {
+                std::vector<std::span<const double>> cols(c.columns.begin(), c.columns.end());
+                for (auto& col : cols) {
+                    if (col.size() != 1)
+                        col = col.subspan(first, last - first);
+                }
+                m_jit->eval_batch(cols, std::span(c.out).subspan(first, last - first));
+            });
+        }
+
+        [[nodiscard]] bool native() const noexcept{return m_jit && m_jit->batch_width() > 0;}
+    private:
+        std::shared_ptr<const meval::compiled_expr> m_expr;
+        std::unique_ptr<meval::jit_expr> m_jit;
+        meval::thread_pool m_pool;
+    };
+
+    void write_chunk(FILE* out, const chunk& c, const bool binary, std::vector<char>& text) {
+        if (binary) {
+            if (std::fwrite(c.out.data(), sizeof(double), c.rows, out) != c.rows)
+                throw std::runtime_error("write failed");
+            return;
+        }
+        text.resize(c.rows * 26);
+        char* p = text.data();
+        for (const double v : c.out) {
+            p = std::to_chars(p, p + 25, v).ptr;
+            *p++ = '\n';
+        }
+        const auto n = static_cast<std::size_t>(p - text.data());
+        if (std::fwrite(text.data(), 1, n, out) != n)
+            throw std::runtime_error("write failed");
+    }
+
+    template<typename Reader>
+    std::size_t run_pipeline(Reader& reader, const mapped_file& file, evaluator& eval, FILE* out,
+                             const options& opt) {
+        constexpr std::size_t in_flight = 4;
+        std::vector<chunk> chunks(in_flight);
+        chunk_queue free_q, parsed_q, done_q;
+        for (auto& c : chunks)
+            free_q.push(&c);
+        pipeline_error error;
+        std::size_t rows = 0;
+
+        // parse -> evaluate -> write; a failing stage closes its output and
+        // the free queue so that every other stage runs out of work
+        std::thread parser([&] {
+            try {
+                std::size_t next_row = 0;
+                while (chunk* c = free_q.pop()) {
+                    if (!reader.read(*c, opt.chunk_rows))
+                        break;
+                    c->first_row = next_row;
+                    next_row += c->rows;
+                    parsed_q.push(c);
+                }
+            } catch (...) {
+                error.set(std::current_exception());
+                free_q.close();
+            }
+            parsed_q.close();
+        });
+        std::thread writer([&] {
+            std::vector<char> text;
+            try {
+                while (chunk* c = done_q.pop()) {
+                    write_chunk(out, *c, opt.binary_out, text);
+                    rows += c->rows;
+                    for (const auto& [b, e] : c->input)
+                        file.release(b, e);
+                    free_q.push(c);
+                }
+            } catch (...) {
+                error.set(std::current_exception());
+                free_q.close();
+                while (done_q.pop()) {}
+            }
+        });
+        try {
+            while (chunk* c = parsed_q.pop()) {
+                eval.run(*c);
+                done_q.push(c);
+            }
+        } catch (...) {
+            error.set(std::current_exception());
+            free_q.close();
+            while (parsed_q.pop()) {}
+        }
+        done_q.close();
+        parser.join();
+        writer.join();
+        if (const auto e = error.get())
+            std::rethrow_exception(e);
+        return rows;
+    }
+
+    int usage(const char* argv0) {
+        std::fprintf(stderr, "usage: %s [-o FILE] [--format csv|mcol] [--out-format csv|bin] [--chunk ROWS]\n"
+                     "       [--threads N] [--opt none|basic|full] [--fast-math] [--no-jit]\n"
+                     "       [--stats FILE] EXPRESSION INPUT\n", argv0);
+        return 2;
+    }
+
+    double peak_rss_mib() {
+        rusage ru{};
+        ::getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+        return static_cast<double>(ru.ru_maxrss) / (1024.0 * 1024.0);
+#else
+        return static_cast<double>(ru.ru_maxrss) / 1024.0;
+#endif
+    }
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (a == "-o" && has_value) {
+            opt.output = argv[++i];
+        } else if (a == "--format" && has_value) {
+            opt.format = argv[++i];
+        } else if (a == "--out-format" && has_value) {
+            const std::string f = argv[++i];
+            if (f != "csv" && f != "bin")
+                return usage(argv[0]);
+            opt.binary_out = f == "bin";
+        } else if (a == "--chunk" && has_value) {
+            opt.chunk_rows = std::max<std::size_t>(std::stoull(argv[++i]), 1);
+        } else if (a == "--threads" && has_value) {
+            opt.threads = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        } else if (a == "--opt" && has_value) {
+            const std::string l = argv[++i];
+            if (l == "none")
+                opt.level = meval::opt_level::none;
+            else if (l == "basic")
+                opt.level = meval::opt_level::basic;
+            else if (l == "full")
+                opt.level = meval::opt_level::full;
+            else
+                return usage(argv[0]);
+        } else if (a == "--fast-math") {
+            opt.fast_math = true;
+        } else if (a == "--no-jit") {
+            opt.jit = false;
+        } else if (a == "--stats" && has_value) {
+            opt.stats = argv[++i];
+        } else if (a.size() > 1 && a[0] == '-' && a != "-") {
+            return usage(argv[0]);
+        } else {
+            positional.push_back(a);
+        }
+    }
+    if (positional.size() != 2)
+        return usage(argv[0]);
+    opt.expr = positional[0];
+    opt.input = positional[1];
+    if (opt.format.empty())
+        opt.format = opt.input.ends_with(".mcol") ? "mcol" : "csv";
+    if (opt.format != "csv" && opt.format != "mcol")
+        return usage(argv[0]);
+
+    auto vars = std::make_shared<meval::var_map>();
+    auto funcs = std::make_shared<meval::func_map>();
+    auto ops = std::make_shared<meval::operator_map>();
+    meval::init_def_vars(vars);
+    meval::init_def_funcs(funcs);
+    meval::init_def_ops(ops);
+
+    // every $name must resolve at compile time; input columns override these
+    // values. The var_map keys are views into names.
+    std::vector<std::string> names;
+    FILE* out = stdout;
+    try {
+        for (std::size_t p = opt.expr.find('$'); p != std::string::npos; p = opt.expr.find('$', p + 1)) {
+            std::size_t q = p + 1;
+            while (q < opt.expr.size() && (std::isalnum(static_cast<unsigned char>(opt.expr[q])) || opt.expr[q] == '_'))
+                q++;
+            names.emplace_back(opt.expr.substr(p + 1, q - p - 1));
+        }
+        const meval::var_map defaults = *vars;
+        for (const auto& n : names) {
+            if (!vars->contains(n))
+                (*vars)[n] = 0.0;
+        }
+        meval::compile_options copt;
+        copt.level = opt.level;
+        copt.fast_math = opt.fast_math;
+        const meval::math_expr mexp(opt.expr, vars, funcs, ops, copt);
+
+        const mapped_file file(opt.input.c_str());
+        if (!opt.output.empty() && opt.output != "-") {
+            out = std::fopen(opt.output.c_str(), opt.binary_out ? "wb" : "w");
+            if (!out)
+                throw std::runtime_error("cannot open " + opt.output + ": " + std::strerror(errno));
+        }
+        std::setvbuf(out, nullptr, _IOFBF, 1 << 20);
+
+        evaluator eval(mexp.get_compiled(), opt);
+        const auto start = std::chrono::steady_clock::now();
+        std::size_t rows;
+        if (opt.format == "mcol") {
+            mcol_reader reader(file, *mexp.get_compiled(), defaults);
+            rows = run_pipeline(reader, file, eval, out, opt);
+        } else {
+            csv_reader reader(file, *mexp.get_compiled(), defaults);
+            rows = run_pipeline(reader, file, eval, out, opt);
+        }
+        if (std::fflush(out) != 0)
+            throw std::runtime_error("write failed");
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(stderr, "%zu rows in %.3f s, %.3e rows/s, %u threads%s, peak RSS %.1f MiB\n", rows, seconds,
+                     seconds > 0 ? static_cast<double>(rows) / seconds : 0.0, opt.threads,
+                     eval.native() ? ", native" : "", peak_rss_mib());
+        if (!opt.stats.empty()) {
+            std::ofstream stats(opt.stats);
+            stats << meval::stats_json(meval::snapshot_stats());
+            if (!stats)
+                throw std::runtime_error("cannot write " + opt.stats);
+        }
+    } catch (const meval::meval_error& merr) {
+        std::fprintf(stderr, "%s\n", merr.what());
+        return 1;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+    if (out != stdout)
+        std::fclose(out);
+    return 0;
+}
@@ -0,0 +1,143 @@
+//
+// Binary protocol of meval_server, shared with meval_loadgen.
+//
+// Every message is a frame of little-endian fields:
+//
+//   uint32   size          bytes after this field
+//   uint32   id            chosen by the client, echoed in the response
+//   uint8    kind          requests only
+//   uint8    status        responses only: 0 ok, 1 error
+//   uint64   latency_ns    responses only: from the request being read to
+//                          its response being queued
+//   payload
+//
+// Requests and their ok payloads:
+//
+//   compile  uint8 level (opt_level), uint8 flags (bit 0 fast_math, bit 1
+//            exact batches, i.e. no vector_math), expression text
+//        ->  uint32 handle, uint32 slots, slots x { uint32 length; name }
+//   eval     uint32 handle, uint32 rows (at most the server's --max-batch), uint32 columns,
+//            columns x { uint32 count (rows, or 1 to broadcast); count float64 }
+//        ->  uint32 rows, uint8 has_errors, rows float64,
+//            rows uint32 eval_error masks if has_errors
+//   stats    nothing
+//        ->  JSON text
+//
+// An error payload is uint8 meval_error::error_type (255 for a malformed
+// request) followed by the message. Columns follow slot order as returned by
+// compile. A connection may pipeline any number of requests; responses can
+// come back in a different order, so clients match them by id.
+//
+
+#ifndef MEVAL_WIRE_H
+#define MEVAL_WIRE_H
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace meval::wire {
+
+    static_assert(std::endian::native == std::endian::little, "frames are copied to and from memory as is");
+
+    enum class kind : uint8_t {
+        compile = 1,
+        eval = 2,
+        stats = 3,
+    };
+
+    enum class status : uint8_t {
+        ok = 0,
+        error = 1,
+    };
+
+    constexpr uint8_t flag_fast_math = 1;
+    constexpr uint8_t flag_exact = 2;
+    constexpr uint8_t malformed = 255;
+
+    // bytes from the start of a frame to its payload
+    constexpr std::size_t request_header = 9;
+    constexpr std::size_t response_header = 17;
+    // larger frames are rejected and the connection closed
+    constexpr uint32_t max_frame = 64u << 20;
+    // most rows an eval request may ask for, so that its response fits a frame
+    constexpr uint32_t max_rows = (max_frame - response_header - 5) / (sizeof(double) + sizeof(uint32_t));
+
+    // Appends fields to a buffer; finish() writes the size of the frame started at begin.
+    class frame_writer {
+    public:
+        explicit frame_writer(std::string& buf) : m_buf(buf), m_begin(buf.size()) {
+            put<uint32_t>(0);
+        }
+
+        template<typename T>
+        frame_writer& put(const T v) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            m_buf.append(reinterpret_cast<const char*>(&v), sizeof v);
+            return *this;
+        }
+        frame_writer& put_bytes(const void* p, const std::size_t n) {
+            m_buf.append(static_cast<const char*>(p), n);
+            return *this;
+        }
+        frame_writer& put_string(const std::string_view s) {
+            put(static_cast<uint32_t>(s.size()));
+            return put_bytes(s.data(), s.size());
+        }
+        void finish() {
+            const auto size = static_cast<uint32_t>(m_buf.size() - m_begin - sizeof(uint32_t));
+            std::memcpy(m_buf.data() + m_begin, &size, sizeof size);
+        }
+    private:
+        std::string& m_buf;
+        std::size_t m_begin;
+    };
+
+    // Reads fields of one frame; every get fails once the frame is exhausted.
+    class frame_reader {
+    public:
+        frame_reader(const char* p, const std::size_t n) : m_pos(p), m_end(p + n) {}
+
+        template<typename T>
+        bool get(T& v) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            return get_bytes(&v, sizeof v);
+        }
+        bool get_bytes(void* dst, const std::size_t n) {
+            if (static_cast<std::size_t>(m_end - m_pos) < n)
+                return false;
+            if (n != 0)
+                std::memcpy(dst, m_pos, n);
+            m_pos += n;
+            return true;
+        }
+        bool get_string(std::string& s) {
+            uint32_t n;
+            if (!get(n) || static_cast<std::size_t>(m_end - m_pos) < n)
+                return false;
+            s.assign(m_pos, n);
+            m_pos += n;
+            return true;
+        }
+        [[nodiscard]] std::string_view rest() const noexcept{return {m_pos, static_cast<std::size_t>(m_end - m_pos)};}
+        [[nodiscard]] std::size_t remaining() const noexcept{return static_cast<std::size_t>(m_end - m_pos);}
+    private:
+        const char* m_pos;
+        const char* m_end;
+    };
+
+    // size of the complete frame at the start of buf, 0 while it is still incomplete
+    inline std::size_t complete_frame(const std::string_view buf) {
+        uint32_t size;
+        if (buf.size() < sizeof size)
+            return 0;
+        std::memcpy(&size, buf.data(), sizeof size);
+        return buf.size() - sizeof size < size ? 0 : size + sizeof size;
+    }
+
+} // meval::wire
+
+#endif //MEVAL_WIRE_H